@@ -413,7 +413,8 @@ bool livewave(const char *filename, uint32_t sample_rate, uint16_t bits_per_samp
 					fprintf(stderr, "%s", buffer);
 				}
 				mathfun tmp = MATHFUN_INIT;
-				if (mathfun_context_compile(&ctx, argnames, 4, buffer, &tmp, &error)) {
+				if (mathfun_context_compile(&ctx, argnames, 4, buffer, &tmp, &error) &&
+					mathfun_jit(&tmp, &error)) {
 					mathfun_cleanup(&funct);
 					funct = tmp;
 					last_mtime = meta.st_ctime;
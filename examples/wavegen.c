@@ -71,6 +71,7 @@ static mathfun_value drop(const mathfun_value args[]) {
 }
 
 #define RIFF_WAVE_HEADER_SIZE 44
+#define WAVEGEN_BLOCK_SIZE 1024
 
 #pragma pack(push, 1)
 struct riff_wave_header {
@@ -126,24 +127,39 @@ bool mathfun_wavegen(const char *filename, FILE *stream, uint32_t sample_rate, u
 		return false;
 	}
 
-	// to boost performance even more pre-allocate a big enough frame instead of
-	// allocating a new frame on each function call
-	size_t maxframesize = 0;
-	for (uint16_t channel = 0; channel < channels; ++ channel) {
-		size_t framesize = channel_functs[channel].framesize;
-		if (framesize > maxframesize) {
-			maxframesize = framesize;
-		}
-	}
+	// to boost performance even more evaluate blocks of samples at once instead
+	// of calling the function for every single sample
+	double *columns = calloc((5 + channels) * WAVEGEN_BLOCK_SIZE, sizeof(double));
 
-	mathfun_value *frame = calloc(maxframesize, sizeof(mathfun_value));
+	if (!columns) {
+		perror("allocating sample columns");
+		free(sample_buf);
+		return false;
+	}
 
-	if (!frame) {
-		perror("allocating frame");
+	double *ts = columns;
+	double *rs = ts + WAVEGEN_BLOCK_SIZE;
+	double *ss = rs + WAVEGEN_BLOCK_SIZE;
+	double *cs = ss + WAVEGEN_BLOCK_SIZE;
+	double *values = cs + WAVEGEN_BLOCK_SIZE;
+	const double *args[] = { ts, rs, ss, cs };
+
+	// all channels compiled into one program (see wavegen()) write into their
+	// own column of values with a single call
+	const bool shared = channel_functs[0].retc == channels;
+	double **outs = calloc(channels, sizeof(double*));
+
+	if (!outs) {
+		perror("allocating output columns");
+		free(columns);
 		free(sample_buf);
 		return false;
 	}
 
+	for (size_t channel = 0; channel < channels; ++ channel) {
+		outs[channel] = values + channel * WAVEGEN_BLOCK_SIZE;
+	}
+
 	if (write_header) {
 		const uint16_t block_align = channels * bytes_per_sample;
 		const uint32_t data_size   = block_align * samples;
@@ -166,43 +182,58 @@ bool mathfun_wavegen(const char *filename, FILE *stream, uint32_t sample_rate, u
 
 		if (fwrite(&header, RIFF_WAVE_HEADER_SIZE, 1, stream) != 1) {
 			perror(filename);
-			free(frame);
+			free(outs);
+			free(columns);
 			free(sample_buf);
 			return false;
 		}
 	}
 
-	for (size_t sample = 0; sample < samples; ++ sample) {
-		const double t = (double)sample / (double)sample_rate;
-		const double r = t * M_TAU;
-		for (size_t channel = 0; channel < channels; ++ channel) {
-			const mathfun *funct = channel_functs + channel;
-			// arguments are the first cells in frame:
-			frame[0].number = t;
-			frame[1].number = r;
-			frame[2].number = sample;
-			frame[3].number = channel;
-			// ignore math errors here (would be in errno)
-			double value = mathfun_exec(funct, frame);
-			if (value > 1.0) value = 1.0;
-			else if (value < -1.0) value = -1.0;
-			int vol = (int)(max_volume * value) << shift;
-			if (bits_per_sample <= 8) {
-				vol += mid;
-			}
-			for (size_t byte = 0; byte < bytes_per_sample; ++ byte) {
-				sample_buf[byte] = (vol >> (byte * 8)) & 0xFF;
+	for (size_t offset = 0; offset < samples; offset += WAVEGEN_BLOCK_SIZE) {
+		const size_t count = samples - offset < WAVEGEN_BLOCK_SIZE ? samples - offset : WAVEGEN_BLOCK_SIZE;
+		for (size_t i = 0; i < count; ++ i) {
+			const size_t sample = offset + i;
+			ts[i] = (double)sample / (double)sample_rate;
+			rs[i] = ts[i] * M_TAU;
+			ss[i] = sample;
+		}
+		// ignore math errors here, flush the denormals of decaying signals to zero
+		if (shared) {
+			mathfun_exec_batch_multi_status(channel_functs, args, count, outs,
+				MATHFUN_EXEC_FTZ, NULL, NULL);
+		}
+		else for (size_t channel = 0; channel < channels; ++ channel) {
+			for (size_t i = 0; i < count; ++ i) {
+				cs[i] = channel;
 			}
-			if (fwrite(sample_buf, bytes_per_sample, 1, stream) != 1) {
-				perror(filename);
-				free(frame);
-				free(sample_buf);
-				return false;
+			mathfun_exec_batch_status(channel_functs + channel, args, count,
+				outs[channel], MATHFUN_EXEC_FTZ, NULL, NULL);
+		}
+		for (size_t i = 0; i < count; ++ i) {
+			for (size_t channel = 0; channel < channels; ++ channel) {
+				double value = values[channel * WAVEGEN_BLOCK_SIZE + i];
+				if (value > 1.0) value = 1.0;
+				else if (value < -1.0) value = -1.0;
+				int vol = (int)(max_volume * value) << shift;
+				if (bits_per_sample <= 8) {
+					vol += mid;
+				}
+				for (size_t byte = 0; byte < bytes_per_sample; ++ byte) {
+					sample_buf[byte] = (vol >> (byte * 8)) & 0xFF;
+				}
+				if (fwrite(sample_buf, bytes_per_sample, 1, stream) != 1) {
+					perror(filename);
+					free(outs);
+					free(columns);
+					free(sample_buf);
+					return false;
+				}
 			}
 		}
 	}
 
-	free(frame);
+	free(outs);
+	free(columns);
 	free(sample_buf);
 	
 	return true;
@@ -352,6 +383,22 @@ bool wavegen(const char *filename, FILE *stream, uint32_t sample_rate, uint16_t
 	// s ... sample
 	// c ... channel
 	const char *argnames[] = { "t", "r", "s", "c" };
+
+	// Channels that don't depend on c are compiled into one program, so
+	// subexpressions they have in common are only evaluated once per sample.
+	// Otherwise (or on any error) every channel gets its own program.
+	if (channels > 1 && mathfun_context_compile_multi(&ctx, argnames, 3,
+			channel_functs, channels, functs, NULL)) {
+		bool ok = mathfun_wavegen(filename, stream, sample_rate, bits_per_sample, channels,
+			samples, functs, write_header);
+
+		mathfun_cleanup(functs);
+		free(functs);
+		mathfun_context_cleanup(&ctx);
+
+		return ok;
+	}
+
 	for (size_t i = 0; i < channels; ++ i) {
 		if (!mathfun_context_compile(&ctx, argnames, 4, channel_functs[i], functs + i, &error)) {
 			mathfun_error_log_and_cleanup(&error, stderr);
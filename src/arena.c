@@ -0,0 +1,63 @@
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Arena of the expression trees of mathfun_arun() and the compile functions.
+// These trees only live from parsing to execution or code generation, so
+// instead of allocating every node on its own they are carved out of a buffer
+// on the caller's stack and, once that is exhausted, out of heap chunks that
+// double in size. Everything is released at once by mathfun_arena_cleanup().
+
+// size in words of the first heap chunk
+#define MATHFUN_ARENA_CHUNK_SIZE 512
+
+void mathfun_arena_init(mathfun_arena *arena, mathfun_arena_word buffer[], size_t size) {
+	arena->ptr        = buffer;
+	arena->end        = buffer + size;
+	arena->chunks     = NULL;
+	arena->chunk_size = MATHFUN_ARENA_CHUNK_SIZE;
+}
+
+void *mathfun_arena_alloc(mathfun_arena *arena, size_t size, mathfun_error_p *error) {
+	const size_t words = (size + sizeof(mathfun_arena_word) - 1) / sizeof(mathfun_arena_word);
+
+	if ((size_t)(arena->end - arena->ptr) < words) {
+		while (arena->chunk_size < words) {
+			arena->chunk_size *= 2;
+		}
+
+		mathfun_arena_chunk *chunk = malloc(
+			sizeof(mathfun_arena_chunk) + arena->chunk_size * sizeof(mathfun_arena_word));
+
+		if (!chunk) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return NULL;
+		}
+
+		chunk->prev   = arena->chunks;
+		arena->chunks = chunk;
+		arena->ptr    = chunk->words;
+		arena->end    = chunk->words + arena->chunk_size;
+		arena->chunk_size *= 2;
+	}
+
+	void *ptr = arena->ptr;
+	arena->ptr += words;
+	memset(ptr, 0, words * sizeof(mathfun_arena_word));
+
+	return ptr;
+}
+
+void mathfun_arena_cleanup(mathfun_arena *arena) {
+	mathfun_arena_chunk *chunk = arena->chunks;
+
+	while (chunk) {
+		mathfun_arena_chunk *prev = chunk->prev;
+		free(chunk);
+		chunk = prev;
+	}
+
+	arena->ptr    = NULL;
+	arena->end    = NULL;
+	arena->chunks = NULL;
+}
@@ -0,0 +1,497 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Block-at-a-time interpreter. Every register is a column of up to
+// MATHFUN_BATCH_SIZE rows, so the dispatch cost of an instruction is paid once
+// per block instead of once per row.
+//
+// The rows of a block run in lock-step as long as all conditional jumps agree.
+// When they don't, each row gets its own program counter and the rows that are
+// the furthest behind are executed first. Because codegen only emits forward
+// jumps this lets diverged rows meet again at the join points of ?:, && and ||.
+// Diverged rows are described by a lane mask, so the arithmetic, comparison and
+// boolean instructions of the two arms of a branch run as masked vector kernels
+// (see simd.c) that blend their results into the registers. Those compute all
+// rows, so mathfun_exec_batch_status() uses the portable kernels for diverged
+// rows instead, which keeps the inactive rows from raising spurious exceptions.
+//
+// The prologue of a function with uniform arguments (the code before
+// fun->entry) is executed once per call for the first row, its registers are
+// copied to all lanes and every block starts at the entry.
+
+#define MATHFUN_BATCH_FOR(BODY) \
+	if (diverged) { \
+		for (size_t i = 0; i < count; ++ i) { \
+			if (mask[i]) { BODY; } \
+		} \
+	} \
+	else { \
+		for (size_t i = 0; i < count; ++ i) { \
+			BODY; \
+		} \
+	}
+
+#define MATHFUN_BATCH_BINARY(OUT, EXPR) \
+	{ \
+		const mathfun_value *a = regs[code[1]]; \
+		const mathfun_value *b = regs[code[2]]; \
+		mathfun_value *c = regs[code[3]]; \
+		MATHFUN_BATCH_FOR(c[i].OUT = (EXPR)); \
+		next = code + 4; \
+		break; \
+	}
+
+#define MATHFUN_BATCH_KERNEL2(KERNEL) \
+	simd->KERNEL(regs[code[1]], regs[code[2]], regs[code[3]], diverged ? mask : NULL, count); \
+	next = code + 4; \
+	break;
+
+#define MATHFUN_BATCH_KERNEL1(KERNEL) \
+	simd->KERNEL(regs[code[1]], regs[code[2]], diverged ? mask : NULL, count); \
+	next = code + 3; \
+	break;
+
+// Conditional jump. Rows that disagree with the others get their own program counter.
+#define MATHFUN_BATCH_BRANCH(COND, JMPIF, TARGET, NEXT) \
+	{ \
+		const mathfun_value *cond = (COND); \
+		const bool jmpif = (JMPIF); \
+		const mathfun_code *target = (TARGET); \
+		next = (NEXT); \
+		\
+		if (diverged) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				if (mask[i]) { \
+					pcs[i] = cond[i].boolean == jmpif ? target : next; \
+				} \
+			} \
+			continue; \
+		} \
+		\
+		size_t jumps = 0; \
+		for (size_t i = 0; i < count; ++ i) { \
+			jumps += cond[i].boolean == jmpif; \
+		} \
+		\
+		if (jumps == count) { \
+			next = target; \
+		} \
+		else if (jumps > 0) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				pcs[i] = cond[i].boolean == jmpif ? target : next; \
+			} \
+			diverged = true; \
+			continue; \
+		} \
+		break; \
+	}
+
+// masked are the kernels used for diverged rows, out are the first outc of the
+// fun->retc result columns starting at row offset. Executes the code from entry
+// until RET, or until stop is reached. Returns false on an unknown instruction.
+static bool mathfun_exec_block(const mathfun *fun, const mathfun_batch_kernels *masked, mathfun_value *regs[],
+	mathfun_value argbuf[], size_t count, double *out[], size_t outc, size_t offset,
+	const mathfun_code *entry, const mathfun_code *stop) {
+	const mathfun_code *start = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_funct *functs = fun->functs;
+	const mathfun_code *pcs[MATHFUN_BATCH_SIZE];
+	uint64_t mask[MATHFUN_BATCH_SIZE];
+	size_t nlanes = count;
+	size_t live   = count;
+	bool diverged = false;
+	const mathfun_code *code = entry;
+
+	for (;;) {
+		if (diverged) {
+			// continue with the rows that are the furthest behind
+			code = NULL;
+			for (size_t i = 0; i < count; ++ i) {
+				if (pcs[i] && (!code || pcs[i] < code)) {
+					code = pcs[i];
+				}
+			}
+			nlanes = 0;
+			for (size_t i = 0; i < count; ++ i) {
+				if (pcs[i] == code) {
+					mask[i] = ~(uint64_t)0;
+					++ nlanes;
+				}
+				else {
+					mask[i] = 0;
+				}
+			}
+			// all rows met again?
+			diverged = nlanes < count;
+		}
+
+		// jumps never leave the prologue, so all rows are there
+		if (code == stop) return true;
+
+		const mathfun_batch_kernels *simd = diverged ? masked : mathfun_batch_simd;
+
+		const mathfun_code *next = NULL;
+		switch (*code) {
+			case ADD: MATHFUN_BATCH_KERNEL2(add);
+			case SUB: MATHFUN_BATCH_KERNEL2(sub);
+			case MUL: MATHFUN_BATCH_KERNEL2(mul);
+			case DIV: MATHFUN_BATCH_KERNEL2(div);
+			case MOD: MATHFUN_BATCH_BINARY(number, mathfun_mod(a[i].number, b[i].number));
+			case POW: MATHFUN_BATCH_BINARY(number, pow(a[i].number, b[i].number));
+
+			case EQ:  MATHFUN_BATCH_KERNEL2(eq);
+			case NE:  MATHFUN_BATCH_KERNEL2(ne);
+			case LT:  MATHFUN_BATCH_KERNEL2(lt);
+			case GT:  MATHFUN_BATCH_KERNEL2(gt);
+			case LE:  MATHFUN_BATCH_KERNEL2(le);
+			case GE:  MATHFUN_BATCH_KERNEL2(ge);
+			case BEQ: MATHFUN_BATCH_KERNEL2(beq);
+			case BNE: MATHFUN_BATCH_KERNEL2(bne);
+
+			case NEG: MATHFUN_BATCH_KERNEL1(neg);
+			case NOT: MATHFUN_BATCH_KERNEL1(not);
+
+			case MOV:
+			{
+				const mathfun_value *a = regs[code[1]];
+				mathfun_value *b = regs[code[2]];
+				MATHFUN_BATCH_FOR(b[i] = a[i]);
+				next = code + 3;
+				break;
+			}
+			case VAL:
+			{
+				const mathfun_value value = consts[code[1]];
+				mathfun_value *a = regs[code[2]];
+				MATHFUN_BATCH_FOR(a[i] = value);
+				next = code + 3;
+				break;
+			}
+			case POWK:
+			{
+				const double k = consts[code[1]].number;
+				const mathfun_value *a = regs[code[2]];
+				mathfun_value *b = regs[code[3]];
+				MATHFUN_BATCH_FOR(b[i].number = mathfun_pow_k(a[i].number, k));
+				next = code + 4;
+				break;
+			}
+			case FMA:
+			{
+				const mathfun_value *a = regs[code[1]];
+				const mathfun_value *b = regs[code[2]];
+				const mathfun_value *c = regs[code[3]];
+				mathfun_value *d = regs[code[4]];
+				MATHFUN_BATCH_FOR(d[i].number = fma(a[i].number, b[i].number, c[i].number));
+				next = code + 5;
+				break;
+			}
+			case CALL:
+			{
+				mathfun_binding_funct funct = functs[code[1]];
+				const mathfun_code argc     = code[2];
+				const mathfun_code firstarg = code[3];
+				mathfun_value *ret = regs[code[4]];
+				MATHFUN_BATCH_FOR(
+					for (mathfun_code arg = 0; arg < argc; ++ arg) {
+						argbuf[arg] = regs[firstarg + arg][i];
+					}
+					ret[i] = funct(argbuf));
+				next = code + 5;
+				break;
+			}
+			case SETT:
+			{
+				mathfun_value *a = regs[code[1]];
+				MATHFUN_BATCH_FOR(a[i].boolean = true);
+				next = code + 2;
+				break;
+			}
+			case SETF:
+			{
+				mathfun_value *a = regs[code[1]];
+				MATHFUN_BATCH_FOR(a[i].boolean = false);
+				next = code + 2;
+				break;
+			}
+			case NOP:
+				next = code + 1;
+				break;
+
+			case JMP:
+				next = start + mathfun_code_adr(code + 1);
+				break;
+
+			case JMPT:
+			case JMPF:
+				MATHFUN_BATCH_BRANCH(regs[code[1]], *code == JMPT, start + mathfun_code_adr(code + 2),
+					code + 2 + MATHFUN_ADR_CODES);
+
+			case MULADD:
+			case MULSUB:
+			{
+				const uint64_t *active = diverged ? mask : NULL;
+				simd->mul(regs[code[1]], regs[code[2]], regs[code[3]], active, count);
+				(*code == MULADD ? simd->add : simd->sub)(
+					regs[code[3]], regs[code[4]], regs[code[5]], active, count);
+				next = code + 6;
+				break;
+			}
+			case VADD:
+			case VSUB:
+			case VMUL:
+			case VDIV:
+			{
+				const mathfun_value value = consts[code[1]];
+				const mathfun_code *args = code + 2;
+				mathfun_value *a = regs[args[0]];
+				MATHFUN_BATCH_FOR(a[i] = value);
+
+				mathfun_batch_binary kernel =
+					*code == VADD ? simd->add :
+					*code == VSUB ? simd->sub :
+					*code == VMUL ? simd->mul :
+					                simd->div;
+				kernel(regs[args[1]], regs[args[2]], regs[args[3]], diverged ? mask : NULL, count);
+				next = code + 6;
+				break;
+			}
+			case EQJ:
+			case NEJ:
+			case LTJ:
+			case GTJ:
+			case LEJ:
+			case GEJ:
+			{
+				const mathfun_batch_binary kernels[] = {
+					simd->eq, simd->ne,
+					simd->lt, simd->gt,
+					simd->le, simd->ge
+				};
+				kernels[*code - EQJ](regs[code[1]], regs[code[2]], regs[code[3]], diverged ? mask : NULL, count);
+				MATHFUN_BATCH_BRANCH(regs[code[3]], code[4], start + mathfun_code_adr(code + 5),
+					code + 5 + MATHFUN_ADR_CODES);
+			}
+			case ADDK:
+			case SUBK:
+			case RSUBK:
+			case MULK:
+			case DIVK:
+			case RDIVK:
+			case EQK:
+			case NEK:
+			case LTK:
+			case GTK:
+			case LEK:
+			case GEK:
+			{
+				const mathfun_batch_const kernels[] = {
+					simd->addk, simd->subk, simd->rsubk,
+					simd->mulk, simd->divk, simd->rdivk,
+					simd->eqk,  simd->nek,  simd->ltk,
+					simd->gtk,  simd->lek,  simd->gek
+				};
+				kernels[*code - ADDK](regs[code[2]], consts[code[1]], regs[code[3]], diverged ? mask : NULL, count);
+				next = code + 4;
+				break;
+			}
+			case INK:
+			case INXK:
+			{
+				const double lower = consts[code[1]].number;
+				const double upper = consts[code[2]].number;
+				const mathfun_value *a = regs[code[3]];
+				mathfun_value *b = regs[code[4]];
+				if (*code == INK) {
+					MATHFUN_BATCH_FOR(b[i].boolean = a[i].number >= lower && a[i].number <= upper);
+				}
+				else {
+					MATHFUN_BATCH_FOR(b[i].boolean = a[i].number >= lower && a[i].number <  upper);
+				}
+				next = code + 5;
+				break;
+			}
+			case RET:
+			{
+				const mathfun_value *a = regs[code[1]];
+				double *ret = out[0] + offset;
+				MATHFUN_BATCH_FOR(ret[i] = a[i].number);
+
+				// the other results are left in the registers following the arguments
+				for (size_t k = 1; k < outc; ++ k) {
+					const mathfun_value *b = regs[fun->argc + k];
+					ret = out[k] + offset;
+					MATHFUN_BATCH_FOR(ret[i] = b[i].number);
+				}
+
+				if (!diverged) return true;
+
+				MATHFUN_BATCH_FOR(pcs[i] = NULL);
+				live -= nlanes;
+				if (live == 0) return true;
+				continue;
+			}
+			default:
+				for (size_t k = 0; k < outc; ++ k) {
+					for (size_t i = 0; i < count; ++ i) {
+						out[k][offset + i] = NAN;
+					}
+				}
+				return false;
+		}
+
+		if (diverged) {
+			MATHFUN_BATCH_FOR(pcs[i] = next);
+		}
+		else {
+			code = next;
+		}
+	}
+}
+
+bool mathfun_batch_frame_reserve(mathfun_batch_frame *frame, const mathfun *fun, mathfun_error_p *error) {
+	const size_t temps = fun->framesize - fun->argc;
+	// temporary registers followed by the argument buffer used by CALL
+	const size_t size = temps * MATHFUN_BATCH_SIZE + fun->framesize;
+
+	if (frame->framesize < fun->framesize) {
+		mathfun_value **regs = realloc(frame->regs, fun->framesize * sizeof(mathfun_value*));
+
+		if (!regs) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		frame->regs = regs;
+		frame->framesize = fun->framesize;
+	}
+
+	if (frame->size < size) {
+		mathfun_value *values = realloc(frame->values, size * sizeof(mathfun_value));
+
+		if (!values) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		frame->values = values;
+		frame->size = size;
+	}
+
+	for (size_t reg = fun->argc; reg < fun->framesize; ++ reg) {
+		frame->regs[reg] = frame->values + (reg - fun->argc) * MATHFUN_BATCH_SIZE;
+	}
+	frame->argbuf = frame->values + temps * MATHFUN_BATCH_SIZE;
+
+	return true;
+}
+
+void mathfun_batch_frame_cleanup(mathfun_batch_frame *frame) {
+	free(frame->values);
+	free(frame->regs);
+	memset(frame, 0, sizeof(mathfun_batch_frame));
+}
+
+bool mathfun_exec_rows(const mathfun *fun, const mathfun_batch_kernels *masked, mathfun_batch_frame *frame,
+	const double *args[], size_t offset, size_t n, double *out[], size_t outc) {
+	mathfun_value **regs = frame->regs;
+	const mathfun_code *entry = (const mathfun_code*)fun->code + fun->entry;
+	const size_t first = offset;
+	const size_t end   = offset + n;
+
+	bool ok = true;
+	for (; offset < end; offset += MATHFUN_BATCH_SIZE) {
+		const size_t count = end - offset < MATHFUN_BATCH_SIZE ? end - offset : MATHFUN_BATCH_SIZE;
+
+		// argument registers are never written, so they can point directly into the columns
+		for (size_t arg = 0; arg < fun->argc; ++ arg) {
+			regs[arg] = (mathfun_value*)(args[arg] + offset);
+		}
+
+		if (offset == first && fun->entry > 0) {
+			ok = mathfun_exec_block(fun, masked, regs, frame->argbuf, 1, out, outc, offset,
+				fun->code, entry);
+
+			for (size_t reg = fun->argc; reg < fun->framesize; ++ reg) {
+				for (size_t i = 1; i < MATHFUN_BATCH_SIZE; ++ i) {
+					regs[reg][i] = regs[reg][0];
+				}
+			}
+		}
+
+		ok = mathfun_exec_block(fun, masked, regs, frame->argbuf, count, out, outc, offset, entry, NULL) && ok;
+	}
+
+	return ok;
+}
+
+static bool mathfun_exec_batch_rows(const mathfun *fun, const mathfun_batch_kernels *masked,
+	const double *args[], size_t n, double *out[], size_t outc, mathfun_error_p *error) {
+	mathfun_batch_frame frame = MATHFUN_BATCH_FRAME_INIT;
+
+	if (!mathfun_batch_frame_reserve(&frame, fun, error)) {
+		mathfun_batch_frame_cleanup(&frame);
+		return false;
+	}
+
+	const bool ok = mathfun_exec_rows(fun, masked, &frame, args, 0, n, out, outc);
+
+	mathfun_batch_frame_cleanup(&frame);
+
+	if (!ok) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+	}
+
+	return ok;
+}
+
+static bool mathfun_exec_batch_outs(const mathfun *fun, const double *args[], size_t n, double *out[],
+	size_t outc, mathfun_error_p *error) {
+	errno = 0;
+	if (!mathfun_exec_batch_rows(fun, mathfun_batch_simd, args, n, out, outc, error)) {
+		return false;
+	}
+
+	if (errno != 0) {
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	return true;
+}
+
+bool mathfun_exec_batch(const mathfun *fun, const double *args[], size_t n, double out[],
+	mathfun_error_p *error) {
+	return mathfun_exec_batch_outs(fun, args, n, &out, 1, error);
+}
+
+bool mathfun_exec_batch_multi(const mathfun *fun, const double *args[], size_t n, double *out[],
+	mathfun_error_p *error) {
+	return mathfun_exec_batch_outs(fun, args, n, out, fun->retc, error);
+}
+
+static bool mathfun_exec_batch_outs_status(const mathfun *fun, const double *args[], size_t n, double *out[],
+	size_t outc, int flags, int *status, mathfun_error_p *error) {
+	mathfun_fenv env;
+	mathfun_fenv_enter(&env, flags);
+
+	const bool ok = mathfun_exec_batch_rows(fun, &mathfun_batch_generic, args, n, out, outc, error);
+
+	const int raised = mathfun_fenv_leave(&env);
+	if (status) *status = raised;
+
+	return ok;
+}
+
+bool mathfun_exec_batch_status(const mathfun *fun, const double *args[], size_t n, double out[],
+	int flags, int *status, mathfun_error_p *error) {
+	return mathfun_exec_batch_outs_status(fun, args, n, &out, 1, flags, status, error);
+}
+
+bool mathfun_exec_batch_multi_status(const mathfun *fun, const double *args[], size_t n, double *out[],
+	int flags, int *status, mathfun_error_p *error) {
+	return mathfun_exec_batch_outs_status(fun, args, n, out, fun->retc, flags, status, error);
+}
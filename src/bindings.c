@@ -275,6 +275,202 @@ static mathfun_value mathfun_funct_sign(const mathfun_value args[]) {
 	return (mathfun_value){ .number = isnan(x) || x == 0.0 ? x : copysign(1.0, x) };
 }
 
+// Derivative rules for mathfun_acall_dual(). Functions that are constant
+// almost everywhere (floor, round, ...) have a zero derivative, integer
+// arguments (like n of jn) are treated as constants.
+
+#define MATHFUN_DERIV1(NAME, EXPR) \
+	static void mathfun_deriv_##NAME(const mathfun_value args[], double grad[]) { \
+		const double x = args[0].number; \
+		grad[0] = (EXPR); \
+	}
+
+MATHFUN_DERIV1(acos,  -1.0 / sqrt(1.0 - x * x))
+MATHFUN_DERIV1(acosh,  1.0 / sqrt(x * x - 1.0))
+MATHFUN_DERIV1(asin,   1.0 / sqrt(1.0 - x * x))
+MATHFUN_DERIV1(asinh,  1.0 / sqrt(x * x + 1.0))
+MATHFUN_DERIV1(atan,   1.0 / (1.0 + x * x))
+MATHFUN_DERIV1(atanh,  1.0 / (1.0 - x * x))
+MATHFUN_DERIV1(cbrt,   1.0 / (3.0 * cbrt(x) * cbrt(x)))
+MATHFUN_DERIV1(cos,   -sin(x))
+MATHFUN_DERIV1(cosh,   sinh(x))
+MATHFUN_DERIV1(erf,    M_2_SQRTPI * exp(-x * x))
+MATHFUN_DERIV1(erfc,  -M_2_SQRTPI * exp(-x * x))
+MATHFUN_DERIV1(exp,    exp(x))
+MATHFUN_DERIV1(exp2,   exp2(x) * M_LN2)
+MATHFUN_DERIV1(expm1,  exp(x))
+MATHFUN_DERIV1(abs,    x > 0.0 ? 1.0 : x < 0.0 ? -1.0 : 0.0)
+MATHFUN_DERIV1(j0,    -j1(x))
+MATHFUN_DERIV1(j1,     x == 0.0 ? 0.5 : j0(x) - j1(x) / x)
+MATHFUN_DERIV1(log,    1.0 / x)
+MATHFUN_DERIV1(log10,  1.0 / (x * M_LN10))
+MATHFUN_DERIV1(log1p,  1.0 / (1.0 + x))
+MATHFUN_DERIV1(log2,   1.0 / (x * M_LN2))
+MATHFUN_DERIV1(sin,    cos(x))
+MATHFUN_DERIV1(sinh,   cosh(x))
+MATHFUN_DERIV1(sqrt,   0.5 / sqrt(x))
+MATHFUN_DERIV1(tan,    1.0 + tan(x) * tan(x))
+MATHFUN_DERIV1(tanh,   1.0 - tanh(x) * tanh(x))
+MATHFUN_DERIV1(y0,    -y1(x))
+MATHFUN_DERIV1(y1,     y0(x) - y1(x) / x)
+
+// functions that are constant almost everywhere
+static void mathfun_deriv_step(const mathfun_value args[], double grad[]) {
+	(void)args;
+	grad[0] = 0.0;
+}
+
+static void mathfun_deriv_atan2(const mathfun_value args[], double grad[]) {
+	const double y = args[0].number;
+	const double x = args[1].number;
+	const double r2 = x * x + y * y;
+	grad[0] =  x / r2;
+	grad[1] = -y / r2;
+}
+
+static void mathfun_deriv_copysign(const mathfun_value args[], double grad[]) {
+	grad[0] = !signbit(args[0].number) == !signbit(args[1].number) ? 1.0 : -1.0;
+	grad[1] = 0.0;
+}
+
+static void mathfun_deriv_fdim(const mathfun_value args[], double grad[]) {
+	const bool pos = args[0].number > args[1].number;
+	grad[0] = pos ?  1.0 : 0.0;
+	grad[1] = pos ? -1.0 : 0.0;
+}
+
+static void mathfun_deriv_fma(const mathfun_value args[], double grad[]) {
+	grad[0] = args[1].number;
+	grad[1] = args[0].number;
+	grad[2] = 1.0;
+}
+
+static void mathfun_deriv_fmod(const mathfun_value args[], double grad[]) {
+	grad[0] = 1.0;
+	grad[1] = -trunc(args[0].number / args[1].number);
+}
+
+static void mathfun_deriv_max(const mathfun_value args[], double grad[]) {
+	const double x = args[0].number;
+	const double y = args[1].number;
+	const bool first = x >= y || isnan(x);
+	grad[0] = first ? 1.0 : 0.0;
+	grad[1] = first ? 0.0 : 1.0;
+}
+
+static void mathfun_deriv_min(const mathfun_value args[], double grad[]) {
+	const double x = args[0].number;
+	const double y = args[1].number;
+	const bool first = x <= y || isnan(y);
+	grad[0] = first ? 1.0 : 0.0;
+	grad[1] = first ? 0.0 : 1.0;
+}
+
+static void mathfun_deriv_hypot(const mathfun_value args[], double grad[]) {
+	const double x = args[0].number;
+	const double y = args[1].number;
+	const double h = hypot(x, y);
+	grad[0] = x / h;
+	grad[1] = y / h;
+}
+
+static void mathfun_deriv_jn(const mathfun_value args[], double grad[]) {
+	const int n = (int)args[0].number;
+	const double x = args[1].number;
+	grad[0] = 0.0;
+	grad[1] = 0.5 * (jn(n - 1, x) - jn(n + 1, x));
+}
+
+static void mathfun_deriv_yn(const mathfun_value args[], double grad[]) {
+	const int n = (int)args[0].number;
+	const double x = args[1].number;
+	grad[0] = 0.0;
+	grad[1] = 0.5 * (yn(n - 1, x) - yn(n + 1, x));
+}
+
+// ldexp and scalbln
+static void mathfun_deriv_scale(const mathfun_value args[], double grad[]) {
+	grad[0] = ldexp(1.0, (int)args[1].number);
+	grad[1] = 0.0;
+}
+
+// nextafter and nexttoward
+static void mathfun_deriv_next(const mathfun_value args[], double grad[]) {
+	(void)args;
+	grad[0] = 1.0;
+	grad[1] = 0.0;
+}
+
+static void mathfun_deriv_remainder(const mathfun_value args[], double grad[]) {
+	const double x = args[0].number;
+	const double y = args[1].number;
+	grad[0] = 1.0;
+	grad[1] = -nearbyint((x - remainder(x, y)) / y);
+}
+
+// Symbolic derivatives for mathfun_context_derive(). They follow the rules
+// above and only use default functions. Constants are written as literals, so
+// they don't depend on the constants defined in the context.
+
+static const char *mathfun_params_x[]  = { "x" };
+static const char *mathfun_params_xy[] = { "x", "y" };
+static const char *mathfun_params_yx[] = { "y", "x" };
+static const char *mathfun_params_xn[] = { "x", "n" };
+static const char *mathfun_params_nx[] = { "n", "x" };
+
+#define MATHFUN_PARTIALS1(NAME, EXPR) \
+	static const mathfun_partials mathfun_partials_##NAME = { mathfun_params_x, (const char*[]){ EXPR } };
+
+#define MATHFUN_PARTIALS2(NAME, PARAMS, EXPR1, EXPR2) \
+	static const mathfun_partials mathfun_partials_##NAME = { PARAMS, (const char*[]){ EXPR1, EXPR2 } };
+
+MATHFUN_PARTIALS1(acos,  "-1 / sqrt(1 - x * x)")
+MATHFUN_PARTIALS1(acosh, "1 / sqrt(x * x - 1)")
+MATHFUN_PARTIALS1(asin,  "1 / sqrt(1 - x * x)")
+MATHFUN_PARTIALS1(asinh, "1 / sqrt(x * x + 1)")
+MATHFUN_PARTIALS1(atan,  "1 / (1 + x * x)")
+MATHFUN_PARTIALS1(atanh, "1 / (1 - x * x)")
+MATHFUN_PARTIALS1(cbrt,  "1 / (3 * cbrt(x) * cbrt(x))")
+MATHFUN_PARTIALS1(cos,   "-sin(x)")
+MATHFUN_PARTIALS1(cosh,  "sinh(x)")
+MATHFUN_PARTIALS1(erf,   "1.1283791670955126 * exp(-x * x)")
+MATHFUN_PARTIALS1(erfc,  "-1.1283791670955126 * exp(-x * x)")
+MATHFUN_PARTIALS1(exp,   "exp(x)")
+MATHFUN_PARTIALS1(exp2,  "exp2(x) * 0.69314718055994531")
+MATHFUN_PARTIALS1(expm1, "exp(x)")
+MATHFUN_PARTIALS1(abs,   "sign(x)")
+MATHFUN_PARTIALS1(j0,    "-j1(x)")
+MATHFUN_PARTIALS1(j1,    "x == 0 ? 0.5 : j0(x) - j1(x) / x")
+MATHFUN_PARTIALS1(log,   "1 / x")
+MATHFUN_PARTIALS1(log10, "1 / (x * 2.3025850929940457)")
+MATHFUN_PARTIALS1(log1p, "1 / (1 + x)")
+MATHFUN_PARTIALS1(log2,  "1 / (x * 0.69314718055994531)")
+MATHFUN_PARTIALS1(sin,   "cos(x)")
+MATHFUN_PARTIALS1(sinh,  "cosh(x)")
+MATHFUN_PARTIALS1(sqrt,  "0.5 / sqrt(x)")
+MATHFUN_PARTIALS1(tan,   "1 + tan(x) * tan(x)")
+MATHFUN_PARTIALS1(tanh,  "1 - tanh(x) * tanh(x)")
+MATHFUN_PARTIALS1(y0,    "-y1(x)")
+MATHFUN_PARTIALS1(y1,    "y0(x) - y1(x) / x")
+MATHFUN_PARTIALS1(step,  NULL)
+
+MATHFUN_PARTIALS2(atan2,     mathfun_params_yx, "x / (x * x + y * y)", "-y / (x * x + y * y)")
+MATHFUN_PARTIALS2(copysign,  mathfun_params_xy, "copysign(1, x) * copysign(1, y)", NULL)
+MATHFUN_PARTIALS2(fdim,      mathfun_params_xy, "x > y ? 1 : 0", "x > y ? -1 : 0")
+MATHFUN_PARTIALS2(fmod,      mathfun_params_xy, "1", "-trunc(x / y)")
+MATHFUN_PARTIALS2(max,       mathfun_params_xy, "x >= y || isnan(x) ? 1 : 0", "x >= y || isnan(x) ? 0 : 1")
+MATHFUN_PARTIALS2(min,       mathfun_params_xy, "x <= y || isnan(y) ? 1 : 0", "x <= y || isnan(y) ? 0 : 1")
+MATHFUN_PARTIALS2(hypot,     mathfun_params_xy, "x / hypot(x, y)", "y / hypot(x, y)")
+MATHFUN_PARTIALS2(jn,        mathfun_params_nx, NULL, "0.5 * (jn(n - 1, x) - jn(n + 1, x))")
+MATHFUN_PARTIALS2(yn,        mathfun_params_nx, NULL, "0.5 * (yn(n - 1, x) - yn(n + 1, x))")
+MATHFUN_PARTIALS2(scale,     mathfun_params_xn, "ldexp(1, n)", NULL)
+MATHFUN_PARTIALS2(next,      mathfun_params_xy, "1", NULL)
+MATHFUN_PARTIALS2(remainder, mathfun_params_xy, "1", "-nearbyint((x - remainder(x, y)) / y)")
+
+static const mathfun_partials mathfun_partials_fma = {
+	(const char*[]){ "x", "y", "z" }, (const char*[]){ "y", "x", "1" }
+};
+
 bool mathfun_context_define_default(mathfun_context *ctx, mathfun_error_p *error) {
 	const mathfun_decl decls[] = {
 
@@ -295,71 +491,73 @@ bool mathfun_context_define_default(mathfun_context *ctx, mathfun_error_p *error
 		{ MATHFUN_DECL_CONST, "sqrt1_2",   { .value = M_SQRT1_2 } },
 
 		// Functions
-		{ MATHFUN_DECL_FUNCT, "isnan",          { .funct = { mathfun_funct_isnan,          &mathfun_bsig1 } } },
-		{ MATHFUN_DECL_FUNCT, "isfinite",       { .funct = { mathfun_funct_isfinite,       &mathfun_bsig1 } } },
-		{ MATHFUN_DECL_FUNCT, "isnormal",       { .funct = { mathfun_funct_isnormal,       &mathfun_bsig1 } } },
-		{ MATHFUN_DECL_FUNCT, "isinf",          { .funct = { mathfun_funct_isinf,          &mathfun_bsig1 } } },
-		{ MATHFUN_DECL_FUNCT, "isgreater",      { .funct = { mathfun_funct_isgreater,      &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "isgreaterequal", { .funct = { mathfun_funct_isgreaterequal, &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "isless",         { .funct = { mathfun_funct_isless,         &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "islessequal",    { .funct = { mathfun_funct_islessequal,    &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "islessgreater",  { .funct = { mathfun_funct_islessgreater,  &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "isunordered",    { .funct = { mathfun_funct_isunordered,    &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "signbit",        { .funct = { mathfun_funct_signbit,        &mathfun_bsig2 } } },
-		{ MATHFUN_DECL_FUNCT, "acos",           { .funct = { mathfun_funct_acos,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "acosh",          { .funct = { mathfun_funct_acosh,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "asin",           { .funct = { mathfun_funct_asin,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "asinh",          { .funct = { mathfun_funct_asinh,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "atan",           { .funct = { mathfun_funct_atan,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "atan2",          { .funct = { mathfun_funct_atan2,          &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "atanh",          { .funct = { mathfun_funct_atanh,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "cbrt",           { .funct = { mathfun_funct_cbrt,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "ceil",           { .funct = { mathfun_funct_ceil,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "copysign",       { .funct = { mathfun_funct_copysign,       &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "cos",            { .funct = { mathfun_funct_cos,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "cosh",           { .funct = { mathfun_funct_cosh,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "erf",            { .funct = { mathfun_funct_erf,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "erfc",           { .funct = { mathfun_funct_erfc,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "exp",            { .funct = { mathfun_funct_exp,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "exp2",           { .funct = { mathfun_funct_exp2,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "expm1",          { .funct = { mathfun_funct_expm1,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "abs",            { .funct = { mathfun_funct_abs,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "fdim",           { .funct = { mathfun_funct_fdim,           &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "floor",          { .funct = { mathfun_funct_floor,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "fma",            { .funct = { mathfun_funct_fma,            &mathfun_sig3 } } },
-		{ MATHFUN_DECL_FUNCT, "fmod",           { .funct = { mathfun_funct_fmod,           &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "max",            { .funct = { mathfun_funct_max,            &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "min",            { .funct = { mathfun_funct_min,            &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "hypot",          { .funct = { mathfun_funct_hypot,          &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "j0",             { .funct = { mathfun_funct_j0,             &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "j1",             { .funct = { mathfun_funct_j1,             &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "jn",             { .funct = { mathfun_funct_jn,             &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "ldexp",          { .funct = { mathfun_funct_ldexp,          &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "log",            { .funct = { mathfun_funct_log,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "log10",          { .funct = { mathfun_funct_log10,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "log1p",          { .funct = { mathfun_funct_log1p,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "log2",           { .funct = { mathfun_funct_log2,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "logb",           { .funct = { mathfun_funct_logb,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "nearbyint",      { .funct = { mathfun_funct_nearbyint,      &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "nextafter",      { .funct = { mathfun_funct_nextafter,      &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "nexttoward",     { .funct = { mathfun_funct_nexttoward,     &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "remainder",      { .funct = { mathfun_funct_remainder,      &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "round",          { .funct = { mathfun_funct_round,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "scalbln",        { .funct = { mathfun_funct_scalbln,        &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "sin",            { .funct = { mathfun_funct_sin,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "sinh",           { .funct = { mathfun_funct_sinh,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "sqrt",           { .funct = { mathfun_funct_sqrt,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "tan",            { .funct = { mathfun_funct_tan,            &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "tanh",           { .funct = { mathfun_funct_tanh,           &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "gamma",          { .funct = { mathfun_funct_gamma,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "trunc",          { .funct = { mathfun_funct_trunc,          &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "y0",             { .funct = { mathfun_funct_y0,             &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "y1",             { .funct = { mathfun_funct_y1,             &mathfun_sig1 } } },
-		{ MATHFUN_DECL_FUNCT, "yn",             { .funct = { mathfun_funct_yn,             &mathfun_sig2 } } },
-		{ MATHFUN_DECL_FUNCT, "sign",           { .funct = { mathfun_funct_sign,           &mathfun_sig1 } } },
+		{ MATHFUN_DECL_FUNCT, "isnan",          { .funct = { mathfun_funct_isnan,          &mathfun_bsig1, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isfinite",       { .funct = { mathfun_funct_isfinite,       &mathfun_bsig1, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isnormal",       { .funct = { mathfun_funct_isnormal,       &mathfun_bsig1, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isinf",          { .funct = { mathfun_funct_isinf,          &mathfun_bsig1, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isgreater",      { .funct = { mathfun_funct_isgreater,      &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isgreaterequal", { .funct = { mathfun_funct_isgreaterequal, &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isless",         { .funct = { mathfun_funct_isless,         &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "islessequal",    { .funct = { mathfun_funct_islessequal,    &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "islessgreater",  { .funct = { mathfun_funct_islessgreater,  &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "isunordered",    { .funct = { mathfun_funct_isunordered,    &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "signbit",        { .funct = { mathfun_funct_signbit,        &mathfun_bsig2, NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "acos",           { .funct = { mathfun_funct_acos,           &mathfun_sig1,  mathfun_deriv_acos,      &mathfun_partials_acos } } },
+		{ MATHFUN_DECL_FUNCT, "acosh",          { .funct = { mathfun_funct_acosh,          &mathfun_sig1,  mathfun_deriv_acosh,     &mathfun_partials_acosh } } },
+		{ MATHFUN_DECL_FUNCT, "asin",           { .funct = { mathfun_funct_asin,           &mathfun_sig1,  mathfun_deriv_asin,      &mathfun_partials_asin } } },
+		{ MATHFUN_DECL_FUNCT, "asinh",          { .funct = { mathfun_funct_asinh,          &mathfun_sig1,  mathfun_deriv_asinh,     &mathfun_partials_asinh } } },
+		{ MATHFUN_DECL_FUNCT, "atan",           { .funct = { mathfun_funct_atan,           &mathfun_sig1,  mathfun_deriv_atan,      &mathfun_partials_atan } } },
+		{ MATHFUN_DECL_FUNCT, "atan2",          { .funct = { mathfun_funct_atan2,          &mathfun_sig2,  mathfun_deriv_atan2,     &mathfun_partials_atan2 } } },
+		{ MATHFUN_DECL_FUNCT, "atanh",          { .funct = { mathfun_funct_atanh,          &mathfun_sig1,  mathfun_deriv_atanh,     &mathfun_partials_atanh } } },
+		{ MATHFUN_DECL_FUNCT, "cbrt",           { .funct = { mathfun_funct_cbrt,           &mathfun_sig1,  mathfun_deriv_cbrt,      &mathfun_partials_cbrt } } },
+		{ MATHFUN_DECL_FUNCT, "ceil",           { .funct = { mathfun_funct_ceil,           &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
+		{ MATHFUN_DECL_FUNCT, "copysign",       { .funct = { mathfun_funct_copysign,       &mathfun_sig2,  mathfun_deriv_copysign,  &mathfun_partials_copysign } } },
+		{ MATHFUN_DECL_FUNCT, "cos",            { .funct = { mathfun_funct_cos,            &mathfun_sig1,  mathfun_deriv_cos,       &mathfun_partials_cos } } },
+		{ MATHFUN_DECL_FUNCT, "cosh",           { .funct = { mathfun_funct_cosh,           &mathfun_sig1,  mathfun_deriv_cosh,      &mathfun_partials_cosh } } },
+		{ MATHFUN_DECL_FUNCT, "erf",            { .funct = { mathfun_funct_erf,            &mathfun_sig1,  mathfun_deriv_erf,       &mathfun_partials_erf } } },
+		{ MATHFUN_DECL_FUNCT, "erfc",           { .funct = { mathfun_funct_erfc,           &mathfun_sig1,  mathfun_deriv_erfc,      &mathfun_partials_erfc } } },
+		{ MATHFUN_DECL_FUNCT, "exp",            { .funct = { mathfun_funct_exp,            &mathfun_sig1,  mathfun_deriv_exp,       &mathfun_partials_exp } } },
+		{ MATHFUN_DECL_FUNCT, "exp2",           { .funct = { mathfun_funct_exp2,           &mathfun_sig1,  mathfun_deriv_exp2,      &mathfun_partials_exp2 } } },
+		{ MATHFUN_DECL_FUNCT, "expm1",          { .funct = { mathfun_funct_expm1,          &mathfun_sig1,  mathfun_deriv_expm1,     &mathfun_partials_expm1 } } },
+		{ MATHFUN_DECL_FUNCT, "abs",            { .funct = { mathfun_funct_abs,            &mathfun_sig1,  mathfun_deriv_abs,       &mathfun_partials_abs } } },
+		{ MATHFUN_DECL_FUNCT, "fdim",           { .funct = { mathfun_funct_fdim,           &mathfun_sig2,  mathfun_deriv_fdim,      &mathfun_partials_fdim } } },
+		{ MATHFUN_DECL_FUNCT, "floor",          { .funct = { mathfun_funct_floor,          &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
+		{ MATHFUN_DECL_FUNCT, "fma",            { .funct = { mathfun_funct_fma,            &mathfun_sig3,  mathfun_deriv_fma,       &mathfun_partials_fma } } },
+		{ MATHFUN_DECL_FUNCT, "fmod",           { .funct = { mathfun_funct_fmod,           &mathfun_sig2,  mathfun_deriv_fmod,      &mathfun_partials_fmod } } },
+		{ MATHFUN_DECL_FUNCT, "max",            { .funct = { mathfun_funct_max,            &mathfun_sig2,  mathfun_deriv_max,       &mathfun_partials_max } } },
+		{ MATHFUN_DECL_FUNCT, "min",            { .funct = { mathfun_funct_min,            &mathfun_sig2,  mathfun_deriv_min,       &mathfun_partials_min } } },
+		{ MATHFUN_DECL_FUNCT, "hypot",          { .funct = { mathfun_funct_hypot,          &mathfun_sig2,  mathfun_deriv_hypot,     &mathfun_partials_hypot } } },
+		{ MATHFUN_DECL_FUNCT, "j0",             { .funct = { mathfun_funct_j0,             &mathfun_sig1,  mathfun_deriv_j0,        &mathfun_partials_j0 } } },
+		{ MATHFUN_DECL_FUNCT, "j1",             { .funct = { mathfun_funct_j1,             &mathfun_sig1,  mathfun_deriv_j1,        &mathfun_partials_j1 } } },
+		{ MATHFUN_DECL_FUNCT, "jn",             { .funct = { mathfun_funct_jn,             &mathfun_sig2,  mathfun_deriv_jn,        &mathfun_partials_jn } } },
+		{ MATHFUN_DECL_FUNCT, "ldexp",          { .funct = { mathfun_funct_ldexp,          &mathfun_sig2,  mathfun_deriv_scale,     &mathfun_partials_scale } } },
+		{ MATHFUN_DECL_FUNCT, "log",            { .funct = { mathfun_funct_log,            &mathfun_sig1,  mathfun_deriv_log,       &mathfun_partials_log } } },
+		{ MATHFUN_DECL_FUNCT, "log10",          { .funct = { mathfun_funct_log10,          &mathfun_sig1,  mathfun_deriv_log10,     &mathfun_partials_log10 } } },
+		{ MATHFUN_DECL_FUNCT, "log1p",          { .funct = { mathfun_funct_log1p,          &mathfun_sig1,  mathfun_deriv_log1p,     &mathfun_partials_log1p } } },
+		{ MATHFUN_DECL_FUNCT, "log2",           { .funct = { mathfun_funct_log2,           &mathfun_sig1,  mathfun_deriv_log2,      &mathfun_partials_log2 } } },
+		{ MATHFUN_DECL_FUNCT, "logb",           { .funct = { mathfun_funct_logb,           &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
+		{ MATHFUN_DECL_FUNCT, "nearbyint",      { .funct = { mathfun_funct_nearbyint,      &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
+		{ MATHFUN_DECL_FUNCT, "nextafter",      { .funct = { mathfun_funct_nextafter,      &mathfun_sig2,  mathfun_deriv_next,      &mathfun_partials_next } } },
+		{ MATHFUN_DECL_FUNCT, "nexttoward",     { .funct = { mathfun_funct_nexttoward,     &mathfun_sig2,  mathfun_deriv_next,      &mathfun_partials_next } } },
+		{ MATHFUN_DECL_FUNCT, "remainder",      { .funct = { mathfun_funct_remainder,      &mathfun_sig2,  mathfun_deriv_remainder, &mathfun_partials_remainder } } },
+		{ MATHFUN_DECL_FUNCT, "round",          { .funct = { mathfun_funct_round,          &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
+		{ MATHFUN_DECL_FUNCT, "scalbln",        { .funct = { mathfun_funct_scalbln,        &mathfun_sig2,  mathfun_deriv_scale,     &mathfun_partials_scale } } },
+		{ MATHFUN_DECL_FUNCT, "sin",            { .funct = { mathfun_funct_sin,            &mathfun_sig1,  mathfun_deriv_sin,       &mathfun_partials_sin } } },
+		{ MATHFUN_DECL_FUNCT, "sinh",           { .funct = { mathfun_funct_sinh,           &mathfun_sig1,  mathfun_deriv_sinh,      &mathfun_partials_sinh } } },
+		{ MATHFUN_DECL_FUNCT, "sqrt",           { .funct = { mathfun_funct_sqrt,           &mathfun_sig1,  mathfun_deriv_sqrt,      &mathfun_partials_sqrt } } },
+		{ MATHFUN_DECL_FUNCT, "tan",            { .funct = { mathfun_funct_tan,            &mathfun_sig1,  mathfun_deriv_tan,       &mathfun_partials_tan } } },
+		{ MATHFUN_DECL_FUNCT, "tanh",           { .funct = { mathfun_funct_tanh,           &mathfun_sig1,  mathfun_deriv_tanh,      &mathfun_partials_tanh } } },
+		{ MATHFUN_DECL_FUNCT, "gamma",          { .funct = { mathfun_funct_gamma,          &mathfun_sig1,  NULL,                    NULL } } },
+		{ MATHFUN_DECL_FUNCT, "trunc",          { .funct = { mathfun_funct_trunc,          &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
+		{ MATHFUN_DECL_FUNCT, "y0",             { .funct = { mathfun_funct_y0,             &mathfun_sig1,  mathfun_deriv_y0,        &mathfun_partials_y0 } } },
+		{ MATHFUN_DECL_FUNCT, "y1",             { .funct = { mathfun_funct_y1,             &mathfun_sig1,  mathfun_deriv_y1,        &mathfun_partials_y1 } } },
+		{ MATHFUN_DECL_FUNCT, "yn",             { .funct = { mathfun_funct_yn,             &mathfun_sig2,  mathfun_deriv_yn,        &mathfun_partials_yn } } },
+		{ MATHFUN_DECL_FUNCT, "sign",           { .funct = { mathfun_funct_sign,           &mathfun_sig1,  mathfun_deriv_step,      &mathfun_partials_step } } },
 
 		{ -1, NULL, { .value = 0 } }
 	};
 
-	return mathfun_context_define(ctx, decls, error);
+	return mathfun_context_define(ctx, decls, error) &&
+		mathfun_context_define_default_intervals(ctx, error) &&
+		mathfun_context_define_default_floats(ctx, error);
 }
@@ -1,12 +1,96 @@
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 
 #include "mathfun_intern.h"
 
+const mathfun_bytecode_info mathfun_bytecode_infos[MATHFUN_BYTECODE_COUNT] = {
+	[NOP]    = { "nop",    ""      },
+	[RET]    = { "ret",    "r"     },
+	[MOV]    = { "mov",    "rr"    },
+	[VAL]    = { "val",    "vr"    },
+	[CALL]   = { "call",   "fnrr"  },
+	[NEG]    = { "neg",    "rr"    },
+	[ADD]    = { "add",    "rrr"   },
+	[SUB]    = { "sub",    "rrr"   },
+	[MUL]    = { "mul",    "rrr"   },
+	[DIV]    = { "div",    "rrr"   },
+	[MOD]    = { "mod",    "rrr"   },
+	[POW]    = { "pow",    "rrr"   },
+	[NOT]    = { "not",    "rr"    },
+	[EQ]     = { "eq",     "rrr"   },
+	[NE]     = { "ne",     "rrr"   },
+	[LT]     = { "lt",     "rrr"   },
+	[GT]     = { "gt",     "rrr"   },
+	[LE]     = { "le",     "rrr"   },
+	[GE]     = { "ge",     "rrr"   },
+	[BEQ]    = { "beq",    "rrr"   },
+	[BNE]    = { "bne",    "rrr"   },
+	[JMP]    = { "jmp",    "a"     },
+	[JMPT]   = { "jmpt",   "ra"    },
+	[JMPF]   = { "jmpf",   "ra"    },
+	[SETT]   = { "sett",   "r"     },
+	[SETF]   = { "setf",   "r"     },
+	[MULADD] = { "muladd", "rrrrr" },
+	[MULSUB] = { "mulsub", "rrrrr" },
+	[VADD]   = { "vadd",   "vrrrr" },
+	[VSUB]   = { "vsub",   "vrrrr" },
+	[VMUL]   = { "vmul",   "vrrrr" },
+	[VDIV]   = { "vdiv",   "vrrrr" },
+	[EQJ]    = { "eqj",    "rrrna" },
+	[NEJ]    = { "nej",    "rrrna" },
+	[LTJ]    = { "ltj",    "rrrna" },
+	[GTJ]    = { "gtj",    "rrrna" },
+	[LEJ]    = { "lej",    "rrrna" },
+	[GEJ]    = { "gej",    "rrrna" },
+	[ADDK]   = { "addk",   "vrr"   },
+	[SUBK]   = { "subk",   "vrr"   },
+	[RSUBK]  = { "rsubk",  "vrr"   },
+	[MULK]   = { "mulk",   "vrr"   },
+	[DIVK]   = { "divk",   "vrr"   },
+	[RDIVK]  = { "rdivk",  "vrr"   },
+	[EQK]    = { "eqk",    "vrr"   },
+	[NEK]    = { "nek",    "vrr"   },
+	[LTK]    = { "ltk",    "vrr"   },
+	[GTK]    = { "gtk",    "vrr"   },
+	[LEK]    = { "lek",    "vrr"   },
+	[GEK]    = { "gek",    "vrr"   },
+	[INK]    = { "ink",    "vvrr"  },
+	[INXK]   = { "inxk",   "vvrr"  },
+	[POWK]   = { "powk",   "vrr"   },
+	[FMA]    = { "fma",    "rrrr"  },
+	[END]    = { "end",    ""      }
+};
+
+static size_t mathfun_operand_size(char kind) {
+	return kind == 'a' ? MATHFUN_ADR_CODES : 1;
+}
+
+size_t mathfun_code_size(const mathfun_code *code) {
+	size_t size = 1;
+	for (const char *kind = mathfun_bytecode_infos[*code].operands; *kind; ++ kind) {
+		size += mathfun_operand_size(*kind);
+	}
+	return size;
+}
+
 void mathfun_codegen_cleanup(mathfun_codegen *codegen) {
 	free(codegen->code);
-	codegen->code = NULL;
+	free(codegen->consts);
+	free(codegen->functs);
+	free(codegen->derivs);
+	free(codegen->intervals);
+	free(codegen->srcmap);
+	codegen->code      = NULL;
+	codegen->consts    = NULL;
+	codegen->functs    = NULL;
+	codegen->derivs    = NULL;
+	codegen->intervals = NULL;
+	codegen->srcmap    = NULL;
 }
 
+// Makes room for an instruction of n code words. Every instruction is emitted
+// right after this, so this is also where its source map entry is written.
 bool mathfun_codegen_ensure(mathfun_codegen *codegen, size_t n) {
 	const size_t size = codegen->code_used + n;
 	if (size > codegen->code_size) {
@@ -18,48 +102,181 @@ bool mathfun_codegen_ensure(mathfun_codegen *codegen, size_t n) {
 		}
 
 		codegen->code = code;
+
+		if (codegen->srcmap) {
+			mathfun_srcspan *srcmap = realloc(codegen->srcmap, size * sizeof(mathfun_srcspan));
+
+			if (!srcmap) {
+				mathfun_raise_error(codegen->error, MATHFUN_OUT_OF_MEMORY);
+				return false;
+			}
+
+			codegen->srcmap = srcmap;
+		}
+
 		codegen->code_size = size;
 	}
+
+	if (codegen->srcmap) {
+		codegen->srcmap[codegen->code_used] = codegen->span;
+	}
+
+	return true;
+}
+
+// Returns the index of value in the constant pool, adding it if it isn't there yet.
+// Values are compared bitwise, so e.g. 0.0 and -0.0 get different entries.
+static bool mathfun_codegen_const(mathfun_codegen *codegen, mathfun_value value, mathfun_code *index) {
+	for (size_t i = 0; i < codegen->consts_used; ++ i) {
+		if (memcmp(&codegen->consts[i].number, &value.number, sizeof(value.number)) == 0) {
+			*index = i;
+			return true;
+		}
+	}
+
+	if (codegen->consts_used >= MATHFUN_POOL_MAX) {
+		mathfun_raise_error(codegen->error, MATHFUN_EXCEEDS_MAX_CODE_SIZE);
+		return false;
+	}
+
+	if (codegen->consts_used == codegen->consts_size) {
+		const size_t size = codegen->consts_size ? codegen->consts_size * 2 : 8;
+		mathfun_value *consts = realloc(codegen->consts, size * sizeof(mathfun_value));
+
+		if (!consts) {
+			mathfun_raise_error(codegen->error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		codegen->consts = consts;
+		codegen->consts_size = size;
+	}
+
+	*index = codegen->consts_used;
+	codegen->consts[codegen->consts_used ++] = value;
 	return true;
 }
 
-bool mathfun_codegen_align(mathfun_codegen *codegen, size_t offset, size_t align) {
-	const uintptr_t mask = ~(align - 1);
-	for (;;) {
-		uintptr_t ptr = (uintptr_t)(codegen->code + codegen->code_used + offset);
-		uintptr_t aligned = ptr & mask;
-		if (aligned == ptr) break;
-		if (!mathfun_codegen_ensure(codegen, 1)) return false;
-		codegen->code[codegen->code_used ++] = NOP;
+// same as mathfun_codegen_const, but for the function pool (and the parallel pools of derivative
+// rules and interval versions)
+static bool mathfun_codegen_funct(mathfun_codegen *codegen, mathfun_binding_funct funct,
+	mathfun_binding_deriv deriv, mathfun_binding_interval interval, mathfun_code *index) {
+	for (size_t i = 0; i < codegen->functs_used; ++ i) {
+		if (codegen->functs[i] == funct) {
+			*index = i;
+			return true;
+		}
+	}
+
+	if (codegen->functs_used >= MATHFUN_POOL_MAX) {
+		mathfun_raise_error(codegen->error, MATHFUN_EXCEEDS_MAX_CODE_SIZE);
+		return false;
+	}
+
+	if (codegen->functs_used == codegen->functs_size) {
+		const size_t size = codegen->functs_size ? codegen->functs_size * 2 : 4;
+		mathfun_binding_funct *functs = realloc(codegen->functs, size * sizeof(mathfun_binding_funct));
+
+		if (!functs) {
+			mathfun_raise_error(codegen->error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		codegen->functs = functs;
+
+		mathfun_binding_deriv *derivs = realloc(codegen->derivs, size * sizeof(mathfun_binding_deriv));
+
+		if (!derivs) {
+			mathfun_raise_error(codegen->error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		codegen->derivs = derivs;
+
+		mathfun_binding_interval *intervals = realloc(codegen->intervals, size * sizeof(mathfun_binding_interval));
+
+		if (!intervals) {
+			mathfun_raise_error(codegen->error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		codegen->intervals = intervals;
+		codegen->functs_size = size;
 	}
+
+	*index = codegen->functs_used;
+	codegen->derivs[codegen->functs_used] = deriv;
+	codegen->intervals[codegen->functs_used] = interval;
+	codegen->functs[codegen->functs_used ++] = funct;
 	return true;
 }
 
 bool mathfun_codegen_val(mathfun_codegen *codegen, mathfun_value value, mathfun_code target) {
-	if (!mathfun_codegen_align(codegen, 1, sizeof(mathfun_value))) return false;
-	if (!mathfun_codegen_ensure(codegen, MATHFUN_VALUE_CODES + 2)) return false;
+	mathfun_code index = 0;
+	if (!mathfun_codegen_const(codegen, value, &index)) return false;
+	return mathfun_codegen_ins2(codegen, VAL, index, target);
+}
 
-	codegen->code[codegen->code_used ++] = VAL;
-	*(mathfun_value*)(codegen->code + codegen->code_used) = value;
-	codegen->code_used += MATHFUN_VALUE_CODES;
-	codegen->code[codegen->code_used ++] = target;
+bool mathfun_codegen_insk(mathfun_codegen *codegen, enum mathfun_bytecode code, mathfun_value value,
+	mathfun_code arg1, mathfun_code arg2) {
+	mathfun_code index = 0;
+	if (!mathfun_codegen_const(codegen, value, &index)) return false;
+	return mathfun_codegen_ins3(codegen, code, index, arg1, arg2);
+}
+
+bool mathfun_codegen_insk2(mathfun_codegen *codegen, enum mathfun_bytecode code, mathfun_value value1,
+	mathfun_value value2, mathfun_code arg1, mathfun_code arg2) {
+	mathfun_code index1 = 0;
+	mathfun_code index2 = 0;
+	if (!mathfun_codegen_const(codegen, value1, &index1)) return false;
+	if (!mathfun_codegen_const(codegen, value2, &index2)) return false;
+	if (!mathfun_codegen_ensure(codegen, 5)) return false;
+
+	codegen->code[codegen->code_used ++] = code;
+	codegen->code[codegen->code_used ++] = index1;
+	codegen->code[codegen->code_used ++] = index2;
+	codegen->code[codegen->code_used ++] = arg1;
+	codegen->code[codegen->code_used ++] = arg2;
 
 	return true;
 }
 
-bool mathfun_codegen_call(mathfun_codegen *codegen, mathfun_binding_funct funct, mathfun_code firstarg, mathfun_code target) {
-	if (!mathfun_codegen_align(codegen, 1, sizeof(mathfun_binding_funct))) return false;
-	if (!mathfun_codegen_ensure(codegen, MATHFUN_FUNCT_CODES + 3)) return false;
+bool mathfun_codegen_call(mathfun_codegen *codegen, mathfun_binding_funct funct,
+	mathfun_binding_deriv deriv, mathfun_binding_interval interval, mathfun_code argc, mathfun_code firstarg,
+	mathfun_code target) {
+	mathfun_code index = 0;
+	if (!mathfun_codegen_funct(codegen, funct, deriv, interval, &index)) return false;
+	if (!mathfun_codegen_ensure(codegen, 5)) return false;
 
 	codegen->code[codegen->code_used ++] = CALL;
-	*(mathfun_binding_funct*)(codegen->code + codegen->code_used) = funct;
-	codegen->code_used += MATHFUN_FUNCT_CODES;
+	codegen->code[codegen->code_used ++] = index;
+	codegen->code[codegen->code_used ++] = argc;
 	codegen->code[codegen->code_used ++] = firstarg;
 	codegen->code[codegen->code_used ++] = target;
 
 	return true;
 }
 
+// Emits a jump (JMP, or JMPT/JMPF on reg) with a yet unknown target. *adr is
+// set to the position of the target operand, see mathfun_codegen_patch.
+static bool mathfun_codegen_jmp(mathfun_codegen *codegen, enum mathfun_bytecode code, mathfun_code reg,
+	size_t *adr) {
+	if (!mathfun_codegen_ensure(codegen, 2 + MATHFUN_ADR_CODES)) return false;
+	codegen->code[codegen->code_used ++] = code;
+	if (code != JMP) {
+		codegen->code[codegen->code_used ++] = reg;
+	}
+	*adr = codegen->code_used;
+	mathfun_code_set_adr(codegen->code + codegen->code_used, 0);
+	codegen->code_used += MATHFUN_ADR_CODES;
+	return true;
+}
+
+// let the jump target operand at adr point to the next instruction
+static inline void mathfun_codegen_patch(mathfun_codegen *codegen, size_t adr) {
+	mathfun_code_set_adr(codegen->code + adr, codegen->code_used);
+}
+
 bool mathfun_codegen_ins0(mathfun_codegen *codegen, enum mathfun_bytecode code) {
 	if (!mathfun_codegen_ensure(codegen, 1)) return false;
 	codegen->code[codegen->code_used ++] = code;
@@ -90,11 +307,61 @@ bool mathfun_codegen_ins3(mathfun_codegen *codegen, enum mathfun_bytecode code,
 	return true;
 }
 
+// Immediate forms of binary instructions. The first one is used if the right
+// operand is a constant, the second one if the left operand is. NOP means there
+// is no immediate form.
+static const enum mathfun_bytecode mathfun_immediate_forms[][2] = {
+	[ADD] = { ADDK, ADDK  },
+	[SUB] = { SUBK, RSUBK },
+	[MUL] = { MULK, MULK  },
+	[DIV] = { DIVK, RDIVK },
+	[POW] = { POWK, NOP   },
+	[EQ]  = { EQK,  EQK   },
+	[NE]  = { NEK,  NEK   },
+	[LT]  = { LTK,  GTK   },
+	[GT]  = { GTK,  LTK   },
+	[LE]  = { LEK,  GEK   },
+	[GE]  = { GEK,  LEK   }
+};
+
+static inline bool mathfun_expr_is_number(const mathfun_expr *expr) {
+	return expr->type == EX_CONST && expr->ex.value.type == MATHFUN_NUMBER;
+}
+
+static inline enum mathfun_bytecode mathfun_immediate_form(enum mathfun_bytecode code, bool left) {
+	const size_t count = sizeof(mathfun_immediate_forms) / sizeof(mathfun_immediate_forms[0]);
+	return (size_t)code < count ? mathfun_immediate_forms[code][left] : NOP;
+}
+
+// operand op constant, the operand is evaluated into *ret
+static bool mathfun_codegen_immediate(mathfun_codegen *codegen, mathfun_expr *operand,
+	enum mathfun_bytecode code, mathfun_value value, mathfun_code *ret) {
+	mathfun_code operandret = *ret;
+	if (!mathfun_codegen_expr(codegen, operand, &operandret)) return false;
+	return mathfun_codegen_insk(codegen, code, value, operandret, *ret);
+}
+
 bool mathfun_codegen_binary(
 	mathfun_codegen *codegen,
 	mathfun_expr *expr,
 	enum mathfun_bytecode code,
 	mathfun_code *ret) {
+	// constants are passed as immediate operands, so they don't need a register
+	// (the optimizer already folded the case where both operands are constant)
+	// POWK doesn't give the same results as pow(), see mathfun_pow_k()
+	const enum mathfun_bytecode rightk = code == POW && !codegen->fast_math ?
+		NOP : mathfun_immediate_form(code, false);
+	if (rightk != NOP && mathfun_expr_is_number(expr->ex.binary.right)) {
+		return mathfun_codegen_immediate(codegen, expr->ex.binary.left, rightk,
+			expr->ex.binary.right->ex.value.value, ret);
+	}
+
+	const enum mathfun_bytecode leftk = mathfun_immediate_form(code, true);
+	if (leftk != NOP && mathfun_expr_is_number(expr->ex.binary.left)) {
+		return mathfun_codegen_immediate(codegen, expr->ex.binary.right, leftk,
+			expr->ex.binary.left->ex.value.value, ret);
+	}
+
 	mathfun_code leftret  = codegen->currstack;
 	mathfun_code rightret;
 
@@ -106,48 +373,110 @@ bool mathfun_codegen_binary(
 		if (!mathfun_codegen_expr(codegen, expr->ex.binary.right, &rightret)) return false;
 	}
 	else {
+		// the register is taken even if the right expression ends up in another
+		// one (e.g. a common subexpression), because it's still used as scratch
+		// register. mathfun_code_regalloc() removes the ones that aren't needed.
 		rightret = ++ codegen->currstack;
-		if (!mathfun_codegen_expr(codegen, expr->ex.binary.right, &rightret)) return false;
-
-		// doing this *after* the codegen for the right expression
-		// optimizes the case where no extra register is needed (e.g. it
-		// just accesses an argument register)
 		if (codegen->maxstack < rightret) {
 			codegen->maxstack = rightret;
 		}
 
+		if (!mathfun_codegen_expr(codegen, expr->ex.binary.right, &rightret)) return false;
+
 		-- codegen->currstack;
 	}
 
 	return mathfun_codegen_ins3(codegen, code, leftret, rightret, *ret);
 }
 
+// Products and sums with constants are left to the immediate instructions,
+// because FMA would need a register and a VAL for each constant.
+static bool mathfun_codegen_contractible(const mathfun_expr *product, const mathfun_expr *addend) {
+	return product->type == EX_MUL &&
+		!mathfun_expr_is_number(product->ex.binary.left) &&
+		!mathfun_expr_is_number(product->ex.binary.right) &&
+		!mathfun_expr_is_number(addend);
+}
+
+// *ret = product->left * product->right + addend, rounded once
+static bool mathfun_codegen_fma(mathfun_codegen *codegen, mathfun_expr *product, mathfun_expr *addend,
+	mathfun_code *ret) {
+	mathfun_expr *operands[] = { product->ex.binary.left, product->ex.binary.right, addend };
+	mathfun_code regs[3];
+	const mathfun_code oldstack = codegen->currstack;
+
+	for (size_t i = 0; i < 3; ++ i) {
+		regs[i] = codegen->currstack;
+		if (!mathfun_codegen_expr(codegen, operands[i], &regs[i])) return false;
+
+		// keep the result unless it's in an argument or common subexpression register
+		if (i < 2 && regs[i] >= codegen->currstack) {
+			++ codegen->currstack;
+			if (codegen->maxstack < codegen->currstack) {
+				codegen->maxstack = codegen->currstack;
+			}
+		}
+	}
+	codegen->currstack = oldstack;
+
+	if (!mathfun_codegen_ensure(codegen, 5)) return false;
+	codegen->code[codegen->code_used ++] = FMA;
+	codegen->code[codegen->code_used ++] = regs[0];
+	codegen->code[codegen->code_used ++] = regs[1];
+	codegen->code[codegen->code_used ++] = regs[2];
+	codegen->code[codegen->code_used ++] = *ret;
+
+	return true;
+}
+
+// target = value compared to bound
+static bool mathfun_codegen_bound(
+	mathfun_codegen *codegen,
+	mathfun_expr *bound,
+	enum mathfun_bytecode code,
+	mathfun_code valuereg,
+	mathfun_code target) {
+	if (mathfun_expr_is_number(bound)) {
+		return mathfun_codegen_insk(codegen, mathfun_immediate_form(code, false),
+			bound->ex.value.value, valuereg, target);
+	}
+
+	mathfun_code boundret = codegen->currstack;
+	if (!mathfun_codegen_expr(codegen, bound, &boundret)) return false;
+	return mathfun_codegen_ins3(codegen, code, valuereg, boundret, target);
+}
+
 static bool mathfun_codegen_range(
 	mathfun_codegen *codegen,
 	mathfun_expr *expr,
 	mathfun_code valuereg,
 	mathfun_code *ret) {
-	mathfun_code rngret = codegen->currstack;
-	if (!mathfun_codegen_expr(codegen, expr->ex.binary.left, &rngret)) return false;
-
 	const mathfun_code lowerret = codegen->currstack;
-	if (!mathfun_codegen_ins3(codegen, GE, valuereg, rngret, lowerret)) return false;
+	if (!mathfun_codegen_bound(codegen, expr->ex.binary.left, GE, valuereg, lowerret)) return false;
 
-	size_t adr = codegen->code_used + 2;
-	if (!mathfun_codegen_ins2(codegen, JMPF, lowerret, 0)) return false;
-
-	rngret = codegen->currstack;
-	if (!mathfun_codegen_expr(codegen, expr->ex.binary.right, &rngret)) return false;
+	size_t adr = 0;
+	if (!mathfun_codegen_jmp(codegen, JMPF, lowerret, &adr)) return false;
 
 	const mathfun_code upperret = codegen->currstack;
-	if (!mathfun_codegen_ins3(codegen, expr->type == EX_RNG_INCL ? LE : LT, valuereg, rngret, upperret)) return false;
+	++ codegen->conditional;
+	if (!mathfun_codegen_bound(codegen, expr->ex.binary.right,
+		expr->type == EX_RNG_INCL ? LE : LT, valuereg, upperret)) return false;
+	-- codegen->conditional;
 
 	if (upperret != *ret) {
 		if (!mathfun_codegen_ins2(codegen, MOV, upperret, *ret)) return false;
 	}
-	codegen->code[adr] = codegen->code_used;
+
 	if (lowerret != *ret) {
-		return mathfun_codegen_ins1(codegen, SETF, *ret);
+		// only the jump from the lower bound check has to set the result
+		size_t endadr = 0;
+		if (!mathfun_codegen_jmp(codegen, JMP, 0, &endadr)) return false;
+		mathfun_codegen_patch(codegen, adr);
+		if (!mathfun_codegen_ins1(codegen, SETF, *ret)) return false;
+		mathfun_codegen_patch(codegen, endadr);
+	}
+	else {
+		mathfun_codegen_patch(codegen, adr);
 	}
 
 	return true;
@@ -157,23 +486,30 @@ static bool mathfun_codegen_in(
 	mathfun_codegen *codegen,
 	mathfun_expr *expr,
 	mathfun_code *ret) {
+	mathfun_expr *range = expr->ex.binary.right;
+
+	if (mathfun_expr_is_number(range->ex.binary.left) && mathfun_expr_is_number(range->ex.binary.right)) {
+		mathfun_code valueret = *ret;
+		if (!mathfun_codegen_expr(codegen, expr->ex.binary.left, &valueret)) return false;
+		return mathfun_codegen_insk2(codegen, range->type == EX_RNG_INCL ? INK : INXK,
+			range->ex.binary.left->ex.value.value, range->ex.binary.right->ex.value.value,
+			valueret, *ret);
+	}
+
 	mathfun_code valueret = codegen->currstack;
 
 	if (!mathfun_codegen_expr(codegen, expr->ex.binary.left, &valueret)) return false;
 
 	if (valueret < codegen->currstack) {
-		return mathfun_codegen_range(codegen, expr->ex.binary.right, valueret, ret);
+		return mathfun_codegen_range(codegen, range, valueret, ret);
 	}
 	else {
 		++ codegen->currstack;
-		if (!mathfun_codegen_range(codegen, expr->ex.binary.right, valueret, ret)) return false;
-
-		// doing this *after* the codegen for the range expression
-		// optimizes the case where no extra register is needed (e.g. it
-		// just accesses an argument registers)
 		if (codegen->maxstack < codegen->currstack) {
 			codegen->maxstack = codegen->currstack;
 		}
+
+		if (!mathfun_codegen_range(codegen, range, valueret, ret)) return false;
 		-- codegen->currstack;
 
 		return true;
@@ -187,7 +523,7 @@ bool mathfun_codegen_unary(mathfun_codegen *codegen, mathfun_expr *expr,
 	return mathfun_codegen_ins2(codegen, code, unret, *ret);
 }
 
-bool mathfun_codegen_expr(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_code *ret) {
+static bool mathfun_codegen_node(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_code *ret) {
 	switch (expr->type) {
 		case EX_CONST:
 			if (expr->ex.value.type == MATHFUN_BOOLEAN) {
@@ -246,12 +582,30 @@ bool mathfun_codegen_expr(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_
 			}
 			codegen->currstack = oldstack;
 
-			return mathfun_codegen_call(codegen, expr->ex.funct.funct, firstarg, *ret);
+			mathfun_binding_interval interval = expr->ex.funct.interval;
+			if (!interval) {
+				interval = expr->ex.funct.sig->rettype == MATHFUN_BOOLEAN ?
+					mathfun_interval_any_boolean : mathfun_interval_any_number;
+			}
+
+			return mathfun_codegen_call(codegen, expr->ex.funct.funct, expr->ex.funct.deriv,
+				interval, argc, firstarg, *ret);
 		}
 		case EX_NEG:
 			return mathfun_codegen_unary(codegen, expr, NEG, ret);
 
 		case EX_ADD:
+			if (codegen->fast_math) {
+				// a * b + c and c + a * b
+				mathfun_expr *left  = expr->ex.binary.left;
+				mathfun_expr *right = expr->ex.binary.right;
+				if (mathfun_codegen_contractible(left, right)) {
+					return mathfun_codegen_fma(codegen, left, right, ret);
+				}
+				if (mathfun_codegen_contractible(right, left)) {
+					return mathfun_codegen_fma(codegen, right, left, ret);
+				}
+			}
 			return mathfun_codegen_binary(codegen, expr, ADD, ret);
 
 		case EX_SUB:
@@ -308,56 +662,63 @@ bool mathfun_codegen_expr(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_
 		{
 			mathfun_code leftret = *ret;
 			if (!mathfun_codegen_expr(codegen, expr->ex.binary.left, &leftret)) return false;
-			size_t adr = codegen->code_used + 2;
-			if (!mathfun_codegen_ins2(codegen, JMPF, leftret, 0)) return false;
+			// the left value is the result when the right operand is skipped
+			if (leftret != *ret) {
+				if (!mathfun_codegen_ins2(codegen, MOV, leftret, *ret)) return false;
+			}
+			size_t adr = 0;
+			if (!mathfun_codegen_jmp(codegen, JMPF, *ret, &adr)) return false;
 			mathfun_code rightret = *ret;
+			++ codegen->conditional;
 			if (!mathfun_codegen_expr(codegen, expr->ex.binary.right, &rightret)) return false;
+			-- codegen->conditional;
 			if (rightret != *ret) {
 				if (!mathfun_codegen_ins2(codegen, MOV, rightret, *ret)) return false;
 			}
-			codegen->code[adr] = codegen->code_used;
-			if (leftret != *ret) {
-				return mathfun_codegen_ins1(codegen, SETF, *ret);
-			}
+			mathfun_codegen_patch(codegen, adr);
 			return true;
 		}
 		case EX_OR:
 		{
 			mathfun_code leftret = *ret;
 			if (!mathfun_codegen_expr(codegen, expr->ex.binary.left, &leftret)) return false;
-			size_t adr = codegen->code_used + 2;
-			if (!mathfun_codegen_ins2(codegen, JMPT, leftret, 0)) return false;
+			if (leftret != *ret) {
+				if (!mathfun_codegen_ins2(codegen, MOV, leftret, *ret)) return false;
+			}
+			size_t adr = 0;
+			if (!mathfun_codegen_jmp(codegen, JMPT, *ret, &adr)) return false;
 			mathfun_code rightret = *ret;
+			++ codegen->conditional;
 			if (!mathfun_codegen_expr(codegen, expr->ex.binary.right, &rightret)) return false;
+			-- codegen->conditional;
 			if (rightret != *ret) {
 				if (!mathfun_codegen_ins2(codegen, MOV, rightret, *ret)) return false;
 			}
-			codegen->code[adr] = codegen->code_used;
-			if (leftret != *ret) {
-				return mathfun_codegen_ins1(codegen, SETT, *ret);
-			}
+			mathfun_codegen_patch(codegen, adr);
 			return true;
 		}
 		case EX_IIF:
 		{
 			mathfun_code childret = *ret;
 			if (!mathfun_codegen_expr(codegen, expr->ex.iif.cond, &childret)) return false;
-			size_t adr1 = codegen->code_used + 2;
-			if (!mathfun_codegen_ins2(codegen, JMPF, childret, 0)) return false;
+			size_t adr1 = 0;
+			if (!mathfun_codegen_jmp(codegen, JMPF, childret, &adr1)) return false;
 			childret = *ret;
+			++ codegen->conditional;
 			if (!mathfun_codegen_expr(codegen, expr->ex.iif.then_expr, &childret)) return false;
 			if (childret != *ret) {
 				if (!mathfun_codegen_ins2(codegen, MOV, childret, *ret)) return false;
 			}
-			size_t adr2 = codegen->code_used + 1;
-			if (!mathfun_codegen_ins1(codegen, JMP, 0)) return false;
-			codegen->code[adr1] = codegen->code_used;
+			size_t adr2 = 0;
+			if (!mathfun_codegen_jmp(codegen, JMP, 0, &adr2)) return false;
+			mathfun_codegen_patch(codegen, adr1);
 			childret = *ret;
 			if (!mathfun_codegen_expr(codegen, expr->ex.iif.else_expr, &childret)) return false;
+			-- codegen->conditional;
 			if (childret != *ret) {
 				if (!mathfun_codegen_ins2(codegen, MOV, childret, *ret)) return false;
 			}
-			codegen->code[adr2] = codegen->code_used;
+			mathfun_codegen_patch(codegen, adr2);
 			return true;
 		}
 	}
@@ -366,6 +727,84 @@ bool mathfun_codegen_expr(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_
 	return false;
 }
 
+static bool mathfun_codegen_shared(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_code *ret) {
+	mathfun_cse_class *cls = codegen->cse ? mathfun_cse_lookup(codegen->cse, expr) : NULL;
+
+	if (!cls) {
+		return mathfun_codegen_node(codegen, expr, ret);
+	}
+
+	if (cls->computed) {
+		*ret = cls->reg;
+		return true;
+	}
+
+	if (codegen->conditional > 0) {
+		// might not be executed, so later uses can't rely on it
+		return mathfun_codegen_node(codegen, expr, ret);
+	}
+
+	mathfun_code reg = cls->reg;
+	if (!mathfun_codegen_node(codegen, expr, &reg)) return false;
+	if (reg != cls->reg && !mathfun_codegen_ins2(codegen, MOV, reg, cls->reg)) return false;
+
+	cls->computed = true;
+	*ret = cls->reg;
+
+	return true;
+}
+
+// The instructions of expr are attributed to its text, except for nodes that
+// don't come from the parser, which keep the span of their parent.
+bool mathfun_codegen_expr(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_code *ret) {
+	const mathfun_srcspan span = codegen->span;
+
+	if (expr->end > expr->begin) {
+		codegen->span.begin = (uint32_t)(codegen->srcbase + expr->begin);
+		codegen->span.end   = (uint32_t)(codegen->srcbase + expr->end);
+	}
+
+	const bool ok = mathfun_codegen_shared(codegen, expr, ret);
+	codegen->span = span;
+
+	return ok;
+}
+
+// Computes the hoisted subexpressions of expr (see cse.c) into their registers.
+static bool mathfun_codegen_hoist(mathfun_codegen *codegen, mathfun_expr *expr) {
+	const mathfun_cse_class *cls = mathfun_cse_lookup(codegen->cse, expr);
+
+	if (cls && cls->hoisted) {
+		mathfun_code reg = cls->reg;
+		return mathfun_codegen_expr(codegen, expr, &reg);
+	}
+
+	switch (expr->type) {
+		case EX_CONST:
+		case EX_ARG:
+			return true;
+
+		case EX_CALL:
+			for (size_t i = 0; i < expr->ex.funct.sig->argc; ++ i) {
+				if (!mathfun_codegen_hoist(codegen, expr->ex.funct.args[i])) return false;
+			}
+			return true;
+
+		case EX_NEG:
+		case EX_NOT:
+			return mathfun_codegen_hoist(codegen, expr->ex.unary.expr);
+
+		case EX_IIF:
+			return mathfun_codegen_hoist(codegen, expr->ex.iif.cond) &&
+			       mathfun_codegen_hoist(codegen, expr->ex.iif.then_expr) &&
+			       mathfun_codegen_hoist(codegen, expr->ex.iif.else_expr);
+
+		default:
+			return mathfun_codegen_hoist(codegen, expr->ex.binary.left) &&
+			       mathfun_codegen_hoist(codegen, expr->ex.binary.right);
+	}
+}
+
 // shortcut unconditional jump chain to RET
 static bool mathfun_code_shortcut_jmp_to_ret(mathfun_code *code, mathfun_code *ptr, mathfun_code *retptr) {
 	switch (ptr[0]) {
@@ -376,11 +815,15 @@ static bool mathfun_code_shortcut_jmp_to_ret(mathfun_code *code, mathfun_code *p
 	case JMP:
 	{
 		mathfun_code ret = 0;
-		bool shortcut = mathfun_code_shortcut_jmp_to_ret(code, code + ptr[1], &ret);
+		bool shortcut = mathfun_code_shortcut_jmp_to_ret(code, code + mathfun_code_adr(ptr + 1), &ret);
 
 		if (shortcut) {
+			// RET is shorter than JMP, pad the rest with NOPs
 			ptr[0] = RET;
 			ptr[1] = ret;
+			for (size_t i = 2; i < 1 + MATHFUN_ADR_CODES; ++ i) {
+				ptr[i] = NOP;
+			}
 			if (retptr) *retptr = ret;
 		}
 		return shortcut;
@@ -391,9 +834,11 @@ static bool mathfun_code_shortcut_jmp_to_ret(mathfun_code *code, mathfun_code *p
 }
 
 // shortcut unconditional jump chain
-static mathfun_code mathfun_code_shortcut_jmp(mathfun_code *code, mathfun_code *ptr) {
+static size_t mathfun_code_shortcut_jmp(mathfun_code *code, mathfun_code *ptr) {
 	if (ptr[0] == JMP) {
-		return (ptr[1] = mathfun_code_shortcut_jmp(code, code + ptr[1]));
+		const size_t adr = mathfun_code_shortcut_jmp(code, code + mathfun_code_adr(ptr + 1));
+		mathfun_code_set_adr(ptr + 1, adr);
+		return adr;
 	}
 	else {
 		return ptr - code;
@@ -401,41 +846,152 @@ static mathfun_code mathfun_code_shortcut_jmp(mathfun_code *code, mathfun_code *
 }
 
 // shortcut conditional jump chain on same condition register
-static mathfun_code mathfun_code_shortcut_jmptf(mathfun_code *code, mathfun_code *ptr,
+static size_t mathfun_code_shortcut_jmptf(mathfun_code *code, mathfun_code *ptr,
 	enum mathfun_bytecode instr, mathfun_code reg) {
 	if (ptr[0] == instr && ptr[1] == reg) {
-		return (ptr[2] = mathfun_code_shortcut_jmptf(code, code + ptr[2], instr, reg));
+		const size_t adr = mathfun_code_shortcut_jmptf(code, code + mathfun_code_adr(ptr + 2), instr, reg);
+		mathfun_code_set_adr(ptr + 2, adr);
+		return adr;
 	}
 	else {
 		return ptr - code;
 	}
 }
 
-bool mathfun_expr_codegen(mathfun_expr *expr, mathfun *fun, mathfun_error_p *error) {
+static bool mathfun_expr_codegen_exprs(mathfun_expr *exprs[], size_t count, mathfun *fun,
+	bool fast_math, const bool uniform[], mathfun_error_p *error);
+
+// mathfun::source holds the code of every expression, each terminated by a NUL
+static size_t mathfun_source_size(const char *source, size_t count) {
+	size_t size = 0;
+	for (size_t i = 0; i < count; ++ i) {
+		size += strlen(source + size) + 1;
+	}
+	return size;
+}
+
+bool mathfun_expr_codegen(mathfun_expr *expr, mathfun *fun, bool fast_math, const bool uniform[],
+	mathfun_error_p *error) {
+	return mathfun_expr_codegen_exprs(&expr, 1, fun, fast_math, uniform, error);
+}
+
+bool mathfun_expr_codegen_multi(mathfun_expr *exprs[], size_t count, mathfun *fun, mathfun_error_p *error) {
+	return mathfun_expr_codegen_exprs(exprs, count, fun, false, NULL, error);
+}
+
+// Sets the source span of the instructions outside of the expression at
+// codegen->srcbase (MOV, RET), they belong to all of it.
+static void mathfun_codegen_span_source(mathfun_codegen *codegen, const mathfun *fun) {
+	if (codegen->srcmap) {
+		const size_t length = strlen(fun->source + codegen->srcbase);
+		codegen->span.begin = (uint32_t)codegen->srcbase;
+		codegen->span.end   = (uint32_t)(codegen->srcbase + length);
+	}
+}
+
+// Moves codegen->srcbase to the next expression of fun->source.
+static void mathfun_codegen_next_source(mathfun_codegen *codegen, const mathfun *fun) {
+	if (codegen->srcmap) {
+		codegen->srcbase += strlen(fun->source + codegen->srcbase) + 1;
+	}
+}
+
+// With more than one expression the results are stored in the registers
+// following the arguments, followed by the registers of the common
+// subexpressions. RET returns the first result. Common subexpressions are
+// computed only once, within one expression as well as across expressions.
+//
+// With uniform arguments the code starts with a prologue that computes the
+// hoisted subexpressions (see cse.c), the rows start at fun->entry. The
+// registers of the hoisted subexpressions come right after the results, so
+// mathfun_code_regalloc() can keep them for the whole function.
+static bool mathfun_expr_codegen_exprs(mathfun_expr *exprs[], size_t count, mathfun *fun,
+	bool fast_math, const bool uniform[], mathfun_error_p *error) {
 	if (fun->argc > MATHFUN_REGS_MAX) {
 		mathfun_raise_error(error, MATHFUN_TOO_MANY_ARGUMENTS);
 		return false;
 	}
 
+	if (fun->argc + count > MATHFUN_REGS_MAX) {
+		mathfun_raise_error(error, MATHFUN_EXCEEDS_MAX_FRAME_SIZE);
+		return false;
+	}
+
 	mathfun_codegen codegen;
+	mathfun_cse cse;
 
 	memset(&codegen, 0, sizeof(struct mathfun_codegen));
 
 	codegen.argc  = codegen.currstack = codegen.maxstack = fun->argc;
+	codegen.fast_math = fast_math;
 	codegen.code_size = 16;
 	codegen.code  = calloc(codegen.code_size, sizeof(mathfun_code));
 	codegen.error = error;
 
+	// fun->source is only set by the compile functions and sources too
+	// long for 32 bit offsets don't get a source map
+	const size_t source_size = fun->source ? mathfun_source_size(fun->source, count) : 0;
+	if (source_size > 0 && source_size <= UINT32_MAX) {
+		codegen.srcmap = calloc(codegen.code_size, sizeof(mathfun_srcspan));
+
+		if (!codegen.srcmap) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			mathfun_codegen_cleanup(&codegen);
+			return false;
+		}
+	}
+
 	if (!codegen.code) {
 		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
 		mathfun_codegen_cleanup(&codegen);
 		return false;
 	}
 
-	mathfun_code ret = fun->argc;
-	if (!mathfun_codegen_expr(&codegen, expr, &ret) ||
-		!mathfun_codegen_ins1(&codegen, RET, ret) ||
-		!mathfun_codegen_ins0(&codegen, END)) {
+	const mathfun_code firstreg = (mathfun_code)(fun->argc + count);
+	if (!mathfun_cse_init(&cse, exprs, count, firstreg, uniform, error)) {
+		mathfun_codegen_cleanup(&codegen);
+		return false;
+	}
+	codegen.cse = &cse;
+	codegen.currstack = codegen.maxstack = firstreg + cse.classes_used;
+
+	for (size_t i = 0; i < count && cse.hoisted > 0; ++ i) {
+		mathfun_codegen_span_source(&codegen, fun);
+
+		if (!mathfun_codegen_hoist(&codegen, exprs[i])) {
+			mathfun_cse_cleanup(&cse);
+			mathfun_codegen_cleanup(&codegen);
+			return false;
+		}
+
+		mathfun_codegen_next_source(&codegen, fun);
+	}
+
+	const size_t entry = codegen.code_used;
+	codegen.srcbase = 0;
+
+	for (size_t i = 0; i < count; ++ i) {
+		const mathfun_code target = (mathfun_code)(fun->argc + i);
+		mathfun_code ret = target;
+
+		mathfun_codegen_span_source(&codegen, fun);
+
+		if (!mathfun_codegen_expr(&codegen, exprs[i], &ret) ||
+			(count > 1 && ret != target && !mathfun_codegen_ins2(&codegen, MOV, ret, target)) ||
+			(i + 1 == count && !mathfun_codegen_ins1(&codegen, RET, count > 1 ? fun->argc : ret))) {
+			mathfun_cse_cleanup(&cse);
+			mathfun_codegen_cleanup(&codegen);
+			return false;
+		}
+
+		mathfun_codegen_next_source(&codegen, fun);
+	}
+
+	const size_t hoisted = cse.hoisted;
+	mathfun_cse_cleanup(&cse);
+	codegen.cse = NULL;
+
+	if (!mathfun_codegen_ins0(&codegen, END)) {
 		mathfun_codegen_cleanup(&codegen);
 		return false;
 	}
@@ -446,244 +1002,412 @@ bool mathfun_expr_codegen(mathfun_expr *expr, mathfun *fun, mathfun_error_p *err
 		return false;
 	}
 
+	if (codegen.code_used > MATHFUN_CODE_MAX) {
+		mathfun_raise_error(error, MATHFUN_EXCEEDS_MAX_CODE_SIZE);
+		mathfun_codegen_cleanup(&codegen);
+		return false;
+	}
+
 	// shortcut everything that just jumps to RET
 	mathfun_code *ptr = codegen.code;
 
 	while (*ptr != END) {
+		// the jumps of the prologue have to stay in it
+		if ((size_t)(ptr - codegen.code) < entry) {
+			ptr += mathfun_code_size(ptr);
+			continue;
+		}
+
 		switch (*ptr) {
 		case JMP:
 			if (!mathfun_code_shortcut_jmp_to_ret(codegen.code, ptr, NULL)) {
 				mathfun_code_shortcut_jmp(codegen.code, ptr);
 			}
-			ptr += 2;
+			ptr += 1 + MATHFUN_ADR_CODES;
 			break;
 
-		case NOP:  ptr += 1; break;
-		case MOV:
-		case NEG:
-		case NOT:  ptr += 3; break;
 		case JMPF:
 		case JMPT:
 			mathfun_code_shortcut_jmptf(codegen.code, ptr, ptr[0], ptr[1]);
-			ptr += 3;
+			ptr += 2 + MATHFUN_ADR_CODES;
 			break;
 
-		case VAL:  ptr += 2 + MATHFUN_VALUE_CODES; break;
-		case CALL: ptr += 3 + MATHFUN_FUNCT_CODES; break;
-		case ADD:
-		case SUB:
+		default:
+			if (*ptr == END || *ptr >= MATHFUN_BYTECODE_COUNT) {
+				mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
+				mathfun_codegen_cleanup(&codegen);
+				return false;
+			}
+			ptr += mathfun_code_size(ptr);
+		}
+	}
+
+	fun->retc      = count;
+	fun->framesize = codegen.maxstack + 1;
+	fun->entry     = entry;
+	fun->hoisted   = hoisted;
+	fun->code      = codegen.code;
+	fun->consts    = codegen.consts;
+	fun->functs    = codegen.functs;
+	fun->derivs    = codegen.derivs;
+	fun->intervals = codegen.intervals;
+	fun->srcmap    = codegen.srcmap;
+
+	codegen.code      = NULL;
+	codegen.consts    = NULL;
+	codegen.functs    = NULL;
+	codegen.derivs    = NULL;
+	codegen.intervals = NULL;
+	codegen.srcmap    = NULL;
+	mathfun_codegen_cleanup(&codegen);
+
+	return true;
+}
+
+// Emits a superinstruction for ins followed by next if there is one.
+// Returns false on error, *fused tells whether a superinstruction was emitted.
+static bool mathfun_codegen_fused(mathfun_codegen *codegen, const mathfun_code *ins, const mathfun_code *next,
+	bool *fused) {
+	*fused = false;
+	switch (ins[0]) {
 		case MUL:
-		case DIV:
-		case MOD:
-		case POW:
+			// MUL a, b, t; ADD t, c, d  or  ADD c, t, d  or  SUB t, c, d
+			if ((next[0] == ADD && (next[1] == ins[3] || next[2] == ins[3])) ||
+				(next[0] == SUB && next[1] == ins[3])) {
+				if (!mathfun_codegen_ensure(codegen, 6)) return false;
+				mathfun_code *code = codegen->code + codegen->code_used;
+				code[0] = next[0] == ADD ? MULADD : MULSUB;
+				code[1] = ins[1];
+				code[2] = ins[2];
+				code[3] = ins[3];
+				code[4] = next[1] == ins[3] ? next[2] : next[1];
+				code[5] = next[3];
+				codegen->code_used += 6;
+				*fused = true;
+			}
+			return true;
+
+		case VAL:
+		{
+			enum mathfun_bytecode instr;
+			switch (next[0]) {
+				case ADD: instr = VADD; break;
+				case SUB: instr = VSUB; break;
+				case MUL: instr = VMUL; break;
+				case DIV: instr = VDIV; break;
+				default: return true;
+			}
+
+			if (!mathfun_codegen_ensure(codegen, 6)) return false;
+
+			mathfun_code *code = codegen->code + codegen->code_used;
+			code[0] = instr;
+			code[1] = ins[1];
+			code[2] = ins[2];
+			code[3] = next[1];
+			code[4] = next[2];
+			code[5] = next[3];
+			codegen->code_used += 6;
+			*fused = true;
+			return true;
+		}
 		case EQ:
 		case NE:
 		case LT:
 		case GT:
 		case LE:
 		case GE:
-		case BEQ:
-		case BNE:  ptr += 4; break;
-		case SETF:
-		case SETT: ptr += 2; break;
-		case RET:  ptr += 2; break;
+			// compare a, b, t; JMPT/JMPF t, adr
+			if ((next[0] == JMPT || next[0] == JMPF) && next[1] == ins[3]) {
+				if (!mathfun_codegen_ensure(codegen, 5 + MATHFUN_ADR_CODES)) return false;
+				mathfun_code *code = codegen->code + codegen->code_used;
+				code[0] = EQJ + (ins[0] - EQ);
+				code[1] = ins[1];
+				code[2] = ins[2];
+				code[3] = ins[3];
+				code[4] = next[0] == JMPT;
+				mathfun_code_set_adr(code + 5, mathfun_code_adr(next + 2));
+				codegen->code_used += 5 + MATHFUN_ADR_CODES;
+				*fused = true;
+			}
+			return true;
+
 		default:
-			mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
-			mathfun_codegen_cleanup(&codegen);
-			return false;
+			return true;
+	}
+}
+
+// the smallest span containing a and b (superinstructions belong to both parts)
+static mathfun_srcspan mathfun_srcspan_union(mathfun_srcspan a, mathfun_srcspan b) {
+	if (a.end <= a.begin) return b;
+	if (b.end <= b.begin) return a;
+	return (mathfun_srcspan){ a.begin < b.begin ? a.begin : b.begin, a.end > b.end ? a.end : b.end };
+}
+
+static bool mathfun_codegen_fuse(mathfun_codegen *codegen, const mathfun_code *code,
+	const mathfun_srcspan *srcmap, size_t size, bool targets[], size_t addrs[]) {
+	for (size_t ptr = 0; ptr < size; ptr += mathfun_code_size(code + ptr)) {
+		size_t offset = 1;
+		for (const char *kind = mathfun_bytecode_infos[code[ptr]].operands; *kind; ++ kind) {
+			if (*kind == 'a') targets[mathfun_code_adr(code + ptr + offset)] = true;
+			offset += mathfun_operand_size(*kind);
 		}
 	}
 
-	fun->framesize = codegen.maxstack + 1;
-	fun->code      = codegen.code;
+	for (size_t ptr = 0; ptr < size;) {
+		const mathfun_code *ins = code + ptr;
+		const size_t next = ptr + mathfun_code_size(ins);
+		addrs[ptr] = codegen->code_used;
 
-	codegen.code = NULL;
-	mathfun_codegen_cleanup(&codegen);
+		if (next < size && !targets[next]) {
+			bool fused = false;
+			if (srcmap) codegen->span = mathfun_srcspan_union(srcmap[ptr], srcmap[next]);
+			if (!mathfun_codegen_fused(codegen, ins, code + next, &fused)) return false;
+
+			if (fused) {
+				addrs[next] = addrs[ptr];
+				ptr = next + mathfun_code_size(code + next);
+				continue;
+			}
+		}
+
+		if (srcmap) codegen->span = srcmap[ptr];
+
+		switch (*ins) {
+			case NOP:
+				break;
+
+			default:
+				if (!mathfun_codegen_ensure(codegen, next - ptr)) return false;
+				memcpy(codegen->code + codegen->code_used, ins, (next - ptr) * sizeof(mathfun_code));
+				codegen->code_used += next - ptr;
+		}
+
+		ptr = next;
+	}
+
+	addrs[size] = codegen->code_used;
+	if (!mathfun_codegen_ins0(codegen, END)) return false;
+
+	// remap jump targets
+	for (mathfun_code *ptr = codegen->code; *ptr != END; ptr += mathfun_code_size(ptr)) {
+		size_t offset = 1;
+		for (const char *kind = mathfun_bytecode_infos[*ptr].operands; *kind; ++ kind) {
+			if (*kind == 'a') mathfun_code_set_adr(ptr + offset, addrs[mathfun_code_adr(ptr + offset)]);
+			offset += mathfun_operand_size(*kind);
+		}
+	}
 
 	return true;
 }
 
+// Peephole pass that replaces common pairs of instructions by superinstructions.
+// Pairs are only fused if nothing jumps to the second instruction and it isn't
+// the entry. NOPs are dropped, so all addresses are remapped. The constant and
+// function pools are left as they are.
+bool mathfun_code_fuse(mathfun *fun, mathfun_error_p *error) {
+	size_t size = 0;
+	const mathfun_code *code = fun->code;
+	while (code[size] != END) {
+		size += mathfun_code_size(code + size);
+	}
+
+	mathfun_codegen codegen;
+	memset(&codegen, 0, sizeof(struct mathfun_codegen));
+
+	codegen.code_size = size + 1;
+	codegen.code  = calloc(codegen.code_size, sizeof(mathfun_code));
+	codegen.error = error;
+
+	const mathfun_srcspan *srcmap = fun->srcmap;
+	if (srcmap) {
+		codegen.srcmap = calloc(codegen.code_size, sizeof(mathfun_srcspan));
+	}
+
+	bool   *targets = calloc(size + 1, sizeof(bool));
+	size_t *addrs   = calloc(size + 1, sizeof(size_t));
+
+	bool ok = false;
+	if (!codegen.code || (srcmap && !codegen.srcmap) || !targets || !addrs) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+	}
+	else {
+		// the prologue is executed on its own
+		targets[fun->entry] = true;
+
+		if ((ok = mathfun_codegen_fuse(&codegen, code, srcmap, size, targets, addrs))) {
+			free(fun->code);
+			free(fun->srcmap);
+			fun->code   = codegen.code;
+			fun->srcmap = codegen.srcmap;
+			fun->entry  = addrs[fun->entry];
+			codegen.code   = NULL;
+			codegen.srcmap = NULL;
+		}
+	}
+
+	mathfun_codegen_cleanup(&codegen);
+	free(targets);
+	free(addrs);
+
+	return ok;
+}
+
 #define MATHFUN_DUMP(ARGS) \
 	if (fprintf ARGS < 0) { \
 		mathfun_raise_error(error, MATHFUN_IO_ERROR); \
 		return false; \
 	}
 
-bool mathfun_dump(const mathfun *fun, FILE *stream, const mathfun_context *ctx, mathfun_error_p *error) {
+// Prints the instruction at code without a newline. Returns the number of
+// characters printed or -1 on error.
+static int mathfun_dump_ins(const mathfun *fun, const mathfun_code *code, FILE *stream,
+	const mathfun_context *ctx, mathfun_error_p *error) {
 	const mathfun_code *start = fun->code;
-	const mathfun_code *code  = start;
+	int count = 0, n;
 
-	MATHFUN_DUMP((stream, "argc = %"PRIzu", framesize = %"PRIzu"\n\n", fun->argc, fun->framesize));
-
-	while (*code != END) {
-		MATHFUN_DUMP((stream, "0x%08"PRIXPTR": ", code - start));
-		switch (*code) {
-			case NOP:
-				MATHFUN_DUMP((stream, "nop\n"));
-				++ code;
-				break;
+#define MATHFUN_DUMP_INS(ARGS) \
+	if ((n = fprintf ARGS) < 0) { \
+		mathfun_raise_error(error, MATHFUN_IO_ERROR); \
+		return -1; \
+	} \
+	count += n;
 
-			case RET:
-				MATHFUN_DUMP((stream, "ret %"PRIuPTR"\n", code[1]));
-				code += 2;
-				break;
+	if (*code >= MATHFUN_BYTECODE_COUNT) { // assert?
+		mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
+		return -1;
+	}
 
-			case MOV:
-				MATHFUN_DUMP((stream, "mov %"PRIuPTR", %"PRIuPTR"\n", code[1], code[2]));
-				code += 3;
-				break;
+	const mathfun_bytecode_info *info = mathfun_bytecode_infos + *code;
+	MATHFUN_DUMP_INS((stream, "0x%08"PRIXPTR": %s", code - start, info->name));
+	++ code;
 
-			case VAL:
-				MATHFUN_DUMP((stream, "val %a, %"PRIuPTR"\n", *(double*)(code + 1),
-					code[1 + MATHFUN_VALUE_CODES]));
-				code += 2 + MATHFUN_VALUE_CODES;
+	for (const char *kind = info->operands; *kind; ++ kind) {
+		const char *sep = kind == info->operands ? " " : ", ";
+		switch (*kind) {
+			case 'v':
+				MATHFUN_DUMP_INS((stream, "%s%a", sep, fun->consts[*code].number));
 				break;
 
-			case CALL:
+			case 'f':
 			{
-				mathfun_binding_funct funct = *(mathfun_binding_funct*)(code + 1);
-				mathfun_code firstarg = code[MATHFUN_FUNCT_CODES + 1];
-				mathfun_code ret = code[MATHFUN_FUNCT_CODES + 2];
-				code += 3 + MATHFUN_FUNCT_CODES;
-
-				if (ctx) {
-					const char *name = mathfun_context_funct_name(ctx, funct);
-					if (name) {
-						MATHFUN_DUMP((stream, "call %s, %"PRIuPTR", %"PRIuPTR"\n", name, firstarg, ret));
-						break;
-					}
-				}
+				mathfun_binding_funct funct = fun->functs[*code];
+				const char *name = ctx ? mathfun_context_funct_name(ctx, funct) : NULL;
 
-				MATHFUN_DUMP((stream, "call 0x%"PRIxPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					(uintptr_t)funct, firstarg, ret));
+				if (name) {
+					MATHFUN_DUMP_INS((stream, "%s%s", sep, name));
+				}
+				else {
+					MATHFUN_DUMP_INS((stream, "%s0x%"PRIxPTR, sep, (uintptr_t)funct));
+				}
 				break;
 			}
-
-			case NEG:
-				MATHFUN_DUMP((stream, "neg %"PRIuPTR", %"PRIuPTR"\n", code[1], code[2]));
-				code += 3;
+			case 'a':
+				MATHFUN_DUMP_INS((stream, "%s0x%"PRIXPTR, sep, (uintptr_t)mathfun_code_adr(code)));
 				break;
 
-			case ADD:
-				MATHFUN_DUMP((stream, "add %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
+			default:
+				MATHFUN_DUMP_INS((stream, "%s%u", sep, (unsigned int)*code));
 				break;
+		}
+		code += mathfun_operand_size(*kind);
+	}
 
-			case SUB:
-				MATHFUN_DUMP((stream, "sub %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+#undef MATHFUN_DUMP_INS
 
-			case MUL:
-				MATHFUN_DUMP((stream, "mul %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+	return count;
+}
 
-			case DIV:
-				MATHFUN_DUMP((stream, "div %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+bool mathfun_dump(const mathfun *fun, FILE *stream, const mathfun_context *ctx, mathfun_error_p *error) {
+	MATHFUN_DUMP((stream, "argc = %"PRIzu", retc = %"PRIzu", framesize = %"PRIzu,
+		fun->argc, fun->retc, fun->framesize));
 
-			case MOD:
-				MATHFUN_DUMP((stream, "mod %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+	if (fun->entry > 0) {
+		MATHFUN_DUMP((stream, ", entry = 0x%08"PRIXPTR, (uintptr_t)fun->entry));
+	}
 
-			case POW:
-				MATHFUN_DUMP((stream, "pow %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+	MATHFUN_DUMP((stream, "\n\n"));
 
-			case NOT:
-				MATHFUN_DUMP((stream, "not %"PRIuPTR", %"PRIuPTR"\n", code[1], code[2]));
-				code += 3;
-				break;
+	for (const mathfun_code *code = fun->code; *code != END; code += mathfun_code_size(code)) {
+		if (mathfun_dump_ins(fun, code, stream, ctx, error) < 0) return false;
+		MATHFUN_DUMP((stream, "\n"));
+	}
 
-			case EQ:
-				MATHFUN_DUMP((stream, "eq %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+	return true;
+}
 
-			case NE:
-				MATHFUN_DUMP((stream, "ne %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+// width of the instruction column of mathfun_dump_profile() and the
+// maximum number of characters of expression text shown per instruction
+#define MATHFUN_DUMP_INS_WIDTH 40
+#define MATHFUN_DUMP_SRC_WIDTH 48
 
-			case LT:
-				MATHFUN_DUMP((stream, "lt %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+// Prints the text of span with all whitespace collapsed to single spaces.
+static bool mathfun_dump_span(const mathfun *fun, mathfun_srcspan span, FILE *stream, mathfun_error_p *error) {
+	size_t width = 0;
+	bool space = false;
 
-			case GT:
-				MATHFUN_DUMP((stream, "gt %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+	for (const char *ptr = fun->source + span.begin; ptr < fun->source + span.end; ++ ptr) {
+		if (isspace((unsigned char)*ptr)) {
+			space = true;
+			continue;
+		}
 
-			case LE:
-				MATHFUN_DUMP((stream, "le %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+		if (width + space >= MATHFUN_DUMP_SRC_WIDTH) {
+			MATHFUN_DUMP((stream, " ..."));
+			break;
+		}
 
-			case GE:
-				MATHFUN_DUMP((stream, "ge %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+		MATHFUN_DUMP((stream, "%s%c", space ? " " : "", *ptr));
+		width += space + 1;
+		space = false;
+	}
 
-			case BEQ:
-				MATHFUN_DUMP((stream, "beq %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+	return true;
+}
 
-			case BNE:
-				MATHFUN_DUMP((stream, "bne %"PRIuPTR", %"PRIuPTR", %"PRIuPTR"\n",
-					code[1], code[2], code[3]));
-				code += 4;
-				break;
+bool mathfun_dump_profile(const mathfun *fun, const mathfun_profile *profile, FILE *stream,
+	const mathfun_context *ctx, mathfun_error_p *error) {
+	const mathfun_code *start = fun->code;
+	const mathfun_srcspan *srcmap = fun->srcmap;
+	uint64_t total = 0;
+	size_t size = 0;
 
-			case JMP:
-				MATHFUN_DUMP((stream, "jmp 0x%"PRIXPTR"\n", code[1]));
-				code += 2;
-				break;
+	// the profile has to be checked before its counters are read
+	while (start[size] != END) {
+		size += mathfun_code_size(start + size);
+	}
 
-			case JMPT:
-				MATHFUN_DUMP((stream, "jmpt %"PRIuPTR", 0x%"PRIXPTR"\n",
-					code[1], code[2]));
-				code += 3;
-				break;
+	if (profile->size != size + 1) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return false;
+	}
 
-			case JMPF:
-				MATHFUN_DUMP((stream, "jmpf %"PRIuPTR", 0x%"PRIXPTR"\n",
-					code[1], code[2]));
-				code += 3;
-				break;
+	for (const mathfun_code *code = start; *code != END; code += mathfun_code_size(code)) {
+		total += profile->ticks[code - start];
+	}
 
-			case SETT:
-				MATHFUN_DUMP((stream, "sett %"PRIuPTR"\n", code[1]));
-				code += 2;
-				break;
+	MATHFUN_DUMP((stream, "argc = %"PRIzu", retc = %"PRIzu", framesize = %"PRIzu", ticks = %"PRIu64"\n\n",
+		fun->argc, fun->retc, fun->framesize, total));
+	MATHFUN_DUMP((stream, "%12s %14s %6s  %-*s  %s\n", "count", "ticks", "%", MATHFUN_DUMP_INS_WIDTH,
+		"instruction", srcmap ? "expression" : ""));
 
-			case SETF:
-				MATHFUN_DUMP((stream, "setf %"PRIuPTR"\n", code[1]));
-				code += 2;
-				break;
+	for (const mathfun_code *code = start; *code != END; code += mathfun_code_size(code)) {
+		const size_t adr = code - start;
+		const uint64_t ticks = profile->ticks[adr];
 
-			default: // assert?
-				mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
-				return false;
+		MATHFUN_DUMP((stream, "%12"PRIu64" %14"PRIu64" %5.1f%%  ", profile->counts[adr], ticks,
+			total > 0 ? 100.0 * (double)ticks / (double)total : 0.0));
+
+		const int width = mathfun_dump_ins(fun, code, stream, ctx, error);
+		if (width < 0) return false;
+
+		if (srcmap && srcmap[adr].end > srcmap[adr].begin) {
+			MATHFUN_DUMP((stream, "%*s  ", width < MATHFUN_DUMP_INS_WIDTH ? MATHFUN_DUMP_INS_WIDTH - width : 0, ""));
+			if (!mathfun_dump_span(fun, srcmap[adr], stream, error)) return false;
 		}
+
+		MATHFUN_DUMP((stream, "\n"));
 	}
 
 	return true;
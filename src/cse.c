@@ -0,0 +1,459 @@
+#include "mathfun_intern.h"
+
+// Common subexpression elimination (value numbering on the expression trees).
+//
+// All expressions are hashed bottom-up and structurally equal subexpressions
+// are grouped into classes. The operands of commutative operators are compared
+// in either order, so x * sin(y) and sin(y) * x are the same value. Bound
+// functions are constant functions, so equal calls are equal values too.
+//
+// A class that occurs more than once, at least once in a position that is
+// always executed, gets a register of its own. Codegen computes such a
+// subexpression into its register the first time it's needed unconditionally
+// and just returns the register afterwards.
+//
+// Subexpressions that only occur in branches of ?:, && or || are never hoisted,
+// because they might raise math errors that the original expression doesn't.
+// Classes that only occur inside of the same other class don't need a register,
+// because the enclosing subexpression is only computed once anyway.
+//
+// With uniform arguments, subexpressions that only depend on them and on
+// constants are uniform too. The largest ones that are always executed are
+// hoisted: they get a class even if they occur only once, and codegen computes
+// them in a prologue that batch execution runs once for all rows. Every class
+// computed by the prologue is hoisted, so its register has to survive all rows.
+
+#define MATHFUN_CSE_NONE    SIZE_MAX
+#define MATHFUN_CSE_PENDING (SIZE_MAX - 1)
+#define MATHFUN_CSE_MEMBER  (SIZE_MAX - 2)
+
+static inline size_t mathfun_cse_mix(size_t hash, size_t value) {
+	return (hash ^ value) * (size_t)UINT64_C(0x100000001B3) + (hash >> 7);
+}
+
+static bool mathfun_expr_commutative(enum mathfun_expr_type type) {
+	switch (type) {
+		case EX_ADD:
+		case EX_MUL:
+		case EX_EQ:
+		case EX_NE:
+		case EX_BEQ:
+		case EX_BNE:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+bool mathfun_expr_equal(const mathfun_expr *a, const mathfun_expr *b) {
+	if (a == b) return true;
+	if (a->type != b->type) return false;
+
+	switch (a->type) {
+		case EX_CONST:
+			if (a->ex.value.type != b->ex.value.type) return false;
+			if (a->ex.value.type == MATHFUN_BOOLEAN) {
+				return a->ex.value.value.boolean == b->ex.value.value.boolean;
+			}
+			return memcmp(&a->ex.value.value.number, &b->ex.value.value.number, sizeof(double)) == 0;
+
+		case EX_ARG:
+			return a->ex.arg == b->ex.arg;
+
+		case EX_CALL:
+			if (a->ex.funct.funct != b->ex.funct.funct || a->ex.funct.sig->argc != b->ex.funct.sig->argc) {
+				return false;
+			}
+			for (size_t i = 0; i < a->ex.funct.sig->argc; ++ i) {
+				if (!mathfun_expr_equal(a->ex.funct.args[i], b->ex.funct.args[i])) return false;
+			}
+			return true;
+
+		case EX_NEG:
+		case EX_NOT:
+			return mathfun_expr_equal(a->ex.unary.expr, b->ex.unary.expr);
+
+		case EX_IIF:
+			return mathfun_expr_equal(a->ex.iif.cond,      b->ex.iif.cond) &&
+			       mathfun_expr_equal(a->ex.iif.then_expr, b->ex.iif.then_expr) &&
+			       mathfun_expr_equal(a->ex.iif.else_expr, b->ex.iif.else_expr);
+
+		default:
+			if (mathfun_expr_equal(a->ex.binary.left,  b->ex.binary.left) &&
+			    mathfun_expr_equal(a->ex.binary.right, b->ex.binary.right)) {
+				return true;
+			}
+			return mathfun_expr_commutative(a->type) &&
+			       mathfun_expr_equal(a->ex.binary.left,  b->ex.binary.right) &&
+			       mathfun_expr_equal(a->ex.binary.right, b->ex.binary.left);
+	}
+}
+
+static bool mathfun_cse_add(mathfun_cse *cse, const mathfun_expr *expr, size_t hash, bool uncond,
+	bool uniform, mathfun_error_p *error) {
+	if (cse->nodes_used == cse->nodes_size) {
+		const size_t size = cse->nodes_size ? cse->nodes_size * 2 : 32;
+		mathfun_cse_node *nodes = realloc(cse->nodes, size * sizeof(mathfun_cse_node));
+
+		if (!nodes) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		cse->nodes      = nodes;
+		cse->nodes_size = size;
+	}
+
+	mathfun_cse_node *node = cse->nodes + cse->nodes_used ++;
+	node->expr    = expr;
+	node->parent  = NULL;
+	node->hash    = hash;
+	node->cls     = MATHFUN_CSE_PENDING;
+	node->uncond  = uncond;
+	node->uniform = uniform;
+	node->hoist   = false;
+
+	return true;
+}
+
+// Collects all subexpressions that need code (everything but constants and arguments).
+// uncond tells whether expr is always executed when the function is executed,
+// *uniform is cleared unless expr only depends on uniform arguments.
+static bool mathfun_cse_walk(mathfun_cse *cse, const mathfun_expr *expr, bool uncond, size_t *hash,
+	bool *uniform, mathfun_error_p *error) {
+	size_t h = mathfun_cse_mix((size_t)UINT64_C(0xCBF29CE484222325), expr->type);
+	size_t child = 0;
+	bool uni = cse->uniform != NULL;
+
+	switch (expr->type) {
+		case EX_CONST:
+			if (expr->ex.value.type == MATHFUN_BOOLEAN) {
+				h = mathfun_cse_mix(h, expr->ex.value.value.boolean);
+			}
+			else {
+				uint64_t bits;
+				memcpy(&bits, &expr->ex.value.value.number, sizeof(bits));
+				h = mathfun_cse_mix(mathfun_cse_mix(h, (size_t)bits), (size_t)(bits >> 32));
+			}
+			*uniform = *uniform && uni;
+			*hash = h;
+			return true;
+
+		case EX_ARG:
+			*uniform = *uniform && uni && cse->uniform[expr->ex.arg];
+			*hash = mathfun_cse_mix(h, expr->ex.arg);
+			return true;
+
+		case EX_CALL:
+			h = mathfun_cse_mix(h, (size_t)(uintptr_t)expr->ex.funct.funct);
+			for (size_t i = 0; i < expr->ex.funct.sig->argc; ++ i) {
+				if (!mathfun_cse_walk(cse, expr->ex.funct.args[i], uncond, &child, &uni, error)) return false;
+				h = mathfun_cse_mix(h, child);
+			}
+			break;
+
+		case EX_NEG:
+		case EX_NOT:
+			if (!mathfun_cse_walk(cse, expr->ex.unary.expr, uncond, &child, &uni, error)) return false;
+			h = mathfun_cse_mix(h, child);
+			break;
+
+		case EX_IIF:
+			if (!mathfun_cse_walk(cse, expr->ex.iif.cond, uncond, &child, &uni, error)) return false;
+			h = mathfun_cse_mix(h, child);
+			if (!mathfun_cse_walk(cse, expr->ex.iif.then_expr, false, &child, &uni, error)) return false;
+			h = mathfun_cse_mix(h, child);
+			if (!mathfun_cse_walk(cse, expr->ex.iif.else_expr, false, &child, &uni, error)) return false;
+			h = mathfun_cse_mix(h, child);
+			break;
+
+		case EX_AND:
+		case EX_OR:
+		case EX_RNG_INCL:
+		case EX_RNG_EXCL:
+			// the right operand (upper bound) is only evaluated depending on the left one
+			if (!mathfun_cse_walk(cse, expr->ex.binary.left, uncond, &child, &uni, error)) return false;
+			h = mathfun_cse_mix(h, child);
+			if (!mathfun_cse_walk(cse, expr->ex.binary.right, false, &child, &uni, error)) return false;
+			h = mathfun_cse_mix(h, child);
+			if (expr->type == EX_RNG_INCL || expr->type == EX_RNG_EXCL) {
+				// part of EX_IN, doesn't have code of its own
+				*uniform = *uniform && uni;
+				*hash = h;
+				return true;
+			}
+			break;
+
+		default:
+		{
+			size_t right = 0;
+			if (!mathfun_cse_walk(cse, expr->ex.binary.left,  uncond, &child, &uni, error)) return false;
+			if (!mathfun_cse_walk(cse, expr->ex.binary.right, uncond, &right, &uni, error)) return false;
+			if (mathfun_expr_commutative(expr->type) && right < child) {
+				// hash commutative operands in a canonical order
+				const size_t tmp = child;
+				child = right;
+				right = tmp;
+			}
+			h = mathfun_cse_mix(mathfun_cse_mix(h, child), right);
+			break;
+		}
+	}
+
+	*uniform = *uniform && uni;
+	*hash = h;
+	return mathfun_cse_add(cse, expr, h, uncond, uni, error);
+}
+
+static int mathfun_cse_cmp_hash(const void *a, const void *b) {
+	const size_t ha = ((const mathfun_cse_node*)a)->hash;
+	const size_t hb = ((const mathfun_cse_node*)b)->hash;
+	return ha < hb ? -1 : ha > hb ? 1 : 0;
+}
+
+static int mathfun_cse_cmp_expr(const void *a, const void *b) {
+	const uintptr_t ea = (uintptr_t)((const mathfun_cse_node*)a)->expr;
+	const uintptr_t eb = (uintptr_t)((const mathfun_cse_node*)b)->expr;
+	return ea < eb ? -1 : ea > eb ? 1 : 0;
+}
+
+// cse->nodes has to be sorted by expr
+static mathfun_cse_node *mathfun_cse_find(const mathfun_cse *cse, const mathfun_expr *expr) {
+	if (cse->nodes_used == 0) return NULL;
+
+	mathfun_cse_node key;
+	key.expr = expr;
+
+	return bsearch(&key, cse->nodes, cse->nodes_used, sizeof(mathfun_cse_node), mathfun_cse_cmp_expr);
+}
+
+// sets the parent of every node, the nearest enclosing subexpression that has a node
+static void mathfun_cse_link(const mathfun_cse *cse, const mathfun_expr *expr, const mathfun_expr *parent) {
+	mathfun_cse_node *node = mathfun_cse_find(cse, expr);
+	if (node) {
+		node->parent = parent;
+		parent = expr;
+	}
+
+	switch (expr->type) {
+		case EX_CONST:
+		case EX_ARG:
+			break;
+
+		case EX_CALL:
+			for (size_t i = 0; i < expr->ex.funct.sig->argc; ++ i) {
+				mathfun_cse_link(cse, expr->ex.funct.args[i], parent);
+			}
+			break;
+
+		case EX_NEG:
+		case EX_NOT:
+			mathfun_cse_link(cse, expr->ex.unary.expr, parent);
+			break;
+
+		case EX_IIF:
+			mathfun_cse_link(cse, expr->ex.iif.cond,      parent);
+			mathfun_cse_link(cse, expr->ex.iif.then_expr, parent);
+			mathfun_cse_link(cse, expr->ex.iif.else_expr, parent);
+			break;
+
+		default:
+			mathfun_cse_link(cse, expr->ex.binary.left,  parent);
+			mathfun_cse_link(cse, expr->ex.binary.right, parent);
+			break;
+	}
+}
+
+// Drops the classes whose members all have parents of the same class, once per
+// parent, and renumbers the rest. Classes with members that are hoisted are
+// kept, the parent is computed for every row. Afterwards only nodes that belong
+// to a class are kept, sorted for lookup.
+static bool mathfun_cse_prune(mathfun_cse *cse, mathfun_error_p *error) {
+	mathfun_cse_node *nodes = cse->nodes;
+	qsort(nodes, cse->nodes_used, sizeof(mathfun_cse_node), mathfun_cse_cmp_expr);
+
+	const size_t size = cse->classes_used > 0 ? cse->classes_used : 1;
+	size_t *parents = malloc(size * sizeof(size_t));
+	size_t *members = calloc(size, sizeof(size_t));
+	bool   *hoist   = calloc(size, sizeof(bool));
+	if (!parents || !members || !hoist) {
+		free(parents);
+		free(members);
+		free(hoist);
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	for (size_t i = 0; i < cse->classes_used; ++ i) {
+		parents[i] = MATHFUN_CSE_PENDING;
+	}
+
+	for (size_t i = 0; i < cse->nodes_used; ++ i) {
+		if (nodes[i].cls != MATHFUN_CSE_NONE) {
+			++ members[nodes[i].cls];
+			hoist[nodes[i].cls] = hoist[nodes[i].cls] || nodes[i].hoist;
+		}
+	}
+
+	for (size_t i = 0; i < cse->nodes_used; ++ i) {
+		const size_t cls = nodes[i].cls;
+		if (cls == MATHFUN_CSE_NONE) continue;
+
+		const mathfun_cse_node *parent = nodes[i].parent ? mathfun_cse_find(cse, nodes[i].parent) : NULL;
+		const size_t parentcls = parent ? parent->cls : MATHFUN_CSE_NONE;
+
+		if (parents[cls] == MATHFUN_CSE_PENDING) {
+			parents[cls] = parentcls;
+		}
+		else if (parents[cls] != parentcls) {
+			parents[cls] = MATHFUN_CSE_NONE;
+		}
+	}
+
+	// parents[cls] becomes the new class number
+	size_t classes = 0;
+	for (size_t i = 0; i < cse->classes_used; ++ i) {
+		const bool nested = !hoist[i] && parents[i] != MATHFUN_CSE_NONE && members[parents[i]] == members[i];
+		parents[i] = nested ? MATHFUN_CSE_NONE : classes ++;
+	}
+
+	size_t used = 0;
+	for (size_t i = 0; i < cse->nodes_used; ++ i) {
+		const size_t cls = nodes[i].cls;
+		if (cls != MATHFUN_CSE_NONE && parents[cls] != MATHFUN_CSE_NONE) {
+			nodes[used] = nodes[i];
+			nodes[used].cls = parents[cls];
+			++ used;
+		}
+	}
+
+	cse->nodes_used   = used;
+	cse->classes_used = classes;
+	free(parents);
+	free(members);
+	free(hoist);
+
+	return true;
+}
+
+bool mathfun_cse_init(mathfun_cse *cse, mathfun_expr *exprs[], size_t count, mathfun_code firstreg,
+	const bool uniform[], mathfun_error_p *error) {
+	memset(cse, 0, sizeof(mathfun_cse));
+	cse->uniform = uniform;
+
+	for (size_t i = 0; i < count; ++ i) {
+		size_t hash = 0;
+		bool uni = true;
+		if (!mathfun_cse_walk(cse, exprs[i], true, &hash, &uni, error)) {
+			mathfun_cse_cleanup(cse);
+			return false;
+		}
+	}
+
+	// only leaves, nothing to share
+	if (cse->nodes_used == 0) return true;
+
+	qsort(cse->nodes, cse->nodes_used, sizeof(mathfun_cse_node), mathfun_cse_cmp_expr);
+	for (size_t i = 0; i < count; ++ i) {
+		mathfun_cse_link(cse, exprs[i], NULL);
+	}
+
+	// hoist the largest uniform subexpressions that are always executed
+	for (size_t i = 0; i < cse->nodes_used; ++ i) {
+		mathfun_cse_node *node = cse->nodes + i;
+		const mathfun_cse_node *parent = node->parent ? mathfun_cse_find(cse, node->parent) : NULL;
+		node->hoist = node->uniform && node->uncond && !(parent && parent->uniform);
+	}
+
+	// group equal subexpressions, they have equal hashes
+	qsort(cse->nodes, cse->nodes_used, sizeof(mathfun_cse_node), mathfun_cse_cmp_hash);
+
+	mathfun_cse_node *nodes = cse->nodes;
+	for (size_t i = 0; i < cse->nodes_used; ) {
+		size_t end = i + 1;
+		while (end < cse->nodes_used && nodes[end].hash == nodes[i].hash) ++ end;
+
+		for (size_t j = i; j < end; ++ j) {
+			if (nodes[j].cls != MATHFUN_CSE_PENDING) continue;
+
+			size_t members = 0;
+			bool uncond = false;
+			bool hoist  = false;
+			for (size_t k = j; k < end; ++ k) {
+				if (nodes[k].cls == MATHFUN_CSE_PENDING && mathfun_expr_equal(nodes[j].expr, nodes[k].expr)) {
+					nodes[k].cls = MATHFUN_CSE_MEMBER;
+					uncond = uncond || nodes[k].uncond;
+					hoist  = hoist  || nodes[k].hoist;
+					++ members;
+				}
+			}
+
+			const size_t cls = (members > 1 && uncond) || hoist ? cse->classes_used ++ : MATHFUN_CSE_NONE;
+			for (size_t k = j; k < end; ++ k) {
+				if (nodes[k].cls == MATHFUN_CSE_MEMBER) {
+					nodes[k].cls = cls;
+				}
+			}
+		}
+		i = end;
+	}
+
+	if (!mathfun_cse_prune(cse, error)) {
+		mathfun_cse_cleanup(cse);
+		return false;
+	}
+
+	if ((size_t)firstreg + cse->classes_used > MATHFUN_REGS_MAX) {
+		mathfun_raise_error(error, MATHFUN_EXCEEDS_MAX_FRAME_SIZE);
+		mathfun_cse_cleanup(cse);
+		return false;
+	}
+
+	if (cse->classes_used > 0) {
+		cse->classes = calloc(cse->classes_used, sizeof(mathfun_cse_class));
+
+		if (!cse->classes) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			mathfun_cse_cleanup(cse);
+			return false;
+		}
+
+		// a uniform class with an unconditional member might be computed by the prologue
+		for (size_t i = 0; i < cse->nodes_used; ++ i) {
+			if (cse->nodes[i].uniform && cse->nodes[i].uncond) {
+				cse->classes[cse->nodes[i].cls].hoisted = true;
+			}
+		}
+
+		// the registers of the hoisted classes come first
+		mathfun_code reg = firstreg;
+		for (size_t i = 0; i < cse->classes_used; ++ i) {
+			if (cse->classes[i].hoisted) {
+				cse->classes[i].reg = reg ++;
+				++ cse->hoisted;
+			}
+		}
+
+		for (size_t i = 0; i < cse->classes_used; ++ i) {
+			if (!cse->classes[i].hoisted) {
+				cse->classes[i].reg = reg ++;
+			}
+			cse->classes[i].computed = false;
+		}
+	}
+
+	return true;
+}
+
+void mathfun_cse_cleanup(mathfun_cse *cse) {
+	free(cse->nodes);
+	free(cse->classes);
+	memset(cse, 0, sizeof(mathfun_cse));
+}
+
+mathfun_cse_class *mathfun_cse_lookup(const mathfun_cse *cse, const mathfun_expr *expr) {
+	const mathfun_cse_node *node = mathfun_cse_find(cse, expr);
+
+	return node ? cse->classes + node->cls : NULL;
+}
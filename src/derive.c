@@ -0,0 +1,409 @@
+#include "mathfun_intern.h"
+
+// Symbolic differentiation of expression trees. mathfun_expr_derive() builds a
+// new tree and leaves the given one untouched, subexpressions of it that are
+// needed by the derivative are copied.
+//
+// The derivative of an expression that doesn't depend on the argument is the
+// constant 0. The constructors below simplify with 0 and 1 operands as they go,
+// so e.g. the derivative of 3 * x is 3 and not 0 * x + 3 * 1. Constant folding
+// and the rest is left to mathfun_expr_optimize().
+//
+// Comparisons and the conditions of ?: are constant almost everywhere, so they
+// have no derivative. Bound functions are differentiated using the partial
+// derivatives registered with mathfun_context_define_partials(), which are
+// parsed in the context and get the argument expressions substituted for their
+// parameters.
+
+static inline bool mathfun_expr_is_const(const mathfun_expr *expr, double value) {
+	return expr->type == EX_CONST && expr->ex.value.value.number == value;
+}
+
+static mathfun_expr *mathfun_derive_const(double value, mathfun_error_p *error) {
+	mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, error);
+
+	if (expr) {
+		expr->ex.value.type = MATHFUN_NUMBER;
+		expr->ex.value.value.number = value;
+	}
+
+	return expr;
+}
+
+// The constructors take ownership of their operands, also when they fail.
+// NULL operands (failed constructions) are passed through.
+
+static mathfun_expr *mathfun_derive_unary(enum mathfun_expr_type type, mathfun_expr *operand,
+	mathfun_error_p *error) {
+	if (!operand) return NULL;
+
+	mathfun_expr *expr = mathfun_expr_alloc(type, error);
+
+	if (!expr) {
+		mathfun_expr_free(operand);
+		return NULL;
+	}
+
+	expr->ex.unary.expr = operand;
+	return expr;
+}
+
+static mathfun_expr *mathfun_derive_binary(enum mathfun_expr_type type, mathfun_expr *left, mathfun_expr *right,
+	mathfun_error_p *error) {
+	if (!left || !right) {
+		mathfun_expr_free(left);
+		mathfun_expr_free(right);
+		return NULL;
+	}
+
+	mathfun_expr *expr = mathfun_expr_alloc(type, error);
+
+	if (!expr) {
+		mathfun_expr_free(left);
+		mathfun_expr_free(right);
+		return NULL;
+	}
+
+	expr->ex.binary.left  = left;
+	expr->ex.binary.right = right;
+	return expr;
+}
+
+static mathfun_expr *mathfun_derive_neg(mathfun_expr *operand, mathfun_error_p *error) {
+	if (operand && operand->type == EX_CONST) {
+		operand->ex.value.value.number = -operand->ex.value.value.number;
+		return operand;
+	}
+	return mathfun_derive_unary(EX_NEG, operand, error);
+}
+
+static mathfun_expr *mathfun_derive_add(mathfun_expr *left, mathfun_expr *right, mathfun_error_p *error) {
+	if (left && right) {
+		if (mathfun_expr_is_const(left, 0.0)) {
+			mathfun_expr_free(left);
+			return right;
+		}
+		if (mathfun_expr_is_const(right, 0.0)) {
+			mathfun_expr_free(right);
+			return left;
+		}
+	}
+	return mathfun_derive_binary(EX_ADD, left, right, error);
+}
+
+static mathfun_expr *mathfun_derive_sub(mathfun_expr *left, mathfun_expr *right, mathfun_error_p *error) {
+	if (left && right) {
+		if (mathfun_expr_is_const(right, 0.0)) {
+			mathfun_expr_free(right);
+			return left;
+		}
+		if (mathfun_expr_is_const(left, 0.0)) {
+			mathfun_expr_free(left);
+			return mathfun_derive_neg(right, error);
+		}
+	}
+	return mathfun_derive_binary(EX_SUB, left, right, error);
+}
+
+static mathfun_expr *mathfun_derive_mul(mathfun_expr *left, mathfun_expr *right, mathfun_error_p *error) {
+	if (left && right) {
+		if (mathfun_expr_is_const(left, 0.0)) {
+			mathfun_expr_free(right);
+			return left;
+		}
+		if (mathfun_expr_is_const(right, 0.0)) {
+			mathfun_expr_free(left);
+			return right;
+		}
+		if (mathfun_expr_is_const(left, 1.0)) {
+			mathfun_expr_free(left);
+			return right;
+		}
+		if (mathfun_expr_is_const(right, 1.0)) {
+			mathfun_expr_free(right);
+			return left;
+		}
+		if (mathfun_expr_is_const(left, -1.0)) {
+			mathfun_expr_free(left);
+			return mathfun_derive_neg(right, error);
+		}
+		if (mathfun_expr_is_const(right, -1.0)) {
+			mathfun_expr_free(right);
+			return mathfun_derive_neg(left, error);
+		}
+	}
+	return mathfun_derive_binary(EX_MUL, left, right, error);
+}
+
+static mathfun_expr *mathfun_derive_div(mathfun_expr *left, mathfun_expr *right, mathfun_error_p *error) {
+	if (left && right) {
+		if (mathfun_expr_is_const(left, 0.0)) {
+			mathfun_expr_free(right);
+			return left;
+		}
+		if (mathfun_expr_is_const(right, 1.0)) {
+			mathfun_expr_free(right);
+			return left;
+		}
+	}
+	return mathfun_derive_binary(EX_DIV, left, right, error);
+}
+
+// Replaces the parameters (EX_ARG nodes) of a parsed partial derivative by
+// copies of the argument expressions of the call.
+static bool mathfun_derive_subst(mathfun_expr *expr, mathfun_expr *const args[], mathfun_error_p *error) {
+	switch (expr->type) {
+		case EX_CONST:
+			return true;
+
+		case EX_ARG:
+		{
+			mathfun_expr *arg = mathfun_expr_copy(args[expr->ex.arg], error);
+			if (!arg) return false;
+			*expr = *arg;
+			free(arg);
+			return true;
+		}
+		case EX_CALL:
+			for (size_t i = 0; i < expr->ex.funct.sig->argc; ++ i) {
+				if (!mathfun_derive_subst(expr->ex.funct.args[i], args, error)) return false;
+			}
+			return true;
+
+		case EX_NEG:
+		case EX_NOT:
+			return mathfun_derive_subst(expr->ex.unary.expr, args, error);
+
+		case EX_IIF:
+			return
+				mathfun_derive_subst(expr->ex.iif.cond,      args, error) &&
+				mathfun_derive_subst(expr->ex.iif.then_expr, args, error) &&
+				mathfun_derive_subst(expr->ex.iif.else_expr, args, error);
+
+		default:
+			return
+				mathfun_derive_subst(expr->ex.binary.left,  args, error) &&
+				mathfun_derive_subst(expr->ex.binary.right, args, error);
+	}
+}
+
+// sum of partial_i(args) * dargs[i]
+static mathfun_expr *mathfun_derive_call(const mathfun_context *ctx, const mathfun_expr *expr, size_t arg,
+	mathfun_error_p *error) {
+	const mathfun_sig *sig = expr->ex.funct.sig;
+	const mathfun_partials *partials = expr->ex.funct.partials;
+	mathfun_expr *sum = mathfun_derive_const(0.0, error);
+
+	for (size_t i = 0; i < sig->argc && sum; ++ i) {
+		if (sig->argtypes[i] != MATHFUN_NUMBER) continue;
+
+		mathfun_expr *darg = mathfun_expr_derive(ctx, expr->ex.funct.args[i], arg, error);
+
+		if (!darg) {
+			mathfun_expr_free(sum);
+			return NULL;
+		}
+
+		if (mathfun_expr_is_const(darg, 0.0)) {
+			mathfun_expr_free(darg);
+			continue;
+		}
+
+		if (!partials) {
+			mathfun_expr_free(darg);
+			mathfun_expr_free(sum);
+			const char *name = mathfun_context_funct_name(ctx, expr->ex.funct.funct);
+			mathfun_raise_name_error(error, MATHFUN_NO_DERIVATIVE, name ? name : "?");
+			return NULL;
+		}
+
+		if (!partials->partials[i]) {
+			mathfun_expr_free(darg);
+			continue;
+		}
+
+		mathfun_expr *partial = mathfun_context_parse(ctx, partials->params, sig->argc, partials->partials[i], NULL, error);
+
+		if (partial && !mathfun_derive_subst(partial, expr->ex.funct.args, error)) {
+			mathfun_expr_free(partial);
+			partial = NULL;
+		}
+
+		if (!partial) {
+			mathfun_expr_free(darg);
+			mathfun_expr_free(sum);
+			return NULL;
+		}
+
+		sum = mathfun_derive_add(sum, mathfun_derive_mul(partial, darg, error), error);
+	}
+
+	return sum;
+}
+
+// d(a**b) = b * a**(b - 1) * da + a**b * log(a) * db
+static mathfun_expr *mathfun_derive_pow(const mathfun_context *ctx, const mathfun_expr *expr,
+	mathfun_expr *da, mathfun_expr *db, mathfun_error_p *error) {
+	const mathfun_expr *a = expr->ex.binary.left;
+	const mathfun_expr *b = expr->ex.binary.right;
+	mathfun_expr *deriv = mathfun_derive_const(0.0, error);
+
+	// skip the terms of constant operands, so e.g. x**2 works for x < 0
+	if (!mathfun_expr_is_const(da, 0.0)) {
+		mathfun_expr *exponent = mathfun_derive_sub(mathfun_expr_copy(b, error), mathfun_derive_const(1.0, error), error);
+		mathfun_expr *power = mathfun_derive_binary(EX_POW, mathfun_expr_copy(a, error), exponent, error);
+		deriv = mathfun_derive_add(deriv,
+			mathfun_derive_mul(mathfun_derive_mul(mathfun_expr_copy(b, error), power, error), da, error), error);
+	}
+	else {
+		mathfun_expr_free(da);
+	}
+
+	if (!mathfun_expr_is_const(db, 0.0)) {
+		const mathfun_decl *log_decl = mathfun_context_get(ctx, "log");
+
+		if (!log_decl || log_decl->type != MATHFUN_DECL_FUNCT || log_decl->decl.funct.sig->argc != 1 ||
+			log_decl->decl.funct.sig->rettype != MATHFUN_NUMBER) {
+			mathfun_expr_free(deriv);
+			mathfun_expr_free(db);
+			mathfun_raise_name_error(error, MATHFUN_NO_SUCH_NAME, "log");
+			return NULL;
+		}
+
+		mathfun_expr *log_a = mathfun_expr_alloc(EX_CALL, error);
+		mathfun_expr **args = calloc(1, sizeof(mathfun_expr*));
+
+		if (!log_a || !args || !(args[0] = mathfun_expr_copy(a, error))) {
+			if (log_a && !args) mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			free(args);
+			mathfun_expr_free(log_a);
+			mathfun_expr_free(deriv);
+			mathfun_expr_free(db);
+			return NULL;
+		}
+
+		log_a->ex.funct.funct    = log_decl->decl.funct.funct;
+		log_a->ex.funct.deriv    = log_decl->decl.funct.deriv;
+		log_a->ex.funct.partials = log_decl->decl.funct.partials;
+		log_a->ex.funct.interval = log_decl->decl.funct.interval;
+		log_a->ex.funct.sig      = log_decl->decl.funct.sig;
+		log_a->ex.funct.args     = args;
+
+		mathfun_expr *power = mathfun_expr_copy(expr, error);
+		deriv = mathfun_derive_add(deriv,
+			mathfun_derive_mul(mathfun_derive_mul(power, log_a, error), db, error), error);
+	}
+	else {
+		mathfun_expr_free(db);
+	}
+
+	return deriv;
+}
+
+mathfun_expr *mathfun_expr_derive(const mathfun_context *ctx, const mathfun_expr *expr, size_t arg,
+	mathfun_error_p *error) {
+	switch (expr->type) {
+		case EX_CONST:
+			return mathfun_derive_const(0.0, error);
+
+		case EX_ARG:
+			return mathfun_derive_const(expr->ex.arg == arg ? 1.0 : 0.0, error);
+
+		case EX_CALL:
+			return mathfun_derive_call(ctx, expr, arg, error);
+
+		case EX_NEG:
+			return mathfun_derive_neg(mathfun_expr_derive(ctx, expr->ex.unary.expr, arg, error), error);
+
+		case EX_IIF:
+		{
+			mathfun_expr *dthen = mathfun_expr_derive(ctx, expr->ex.iif.then_expr, arg, error);
+			mathfun_expr *delse = dthen ? mathfun_expr_derive(ctx, expr->ex.iif.else_expr, arg, error) : NULL;
+
+			if (!dthen || !delse) {
+				mathfun_expr_free(dthen);
+				return NULL;
+			}
+
+			if (mathfun_expr_is_const(dthen, 0.0) && mathfun_expr_is_const(delse, 0.0)) {
+				mathfun_expr_free(delse);
+				return dthen;
+			}
+
+			mathfun_expr *deriv = mathfun_expr_alloc(EX_IIF, error);
+			mathfun_expr *cond  = deriv ? mathfun_expr_copy(expr->ex.iif.cond, error) : NULL;
+
+			if (!cond) {
+				mathfun_expr_free(deriv);
+				mathfun_expr_free(dthen);
+				mathfun_expr_free(delse);
+				return NULL;
+			}
+
+			deriv->ex.iif.cond      = cond;
+			deriv->ex.iif.then_expr = dthen;
+			deriv->ex.iif.else_expr = delse;
+			return deriv;
+		}
+		default:
+			break;
+	}
+
+	if (mathfun_expr_type(expr) != MATHFUN_NUMBER) {
+		// booleans are only differentiated as arguments of ?: and calls, which skip them
+		return mathfun_derive_const(0.0, error);
+	}
+
+	const mathfun_expr *a = expr->ex.binary.left;
+	const mathfun_expr *b = expr->ex.binary.right;
+	mathfun_expr *da = mathfun_expr_derive(ctx, a, arg, error);
+	mathfun_expr *db = da ? mathfun_expr_derive(ctx, b, arg, error) : NULL;
+
+	if (!da || !db) {
+		mathfun_expr_free(da);
+		return NULL;
+	}
+
+	switch (expr->type) {
+		case EX_ADD:
+			return mathfun_derive_add(da, db, error);
+
+		case EX_SUB:
+			return mathfun_derive_sub(da, db, error);
+
+		case EX_MUL:
+			return mathfun_derive_add(
+				mathfun_derive_mul(da, mathfun_expr_copy(b, error), error),
+				mathfun_derive_mul(mathfun_expr_copy(a, error), db, error), error);
+
+		case EX_DIV:
+			// (da - (a / b) * db) / b
+			if (!mathfun_expr_is_const(db, 0.0)) {
+				da = mathfun_derive_sub(da, mathfun_derive_mul(mathfun_expr_copy(expr, error), db, error), error);
+			}
+			else {
+				mathfun_expr_free(db);
+			}
+			return mathfun_derive_div(da, mathfun_expr_copy(b, error), error);
+
+		case EX_MOD:
+			// a % b = a - q * b with integer q = (a - a % b) / b
+			if (!mathfun_expr_is_const(db, 0.0)) {
+				mathfun_expr *q = mathfun_derive_div(
+					mathfun_derive_sub(mathfun_expr_copy(a, error), mathfun_expr_copy(expr, error), error),
+					mathfun_expr_copy(b, error), error);
+				return mathfun_derive_sub(da, mathfun_derive_mul(q, db, error), error);
+			}
+			mathfun_expr_free(db);
+			return da;
+
+		case EX_POW:
+			return mathfun_derive_pow(ctx, expr, da, db, error);
+
+		default:
+			mathfun_expr_free(da);
+			mathfun_expr_free(db);
+			mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
+			return NULL;
+	}
+}
@@ -0,0 +1,356 @@
+#include <errno.h>
+
+#include "mathfun_intern.h"
+
+// Forward mode automatic differentiation. The byte code is executed with dual
+// numbers: next to every register there is a tangent register holding the
+// derivative of its value in the direction given for the arguments. Each
+// instruction computes its result like mathfun_exec() does and its tangent by
+// the chain rule. Comparisons and booleans have a zero tangent, jumps simply
+// follow the values.
+//
+// CALL uses the derivative rule of the function (fun->derivs). Partial
+// derivatives that are zero are skipped, so boolean arguments (whose tangents
+// are meaningless) don't spoil the result. A function without a rule gets a
+// NaN tangent unless all tangents of its arguments are zero.
+
+#define MATHFUN_DUAL_BINARY(OP, DOP) \
+	{ \
+		const double a = regs[code[1]].number, da = dregs[code[1]]; \
+		const double b = regs[code[2]].number, db = dregs[code[2]]; \
+		regs[code[3]].number = a OP b; \
+		dregs[code[3]] = (DOP); \
+	} \
+	code += 4; \
+	break;
+
+#define MATHFUN_DUAL_COMPARE(OP) \
+	regs[code[3]].boolean = regs[code[1]].number OP regs[code[2]].number; \
+	dregs[code[3]] = 0.0; \
+	code += 4; \
+	break;
+
+#define MATHFUN_DUAL_MUL_BINARY(OP) \
+	{ \
+		const double a = regs[code[1]].number, da = dregs[code[1]]; \
+		const double b = regs[code[2]].number, db = dregs[code[2]]; \
+		regs[code[3]].number = a * b; \
+		dregs[code[3]] = da * b + a * db; \
+		regs[code[5]].number = regs[code[3]].number OP regs[code[4]].number; \
+		dregs[code[5]] = dregs[code[3]] OP dregs[code[4]]; \
+	} \
+	code += 6; \
+	break;
+
+// the constant is loaded first, the binary operation may read it
+#define MATHFUN_DUAL_VAL_BINARY(OP, DOP) \
+	regs[code[2]] = consts[code[1]]; \
+	dregs[code[2]] = 0.0; \
+	{ \
+		const double a = regs[code[3]].number, da = dregs[code[3]]; \
+		const double b = regs[code[4]].number, db = dregs[code[4]]; \
+		regs[code[5]].number = a OP b; \
+		dregs[code[5]] = (DOP); \
+	} \
+	code += 6; \
+	break;
+
+#define MATHFUN_DUAL_COMPARE_JUMP(OP) \
+	regs[code[3]].boolean = regs[code[1]].number OP regs[code[2]].number; \
+	dregs[code[3]] = 0.0; \
+	if (regs[code[3]].boolean == (bool)code[4]) { \
+		code = start + mathfun_code_adr(code + 5); \
+	} \
+	else { \
+		code += 5 + MATHFUN_ADR_CODES; \
+	} \
+	break;
+
+#define MATHFUN_DUAL_IMMEDIATE(EXPR, DEXPR) \
+	{ \
+		const double k = consts[code[1]].number; \
+		const double a = regs[code[2]].number, da = dregs[code[2]]; \
+		regs[code[3]].number = (EXPR); \
+		dregs[code[3]] = (DEXPR); \
+	} \
+	code += 4; \
+	break;
+
+#define MATHFUN_DUAL_COMPARE_IMMEDIATE(OP) \
+	regs[code[3]].boolean = regs[code[2]].number OP consts[code[1]].number; \
+	dregs[code[3]] = 0.0; \
+	code += 4; \
+	break;
+
+#define MATHFUN_DUAL_IN_IMMEDIATE(OP) \
+	{ \
+		const double a = regs[code[3]].number; \
+		regs[code[4]].boolean = a >= consts[code[1]].number && a OP consts[code[2]].number; \
+		dregs[code[4]] = 0.0; \
+	} \
+	code += 5; \
+	break;
+
+// tangent of the result of CALL. Must run before the result register is written.
+static double mathfun_dual_call(mathfun_binding_deriv deriv, const mathfun_value args[], const double dargs[],
+	size_t argc) {
+	bool constant = true;
+	for (size_t i = 0; i < argc && constant; ++ i) {
+		constant = dargs[i] == 0.0;
+	}
+
+	if (constant) return 0.0;
+	if (!deriv) return NAN;
+
+	double stack[MATHFUN_STACK_FRAME_SIZE];
+	double *grad = argc <= MATHFUN_STACK_FRAME_SIZE ? stack : malloc(argc * sizeof(double));
+
+	if (!grad) {
+		errno = ENOMEM;
+		return NAN;
+	}
+
+	for (size_t i = 0; i < argc; ++ i) {
+		grad[i] = 0.0;
+	}
+	deriv(args, grad);
+
+	double darg = 0.0;
+	for (size_t i = 0; i < argc; ++ i) {
+		if (grad[i] != 0.0) {
+			darg += grad[i] * dargs[i];
+		}
+	}
+
+	if (grad != stack) free(grad);
+
+	return darg;
+}
+
+double mathfun_exec_dual(const mathfun *fun, mathfun_value regs[], double dregs[], double *deriv) {
+	const mathfun_code *start = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_funct *functs = fun->functs;
+	const mathfun_binding_deriv *derivs = fun->derivs;
+	const mathfun_code *code = start;
+
+	for (;;) {
+		switch (*code) {
+			case NOP:
+				++ code;
+				break;
+
+			case RET:
+				*deriv = dregs[code[1]];
+				return regs[code[1]].number;
+
+			case MOV:
+				regs[code[2]]  = regs[code[1]];
+				dregs[code[2]] = dregs[code[1]];
+				code += 3;
+				break;
+
+			case VAL:
+				regs[code[2]]  = consts[code[1]];
+				dregs[code[2]] = 0.0;
+				code += 3;
+				break;
+
+			case CALL:
+			{
+				const mathfun_code argc = code[2];
+				const double darg = mathfun_dual_call(derivs ? derivs[code[1]] : NULL,
+					regs + code[3], dregs + code[3], argc);
+				regs[code[4]]  = functs[code[1]](regs + code[3]);
+				dregs[code[4]] = darg;
+				code += 5;
+				break;
+			}
+			case NEG:
+				regs[code[2]].number = -regs[code[1]].number;
+				dregs[code[2]] = -dregs[code[1]];
+				code += 3;
+				break;
+
+			case ADD: MATHFUN_DUAL_BINARY(+, da + db)
+			case SUB: MATHFUN_DUAL_BINARY(-, da - db)
+			case MUL: MATHFUN_DUAL_BINARY(*, da * b + a * db)
+			case DIV: MATHFUN_DUAL_BINARY(/, (da - (a / b) * db) / b)
+
+			case MOD:
+			{
+				const double a = regs[code[1]].number, da = dregs[code[1]];
+				const double b = regs[code[2]].number, db = dregs[code[2]];
+				const double c = mathfun_mod(a, b);
+				// a = q * b + c with integer q
+				regs[code[3]].number = c;
+				dregs[code[3]] = db == 0.0 ? da : da - nearbyint((a - c) / b) * db;
+				code += 4;
+				break;
+			}
+			case POW:
+			{
+				const double a = regs[code[1]].number, da = dregs[code[1]];
+				const double b = regs[code[2]].number, db = dregs[code[2]];
+				const double c = pow(a, b);
+				// skip the terms of constant operands, so e.g. x**2 works for x < 0
+				double dc = 0.0;
+				if (da != 0.0) dc += b * pow(a, b - 1.0) * da;
+				if (db != 0.0) dc += c * log(a) * db;
+				regs[code[3]].number = c;
+				dregs[code[3]] = dc;
+				code += 4;
+				break;
+			}
+			case POWK:
+			{
+				const double k = consts[code[1]].number;
+				const double a = regs[code[2]].number, da = dregs[code[2]];
+				regs[code[3]].number = mathfun_pow_k(a, k);
+				dregs[code[3]] = da != 0.0 ? k * pow(a, k - 1.0) * da : 0.0;
+				code += 4;
+				break;
+			}
+			case FMA:
+			{
+				const double a = regs[code[1]].number, da = dregs[code[1]];
+				const double b = regs[code[2]].number, db = dregs[code[2]];
+				const double dc = dregs[code[3]];
+				regs[code[4]].number = fma(a, b, regs[code[3]].number);
+				dregs[code[4]] = da * b + a * db + dc;
+				code += 5;
+				break;
+			}
+			case NOT:
+				regs[code[2]].boolean = !regs[code[1]].boolean;
+				dregs[code[2]] = 0.0;
+				code += 3;
+				break;
+
+			case EQ: MATHFUN_DUAL_COMPARE(==)
+			case NE: MATHFUN_DUAL_COMPARE(!=)
+			case LT: MATHFUN_DUAL_COMPARE(<)
+			case GT: MATHFUN_DUAL_COMPARE(>)
+			case LE: MATHFUN_DUAL_COMPARE(<=)
+			case GE: MATHFUN_DUAL_COMPARE(>=)
+
+			case BEQ:
+				regs[code[3]].boolean = regs[code[1]].boolean == regs[code[2]].boolean;
+				dregs[code[3]] = 0.0;
+				code += 4;
+				break;
+
+			case BNE:
+				regs[code[3]].boolean = regs[code[1]].boolean != regs[code[2]].boolean;
+				dregs[code[3]] = 0.0;
+				code += 4;
+				break;
+
+			case JMP:
+				code = start + mathfun_code_adr(code + 1);
+				break;
+
+			case JMPT:
+				if (regs[code[1]].boolean) {
+					code = start + mathfun_code_adr(code + 2);
+				}
+				else {
+					code += 2 + MATHFUN_ADR_CODES;
+				}
+				break;
+
+			case JMPF:
+				if (regs[code[1]].boolean) {
+					code += 2 + MATHFUN_ADR_CODES;
+				}
+				else {
+					code = start + mathfun_code_adr(code + 2);
+				}
+				break;
+
+			case SETT:
+			case SETF:
+				regs[code[1]].boolean = *code == SETT;
+				dregs[code[1]] = 0.0;
+				code += 2;
+				break;
+
+			case MULADD: MATHFUN_DUAL_MUL_BINARY(+)
+			case MULSUB: MATHFUN_DUAL_MUL_BINARY(-)
+
+			case VADD: MATHFUN_DUAL_VAL_BINARY(+, da + db)
+			case VSUB: MATHFUN_DUAL_VAL_BINARY(-, da - db)
+			case VMUL: MATHFUN_DUAL_VAL_BINARY(*, da * b + a * db)
+			case VDIV: MATHFUN_DUAL_VAL_BINARY(/, (da - (a / b) * db) / b)
+
+			case EQJ: MATHFUN_DUAL_COMPARE_JUMP(==)
+			case NEJ: MATHFUN_DUAL_COMPARE_JUMP(!=)
+			case LTJ: MATHFUN_DUAL_COMPARE_JUMP(<)
+			case GTJ: MATHFUN_DUAL_COMPARE_JUMP(>)
+			case LEJ: MATHFUN_DUAL_COMPARE_JUMP(<=)
+			case GEJ: MATHFUN_DUAL_COMPARE_JUMP(>=)
+
+			case ADDK:  MATHFUN_DUAL_IMMEDIATE(a + k, da)
+			case SUBK:  MATHFUN_DUAL_IMMEDIATE(a - k, da)
+			case RSUBK: MATHFUN_DUAL_IMMEDIATE(k - a, -da)
+			case MULK:  MATHFUN_DUAL_IMMEDIATE(a * k, da * k)
+			case DIVK:  MATHFUN_DUAL_IMMEDIATE(a / k, da / k)
+			case RDIVK: MATHFUN_DUAL_IMMEDIATE(k / a, -(k / a) / a * da)
+
+			case EQK: MATHFUN_DUAL_COMPARE_IMMEDIATE(==)
+			case NEK: MATHFUN_DUAL_COMPARE_IMMEDIATE(!=)
+			case LTK: MATHFUN_DUAL_COMPARE_IMMEDIATE(<)
+			case GTK: MATHFUN_DUAL_COMPARE_IMMEDIATE(>)
+			case LEK: MATHFUN_DUAL_COMPARE_IMMEDIATE(<=)
+			case GEK: MATHFUN_DUAL_COMPARE_IMMEDIATE(>=)
+
+			case INK:  MATHFUN_DUAL_IN_IMMEDIATE(<=)
+			case INXK: MATHFUN_DUAL_IN_IMMEDIATE(<)
+
+			default:
+				errno = EINVAL;
+				*deriv = NAN;
+				return NAN;
+		}
+	}
+}
+
+double mathfun_acall_dual(const mathfun *fun, const double args[], const double dirs[], double *deriv,
+	mathfun_error_p *error) {
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	double dstack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = stack;
+	double *dregs = dstack;
+
+	if (fun->framesize > MATHFUN_STACK_FRAME_SIZE) {
+		regs  = malloc(fun->framesize * sizeof(mathfun_value));
+		dregs = malloc(fun->framesize * sizeof(double));
+
+		if (!regs || !dregs) {
+			free(regs);
+			free(dregs);
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			*deriv = NAN;
+			return NAN;
+		}
+	}
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		regs[i].number = args[i];
+		dregs[i] = dirs[i];
+	}
+
+	errno = 0;
+	const double value = mathfun_exec_dual(fun, regs, dregs, deriv);
+
+	if (regs != stack) {
+		free(regs);
+		free(dregs);
+	}
+
+	if (errno != 0) {
+		mathfun_raise_c_error(error);
+	}
+
+	return value;
+}
@@ -224,6 +224,20 @@ void mathfun_raise_c_error(mathfun_error_p *errptr) {
 	}
 }
 
+void mathfun_raise_code_error(mathfun_error_p *errptr, size_t address) {
+	if (errptr) {
+		mathfun_error *error = mathfun_error_alloc(MATHFUN_INVALID_CODE);
+
+		if (error) {
+			error->err.code.address = address;
+			*errptr = error;
+		}
+		else {
+			*errptr = &mathfun_memory_error;
+		}
+	}
+}
+
 void mathfun_raise_math_error(mathfun_error_p *errptr, int errnum) {
 	errno = errnum;
 	mathfun_raise_error(errptr, MATHFUN_MATH_ERROR);
@@ -357,6 +371,19 @@ void mathfun_error_log(mathfun_error_p error, FILE *stream) {
 		case MATHFUN_PARSER_TRAILING_GARBAGE:
 			mathfun_log_parser_error(error, stream, "trailing garbage");
 			return;
+
+		case MATHFUN_NO_DERIVATIVE:
+			fprintf(stream, "error: function has no symbolic derivative: '%s'\n", error->str);
+			return;
+
+		case MATHFUN_INVALID_CODE:
+			fprintf(stream, "error: invalid byte code at address 0x%08"PRIXPTR"\n",
+				(uintptr_t)error->err.code.address);
+			return;
+
+		case MATHFUN_EXCEEDS_MAX_CODE_SIZE:
+			fprintf(stream, "error: expression would exceed maximum code size\n");
+			return;
 	}
 	
 	fprintf(stream, "error: unknown error: %d\n", type);
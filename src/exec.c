@@ -1,7 +1,33 @@
 #include <errno.h>
+#include <time.h>
 
 #include "mathfun_intern.h"
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#	include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	include <x86intrin.h>
+#endif
+
+// Time source of mathfun_exec_profile(): the time stamp counter where it can
+// be read directly, else a monotonic clock in nanoseconds.
+static inline uint64_t mathfun_ticks(void) {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || \
+	(defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+	return __rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+	return ticks;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+#else
+	return (uint64_t)clock();
+#endif
+}
+
 // tree interpreter, for one time execution and debugging
 mathfun_value mathfun_expr_exec(const mathfun_expr *expr, const double args[]) {
 	switch (expr->type) {
@@ -14,16 +40,20 @@ mathfun_value mathfun_expr_exec(const mathfun_expr *expr, const double args[]) {
 		case EX_CALL:
 		{
 			const size_t argc = expr->ex.funct.sig->argc;
-			mathfun_value *funct_args = malloc(argc * sizeof(mathfun_value));
-			if (!funct_args) {
-				if (errno == 0) errno = ENOMEM;
-				return (mathfun_value){ .number = NAN };
+			mathfun_value stack[MATHFUN_STACK_ARGS_SIZE];
+			mathfun_value *funct_args = stack;
+			if (argc > MATHFUN_STACK_ARGS_SIZE) {
+				funct_args = malloc(argc * sizeof(mathfun_value));
+				if (!funct_args) {
+					if (errno == 0) errno = ENOMEM;
+					return (mathfun_value){ .number = NAN };
+				}
 			}
 			for (size_t i = 0; i < argc; ++ i) {
 				funct_args[i] = mathfun_expr_exec(expr->ex.funct.args[i], args);
 			}
 			mathfun_value value = expr->ex.funct.funct(funct_args);
-			free(funct_args);
+			if (funct_args != stack) free(funct_args);
 
 			return value;
 		}
@@ -139,228 +169,327 @@ mathfun_value mathfun_expr_exec(const mathfun_expr *expr, const double args[]) {
 	return (mathfun_value){ .number = NAN };
 }
 
-double mathfun_exec(const mathfun *fun, mathfun_value regs[]) {
-	const mathfun_code *start = fun->code;
-	const mathfun_code *code  = fun->code;
+// Semantics of all instructions for the byte code interpreters below. Every
+// instruction reads its operands relative to code, writes regs and advances
+// code (or returns the result). Constants and functions are looked up in the
+// consts and functs pools.
+#define MATHFUN_EXEC_BINARY(FIELD, OP) \
+	regs[code[3]].FIELD = regs[code[1]].number OP regs[code[2]].number; \
+	code += 4;
+
+#define MATHFUN_EXEC_MUL_BINARY(OP) \
+	regs[code[3]].number = regs[code[1]].number * regs[code[2]].number; \
+	regs[code[5]].number = regs[code[3]].number OP regs[code[4]].number; \
+	code += 6;
+
+#define MATHFUN_EXEC_VAL_BINARY(OP) \
+	regs[code[2]] = consts[code[1]]; \
+	regs[code[5]].number = regs[code[3]].number OP regs[code[4]].number; \
+	code += 6;
+
+#define MATHFUN_EXEC_COMPARE_JUMP(OP) \
+	regs[code[3]].boolean = regs[code[1]].number OP regs[code[2]].number; \
+	if (regs[code[3]].boolean == (bool)code[4]) { \
+		code = start + mathfun_code_adr(code + 5); \
+	} \
+	else { \
+		code += 5 + MATHFUN_ADR_CODES; \
+	}
+
+// d = a OP k or, with the operands swapped, d = k OP a
+#define MATHFUN_EXEC_IMMEDIATE(FIELD, A, OP, B) \
+	{ \
+		const double k = consts[code[1]].number; \
+		const double a = regs[code[2]].number; \
+		regs[code[3]].FIELD = A OP B; \
+	} \
+	code += 4;
+
+#define MATHFUN_EXEC_IN_IMMEDIATE(OP) \
+	{ \
+		const double a = regs[code[3]].number; \
+		regs[code[4]].boolean = a >= consts[code[1]].number && a OP consts[code[2]].number; \
+	} \
+	code += 5;
+
+#define MATHFUN_EXEC_INSTRUCTIONS(INSTR) \
+	INSTR(NOP,  ++ code) \
+	INSTR(RET,  return regs[code[1]].number) \
+	INSTR(MOV,  regs[code[2]] = regs[code[1]]; code += 3) \
+	INSTR(VAL,  regs[code[2]] = consts[code[1]]; code += 3) \
+	INSTR(CALL, \
+		regs[code[4]] = functs[code[1]](regs + code[3]); \
+		code += 5) \
+	INSTR(NEG,  regs[code[2]].number = -regs[code[1]].number; code += 3) \
+	INSTR(ADD,  MATHFUN_EXEC_BINARY(number, +)) \
+	INSTR(SUB,  MATHFUN_EXEC_BINARY(number, -)) \
+	INSTR(MUL,  MATHFUN_EXEC_BINARY(number, *)) \
+	INSTR(DIV,  MATHFUN_EXEC_BINARY(number, /)) \
+	INSTR(MOD, \
+		regs[code[3]].number = mathfun_mod(regs[code[1]].number, regs[code[2]].number); \
+		code += 4) \
+	INSTR(POW, \
+		regs[code[3]].number = pow(regs[code[1]].number, regs[code[2]].number); \
+		code += 4) \
+	INSTR(NOT,  regs[code[2]].boolean = !regs[code[1]].boolean; code += 3) \
+	INSTR(EQ,   MATHFUN_EXEC_BINARY(boolean, ==)) \
+	INSTR(NE,   MATHFUN_EXEC_BINARY(boolean, !=)) \
+	INSTR(LT,   MATHFUN_EXEC_BINARY(boolean, <)) \
+	INSTR(GT,   MATHFUN_EXEC_BINARY(boolean, >)) \
+	INSTR(LE,   MATHFUN_EXEC_BINARY(boolean, <=)) \
+	INSTR(GE,   MATHFUN_EXEC_BINARY(boolean, >=)) \
+	INSTR(BEQ, \
+		regs[code[3]].boolean = regs[code[1]].boolean == regs[code[2]].boolean; \
+		code += 4) \
+	INSTR(BNE, \
+		regs[code[3]].boolean = regs[code[1]].boolean != regs[code[2]].boolean; \
+		code += 4) \
+	INSTR(JMP,  code = start + mathfun_code_adr(code + 1)) \
+	INSTR(JMPT, \
+		if (regs[code[1]].boolean) { \
+			code = start + mathfun_code_adr(code + 2); \
+		} \
+		else { \
+			code += 2 + MATHFUN_ADR_CODES; \
+		}) \
+	INSTR(JMPF, \
+		if (regs[code[1]].boolean) { \
+			code += 2 + MATHFUN_ADR_CODES; \
+		} \
+		else { \
+			code = start + mathfun_code_adr(code + 2); \
+		}) \
+	INSTR(SETT, regs[code[1]].boolean = true;  code += 2) \
+	INSTR(SETF, regs[code[1]].boolean = false; code += 2) \
+	INSTR(MULADD, MATHFUN_EXEC_MUL_BINARY(+)) \
+	INSTR(MULSUB, MATHFUN_EXEC_MUL_BINARY(-)) \
+	INSTR(VADD, MATHFUN_EXEC_VAL_BINARY(+)) \
+	INSTR(VSUB, MATHFUN_EXEC_VAL_BINARY(-)) \
+	INSTR(VMUL, MATHFUN_EXEC_VAL_BINARY(*)) \
+	INSTR(VDIV, MATHFUN_EXEC_VAL_BINARY(/)) \
+	INSTR(EQJ,  MATHFUN_EXEC_COMPARE_JUMP(==)) \
+	INSTR(NEJ,  MATHFUN_EXEC_COMPARE_JUMP(!=)) \
+	INSTR(LTJ,  MATHFUN_EXEC_COMPARE_JUMP(<)) \
+	INSTR(GTJ,  MATHFUN_EXEC_COMPARE_JUMP(>)) \
+	INSTR(LEJ,  MATHFUN_EXEC_COMPARE_JUMP(<=)) \
+	INSTR(GEJ,  MATHFUN_EXEC_COMPARE_JUMP(>=)) \
+	INSTR(ADDK,  MATHFUN_EXEC_IMMEDIATE(number, a, +, k)) \
+	INSTR(SUBK,  MATHFUN_EXEC_IMMEDIATE(number, a, -, k)) \
+	INSTR(RSUBK, MATHFUN_EXEC_IMMEDIATE(number, k, -, a)) \
+	INSTR(MULK,  MATHFUN_EXEC_IMMEDIATE(number, a, *, k)) \
+	INSTR(DIVK,  MATHFUN_EXEC_IMMEDIATE(number, a, /, k)) \
+	INSTR(RDIVK, MATHFUN_EXEC_IMMEDIATE(number, k, /, a)) \
+	INSTR(EQK,  MATHFUN_EXEC_IMMEDIATE(boolean, a, ==, k)) \
+	INSTR(NEK,  MATHFUN_EXEC_IMMEDIATE(boolean, a, !=, k)) \
+	INSTR(LTK,  MATHFUN_EXEC_IMMEDIATE(boolean, a, <,  k)) \
+	INSTR(GTK,  MATHFUN_EXEC_IMMEDIATE(boolean, a, >,  k)) \
+	INSTR(LEK,  MATHFUN_EXEC_IMMEDIATE(boolean, a, <=, k)) \
+	INSTR(GEK,  MATHFUN_EXEC_IMMEDIATE(boolean, a, >=, k)) \
+	INSTR(INK,  MATHFUN_EXEC_IN_IMMEDIATE(<=)) \
+	INSTR(INXK, MATHFUN_EXEC_IN_IMMEDIATE(<)) \
+	INSTR(POWK, \
+		regs[code[3]].number = mathfun_pow_k(regs[code[2]].number, consts[code[1]].number); \
+		code += 4) \
+	INSTR(FMA, \
+		regs[code[4]].number = fma(regs[code[1]].number, regs[code[2]].number, regs[code[3]].number); \
+		code += 5)
+
+// Instruction dispatch of mathfun_exec(). Define MATHFUN_DISPATCH_FORCE (see the
+// MATHFUN_DISPATCH cmake option) to select one at build time:
+//
+//   0 ... loop with a switch
+//   1 ... loop with computed gotos (GNU C labels as values)
+//   2 ... every instruction is a function that tail calls the next one
+//
+// By default tail calls are used if the compiler can guarantee them
+// (musttail: clang >= 13, gcc >= 15), else computed gotos with GNU C. Forcing
+// tail calls without musttail relies on the optimizer's sibling calls. That's
+// still safe without optimization, because byte code only jumps forward, so the
+// call depth is bounded by the code size.
+
+#define MATHFUN_DISPATCH_SWITCH   0
+#define MATHFUN_DISPATCH_GOTO     1
+#define MATHFUN_DISPATCH_TAILCALL 2
+
+#ifdef __has_attribute
+#	if __has_attribute(musttail)
+#		define MATHFUN_MUSTTAIL __attribute__((musttail))
+#	endif
+#endif
+
+#if defined(MATHFUN_DISPATCH_FORCE)
+#	define MATHFUN_DISPATCH MATHFUN_DISPATCH_FORCE
+#elif defined(MATHFUN_MUSTTAIL)
+#	define MATHFUN_DISPATCH MATHFUN_DISPATCH_TAILCALL
+#elif defined(__GNUC__)
+#	define MATHFUN_DISPATCH MATHFUN_DISPATCH_GOTO
+#else
+#	define MATHFUN_DISPATCH MATHFUN_DISPATCH_SWITCH
+#endif
+
+#ifndef MATHFUN_MUSTTAIL
+#	define MATHFUN_MUSTTAIL
+#endif
+
+// mathfun_exec_count() always uses a loop
+#if MATHFUN_DISPATCH == MATHFUN_DISPATCH_GOTO || (MATHFUN_DISPATCH == MATHFUN_DISPATCH_TAILCALL && defined(__GNUC__))
+#	define MATHFUN_EXEC_COMPUTED_GOTO
+#endif
+
+#ifdef MATHFUN_EXEC_COMPUTED_GOTO
+// http://gcc.gnu.org/onlinedocs/gcc/Labels-as-Values.html
+// use offsets instead of absolute addresses to reduce the number of
+// dynamic relocations for code in shared libraries (works the same with clang)
+#	define MATHFUN_EXEC_JUMP_TABLE_ENTRY(NAME, ...) [NAME] = &&do_##NAME - &&do_NOP,
+#	define MATHFUN_EXEC_JUMP_TABLE \
+		static const intptr_t jump_table[] = { \
+			MATHFUN_EXEC_INSTRUCTIONS(MATHFUN_EXEC_JUMP_TABLE_ENTRY) \
+		};
+#	define MATHFUN_EXEC_DISPATCH(HOOK) HOOK; goto *(&&do_NOP + jump_table[*code]);
+#	define MATHFUN_EXEC_START(HOOK) MATHFUN_EXEC_DISPATCH(HOOK)
+#else
+#	define MATHFUN_EXEC_JUMP_TABLE
+#	define MATHFUN_EXEC_DISPATCH(HOOK) HOOK; continue;
+#	define MATHFUN_EXEC_START(HOOK) HOOK;
+#endif
+
+#define MATHFUN_EXEC_CASE(NAME, ...) \
+	case NAME: \
+	do_##NAME: \
+	{ \
+		__VA_ARGS__; \
+	} \
+	MATHFUN_EXEC_DISPATCH(MATHFUN_EXEC_HOOK)
+
+// An unknown opcode fails with EINVAL. Only if MATHFUN_ASSUME_VERIFIED is defined
+// (all byte code is compiled or checked by mathfun_verify()) the switch may skip
+// the range check. Computed gotos and tail calls never check the opcode.
+#if defined(MATHFUN_ASSUME_VERIFIED) && defined(__GNUC__)
+#	define MATHFUN_EXEC_INVALID __builtin_unreachable();
+#else
+#	define MATHFUN_EXEC_INVALID errno = EINVAL; return NAN;
+#endif
+
+// The interpreter loop. MATHFUN_EXEC_HOOK is run before every instruction.
+#define MATHFUN_EXEC_LOOP \
+	MATHFUN_EXEC_JUMP_TABLE \
+	MATHFUN_EXEC_START(MATHFUN_EXEC_HOOK) \
+	for (;;) { \
+		switch (*code) { \
+			MATHFUN_EXEC_INSTRUCTIONS(MATHFUN_EXEC_CASE) \
+			default: \
+				MATHFUN_EXEC_INVALID \
+		} \
+	}
 
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
 #pragma GCC diagnostic ignored "-Wunused-label"
 #pragma GCC diagnostic ignored "-Wpointer-arith"
-	// http://gcc.gnu.org/onlinedocs/gcc/Labels-as-Values.html
-	// use offsets instead of absolute addresses to reduce the number of
-	// dynamic relocations for code in shared libraries
-	//
-	// TODO: same for llvm clang
-	// http://blog.llvm.org/2010/01/address-of-label-and-indirect-branches.html
-	static const intptr_t jump_table[] = {
-		/* NOP  */ &&do_nop  - &&do_add,
-		/* RET  */ &&do_ret  - &&do_add,
-		/* MOV  */ &&do_mov  - &&do_add,
-		/* VAL  */ &&do_val  - &&do_add,
-		/* CALL */ &&do_call - &&do_add,
-		/* NEG  */ &&do_neg  - &&do_add,
-		/* ADD  */ &&do_add  - &&do_add,
-		/* SUB  */ &&do_sub  - &&do_add,
-		/* MUL  */ &&do_mul  - &&do_add,
-		/* DIV  */ &&do_div  - &&do_add,
-		/* MOD  */ &&do_mod  - &&do_add,
-		/* POW  */ &&do_pow  - &&do_add,
-		/* NOT  */ &&do_not  - &&do_add,
-		/* EQ   */ &&do_eq   - &&do_add,
-		/* NE   */ &&do_ne   - &&do_add,
-		/* LT   */ &&do_lt   - &&do_add,
-		/* GT   */ &&do_gt   - &&do_add,
-		/* LE   */ &&do_le   - &&do_add,
-		/* GE   */ &&do_ge   - &&do_add,
-		/* BEQ  */ &&do_beq  - &&do_add,
-		/* BNE  */ &&do_bne  - &&do_add,
-		/* JMP  */ &&do_jmp  - &&do_add,
-		/* JMPT */ &&do_jmpt - &&do_add,
-		/* JMPF */ &&do_jmpf - &&do_add,
-		/* SETT */ &&do_sett - &&do_add,
-		/* SETF */ &&do_setf - &&do_add
-	};
-
-#	define DISPATCH goto *(&&do_add + jump_table[*code]);
-	DISPATCH;
+#endif
+
+#if MATHFUN_DISPATCH == MATHFUN_DISPATCH_TAILCALL
+// The interpreter state is passed as arguments, so it stays in registers
+// across instructions (all of them are passed in registers on x86-64 and AArch64).
+#define MATHFUN_EXEC_PARAMS \
+	const mathfun_code *code, \
+	mathfun_value regs[] __attribute__((unused)), \
+	const mathfun_code *start __attribute__((unused)), \
+	const mathfun_value *consts __attribute__((unused)), \
+	const mathfun_binding_funct *functs __attribute__((unused))
+
+typedef double (*mathfun_exec_handler)(MATHFUN_EXEC_PARAMS);
+
+#define MATHFUN_EXEC_HANDLER_DECL(NAME, ...) static double mathfun_exec_##NAME(MATHFUN_EXEC_PARAMS);
+#define MATHFUN_EXEC_HANDLER_ENTRY(NAME, ...) [NAME] = mathfun_exec_##NAME,
+#define MATHFUN_EXEC_HANDLER(NAME, ...) \
+	static double mathfun_exec_##NAME(MATHFUN_EXEC_PARAMS) { \
+		__VA_ARGS__; \
+		MATHFUN_MUSTTAIL return mathfun_exec_handlers[*code](code, regs, start, consts, functs); \
+	}
+
+MATHFUN_EXEC_INSTRUCTIONS(MATHFUN_EXEC_HANDLER_DECL)
+
+static const mathfun_exec_handler mathfun_exec_handlers[] = {
+	MATHFUN_EXEC_INSTRUCTIONS(MATHFUN_EXEC_HANDLER_ENTRY)
+};
+
+MATHFUN_EXEC_INSTRUCTIONS(MATHFUN_EXEC_HANDLER)
+
+double mathfun_exec(const mathfun *fun, mathfun_value regs[]) {
+	if (fun->native) {
+		return fun->native(regs);
+	}
+
+	const mathfun_code *code = fun->code;
+	return mathfun_exec_handlers[*code](code, regs, code, fun->consts, fun->functs);
+}
 #else
-#	define DISPATCH break;
+double mathfun_exec(const mathfun *fun, mathfun_value regs[]) {
+	if (fun->native) {
+		return fun->native(regs);
+	}
+
+	const mathfun_code *start = fun->code;
+	const mathfun_code *code  = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_funct *functs = fun->functs;
+
+#define MATHFUN_EXEC_HOOK
+	MATHFUN_EXEC_LOOP
+#undef MATHFUN_EXEC_HOOK
+}
 #endif
 
-	for (;;) {
-		switch (*code) {
-			case ADD:
-do_add:
-				regs[code[3]].number = regs[code[1]].number + regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case SUB:
-do_sub:
-				regs[code[3]].number = regs[code[1]].number - regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case MUL:
-do_mul:
-				regs[code[3]].number = regs[code[1]].number * regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case DIV:
-do_div:
-				regs[code[3]].number = regs[code[1]].number / regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case MOD:
-do_mod:
-				regs[code[3]].number = mathfun_mod(regs[code[1]].number, regs[code[2]].number);
-				code += 4;
-				DISPATCH;
-
-			case POW:
-do_pow:
-				regs[code[3]].number = pow(regs[code[1]].number, regs[code[2]].number);
-				code += 4;
-				DISPATCH;
-
-			case NEG:
-do_neg:
-				regs[code[2]].number = -regs[code[1]].number;
-				code += 3;
-				DISPATCH;
-
-			case VAL:
-do_val:
-				regs[code[1 + MATHFUN_VALUE_CODES]] = *(mathfun_value*)(code + 1);
-				code += 2 + MATHFUN_VALUE_CODES;
-				DISPATCH;
-
-			case CALL:
-do_call:
-			{
-				mathfun_binding_funct funct = *(mathfun_binding_funct*)(code + 1);
-				code += 1 + MATHFUN_FUNCT_CODES;
-				mathfun_code firstarg = *(code ++);
-				mathfun_code ret      = *(code ++);
-				regs[ret] = funct(regs + firstarg);
-				DISPATCH;
-			}	
-			case MOV:
-do_mov:
-				regs[code[2]] = regs[code[1]];
-				code += 3;
-				DISPATCH;
-
-			case NOT:
-do_not:
-				regs[code[2]].boolean = !regs[code[1]].boolean;
-				code += 3;
-				DISPATCH;
-
-			case EQ:
-do_eq:
-				regs[code[3]].boolean = regs[code[1]].number == regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case NE:
-do_ne:
-				regs[code[3]].boolean = regs[code[1]].number != regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case LT:
-do_lt:
-				regs[code[3]].boolean = regs[code[1]].number < regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case GT:
-do_gt:
-				regs[code[3]].boolean = regs[code[1]].number > regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case LE:
-do_le:
-				regs[code[3]].boolean = regs[code[1]].number <= regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case GE:
-do_ge:
-				regs[code[3]].boolean = regs[code[1]].number >= regs[code[2]].number;
-				code += 4;
-				DISPATCH;
-
-			case BEQ:
-do_beq:
-				regs[code[3]].boolean = regs[code[1]].boolean == regs[code[2]].boolean;
-				code += 4;
-				DISPATCH;
-
-			case BNE:
-do_bne:
-				regs[code[3]].boolean = regs[code[1]].boolean != regs[code[2]].boolean;
-				code += 4;
-				DISPATCH;
-
-			case JMP:
-do_jmp:
-				code = start + code[1];
-				DISPATCH;
-
-			case JMPT:
-do_jmpt:
-				if (regs[code[1]].boolean) {
-					code = start + code[2];
-				}
-				else {
-					code += 3;
-				}
-				DISPATCH;
+// same as mathfun_exec, but counts the executed instructions (for benchmarks)
+double mathfun_exec_count(const mathfun *fun, mathfun_value regs[], size_t *count) {
+	const mathfun_code *start = fun->code;
+	const mathfun_code *code  = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_funct *functs = fun->functs;
 
-			case JMPF:
-do_jmpf:
-				if (regs[code[1]].boolean) {
-					code += 3;
-				}
-				else {
-					code = start + code[2];
-				}
-				DISPATCH;
-
-			case SETT:
-do_sett:
-				regs[code[1]].boolean = true;
-				code += 2;
-				DISPATCH;
-
-			case SETF:
-do_setf:
-				regs[code[1]].boolean = false;
-				code += 2;
-				DISPATCH;
-
-			case RET:
-do_ret:
-				return regs[code[1]].number;
-
-			case NOP:
-do_nop:
-				++ code;
-				DISPATCH;
-
-			default:
-				errno = EINVAL;
-				return NAN;
-		}
+#define MATHFUN_EXEC_HOOK ++ *count
+	MATHFUN_EXEC_LOOP
+#undef MATHFUN_EXEC_HOOK
+}
+
+// Profiling as done by mathfun_exec_profile(). The instruction that was
+// started last and the time it was started are kept outside the interpreter
+// loop, so the time of the final RET can be added after the loop returned.
+typedef struct mathfun_profile_state {
+	mathfun_profile *profile;
+	size_t   current;
+	uint64_t started;
+} mathfun_profile_state;
+
+static double mathfun_exec_profile_loop(const mathfun *fun, mathfun_value regs[], mathfun_profile_state *state) {
+	const mathfun_code *start = fun->code;
+	const mathfun_code *code  = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_funct *functs = fun->functs;
+
+#define MATHFUN_EXEC_HOOK { \
+		const uint64_t now = mathfun_ticks(); \
+		state->profile->ticks[state->current] += now - state->started; \
+		state->current = code - start; \
+		++ state->profile->counts[state->current]; \
+		state->started = mathfun_ticks(); \
 	}
+	MATHFUN_EXEC_LOOP
+#undef MATHFUN_EXEC_HOOK
 }
+
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
+
+// The first hook adds the time since the call started to the first
+// instruction, which executes at most once per call, so that's negligible.
+double mathfun_exec_profile(const mathfun *fun, mathfun_value regs[], mathfun_profile *profile) {
+	mathfun_profile_state state = { profile, 0, mathfun_ticks() };
+	const double value = mathfun_exec_profile_loop(fun, regs, &state);
+	profile->ticks[state.current] += mathfun_ticks() - state.started;
+
+	return value;
+}
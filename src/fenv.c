@@ -0,0 +1,105 @@
+#include "mathfun_intern.h"
+
+// Floating point environment handling of the status execution mode (see
+// mathfun_exec_batch_status()). Math errors are detected through the sticky
+// IEEE 754 exception flags instead of errno, so they are cleared on entry and
+// read once when leaving. The caller's environment, including the reported
+// flags, is restored afterwards.
+//
+// On x86-64 only the MXCSR is used, because the double precision functions of
+// libm use SSE there as well.
+
+#ifdef MATHFUN_FENV_MXCSR
+#	include <xmmintrin.h>
+
+// MXCSR exception flags reported in the status word. The denormal and
+// inexact flags are left alone, they accumulate like with any other code.
+#	define MATHFUN_MXCSR_IE  0x0001
+#	define MATHFUN_MXCSR_ZE  0x0004
+#	define MATHFUN_MXCSR_OE  0x0008
+#	define MATHFUN_MXCSR_UE  0x0010
+#	define MATHFUN_MXCSR_FLAGS (MATHFUN_MXCSR_IE | MATHFUN_MXCSR_ZE | MATHFUN_MXCSR_OE | MATHFUN_MXCSR_UE)
+#	define MATHFUN_MXCSR_DE  0x0002
+#	define MATHFUN_MXCSR_PE  0x0020
+
+// MXCSR control bits
+#	define MATHFUN_MXCSR_DAZ 0x0040
+#	define MATHFUN_MXCSR_FTZ 0x8000
+
+// Writing the MXCSR stalls the pipeline (about as long as a short expression
+// takes to execute), so it's only written if something actually changes.
+void mathfun_fenv_enter(mathfun_fenv *saved, int flags) {
+	saved->csr = _mm_getcsr();
+
+	unsigned int csr = saved->csr & ~MATHFUN_MXCSR_FLAGS;
+	if (flags & MATHFUN_EXEC_FTZ) {
+		csr |= MATHFUN_MXCSR_FTZ | MATHFUN_MXCSR_DAZ;
+	}
+
+	if (csr != saved->csr) {
+		_mm_setcsr(csr);
+	}
+}
+
+int mathfun_fenv_leave(const mathfun_fenv *saved) {
+	const unsigned int csr = _mm_getcsr();
+	const unsigned int restore = saved->csr | (csr & (MATHFUN_MXCSR_DE | MATHFUN_MXCSR_PE));
+
+	if (csr != restore) {
+		_mm_setcsr(restore);
+	}
+
+	int status = MATHFUN_STATUS_OK;
+	if (csr & MATHFUN_MXCSR_IE) status |= MATHFUN_STATUS_INVALID;
+	if (csr & MATHFUN_MXCSR_ZE) status |= MATHFUN_STATUS_DIVBYZERO;
+	if (csr & MATHFUN_MXCSR_OE) status |= MATHFUN_STATUS_OVERFLOW;
+	if (csr & MATHFUN_MXCSR_UE) status |= MATHFUN_STATUS_UNDERFLOW;
+
+	return status;
+}
+
+#else
+
+// FPCR.FZ flushes denormals to zero on AArch64. fesetenv() restores the FPCR.
+#if defined(__aarch64__) && defined(__GNUC__)
+#	define MATHFUN_FPCR_FZ (UINT64_C(1) << 24)
+#endif
+
+void mathfun_fenv_enter(mathfun_fenv *saved, int flags) {
+	// saves the environment and clears the flags
+	feholdexcept(&saved->env);
+
+#ifdef MATHFUN_FPCR_FZ
+	if (flags & MATHFUN_EXEC_FTZ) {
+		uint64_t fpcr;
+		__asm__ __volatile__ ("mrs %0, fpcr" : "=r" (fpcr));
+		fpcr |= MATHFUN_FPCR_FZ;
+		__asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr));
+	}
+#else
+	(void)flags;
+#endif
+}
+
+int mathfun_fenv_leave(const mathfun_fenv *saved) {
+	int status = MATHFUN_STATUS_OK;
+
+#ifdef FE_INVALID
+	if (fetestexcept(FE_INVALID))   status |= MATHFUN_STATUS_INVALID;
+#endif
+#ifdef FE_DIVBYZERO
+	if (fetestexcept(FE_DIVBYZERO)) status |= MATHFUN_STATUS_DIVBYZERO;
+#endif
+#ifdef FE_OVERFLOW
+	if (fetestexcept(FE_OVERFLOW))  status |= MATHFUN_STATUS_OVERFLOW;
+#endif
+#ifdef FE_UNDERFLOW
+	if (fetestexcept(FE_UNDERFLOW)) status |= MATHFUN_STATUS_UNDERFLOW;
+#endif
+
+	fesetenv(&saved->env);
+
+	return status;
+}
+
+#endif
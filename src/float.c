@@ -0,0 +1,651 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Single precision execution. A float program is ordinary byte code with two
+// more pools: the constants rounded to float and the single precision versions
+// of the called functions. The optimizer and codegen run unchanged, so
+// constant folding still happens in double precision.
+//
+// mathfun_exec_batch_float() mirrors the block interpreter of batch.c, with
+// registers of 32 bit lanes. Functions without a single precision version are
+// called through their double precision version, converting the arguments
+// according to the function signature (kept in the pool mathfun::sigs).
+
+#define MATHFUN_FLOAT_FUNCT1(NAME, EXPR) \
+	static mathfun_value_float mathfun_float_##NAME(const mathfun_value_float args[]) { \
+		const float x = args[0].number; \
+		return (mathfun_value_float){ .number = (EXPR) }; \
+	}
+
+#define MATHFUN_FLOAT_FUNCT2(NAME, EXPR) \
+	static mathfun_value_float mathfun_float_##NAME(const mathfun_value_float args[]) { \
+		const float x = args[0].number; \
+		const float y = args[1].number; \
+		return (mathfun_value_float){ .number = (EXPR) }; \
+	}
+
+#define MATHFUN_FLOAT_TEST1(NAME, EXPR) \
+	static mathfun_value_float mathfun_float_##NAME(const mathfun_value_float args[]) { \
+		const float x = args[0].number; \
+		return (mathfun_value_float){ .boolean = (EXPR) }; \
+	}
+
+#define MATHFUN_FLOAT_TEST2(NAME, EXPR) \
+	static mathfun_value_float mathfun_float_##NAME(const mathfun_value_float args[]) { \
+		const float x = args[0].number; \
+		const float y = args[1].number; \
+		return (mathfun_value_float){ .boolean = (EXPR) }; \
+	}
+
+MATHFUN_FLOAT_TEST1(isnan,    isnan(x))
+MATHFUN_FLOAT_TEST1(isfinite, isfinite(x))
+MATHFUN_FLOAT_TEST1(isnormal, isnormal(x))
+MATHFUN_FLOAT_TEST1(isinf,    isinf(x))
+MATHFUN_FLOAT_TEST1(signbit,  signbit(x) != 0)
+
+MATHFUN_FLOAT_TEST2(isgreater,      isgreater(x, y))
+MATHFUN_FLOAT_TEST2(isgreaterequal, isgreaterequal(x, y))
+MATHFUN_FLOAT_TEST2(isless,         isless(x, y))
+MATHFUN_FLOAT_TEST2(islessequal,    islessequal(x, y))
+MATHFUN_FLOAT_TEST2(islessgreater,  islessgreater(x, y))
+MATHFUN_FLOAT_TEST2(isunordered,    isunordered(x, y))
+
+MATHFUN_FLOAT_FUNCT1(acos,      acosf(x))
+MATHFUN_FLOAT_FUNCT1(acosh,     acoshf(x))
+MATHFUN_FLOAT_FUNCT1(asin,      asinf(x))
+MATHFUN_FLOAT_FUNCT1(asinh,     asinhf(x))
+MATHFUN_FLOAT_FUNCT1(atan,      atanf(x))
+MATHFUN_FLOAT_FUNCT1(atanh,     atanhf(x))
+MATHFUN_FLOAT_FUNCT1(cbrt,      cbrtf(x))
+MATHFUN_FLOAT_FUNCT1(ceil,      ceilf(x))
+MATHFUN_FLOAT_FUNCT1(cos,       cosf(x))
+MATHFUN_FLOAT_FUNCT1(cosh,      coshf(x))
+MATHFUN_FLOAT_FUNCT1(erf,       erff(x))
+MATHFUN_FLOAT_FUNCT1(erfc,      erfcf(x))
+MATHFUN_FLOAT_FUNCT1(exp,       expf(x))
+MATHFUN_FLOAT_FUNCT1(exp2,      exp2f(x))
+MATHFUN_FLOAT_FUNCT1(expm1,     expm1f(x))
+MATHFUN_FLOAT_FUNCT1(abs,       fabsf(x))
+MATHFUN_FLOAT_FUNCT1(floor,     floorf(x))
+MATHFUN_FLOAT_FUNCT1(log,       logf(x))
+MATHFUN_FLOAT_FUNCT1(log10,     log10f(x))
+MATHFUN_FLOAT_FUNCT1(log1p,     log1pf(x))
+MATHFUN_FLOAT_FUNCT1(log2,      log2f(x))
+MATHFUN_FLOAT_FUNCT1(logb,      logbf(x))
+MATHFUN_FLOAT_FUNCT1(nearbyint, nearbyintf(x))
+MATHFUN_FLOAT_FUNCT1(round,     roundf(x))
+MATHFUN_FLOAT_FUNCT1(sin,       sinf(x))
+MATHFUN_FLOAT_FUNCT1(sinh,      sinhf(x))
+MATHFUN_FLOAT_FUNCT1(sqrt,      sqrtf(x))
+MATHFUN_FLOAT_FUNCT1(tan,       tanf(x))
+MATHFUN_FLOAT_FUNCT1(tanh,      tanhf(x))
+MATHFUN_FLOAT_FUNCT1(gamma,     tgammaf(x))
+MATHFUN_FLOAT_FUNCT1(trunc,     truncf(x))
+MATHFUN_FLOAT_FUNCT1(sign,      isnan(x) || x == 0.0f ? x : copysignf(1.0f, x))
+
+MATHFUN_FLOAT_FUNCT2(atan2,      atan2f(x, y))
+MATHFUN_FLOAT_FUNCT2(copysign,   copysignf(x, y))
+MATHFUN_FLOAT_FUNCT2(fdim,       fdimf(x, y))
+MATHFUN_FLOAT_FUNCT2(fmod,       fmodf(x, y))
+MATHFUN_FLOAT_FUNCT2(max,        (x >= y || isnan(x)) ? x : y)
+MATHFUN_FLOAT_FUNCT2(min,        (x <= y || isnan(y)) ? x : y)
+MATHFUN_FLOAT_FUNCT2(hypot,      hypotf(x, y))
+MATHFUN_FLOAT_FUNCT2(ldexp,      ldexpf(x, (int)y))
+MATHFUN_FLOAT_FUNCT2(nextafter,  nextafterf(x, y))
+MATHFUN_FLOAT_FUNCT2(nexttoward, nexttowardf(x, y))
+MATHFUN_FLOAT_FUNCT2(remainder,  remainderf(x, y))
+MATHFUN_FLOAT_FUNCT2(scalbln,    scalblnf(x, (long)y))
+
+static mathfun_value_float mathfun_float_fma(const mathfun_value_float args[]) {
+	return (mathfun_value_float){ .number = fmaf(args[0].number, args[1].number, args[2].number) };
+}
+
+bool mathfun_context_define_default_floats(mathfun_context *ctx, mathfun_error_p *error) {
+	static const struct {
+		const char *name;
+		mathfun_binding_float float_funct;
+	} floats[] = {
+		{ "isnan",          mathfun_float_isnan },
+		{ "isfinite",       mathfun_float_isfinite },
+		{ "isnormal",       mathfun_float_isnormal },
+		{ "isinf",          mathfun_float_isinf },
+		{ "isgreater",      mathfun_float_isgreater },
+		{ "isgreaterequal", mathfun_float_isgreaterequal },
+		{ "isless",         mathfun_float_isless },
+		{ "islessequal",    mathfun_float_islessequal },
+		{ "islessgreater",  mathfun_float_islessgreater },
+		{ "isunordered",    mathfun_float_isunordered },
+		{ "signbit",        mathfun_float_signbit },
+		{ "acos",           mathfun_float_acos },
+		{ "acosh",          mathfun_float_acosh },
+		{ "asin",           mathfun_float_asin },
+		{ "asinh",          mathfun_float_asinh },
+		{ "atan",           mathfun_float_atan },
+		{ "atan2",          mathfun_float_atan2 },
+		{ "atanh",          mathfun_float_atanh },
+		{ "cbrt",           mathfun_float_cbrt },
+		{ "ceil",           mathfun_float_ceil },
+		{ "copysign",       mathfun_float_copysign },
+		{ "cos",            mathfun_float_cos },
+		{ "cosh",           mathfun_float_cosh },
+		{ "erf",            mathfun_float_erf },
+		{ "erfc",           mathfun_float_erfc },
+		{ "exp",            mathfun_float_exp },
+		{ "exp2",           mathfun_float_exp2 },
+		{ "expm1",          mathfun_float_expm1 },
+		{ "abs",            mathfun_float_abs },
+		{ "fdim",           mathfun_float_fdim },
+		{ "floor",          mathfun_float_floor },
+		{ "fma",            mathfun_float_fma },
+		{ "fmod",           mathfun_float_fmod },
+		{ "max",            mathfun_float_max },
+		{ "min",            mathfun_float_min },
+		{ "hypot",          mathfun_float_hypot },
+		{ "ldexp",          mathfun_float_ldexp },
+		{ "log",            mathfun_float_log },
+		{ "log10",          mathfun_float_log10 },
+		{ "log1p",          mathfun_float_log1p },
+		{ "log2",           mathfun_float_log2 },
+		{ "logb",           mathfun_float_logb },
+		{ "nearbyint",      mathfun_float_nearbyint },
+		{ "nextafter",      mathfun_float_nextafter },
+		{ "nexttoward",     mathfun_float_nexttoward },
+		{ "remainder",      mathfun_float_remainder },
+		{ "round",          mathfun_float_round },
+		{ "scalbln",        mathfun_float_scalbln },
+		{ "sin",            mathfun_float_sin },
+		{ "sinh",           mathfun_float_sinh },
+		{ "sqrt",           mathfun_float_sqrt },
+		{ "tan",            mathfun_float_tan },
+		{ "tanh",           mathfun_float_tanh },
+		{ "gamma",          mathfun_float_gamma },
+		{ "trunc",          mathfun_float_trunc },
+		{ "sign",           mathfun_float_sign },
+		{ NULL, NULL }
+	};
+
+	for (size_t i = 0; floats[i].name; ++ i) {
+		if (!mathfun_context_define_float(ctx, floats[i].name, floats[i].float_funct, error)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool mathfun_float_pools(const mathfun_context *ctx, mathfun *fun, mathfun_error_p *error) {
+	// the pools have no stored size, but every entry is referenced by the code
+	size_t constc = 0;
+	size_t functc = 0;
+	for (const mathfun_code *code = fun->code; *code != END; code += mathfun_code_size(code)) {
+		const mathfun_code *operand = code + 1;
+		for (const char *kind = mathfun_bytecode_infos[*code].operands; *kind; ++ kind) {
+			if (*kind == 'v' && *operand >= constc) {
+				constc = *operand + 1;
+			}
+			else if (*kind == 'f' && *operand >= functc) {
+				functc = *operand + 1;
+			}
+			operand += *kind == 'a' ? MATHFUN_ADR_CODES : 1;
+		}
+	}
+
+	if (constc > 0) {
+		fun->float_consts = calloc(constc, sizeof(mathfun_value_float));
+
+		if (!fun->float_consts) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		for (size_t i = 0; i < constc; ++ i) {
+			fun->float_consts[i].number = (float)fun->consts[i].number;
+		}
+	}
+
+	if (functc > 0) {
+		fun->float_functs = calloc(functc, sizeof(mathfun_binding_float));
+		fun->sigs = calloc(functc, sizeof(const mathfun_sig*));
+
+		if (!fun->float_functs || !fun->sigs) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		for (size_t i = 0; i < functc; ++ i) {
+			const char *name = mathfun_context_funct_name(ctx, fun->functs[i]);
+			const mathfun_decl *decl = name ? mathfun_context_get(ctx, name) : NULL;
+
+			if (!decl) {
+				mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
+				return false;
+			}
+
+			fun->float_functs[i] = decl->decl.funct.float_funct;
+			fun->sigs[i] = decl->decl.funct.sig;
+		}
+	}
+
+	fun->precision = MATHFUN_PRECISION_FLOAT;
+	return true;
+}
+
+// Calls the double precision version of a function. dargs has room for its arguments.
+static mathfun_value_float mathfun_float_call_double(mathfun_binding_funct funct, const mathfun_sig *sig,
+	const mathfun_value_float args[], mathfun_value dargs[]) {
+	for (size_t i = 0; i < sig->argc; ++ i) {
+		if (sig->argtypes[i] == MATHFUN_BOOLEAN) {
+			dargs[i] = (mathfun_value){ .boolean = args[i].boolean };
+		}
+		else {
+			dargs[i].number = args[i].number;
+		}
+	}
+
+	const mathfun_value ret = funct(dargs);
+
+	if (sig->rettype == MATHFUN_BOOLEAN) {
+		return (mathfun_value_float){ .boolean = ret.boolean };
+	}
+	return (mathfun_value_float){ .number = (float)ret.number };
+}
+
+#define MATHFUN_FLOAT_FOR(BODY) \
+	if (diverged) { \
+		for (size_t i = 0; i < count; ++ i) { \
+			if (mask[i]) { BODY; } \
+		} \
+	} \
+	else { \
+		for (size_t i = 0; i < count; ++ i) { \
+			BODY; \
+		} \
+	}
+
+#define MATHFUN_FLOAT_BINARY(OUT, EXPR) \
+	{ \
+		const mathfun_value_float *a = regs[code[1]]; \
+		const mathfun_value_float *b = regs[code[2]]; \
+		mathfun_value_float *c = regs[code[3]]; \
+		MATHFUN_FLOAT_FOR(c[i].OUT = (EXPR)); \
+		next = code + 4; \
+		break; \
+	}
+
+#define MATHFUN_FLOAT_KERNEL2(KERNEL) \
+	simd->KERNEL(regs[code[1]], regs[code[2]], regs[code[3]], diverged ? mask : NULL, count); \
+	next = code + 4; \
+	break;
+
+#define MATHFUN_FLOAT_KERNEL1(KERNEL) \
+	simd->KERNEL(regs[code[1]], regs[code[2]], diverged ? mask : NULL, count); \
+	next = code + 3; \
+	break;
+
+// Conditional jump. Rows that disagree with the others get their own program counter.
+#define MATHFUN_FLOAT_BRANCH(COND, JMPIF, TARGET, NEXT) \
+	{ \
+		const mathfun_value_float *cond = (COND); \
+		const bool jmpif = (JMPIF); \
+		const mathfun_code *target = (TARGET); \
+		next = (NEXT); \
+		\
+		if (diverged) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				if (mask[i]) { \
+					pcs[i] = cond[i].boolean == jmpif ? target : next; \
+				} \
+			} \
+			continue; \
+		} \
+		\
+		size_t jumps = 0; \
+		for (size_t i = 0; i < count; ++ i) { \
+			jumps += cond[i].boolean == jmpif; \
+		} \
+		\
+		if (jumps == count) { \
+			next = target; \
+		} \
+		else if (jumps > 0) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				pcs[i] = cond[i].boolean == jmpif ? target : next; \
+			} \
+			diverged = true; \
+			continue; \
+		} \
+		break; \
+	}
+
+// Same as mathfun_exec_block() in batch.c. dargs is the argument buffer for
+// functions without single precision version.
+static bool mathfun_exec_block_float(const mathfun *fun, mathfun_value_float *regs[],
+	mathfun_value_float argbuf[], mathfun_value dargs[], size_t count, float out[], size_t offset,
+	const mathfun_code *entry, const mathfun_code *stop) {
+	const mathfun_code *start = fun->code;
+	const mathfun_value_float *consts = fun->float_consts;
+	const mathfun_batch_float_kernels *simd = mathfun_batch_float_simd;
+	const mathfun_code *pcs[MATHFUN_BATCH_SIZE];
+	uint32_t mask[MATHFUN_BATCH_SIZE];
+	size_t nlanes = count;
+	size_t live   = count;
+	bool diverged = false;
+	const mathfun_code *code = entry;
+
+	for (;;) {
+		if (diverged) {
+			// continue with the rows that are the furthest behind
+			code = NULL;
+			for (size_t i = 0; i < count; ++ i) {
+				if (pcs[i] && (!code || pcs[i] < code)) {
+					code = pcs[i];
+				}
+			}
+			nlanes = 0;
+			for (size_t i = 0; i < count; ++ i) {
+				if (pcs[i] == code) {
+					mask[i] = ~(uint32_t)0;
+					++ nlanes;
+				}
+				else {
+					mask[i] = 0;
+				}
+			}
+			// all rows met again?
+			diverged = nlanes < count;
+		}
+
+		if (code == stop) return true;
+
+		const mathfun_code *next = NULL;
+		switch (*code) {
+			case ADD: MATHFUN_FLOAT_KERNEL2(add);
+			case SUB: MATHFUN_FLOAT_KERNEL2(sub);
+			case MUL: MATHFUN_FLOAT_KERNEL2(mul);
+			case DIV: MATHFUN_FLOAT_KERNEL2(div);
+			// fmod is exact, so this is rounded only once
+			case MOD: MATHFUN_FLOAT_BINARY(number, (float)mathfun_mod(a[i].number, b[i].number));
+			case POW: MATHFUN_FLOAT_BINARY(number, powf(a[i].number, b[i].number));
+
+			case EQ:  MATHFUN_FLOAT_KERNEL2(eq);
+			case NE:  MATHFUN_FLOAT_KERNEL2(ne);
+			case LT:  MATHFUN_FLOAT_KERNEL2(lt);
+			case GT:  MATHFUN_FLOAT_KERNEL2(gt);
+			case LE:  MATHFUN_FLOAT_KERNEL2(le);
+			case GE:  MATHFUN_FLOAT_KERNEL2(ge);
+			case BEQ: MATHFUN_FLOAT_KERNEL2(beq);
+			case BNE: MATHFUN_FLOAT_KERNEL2(bne);
+
+			case NEG: MATHFUN_FLOAT_KERNEL1(neg);
+			case NOT: MATHFUN_FLOAT_KERNEL1(not);
+
+			case MOV:
+			{
+				const mathfun_value_float *a = regs[code[1]];
+				mathfun_value_float *b = regs[code[2]];
+				MATHFUN_FLOAT_FOR(b[i] = a[i]);
+				next = code + 3;
+				break;
+			}
+			case VAL:
+			{
+				const mathfun_value_float value = consts[code[1]];
+				mathfun_value_float *a = regs[code[2]];
+				MATHFUN_FLOAT_FOR(a[i] = value);
+				next = code + 3;
+				break;
+			}
+			case POWK:
+			{
+				const float k = consts[code[1]].number;
+				const mathfun_value_float *a = regs[code[2]];
+				mathfun_value_float *b = regs[code[3]];
+				MATHFUN_FLOAT_FOR(b[i].number = powf(a[i].number, k));
+				next = code + 4;
+				break;
+			}
+			case FMA:
+			{
+				const mathfun_value_float *a = regs[code[1]];
+				const mathfun_value_float *b = regs[code[2]];
+				const mathfun_value_float *c = regs[code[3]];
+				mathfun_value_float *d = regs[code[4]];
+				MATHFUN_FLOAT_FOR(d[i].number = fmaf(a[i].number, b[i].number, c[i].number));
+				next = code + 5;
+				break;
+			}
+			case CALL:
+			{
+				mathfun_binding_float float_funct = fun->float_functs[code[1]];
+				const mathfun_code argc     = code[2];
+				const mathfun_code firstarg = code[3];
+				mathfun_value_float *ret = regs[code[4]];
+				if (float_funct) {
+					MATHFUN_FLOAT_FOR(
+						for (mathfun_code arg = 0; arg < argc; ++ arg) {
+							argbuf[arg] = regs[firstarg + arg][i];
+						}
+						ret[i] = float_funct(argbuf));
+				}
+				else {
+					mathfun_binding_funct funct = fun->functs[code[1]];
+					const mathfun_sig *sig = fun->sigs[code[1]];
+					MATHFUN_FLOAT_FOR(
+						for (mathfun_code arg = 0; arg < argc; ++ arg) {
+							argbuf[arg] = regs[firstarg + arg][i];
+						}
+						ret[i] = mathfun_float_call_double(funct, sig, argbuf, dargs));
+				}
+				next = code + 5;
+				break;
+			}
+			case SETT:
+			{
+				mathfun_value_float *a = regs[code[1]];
+				MATHFUN_FLOAT_FOR(a[i].boolean = true);
+				next = code + 2;
+				break;
+			}
+			case SETF:
+			{
+				mathfun_value_float *a = regs[code[1]];
+				MATHFUN_FLOAT_FOR(a[i].boolean = false);
+				next = code + 2;
+				break;
+			}
+			case NOP:
+				next = code + 1;
+				break;
+
+			case JMP:
+				next = start + mathfun_code_adr(code + 1);
+				break;
+
+			case JMPT:
+			case JMPF:
+				MATHFUN_FLOAT_BRANCH(regs[code[1]], *code == JMPT, start + mathfun_code_adr(code + 2),
+					code + 2 + MATHFUN_ADR_CODES);
+
+			case MULADD:
+			case MULSUB:
+			{
+				const uint32_t *active = diverged ? mask : NULL;
+				simd->mul(regs[code[1]], regs[code[2]], regs[code[3]], active, count);
+				(*code == MULADD ? simd->add : simd->sub)(
+					regs[code[3]], regs[code[4]], regs[code[5]], active, count);
+				next = code + 6;
+				break;
+			}
+			case VADD:
+			case VSUB:
+			case VMUL:
+			case VDIV:
+			{
+				const mathfun_value_float value = consts[code[1]];
+				const mathfun_code *args = code + 2;
+				mathfun_value_float *a = regs[args[0]];
+				MATHFUN_FLOAT_FOR(a[i] = value);
+
+				mathfun_batch_float_binary kernel =
+					*code == VADD ? simd->add :
+					*code == VSUB ? simd->sub :
+					*code == VMUL ? simd->mul :
+					                simd->div;
+				kernel(regs[args[1]], regs[args[2]], regs[args[3]], diverged ? mask : NULL, count);
+				next = code + 6;
+				break;
+			}
+			case EQJ:
+			case NEJ:
+			case LTJ:
+			case GTJ:
+			case LEJ:
+			case GEJ:
+			{
+				const mathfun_batch_float_binary kernels[] = {
+					simd->eq, simd->ne,
+					simd->lt, simd->gt,
+					simd->le, simd->ge
+				};
+				kernels[*code - EQJ](regs[code[1]], regs[code[2]], regs[code[3]], diverged ? mask : NULL, count);
+				MATHFUN_FLOAT_BRANCH(regs[code[3]], code[4], start + mathfun_code_adr(code + 5),
+					code + 5 + MATHFUN_ADR_CODES);
+			}
+			case ADDK:
+			case SUBK:
+			case RSUBK:
+			case MULK:
+			case DIVK:
+			case RDIVK:
+			case EQK:
+			case NEK:
+			case LTK:
+			case GTK:
+			case LEK:
+			case GEK:
+			{
+				const mathfun_batch_float_const kernels[] = {
+					simd->addk, simd->subk, simd->rsubk,
+					simd->mulk, simd->divk, simd->rdivk,
+					simd->eqk,  simd->nek,  simd->ltk,
+					simd->gtk,  simd->lek,  simd->gek
+				};
+				kernels[*code - ADDK](regs[code[2]], consts[code[1]], regs[code[3]], diverged ? mask : NULL, count);
+				next = code + 4;
+				break;
+			}
+			case INK:
+			case INXK:
+			{
+				const float lower = consts[code[1]].number;
+				const float upper = consts[code[2]].number;
+				const mathfun_value_float *a = regs[code[3]];
+				mathfun_value_float *b = regs[code[4]];
+				if (*code == INK) {
+					MATHFUN_FLOAT_FOR(b[i].boolean = a[i].number >= lower && a[i].number <= upper);
+				}
+				else {
+					MATHFUN_FLOAT_FOR(b[i].boolean = a[i].number >= lower && a[i].number <  upper);
+				}
+				next = code + 5;
+				break;
+			}
+			case RET:
+			{
+				const mathfun_value_float *a = regs[code[1]];
+				float *ret = out + offset;
+				MATHFUN_FLOAT_FOR(ret[i] = a[i].number);
+
+				if (!diverged) return true;
+
+				MATHFUN_FLOAT_FOR(pcs[i] = NULL);
+				live -= nlanes;
+				if (live == 0) return true;
+				continue;
+			}
+			default:
+				for (size_t i = 0; i < count; ++ i) {
+					out[offset + i] = NAN;
+				}
+				return false;
+		}
+
+		if (diverged) {
+			MATHFUN_FLOAT_FOR(pcs[i] = next);
+		}
+		else {
+			code = next;
+		}
+	}
+}
+
+bool mathfun_exec_batch_float(const mathfun *fun, const float *args[], size_t n, float out[],
+	mathfun_error_p *error) {
+	if (fun->precision != MATHFUN_PRECISION_FLOAT) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	const size_t temps = fun->framesize - fun->argc;
+	mathfun_value_float **regs = malloc(fun->framesize * sizeof(mathfun_value_float*));
+	// temporary registers followed by the argument buffer used by CALL
+	mathfun_value_float *values = malloc((temps * MATHFUN_BATCH_SIZE + fun->framesize) * sizeof(mathfun_value_float));
+	mathfun_value *dargs = malloc(fun->framesize * sizeof(mathfun_value));
+
+	if (!regs || !values || !dargs) {
+		free(dargs);
+		free(values);
+		free(regs);
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	for (size_t reg = fun->argc; reg < fun->framesize; ++ reg) {
+		regs[reg] = values + (reg - fun->argc) * MATHFUN_BATCH_SIZE;
+	}
+	mathfun_value_float *argbuf = values + temps * MATHFUN_BATCH_SIZE;
+
+	const mathfun_code *entry = (const mathfun_code*)fun->code + fun->entry;
+
+	errno = 0;
+	bool ok = true;
+	for (size_t offset = 0; offset < n; offset += MATHFUN_BATCH_SIZE) {
+		const size_t count = n - offset < MATHFUN_BATCH_SIZE ? n - offset : MATHFUN_BATCH_SIZE;
+
+		// argument registers are never written, so they can point directly into the columns
+		for (size_t arg = 0; arg < fun->argc; ++ arg) {
+			regs[arg] = (mathfun_value_float*)(args[arg] + offset);
+		}
+
+		// the prologue once per call for the first row (see batch.c)
+		if (offset == 0 && fun->entry > 0) {
+			ok = mathfun_exec_block_float(fun, regs, argbuf, dargs, 1, out, offset, fun->code, entry);
+
+			for (size_t reg = fun->argc; reg < fun->framesize; ++ reg) {
+				for (size_t i = 1; i < MATHFUN_BATCH_SIZE; ++ i) {
+					regs[reg][i] = regs[reg][0];
+				}
+			}
+		}
+
+		ok = mathfun_exec_block_float(fun, regs, argbuf, dargs, count, out, offset, entry, NULL) && ok;
+	}
+
+	free(dargs);
+	free(values);
+	free(regs);
+
+	if (!ok) {
+		errno = EINVAL;
+	}
+
+	if (errno != 0) {
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	return true;
+}
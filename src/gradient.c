@@ -0,0 +1,663 @@
+#include <errno.h>
+
+#include "mathfun_intern.h"
+
+// Reverse mode automatic differentiation. The byte code is executed forward
+// like mathfun_exec() does, but every instruction that produces a value
+// appends the operand values its partial derivatives need and its own offset
+// to the tape. Then the tape is walked backwards, accumulating the adjoint of
+// every register: an instruction that wrote register d takes the adjoint of d,
+// resets it (the register held another value before) and adds the scaled
+// adjoint to its operands. In the end the adjoints of the argument registers
+// are the gradient.
+//
+// Code only jumps forward, so every instruction is executed at most once and
+// the tape needs at most mathfun_gradient_tapesize() values. It lives in the
+// frame behind the registers and their adjoints:
+//
+//     | registers (framesize) | adjoints (framesize) | tape (tapesize) |
+//
+// Comparisons and booleans have no adjoint, their instructions are recorded
+// only to reset the adjoint of the written register. Like in dual.c partial
+// derivatives that are zero are skipped, and a function without a derivative
+// rule passes NaN to all of its arguments.
+
+// number of tape values instruction code needs at most
+static size_t mathfun_tape_size(const mathfun_code *code) {
+	switch (*code) {
+		case NOP:
+		case RET:
+		case JMP:
+		case JMPT:
+		case JMPF:
+		case END:
+			return 0;
+
+		case CALL:
+			// arguments and the partial derivatives
+			return 1 + 2 * (size_t)code[2];
+
+		case MOD:
+			return 2;
+
+		case MUL:
+		case DIV:
+		case MULADD:
+		case MULSUB:
+		case VMUL:
+		case VDIV:
+		case RDIVK:
+			return 3;
+
+		case POWK:
+		case FMA:
+			return 3;
+
+		case POW:
+			return 4;
+
+		default:
+			return 1;
+	}
+}
+
+size_t mathfun_gradient_tapesize(const mathfun *fun) {
+	const mathfun_code *code = fun->code;
+	// one more, so the size of a compiled gradient is never 0
+	size_t size = 1;
+	while (*code != END) {
+		size += mathfun_tape_size(code);
+		code += mathfun_code_size(code);
+	}
+	return size;
+}
+
+#define MATHFUN_TAPE_PUSH(VALUE) (tape ++)->number = (VALUE)
+#define MATHFUN_TAPE_RECORD() (tape ++)->number = (double)(code - start)
+
+#define MATHFUN_GRAD_BINARY(OP) \
+	regs[code[3]].number = regs[code[1]].number OP regs[code[2]].number; \
+	MATHFUN_TAPE_RECORD(); \
+	code += 4; \
+	break;
+
+#define MATHFUN_GRAD_COMPARE(OP) \
+	regs[code[3]].boolean = regs[code[1]].number OP regs[code[2]].number; \
+	MATHFUN_TAPE_RECORD(); \
+	code += 4; \
+	break;
+
+#define MATHFUN_GRAD_MUL_BINARY(OP) \
+	MATHFUN_TAPE_PUSH(regs[code[1]].number); \
+	MATHFUN_TAPE_PUSH(regs[code[2]].number); \
+	regs[code[3]].number = regs[code[1]].number * regs[code[2]].number; \
+	regs[code[5]].number = regs[code[3]].number OP regs[code[4]].number; \
+	MATHFUN_TAPE_RECORD(); \
+	code += 6; \
+	break;
+
+#define MATHFUN_GRAD_VAL_BINARY(OP) \
+	regs[code[2]] = consts[code[1]]; \
+	regs[code[5]].number = regs[code[3]].number OP regs[code[4]].number; \
+	MATHFUN_TAPE_RECORD(); \
+	code += 6; \
+	break;
+
+#define MATHFUN_GRAD_COMPARE_JUMP(OP) \
+	regs[code[3]].boolean = regs[code[1]].number OP regs[code[2]].number; \
+	MATHFUN_TAPE_RECORD(); \
+	if (regs[code[3]].boolean == (bool)code[4]) { \
+		code = start + mathfun_code_adr(code + 5); \
+	} \
+	else { \
+		code += 5 + MATHFUN_ADR_CODES; \
+	} \
+	break;
+
+#define MATHFUN_GRAD_IMMEDIATE(EXPR) \
+	{ \
+		const double k = consts[code[1]].number; \
+		const double a = regs[code[2]].number; \
+		regs[code[3]].number = (EXPR); \
+	} \
+	MATHFUN_TAPE_RECORD(); \
+	code += 4; \
+	break;
+
+#define MATHFUN_GRAD_COMPARE_IMMEDIATE(OP) \
+	regs[code[3]].boolean = regs[code[2]].number OP consts[code[1]].number; \
+	MATHFUN_TAPE_RECORD(); \
+	code += 4; \
+	break;
+
+#define MATHFUN_GRAD_IN_IMMEDIATE(OP) \
+	{ \
+		const double a = regs[code[3]].number; \
+		regs[code[4]].boolean = a >= consts[code[1]].number && a OP consts[code[2]].number; \
+	} \
+	MATHFUN_TAPE_RECORD(); \
+	code += 5; \
+	break;
+
+// Forward sweep. Returns the end of the tape or NULL on an illegal instruction.
+static mathfun_value *mathfun_exec_tape(const mathfun *fun, mathfun_value regs[], mathfun_value tape[],
+	mathfun_code *ret) {
+	const mathfun_code *start = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_funct *functs = fun->functs;
+	const mathfun_code *code = start;
+
+	for (;;) {
+		switch (*code) {
+			case NOP:
+				++ code;
+				break;
+
+			case RET:
+				*ret = code[1];
+				return tape;
+
+			case MOV:
+				regs[code[2]] = regs[code[1]];
+				MATHFUN_TAPE_RECORD();
+				code += 3;
+				break;
+
+			case VAL:
+				regs[code[2]] = consts[code[1]];
+				MATHFUN_TAPE_RECORD();
+				code += 3;
+				break;
+
+			case CALL:
+			{
+				const mathfun_code argc = code[2];
+				const mathfun_value *args = regs + code[3];
+				for (mathfun_code i = 0; i < argc; ++ i) {
+					*(tape ++) = args[i];
+				}
+				// room for the partial derivatives
+				tape += argc;
+				regs[code[4]] = functs[code[1]](args);
+				MATHFUN_TAPE_RECORD();
+				code += 5;
+				break;
+			}
+			case NEG:
+				regs[code[2]].number = -regs[code[1]].number;
+				MATHFUN_TAPE_RECORD();
+				code += 3;
+				break;
+
+			case ADD: MATHFUN_GRAD_BINARY(+)
+			case SUB: MATHFUN_GRAD_BINARY(-)
+
+			case MUL:
+				MATHFUN_TAPE_PUSH(regs[code[1]].number);
+				MATHFUN_TAPE_PUSH(regs[code[2]].number);
+				regs[code[3]].number = regs[code[1]].number * regs[code[2]].number;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+
+			case DIV:
+			{
+				const double b = regs[code[2]].number;
+				const double c = regs[code[1]].number / b;
+				MATHFUN_TAPE_PUSH(b);
+				MATHFUN_TAPE_PUSH(c);
+				regs[code[3]].number = c;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+			}
+			case MOD:
+			{
+				const double a = regs[code[1]].number;
+				const double b = regs[code[2]].number;
+				const double c = mathfun_mod(a, b);
+				// a = q * b + c with integer q
+				MATHFUN_TAPE_PUSH(nearbyint((a - c) / b));
+				regs[code[3]].number = c;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+			}
+			case POW:
+			{
+				const double a = regs[code[1]].number;
+				const double b = regs[code[2]].number;
+				const double c = pow(a, b);
+				MATHFUN_TAPE_PUSH(a);
+				MATHFUN_TAPE_PUSH(b);
+				MATHFUN_TAPE_PUSH(c);
+				regs[code[3]].number = c;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+			}
+			case POWK:
+			{
+				const double k = consts[code[1]].number;
+				const double a = regs[code[2]].number;
+				MATHFUN_TAPE_PUSH(a);
+				MATHFUN_TAPE_PUSH(k);
+				regs[code[3]].number = mathfun_pow_k(a, k);
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+			}
+			case FMA:
+			{
+				const double a = regs[code[1]].number;
+				const double b = regs[code[2]].number;
+				MATHFUN_TAPE_PUSH(a);
+				MATHFUN_TAPE_PUSH(b);
+				regs[code[4]].number = fma(a, b, regs[code[3]].number);
+				MATHFUN_TAPE_RECORD();
+				code += 5;
+				break;
+			}
+			case NOT:
+				regs[code[2]].boolean = !regs[code[1]].boolean;
+				MATHFUN_TAPE_RECORD();
+				code += 3;
+				break;
+
+			case EQ: MATHFUN_GRAD_COMPARE(==)
+			case NE: MATHFUN_GRAD_COMPARE(!=)
+			case LT: MATHFUN_GRAD_COMPARE(<)
+			case GT: MATHFUN_GRAD_COMPARE(>)
+			case LE: MATHFUN_GRAD_COMPARE(<=)
+			case GE: MATHFUN_GRAD_COMPARE(>=)
+
+			case BEQ:
+				regs[code[3]].boolean = regs[code[1]].boolean == regs[code[2]].boolean;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+
+			case BNE:
+				regs[code[3]].boolean = regs[code[1]].boolean != regs[code[2]].boolean;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+
+			case JMP:
+				code = start + mathfun_code_adr(code + 1);
+				break;
+
+			case JMPT:
+				if (regs[code[1]].boolean) {
+					code = start + mathfun_code_adr(code + 2);
+				}
+				else {
+					code += 2 + MATHFUN_ADR_CODES;
+				}
+				break;
+
+			case JMPF:
+				if (regs[code[1]].boolean) {
+					code += 2 + MATHFUN_ADR_CODES;
+				}
+				else {
+					code = start + mathfun_code_adr(code + 2);
+				}
+				break;
+
+			case SETT:
+			case SETF:
+				regs[code[1]].boolean = *code == SETT;
+				MATHFUN_TAPE_RECORD();
+				code += 2;
+				break;
+
+			case MULADD: MATHFUN_GRAD_MUL_BINARY(+)
+			case MULSUB: MATHFUN_GRAD_MUL_BINARY(-)
+
+			case VADD: MATHFUN_GRAD_VAL_BINARY(+)
+			case VSUB: MATHFUN_GRAD_VAL_BINARY(-)
+
+			case VMUL:
+				regs[code[2]] = consts[code[1]];
+				MATHFUN_TAPE_PUSH(regs[code[3]].number);
+				MATHFUN_TAPE_PUSH(regs[code[4]].number);
+				regs[code[5]].number = regs[code[3]].number * regs[code[4]].number;
+				MATHFUN_TAPE_RECORD();
+				code += 6;
+				break;
+
+			case VDIV:
+			{
+				regs[code[2]] = consts[code[1]];
+				const double b = regs[code[4]].number;
+				const double c = regs[code[3]].number / b;
+				MATHFUN_TAPE_PUSH(b);
+				MATHFUN_TAPE_PUSH(c);
+				regs[code[5]].number = c;
+				MATHFUN_TAPE_RECORD();
+				code += 6;
+				break;
+			}
+			case EQJ: MATHFUN_GRAD_COMPARE_JUMP(==)
+			case NEJ: MATHFUN_GRAD_COMPARE_JUMP(!=)
+			case LTJ: MATHFUN_GRAD_COMPARE_JUMP(<)
+			case GTJ: MATHFUN_GRAD_COMPARE_JUMP(>)
+			case LEJ: MATHFUN_GRAD_COMPARE_JUMP(<=)
+			case GEJ: MATHFUN_GRAD_COMPARE_JUMP(>=)
+
+			case ADDK: MATHFUN_GRAD_IMMEDIATE(a + k)
+			case SUBK: MATHFUN_GRAD_IMMEDIATE(a - k)
+			case RSUBK: MATHFUN_GRAD_IMMEDIATE(k - a)
+			case MULK: MATHFUN_GRAD_IMMEDIATE(a * k)
+			case DIVK: MATHFUN_GRAD_IMMEDIATE(a / k)
+
+			case RDIVK:
+			{
+				const double a = regs[code[2]].number;
+				const double c = consts[code[1]].number / a;
+				MATHFUN_TAPE_PUSH(a);
+				MATHFUN_TAPE_PUSH(c);
+				regs[code[3]].number = c;
+				MATHFUN_TAPE_RECORD();
+				code += 4;
+				break;
+			}
+			case EQK: MATHFUN_GRAD_COMPARE_IMMEDIATE(==)
+			case NEK: MATHFUN_GRAD_COMPARE_IMMEDIATE(!=)
+			case LTK: MATHFUN_GRAD_COMPARE_IMMEDIATE(<)
+			case GTK: MATHFUN_GRAD_COMPARE_IMMEDIATE(>)
+			case LEK: MATHFUN_GRAD_COMPARE_IMMEDIATE(<=)
+			case GEK: MATHFUN_GRAD_COMPARE_IMMEDIATE(>=)
+
+			case INK:  MATHFUN_GRAD_IN_IMMEDIATE(<=)
+			case INXK: MATHFUN_GRAD_IN_IMMEDIATE(<)
+
+			default:
+				return NULL;
+		}
+	}
+}
+
+// takes the adjoint of the register written by an instruction
+#define MATHFUN_ADJOINT(REG) \
+	g = adj[REG].number; \
+	adj[REG].number = 0.0;
+
+// Reverse sweep from the end of the tape back to its start.
+static void mathfun_exec_adjoint(const mathfun *fun, mathfun_value adj[], const mathfun_value tape[],
+	mathfun_value *end) {
+	const mathfun_code *start = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_deriv *derivs = fun->derivs;
+
+	while (end > tape) {
+		const mathfun_code *code = start + (size_t)(-- end)->number;
+		double g;
+
+		switch (*code) {
+			case MOV:
+				MATHFUN_ADJOINT(code[2]);
+				adj[code[1]].number += g;
+				break;
+
+			case CALL:
+			{
+				const mathfun_code argc = code[2];
+				end -= 2 * (size_t)argc;
+				MATHFUN_ADJOINT(code[4]);
+				if (g == 0.0) break;
+
+				const mathfun_binding_deriv deriv = derivs ? derivs[code[1]] : NULL;
+				mathfun_value *args = adj + code[3];
+				if (!deriv) {
+					for (mathfun_code i = 0; i < argc; ++ i) {
+						args[i].number = NAN;
+					}
+					break;
+				}
+
+				// the forward sweep reserved room for the partial derivatives behind the arguments
+				double *grad = (double*)(end + argc);
+				for (mathfun_code i = 0; i < argc; ++ i) {
+					grad[i] = 0.0;
+				}
+				deriv(end, grad);
+				for (mathfun_code i = 0; i < argc; ++ i) {
+					if (grad[i] != 0.0) {
+						args[i].number += g * grad[i];
+					}
+				}
+				break;
+			}
+			case NEG:
+				MATHFUN_ADJOINT(code[2]);
+				adj[code[1]].number -= g;
+				break;
+
+			case ADD:
+				MATHFUN_ADJOINT(code[3]);
+				adj[code[1]].number += g;
+				adj[code[2]].number += g;
+				break;
+
+			case SUB:
+				MATHFUN_ADJOINT(code[3]);
+				adj[code[1]].number += g;
+				adj[code[2]].number -= g;
+				break;
+
+			case MUL:
+			case DIV:
+			{
+				end -= 2;
+				MATHFUN_ADJOINT(code[3]);
+				if (g == 0.0) break;
+
+				if (*code == MUL) {
+					// saved: a, b
+					adj[code[1]].number += g * end[1].number;
+					adj[code[2]].number += g * end[0].number;
+				}
+				else {
+					// saved: b, a / b
+					const double gb = g / end[0].number;
+					adj[code[1]].number += gb;
+					adj[code[2]].number -= gb * end[1].number;
+				}
+				break;
+			}
+			case MOD:
+				-- end;
+				MATHFUN_ADJOINT(code[3]);
+				if (g == 0.0) break;
+				adj[code[1]].number += g;
+				adj[code[2]].number -= g * end->number;
+				break;
+
+			case POW:
+			{
+				end -= 3;
+				MATHFUN_ADJOINT(code[3]);
+				if (g == 0.0) break;
+
+				const double a = end[0].number, b = end[1].number, c = end[2].number;
+				// NaNs of constant operands (e.g. log(a) of x**2 for x < 0) are reset
+				// again when the instruction that loaded the constant is reached
+				adj[code[1]].number += g * b * pow(a, b - 1.0);
+				adj[code[2]].number += g * c * log(a);
+				break;
+			}
+			case POWK:
+				end -= 2;
+				MATHFUN_ADJOINT(code[3]);
+				if (g == 0.0) break;
+				adj[code[2]].number += g * end[1].number * pow(end[0].number, end[1].number - 1.0);
+				break;
+
+			case FMA:
+				// saved: a, b
+				end -= 2;
+				MATHFUN_ADJOINT(code[4]);
+				if (g == 0.0) break;
+				adj[code[1]].number += g * end[1].number;
+				adj[code[2]].number += g * end[0].number;
+				adj[code[3]].number += g;
+				break;
+
+			case NOT:
+				adj[code[2]].number = 0.0;
+				break;
+
+			case EQ:
+			case NE:
+			case LT:
+			case GT:
+			case LE:
+			case GE:
+			case BEQ:
+			case BNE:
+			case EQJ:
+			case NEJ:
+			case LTJ:
+			case GTJ:
+			case LEJ:
+			case GEJ:
+			case EQK:
+			case NEK:
+			case LTK:
+			case GTK:
+			case LEK:
+			case GEK:
+				adj[code[3]].number = 0.0;
+				break;
+
+			case INK:
+			case INXK:
+				adj[code[4]].number = 0.0;
+				break;
+
+			case VAL:
+				adj[code[2]].number = 0.0;
+				break;
+
+			case SETT:
+			case SETF:
+				adj[code[1]].number = 0.0;
+				break;
+
+			case MULADD:
+			case MULSUB:
+			{
+				end -= 2;
+				MATHFUN_ADJOINT(code[5]);
+				adj[code[3]].number += g;
+				if (*code == MULADD) {
+					adj[code[4]].number += g;
+				}
+				else {
+					adj[code[4]].number -= g;
+				}
+
+				MATHFUN_ADJOINT(code[3]);
+				if (g == 0.0) break;
+				adj[code[1]].number += g * end[1].number;
+				adj[code[2]].number += g * end[0].number;
+				break;
+			}
+			case VADD:
+			case VSUB:
+				MATHFUN_ADJOINT(code[5]);
+				adj[code[3]].number += g;
+				if (*code == VADD) {
+					adj[code[4]].number += g;
+				}
+				else {
+					adj[code[4]].number -= g;
+				}
+				adj[code[2]].number = 0.0;
+				break;
+
+			case VMUL:
+				end -= 2;
+				MATHFUN_ADJOINT(code[5]);
+				adj[code[3]].number += g * end[1].number;
+				adj[code[4]].number += g * end[0].number;
+				adj[code[2]].number = 0.0;
+				break;
+
+			case VDIV:
+			{
+				end -= 2;
+				MATHFUN_ADJOINT(code[5]);
+				const double gb = g / end[0].number;
+				adj[code[3]].number += gb;
+				adj[code[4]].number -= gb * end[1].number;
+				adj[code[2]].number = 0.0;
+				break;
+			}
+			case ADDK:
+			case SUBK:
+				MATHFUN_ADJOINT(code[3]);
+				adj[code[2]].number += g;
+				break;
+
+			case RSUBK:
+				MATHFUN_ADJOINT(code[3]);
+				adj[code[2]].number -= g;
+				break;
+
+			case MULK:
+				MATHFUN_ADJOINT(code[3]);
+				adj[code[2]].number += g * consts[code[1]].number;
+				break;
+
+			case DIVK:
+				MATHFUN_ADJOINT(code[3]);
+				adj[code[2]].number += g / consts[code[1]].number;
+				break;
+
+			case RDIVK:
+				// saved: a, k / a
+				end -= 2;
+				MATHFUN_ADJOINT(code[3]);
+				if (g == 0.0) break;
+				adj[code[2]].number -= g * end[1].number / end[0].number;
+				break;
+		}
+	}
+}
+
+double mathfun_exec_gradient(const mathfun *fun, mathfun_value frame[], double grad[]) {
+	const size_t framesize = fun->framesize;
+	mathfun_value *adj  = frame + framesize;
+	mathfun_value *tape = adj + framesize;
+	mathfun_code ret = 0;
+
+	mathfun_value *end = mathfun_exec_tape(fun, frame, tape, &ret);
+
+	if (!end) {
+		errno = EINVAL;
+		for (size_t i = 0; i < fun->argc; ++ i) {
+			grad[i] = NAN;
+		}
+		return NAN;
+	}
+
+	for (size_t i = 0; i < framesize; ++ i) {
+		adj[i].number = 0.0;
+	}
+	adj[ret].number = 1.0;
+
+	// math errors of partial derivatives that are discarded (like log(a) of x**2
+	// for x < 0) are no errors of the function
+	const int errnum = errno;
+	mathfun_exec_adjoint(fun, adj, tape, end);
+	errno = errnum;
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		grad[i] = adj[i].number;
+	}
+
+	return frame[ret].number;
+}
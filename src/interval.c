@@ -0,0 +1,956 @@
+#include <errno.h>
+#include <float.h>
+
+#include "mathfun_intern.h"
+
+// Interval arithmetic. The byte code is executed with intervals [lo, hi] in
+// place of numbers and every instruction computes an interval that contains all
+// results of the instruction for operands within its operand intervals. Bounds
+// are rounded outward, so the result also contains the exact (real) results.
+//
+// Values outside of the domain of an operation are ignored (like the set based
+// intervals of IEEE 1788): sqrt([-1, 4]) is [0, 2] and sqrt([-4, -1]) is the
+// empty interval [NaN, NaN]. Operations of empty intervals are empty.
+//
+// Booleans are tri-state: [0, 0] is false, [1, 1] is true and [0, 1] may be
+// either. A conditional jump on a maybe forks the execution: the thread falls
+// through, a copy of it takes the jump. Because code only jumps forward, the
+// threads meet again where the branches join. The thread that is furthest
+// behind always runs until it catches up with the next one, and threads at the
+// same instruction are merged by taking the hull of their registers. So the
+// number of threads stays small and every instruction is executed at most once
+// per thread that reaches it.
+//
+// Functions use their interval versions (fun->intervals). A function without
+// one gets the whole real line or maybe (see mathfun_interval_any_number()).
+
+#define MATHFUN_INTERVAL_EMPTY  ((mathfun_interval){ NAN, NAN })
+#define MATHFUN_INTERVAL_ENTIRE ((mathfun_interval){ -INFINITY, INFINITY })
+#define MATHFUN_INTERVAL_FALSE  ((mathfun_interval){ 0.0, 0.0 })
+#define MATHFUN_INTERVAL_TRUE   ((mathfun_interval){ 1.0, 1.0 })
+#define MATHFUN_INTERVAL_MAYBE  ((mathfun_interval){ 0.0, 1.0 })
+
+#define MATHFUN_IS_EMPTY(A) isnan((A).lo)
+
+// Below this magnitude the error terms used for rounding may underflow, so
+// results are just widened.
+#define MATHFUN_EXACT_MIN 0x1p-969
+
+static inline double mathfun_down(double x) {
+	return isnan(x) ? -INFINITY : nextafter(x, -INFINITY);
+}
+
+static inline double mathfun_up(double x) {
+	return isnan(x) ? INFINITY : nextafter(x, INFINITY);
+}
+
+// The functions of the C math library aren't correctly rounded, but they are
+// accurate to an ulp or so. Zero results are exact (they are exact or underflow
+// like mathfun_call() does).
+static inline double mathfun_libm_down(double x) {
+	return x == 0.0 ? x : mathfun_down(mathfun_down(x));
+}
+
+static inline double mathfun_libm_up(double x) {
+	return x == 0.0 ? x : mathfun_up(mathfun_up(x));
+}
+
+// Correctly rounded operations are rounded outward by the sign of their exact
+// error, so exact results stay exact.
+
+static double mathfun_add_down(double x, double y) {
+	const double s = x + y;
+	if (!isfinite(s)) return mathfun_down(s);
+	const double t = s - x;
+	return (x - (s - t)) + (y - t) < 0.0 ? mathfun_down(s) : s;
+}
+
+static double mathfun_add_up(double x, double y) {
+	const double s = x + y;
+	if (!isfinite(s)) return mathfun_up(s);
+	const double t = s - x;
+	return (x - (s - t)) + (y - t) > 0.0 ? mathfun_up(s) : s;
+}
+
+// 0 * inf is 0 here, inf only stands for the unbounded end of an interval
+static double mathfun_mul_down(double x, double y) {
+	if (x == 0.0 || y == 0.0) return 0.0;
+	const double p = x * y;
+	if (!isfinite(p) || fabs(p) < MATHFUN_EXACT_MIN) return mathfun_down(p);
+	return fma(x, y, -p) < 0.0 ? mathfun_down(p) : p;
+}
+
+static double mathfun_mul_up(double x, double y) {
+	if (x == 0.0 || y == 0.0) return 0.0;
+	const double p = x * y;
+	if (!isfinite(p) || fabs(p) < MATHFUN_EXACT_MIN) return mathfun_up(p);
+	return fma(x, y, -p) > 0.0 ? mathfun_up(p) : p;
+}
+
+// y != 0, the exact quotient is q + r / y
+static double mathfun_div_down(double x, double y) {
+	const double q = x / y;
+	if (x == 0.0) return q;
+	if (!isfinite(q) || !isfinite(y) || fabs(q) < MATHFUN_EXACT_MIN || fabs(x) < MATHFUN_EXACT_MIN) {
+		return mathfun_down(q);
+	}
+	const double r = fma(-q, y, x);
+	return r != 0.0 && (r < 0.0) != (y < 0.0) ? mathfun_down(q) : q;
+}
+
+static double mathfun_div_up(double x, double y) {
+	const double q = x / y;
+	if (x == 0.0) return q;
+	if (!isfinite(q) || !isfinite(y) || fabs(q) < MATHFUN_EXACT_MIN || fabs(x) < MATHFUN_EXACT_MIN) {
+		return mathfun_up(q);
+	}
+	const double r = fma(-q, y, x);
+	return r != 0.0 && (r < 0.0) == (y < 0.0) ? mathfun_up(q) : q;
+}
+
+// x >= 0, the exact root is s + r / (2 s) roughly
+static double mathfun_sqrt_down(double x) {
+	const double s = sqrt(x);
+	if (s == 0.0 || isinf(s)) return s;
+	if (x < MATHFUN_EXACT_MIN) return mathfun_down(s);
+	return fma(-s, s, x) < 0.0 ? mathfun_down(s) : s;
+}
+
+static double mathfun_sqrt_up(double x) {
+	const double s = sqrt(x);
+	if (s == 0.0 || isinf(s)) return s;
+	if (x < MATHFUN_EXACT_MIN) return mathfun_up(s);
+	return fma(-s, s, x) > 0.0 ? mathfun_up(s) : s;
+}
+
+static inline mathfun_interval mathfun_tristate(bool is_true, bool is_false) {
+	return is_true ? MATHFUN_INTERVAL_TRUE : is_false ? MATHFUN_INTERVAL_FALSE : MATHFUN_INTERVAL_MAYBE;
+}
+
+// smallest and biggest magnitude within a
+static inline double mathfun_interval_mig(mathfun_interval a) {
+	return a.lo > 0.0 ? a.lo : a.hi < 0.0 ? -a.hi : 0.0;
+}
+
+static inline double mathfun_interval_mag(mathfun_interval a) {
+	return fmax(-a.lo, a.hi);
+}
+
+static mathfun_interval mathfun_interval_hull(mathfun_interval a, mathfun_interval b) {
+	// fmin/fmax ignore NaN, so the empty interval is neutral
+	return (mathfun_interval){ fmin(a.lo, b.lo), fmax(a.hi, b.hi) };
+}
+
+static mathfun_interval mathfun_interval_neg(mathfun_interval a) {
+	return (mathfun_interval){ -a.hi, -a.lo };
+}
+
+static mathfun_interval mathfun_interval_add(mathfun_interval a, mathfun_interval b) {
+	if (MATHFUN_IS_EMPTY(a) || MATHFUN_IS_EMPTY(b)) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){ mathfun_add_down(a.lo, b.lo), mathfun_add_up(a.hi, b.hi) };
+}
+
+static mathfun_interval mathfun_interval_sub(mathfun_interval a, mathfun_interval b) {
+	if (MATHFUN_IS_EMPTY(a) || MATHFUN_IS_EMPTY(b)) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){ mathfun_add_down(a.lo, -b.hi), mathfun_add_up(a.hi, -b.lo) };
+}
+
+static mathfun_interval mathfun_interval_mul(mathfun_interval a, mathfun_interval b) {
+	if (MATHFUN_IS_EMPTY(a) || MATHFUN_IS_EMPTY(b)) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){
+		fmin(fmin(mathfun_mul_down(a.lo, b.lo), mathfun_mul_down(a.lo, b.hi)),
+		     fmin(mathfun_mul_down(a.hi, b.lo), mathfun_mul_down(a.hi, b.hi))),
+		fmax(fmax(mathfun_mul_up(a.lo, b.lo), mathfun_mul_up(a.lo, b.hi)),
+		     fmax(mathfun_mul_up(a.hi, b.lo), mathfun_mul_up(a.hi, b.hi)))
+	};
+}
+
+static mathfun_interval mathfun_interval_div(mathfun_interval a, mathfun_interval b) {
+	if (MATHFUN_IS_EMPTY(a) || MATHFUN_IS_EMPTY(b)) return MATHFUN_INTERVAL_EMPTY;
+
+	if (b.lo > 0.0 || b.hi < 0.0) {
+		return (mathfun_interval){
+			fmin(fmin(mathfun_div_down(a.lo, b.lo), mathfun_div_down(a.lo, b.hi)),
+			     fmin(mathfun_div_down(a.hi, b.lo), mathfun_div_down(a.hi, b.hi))),
+			fmax(fmax(mathfun_div_up(a.lo, b.lo), mathfun_div_up(a.lo, b.hi)),
+			     fmax(mathfun_div_up(a.hi, b.lo), mathfun_div_up(a.hi, b.hi)))
+		};
+	}
+
+	// division by zero is undefined, so only the nonzero part of b counts
+	if (b.lo == 0.0 && b.hi == 0.0) return MATHFUN_INTERVAL_EMPTY;
+	if (a.lo == 0.0 && a.hi == 0.0) return a;
+
+	if (b.lo == 0.0) {
+		if (a.lo >= 0.0) return (mathfun_interval){ mathfun_div_down(a.lo, b.hi), INFINITY };
+		if (a.hi <= 0.0) return (mathfun_interval){ -INFINITY, mathfun_div_up(a.hi, b.hi) };
+	}
+	else if (b.hi == 0.0) {
+		if (a.lo >= 0.0) return (mathfun_interval){ -INFINITY, mathfun_div_up(a.lo, b.lo) };
+		if (a.hi <= 0.0) return (mathfun_interval){ mathfun_div_down(a.hi, b.lo), INFINITY };
+	}
+
+	return MATHFUN_INTERVAL_ENTIRE;
+}
+
+// see mathfun_mod(): the result has the sign of the divisor
+static mathfun_interval mathfun_interval_mod(mathfun_interval a, mathfun_interval b) {
+	if (MATHFUN_IS_EMPTY(a) || MATHFUN_IS_EMPTY(b)) return MATHFUN_INTERVAL_EMPTY;
+	if (b.lo == 0.0 && b.hi == 0.0) return MATHFUN_INTERVAL_EMPTY;
+
+	if (b.lo == b.hi && isfinite(b.lo) && isfinite(a.lo) && isfinite(a.hi)) {
+		// x % y == -(-x % -y), so reduce to y > 0
+		const double y = fabs(b.lo);
+		const double x = b.lo > 0.0 ? a.lo : -a.hi;
+		const double r = fmod(x, y); // exact
+		const double lo = r < 0.0 ? mathfun_add_down(r, y) : r;
+		const double hi = mathfun_add_up(r < 0.0 ? mathfun_add_up(r, y) : r, mathfun_add_up(a.hi, -a.lo));
+
+		// all of a within one period
+		if (hi < y) {
+			const mathfun_interval c = { lo, hi };
+			return b.lo > 0.0 ? c : mathfun_interval_neg(c);
+		}
+	}
+
+	if (b.lo > 0.0) return (mathfun_interval){ 0.0, a.lo >= 0.0 ? fmin(a.hi, b.hi) : b.hi };
+	if (b.hi < 0.0) return (mathfun_interval){ a.hi <= 0.0 ? fmax(a.lo, b.lo) : b.lo, 0.0 };
+	return b;
+}
+
+static mathfun_interval mathfun_interval_pow(mathfun_interval a, mathfun_interval b) {
+	if (MATHFUN_IS_EMPTY(a) || MATHFUN_IS_EMPTY(b)) return MATHFUN_INTERVAL_EMPTY;
+
+	if (b.lo == b.hi) {
+		const double n = b.lo;
+		if (n == 0.0) return (mathfun_interval){ 1.0, 1.0 }; // x**0 is 1 for any x
+
+		if (n == nearbyint(n) && fabs(n) < 0x1p53) {
+			const bool odd = fmod(n, 2.0) != 0.0;
+
+			if (n > 0.0) {
+				if (odd) {
+					return (mathfun_interval){ mathfun_libm_down(pow(a.lo, n)), mathfun_libm_up(pow(a.hi, n)) };
+				}
+				return (mathfun_interval){
+					mathfun_libm_down(pow(mathfun_interval_mig(a), n)),
+					mathfun_libm_up(pow(mathfun_interval_mag(a), n))
+				};
+			}
+
+			// negative powers have a pole at 0
+			if (a.lo == 0.0 && a.hi == 0.0) return MATHFUN_INTERVAL_EMPTY;
+			if (!odd) {
+				return (mathfun_interval){
+					mathfun_libm_down(pow(mathfun_interval_mag(a), n)),
+					mathfun_libm_up(pow(mathfun_interval_mig(a), n))
+				};
+			}
+			if (a.lo >= 0.0) return (mathfun_interval){ mathfun_libm_down(pow(a.hi, n)), a.lo == 0.0 ? INFINITY : mathfun_libm_up(pow(a.lo, n)) };
+			if (a.hi <= 0.0) return (mathfun_interval){ a.hi == 0.0 ? -INFINITY : mathfun_libm_down(pow(a.hi, n)), mathfun_libm_up(pow(a.lo, n)) };
+			return MATHFUN_INTERVAL_ENTIRE;
+		}
+	}
+	else if (a.lo < 0.0) {
+		// negative bases are only defined for integer exponents
+		return MATHFUN_INTERVAL_ENTIRE;
+	}
+
+	// only x >= 0 is defined from here on and x**y = exp(y * log(x)), where
+	// y * log(x) takes its extrema at the corners
+	const double lo = fmax(a.lo, 0.0);
+	if (lo > a.hi) return MATHFUN_INTERVAL_EMPTY;
+
+	const double c1 = pow(lo,   b.lo);
+	const double c2 = pow(lo,   b.hi);
+	const double c3 = pow(a.hi, b.lo);
+	const double c4 = pow(a.hi, b.hi);
+	return (mathfun_interval){
+		mathfun_libm_down(fmin(fmin(c1, c2), fmin(c3, c4))),
+		mathfun_libm_up(fmax(fmax(c1, c2), fmax(c3, c4)))
+	};
+}
+
+static inline mathfun_interval mathfun_interval_eq(mathfun_interval a, mathfun_interval b) {
+	return mathfun_tristate(a.lo == a.hi && b.lo == b.hi && a.lo == b.lo, a.hi < b.lo || b.hi < a.lo);
+}
+
+static inline mathfun_interval mathfun_interval_lt(mathfun_interval a, mathfun_interval b) {
+	return mathfun_tristate(a.hi < b.lo, a.lo >= b.hi);
+}
+
+static inline mathfun_interval mathfun_interval_le(mathfun_interval a, mathfun_interval b) {
+	return mathfun_tristate(a.hi <= b.lo, a.lo > b.hi);
+}
+
+static inline mathfun_interval mathfun_interval_not(mathfun_interval a) {
+	return (mathfun_interval){ 1.0 - a.hi, 1.0 - a.lo };
+}
+
+static inline mathfun_interval mathfun_interval_beq(mathfun_interval a, mathfun_interval b) {
+	const bool known = a.lo == a.hi && b.lo == b.hi;
+	return mathfun_tristate(known && a.lo == b.lo, known && a.lo != b.lo);
+}
+
+static inline mathfun_interval mathfun_interval_in(mathfun_interval a, double lo, double hi, bool inclusive) {
+	return inclusive ?
+		mathfun_tristate(a.lo >= lo && a.hi <= hi, a.hi < lo || a.lo > hi) :
+		mathfun_tristate(a.lo >= lo && a.hi <  hi, a.hi < lo || a.lo >= hi);
+}
+
+mathfun_interval mathfun_interval_any_number(const mathfun_interval args[]) {
+	(void)args;
+	return MATHFUN_INTERVAL_ENTIRE;
+}
+
+mathfun_interval mathfun_interval_any_boolean(const mathfun_interval args[]) {
+	(void)args;
+	return MATHFUN_INTERVAL_MAYBE;
+}
+
+typedef struct mathfun_interval_thread {
+	const mathfun_code *code;
+	mathfun_interval *regs;
+} mathfun_interval_thread;
+
+// the other half of a fork: it jumps to code and knows that regs[reg] is value
+typedef struct mathfun_interval_fork {
+	const mathfun_code *code;
+	mathfun_code reg;
+	mathfun_interval value;
+} mathfun_interval_fork;
+
+enum mathfun_interval_exit {
+	MATHFUN_INTERVAL_RET,  // the thread returned
+	MATHFUN_INTERVAL_STOP, // the thread reached stop
+	MATHFUN_INTERVAL_FORK, // the thread forked
+	MATHFUN_INTERVAL_ILLEGAL
+};
+
+#define MATHFUN_INTERVAL_BINARY(FUNC) \
+	regs[code[3]] = FUNC(regs[code[1]], regs[code[2]]); \
+	code += 4; \
+	break;
+
+#define MATHFUN_INTERVAL_MUL_BINARY(FUNC) \
+	regs[code[3]] = mathfun_interval_mul(regs[code[1]], regs[code[2]]); \
+	regs[code[5]] = FUNC(regs[code[3]], regs[code[4]]); \
+	code += 6; \
+	break;
+
+// the constant is loaded first, the binary operation may read it
+#define MATHFUN_INTERVAL_VAL_BINARY(FUNC) \
+	regs[code[2]].lo = regs[code[2]].hi = consts[code[1]].number; \
+	regs[code[5]] = FUNC(regs[code[3]], regs[code[4]]); \
+	code += 6; \
+	break;
+
+#define MATHFUN_INTERVAL_IMMEDIATE(EXPR) \
+	{ \
+		const double k = consts[code[1]].number; \
+		const mathfun_interval kk = { k, k }; \
+		const mathfun_interval a = regs[code[2]]; \
+		regs[code[3]] = (EXPR); \
+	} \
+	code += 4; \
+	break;
+
+// Takes the jump to ADR if regs[REG] is WANT. If it may be either, the thread
+// falls through and the fork takes the jump.
+#define MATHFUN_INTERVAL_JUMP(REG, WANT, ADR, SIZE) \
+	{ \
+		const mathfun_interval cond = regs[REG]; \
+		const mathfun_code *next = code + (SIZE); \
+		const mathfun_code *target = start + mathfun_code_adr(ADR); \
+		if (cond.lo > 0.0) { \
+			code = (WANT) ? target : next; \
+		} \
+		else if (cond.hi <= 0.0) { \
+			code = (WANT) ? next : target; \
+		} \
+		else { \
+			regs[REG]   = (WANT) ? MATHFUN_INTERVAL_FALSE : MATHFUN_INTERVAL_TRUE; \
+			fork->code  = target; \
+			fork->reg   = (REG); \
+			fork->value = (WANT) ? MATHFUN_INTERVAL_TRUE : MATHFUN_INTERVAL_FALSE; \
+			thread->code = next; \
+			return MATHFUN_INTERVAL_FORK; \
+		} \
+	} \
+	break;
+
+#define MATHFUN_INTERVAL_COMPARE_JUMP(EXPR) \
+	regs[code[3]] = (EXPR); \
+	MATHFUN_INTERVAL_JUMP(code[3], code[4], code + 5, 5 + MATHFUN_ADR_CODES)
+
+// Executes thread until it returns, forks or its code reaches stop (if not NULL).
+static enum mathfun_interval_exit mathfun_interval_run(const mathfun *fun, mathfun_interval_thread *thread,
+	const mathfun_code *stop, mathfun_interval_fork *fork, mathfun_interval *ret) {
+	const mathfun_code *start = fun->code;
+	const mathfun_value *consts = fun->consts;
+	const mathfun_binding_interval *intervals = fun->intervals;
+	const mathfun_code *code = thread->code;
+	mathfun_interval *regs = thread->regs;
+
+	for (;;) {
+		if (stop && code >= stop) {
+			thread->code = code;
+			return MATHFUN_INTERVAL_STOP;
+		}
+
+		switch (*code) {
+			case NOP:
+				++ code;
+				break;
+
+			case RET:
+				*ret = regs[code[1]];
+				return MATHFUN_INTERVAL_RET;
+
+			case MOV:
+				regs[code[2]] = regs[code[1]];
+				code += 3;
+				break;
+
+			case VAL:
+				regs[code[2]].lo = regs[code[2]].hi = consts[code[1]].number;
+				code += 3;
+				break;
+
+			case CALL:
+				regs[code[4]] = intervals[code[1]](regs + code[3]);
+				code += 5;
+				break;
+
+			case NEG:
+				regs[code[2]] = mathfun_interval_neg(regs[code[1]]);
+				code += 3;
+				break;
+
+			case POWK:
+			{
+				const double k = consts[code[1]].number;
+				regs[code[3]] = mathfun_interval_pow(regs[code[2]], (mathfun_interval){ k, k });
+				code += 4;
+				break;
+			}
+
+			case FMA:
+				// encloses a * b + c, and so its rounding
+				regs[code[4]] = mathfun_interval_add(
+					mathfun_interval_mul(regs[code[1]], regs[code[2]]), regs[code[3]]);
+				code += 5;
+				break;
+
+			case ADD: MATHFUN_INTERVAL_BINARY(mathfun_interval_add)
+			case SUB: MATHFUN_INTERVAL_BINARY(mathfun_interval_sub)
+			case MUL: MATHFUN_INTERVAL_BINARY(mathfun_interval_mul)
+			case DIV: MATHFUN_INTERVAL_BINARY(mathfun_interval_div)
+			case MOD: MATHFUN_INTERVAL_BINARY(mathfun_interval_mod)
+			case POW: MATHFUN_INTERVAL_BINARY(mathfun_interval_pow)
+
+			case NOT:
+				regs[code[2]] = mathfun_interval_not(regs[code[1]]);
+				code += 3;
+				break;
+
+			case EQ:
+				regs[code[3]] = mathfun_interval_eq(regs[code[1]], regs[code[2]]);
+				code += 4;
+				break;
+
+			case NE:
+				regs[code[3]] = mathfun_interval_not(mathfun_interval_eq(regs[code[1]], regs[code[2]]));
+				code += 4;
+				break;
+
+			case LT:
+				regs[code[3]] = mathfun_interval_lt(regs[code[1]], regs[code[2]]);
+				code += 4;
+				break;
+
+			case GT:
+				regs[code[3]] = mathfun_interval_lt(regs[code[2]], regs[code[1]]);
+				code += 4;
+				break;
+
+			case LE:
+				regs[code[3]] = mathfun_interval_le(regs[code[1]], regs[code[2]]);
+				code += 4;
+				break;
+
+			case GE:
+				regs[code[3]] = mathfun_interval_le(regs[code[2]], regs[code[1]]);
+				code += 4;
+				break;
+
+			case BEQ:
+				regs[code[3]] = mathfun_interval_beq(regs[code[1]], regs[code[2]]);
+				code += 4;
+				break;
+
+			case BNE:
+				regs[code[3]] = mathfun_interval_not(mathfun_interval_beq(regs[code[1]], regs[code[2]]));
+				code += 4;
+				break;
+
+			case JMP:
+				code = start + mathfun_code_adr(code + 1);
+				break;
+
+			case JMPT: MATHFUN_INTERVAL_JUMP(code[1], true,  code + 2, 2 + MATHFUN_ADR_CODES)
+			case JMPF: MATHFUN_INTERVAL_JUMP(code[1], false, code + 2, 2 + MATHFUN_ADR_CODES)
+
+			case SETT:
+			case SETF:
+				regs[code[1]] = *code == SETT ? MATHFUN_INTERVAL_TRUE : MATHFUN_INTERVAL_FALSE;
+				code += 2;
+				break;
+
+			case MULADD: MATHFUN_INTERVAL_MUL_BINARY(mathfun_interval_add)
+			case MULSUB: MATHFUN_INTERVAL_MUL_BINARY(mathfun_interval_sub)
+
+			case VADD: MATHFUN_INTERVAL_VAL_BINARY(mathfun_interval_add)
+			case VSUB: MATHFUN_INTERVAL_VAL_BINARY(mathfun_interval_sub)
+			case VMUL: MATHFUN_INTERVAL_VAL_BINARY(mathfun_interval_mul)
+			case VDIV: MATHFUN_INTERVAL_VAL_BINARY(mathfun_interval_div)
+
+			case EQJ: MATHFUN_INTERVAL_COMPARE_JUMP(mathfun_interval_eq(regs[code[1]], regs[code[2]]))
+			case NEJ: MATHFUN_INTERVAL_COMPARE_JUMP(mathfun_interval_not(mathfun_interval_eq(regs[code[1]], regs[code[2]])))
+			case LTJ: MATHFUN_INTERVAL_COMPARE_JUMP(mathfun_interval_lt(regs[code[1]], regs[code[2]]))
+			case GTJ: MATHFUN_INTERVAL_COMPARE_JUMP(mathfun_interval_lt(regs[code[2]], regs[code[1]]))
+			case LEJ: MATHFUN_INTERVAL_COMPARE_JUMP(mathfun_interval_le(regs[code[1]], regs[code[2]]))
+			case GEJ: MATHFUN_INTERVAL_COMPARE_JUMP(mathfun_interval_le(regs[code[2]], regs[code[1]]))
+
+			case ADDK:  MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_add(a, kk))
+			case SUBK:  MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_sub(a, kk))
+			case RSUBK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_sub(kk, a))
+			case MULK:  MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_mul(a, kk))
+			case DIVK:  MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_div(a, kk))
+			case RDIVK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_div(kk, a))
+
+			case EQK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_eq(a, kk))
+			case NEK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_not(mathfun_interval_eq(a, kk)))
+			case LTK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_lt(a, kk))
+			case GTK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_lt(kk, a))
+			case LEK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_le(a, kk))
+			case GEK: MATHFUN_INTERVAL_IMMEDIATE(mathfun_interval_le(kk, a))
+
+			case INK:
+			case INXK:
+				regs[code[4]] = mathfun_interval_in(regs[code[3]],
+					consts[code[1]].number, consts[code[2]].number, *code == INK);
+				code += 5;
+				break;
+
+			default:
+				return MATHFUN_INTERVAL_ILLEGAL;
+		}
+	}
+}
+
+// Threads at index < count are running, the others are done and their
+// registers are reused by new forks. threads[0] started with the caller's
+// frame, the other registers are owned.
+typedef struct mathfun_interval_threads {
+	mathfun_interval_thread *threads;
+	size_t size;
+	size_t used; // threads with registers
+	size_t count;
+	size_t framesize;
+	const mathfun_interval *frame;
+} mathfun_interval_threads;
+
+static void mathfun_interval_threads_cleanup(mathfun_interval_threads *threads) {
+	for (size_t i = 0; i < threads->used; ++ i) {
+		if (threads->threads[i].regs != threads->frame) free(threads->threads[i].regs);
+	}
+	free(threads->threads);
+}
+
+static void mathfun_interval_threads_remove(mathfun_interval_threads *threads, size_t index) {
+	const mathfun_interval_thread done = threads->threads[index];
+	threads->threads[index] = threads->threads[-- threads->count];
+	threads->threads[threads->count] = done;
+}
+
+// starts the fork of threads[index]
+static bool mathfun_interval_threads_fork(mathfun_interval_threads *threads, size_t index,
+	const mathfun_interval_fork *fork) {
+	if (threads->count == threads->used) {
+		if (threads->used == threads->size) {
+			const size_t size = threads->size * 2;
+			mathfun_interval_thread *grown = realloc(threads->threads, size * sizeof(mathfun_interval_thread));
+
+			if (!grown) return false;
+
+			threads->threads = grown;
+			threads->size = size;
+		}
+
+		mathfun_interval *regs = malloc(threads->framesize * sizeof(mathfun_interval));
+
+		if (!regs) return false;
+
+		threads->threads[threads->used ++].regs = regs;
+	}
+
+	mathfun_interval_thread *thread = threads->threads + threads->count ++;
+	memcpy(thread->regs, threads->threads[index].regs, threads->framesize * sizeof(mathfun_interval));
+	thread->code = fork->code;
+	thread->regs[fork->reg] = fork->value;
+
+	return true;
+}
+
+// Runs first and its fork and all threads forked by them until they returned.
+static bool mathfun_interval_schedule(const mathfun *fun, mathfun_interval frame[],
+	const mathfun_interval_thread *first, const mathfun_interval_fork *first_fork, mathfun_interval *ret) {
+	mathfun_interval_threads threads = { NULL, 4, 1, 1, fun->framesize, frame };
+	mathfun_interval_fork fork = *first_fork;
+
+	threads.threads = malloc(threads.size * sizeof(mathfun_interval_thread));
+
+	if (!threads.threads) {
+		errno = ENOMEM;
+		return false;
+	}
+
+	threads.threads[0] = *first;
+
+	if (!mathfun_interval_threads_fork(&threads, 0, &fork)) {
+		mathfun_interval_threads_cleanup(&threads);
+		errno = ENOMEM;
+		return false;
+	}
+
+	*ret = MATHFUN_INTERVAL_EMPTY;
+
+	while (threads.count > 0) {
+		size_t cur = 0;
+		for (size_t i = 1; i < threads.count; ++ i) {
+			if (threads.threads[i].code < threads.threads[cur].code) cur = i;
+		}
+
+		// merge the threads that arrived at the same instruction and find
+		// where the next one is
+		const mathfun_code *stop = NULL;
+		for (size_t i = 0; i < threads.count;) {
+			if (i != cur && threads.threads[i].code == threads.threads[cur].code) {
+				mathfun_interval *regs = threads.threads[cur].regs;
+				const mathfun_interval *other = threads.threads[i].regs;
+				for (size_t j = 0; j < threads.framesize; ++ j) {
+					regs[j] = mathfun_interval_hull(regs[j], other[j]);
+				}
+
+				mathfun_interval_threads_remove(&threads, i);
+				if (cur == threads.count) cur = i;
+			}
+			else {
+				if (i != cur && (!stop || threads.threads[i].code < stop)) stop = threads.threads[i].code;
+				++ i;
+			}
+		}
+
+		mathfun_interval value;
+		switch (mathfun_interval_run(fun, threads.threads + cur, stop, &fork, &value)) {
+			case MATHFUN_INTERVAL_RET:
+				*ret = mathfun_interval_hull(*ret, value);
+				mathfun_interval_threads_remove(&threads, cur);
+				break;
+
+			case MATHFUN_INTERVAL_STOP:
+				break;
+
+			case MATHFUN_INTERVAL_FORK:
+				if (!mathfun_interval_threads_fork(&threads, cur, &fork)) {
+					mathfun_interval_threads_cleanup(&threads);
+					errno = ENOMEM;
+					return false;
+				}
+				break;
+
+			case MATHFUN_INTERVAL_ILLEGAL:
+				mathfun_interval_threads_cleanup(&threads);
+				errno = EINVAL;
+				return false;
+		}
+	}
+
+	mathfun_interval_threads_cleanup(&threads);
+	return true;
+}
+
+bool mathfun_exec_interval(const mathfun *fun, mathfun_interval frame[], mathfun_interval *ret) {
+	mathfun_interval_thread thread = { fun->code, frame };
+	mathfun_interval_fork fork;
+
+	switch (mathfun_interval_run(fun, &thread, NULL, &fork, ret)) {
+		case MATHFUN_INTERVAL_RET:
+			return true;
+
+		case MATHFUN_INTERVAL_FORK:
+			return mathfun_interval_schedule(fun, frame, &thread, &fork, ret);
+
+		default:
+			errno = EINVAL;
+			return false;
+	}
+}
+
+mathfun_interval mathfun_acall_interval(const mathfun *fun, const mathfun_interval args[], mathfun_error_p *error) {
+	mathfun_interval stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_interval *regs = stack;
+
+	if (fun->framesize > MATHFUN_STACK_FRAME_SIZE) {
+		regs = malloc(fun->framesize * sizeof(mathfun_interval));
+
+		if (!regs) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return MATHFUN_INTERVAL_EMPTY;
+		}
+	}
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		regs[i] = args[i];
+	}
+
+	// so merged threads don't read uninitialized registers
+	for (size_t i = fun->argc; i < fun->framesize; ++ i) {
+		regs[i] = MATHFUN_INTERVAL_EMPTY;
+	}
+
+	// functions at the edge of their domain may set errno, but that isn't an error here
+	const int errnum = errno;
+	mathfun_interval value;
+	const bool ok = mathfun_exec_interval(fun, regs, &value);
+
+	if (regs != stack) free(regs);
+
+	if (!ok) {
+		if (errno == ENOMEM) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		}
+		else {
+			mathfun_raise_c_error(error);
+		}
+		return MATHFUN_INTERVAL_EMPTY;
+	}
+
+	errno = errnum;
+	return value;
+}
+
+// Interval versions of the default functions. Functions that aren't here
+// (e.g. the Bessel functions) yield the whole real line or maybe.
+
+#define MATHFUN_INTERVAL_IDENTITY(X) (X)
+
+// increasing function defined on [MIN, MAX]
+#define MATHFUN_INTERVAL_INCREASING(NAME, FUNC, MIN, MAX, DOWN, UP) \
+	static mathfun_interval mathfun_interval_##NAME(const mathfun_interval args[]) { \
+		if (MATHFUN_IS_EMPTY(args[0])) return MATHFUN_INTERVAL_EMPTY; \
+		const double lo = fmax(args[0].lo, (MIN)); \
+		const double hi = fmin(args[0].hi, (MAX)); \
+		if (lo > hi) return MATHFUN_INTERVAL_EMPTY; \
+		return (mathfun_interval){ DOWN(FUNC(lo)), UP(FUNC(hi)) }; \
+	}
+
+// decreasing function defined on [MIN, MAX]
+#define MATHFUN_INTERVAL_DECREASING(NAME, FUNC, MIN, MAX) \
+	static mathfun_interval mathfun_interval_##NAME(const mathfun_interval args[]) { \
+		if (MATHFUN_IS_EMPTY(args[0])) return MATHFUN_INTERVAL_EMPTY; \
+		const double lo = fmax(args[0].lo, (MIN)); \
+		const double hi = fmin(args[0].hi, (MAX)); \
+		if (lo > hi) return MATHFUN_INTERVAL_EMPTY; \
+		return (mathfun_interval){ mathfun_libm_down(FUNC(hi)), mathfun_libm_up(FUNC(lo)) }; \
+	}
+
+MATHFUN_INTERVAL_INCREASING(acosh,     acosh,      1.0,      INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(asin,      asin,      -1.0,      1.0,      mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(asinh,     asinh,     -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(atan,      atan,      -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(atanh,     atanh,     -1.0,      1.0,      mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(cbrt,      cbrt,      -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(erf,       erf,       -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(exp,       exp,       -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(exp2,      exp2,      -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(expm1,     expm1,     -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(log,       log,        0.0,      INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(log10,     log10,      0.0,      INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(log1p,     log1p,     -1.0,      INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(log2,      log2,       0.0,      INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(sinh,      sinh,      -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(tanh,      tanh,      -INFINITY, INFINITY, mathfun_libm_down, mathfun_libm_up)
+MATHFUN_INTERVAL_INCREASING(sqrt,      MATHFUN_INTERVAL_IDENTITY, 0.0, INFINITY, mathfun_sqrt_down, mathfun_sqrt_up)
+MATHFUN_INTERVAL_INCREASING(ceil,      ceil,      -INFINITY, INFINITY, MATHFUN_INTERVAL_IDENTITY, MATHFUN_INTERVAL_IDENTITY)
+MATHFUN_INTERVAL_INCREASING(floor,     floor,     -INFINITY, INFINITY, MATHFUN_INTERVAL_IDENTITY, MATHFUN_INTERVAL_IDENTITY)
+MATHFUN_INTERVAL_INCREASING(nearbyint, nearbyint, -INFINITY, INFINITY, MATHFUN_INTERVAL_IDENTITY, MATHFUN_INTERVAL_IDENTITY)
+MATHFUN_INTERVAL_INCREASING(round,     round,     -INFINITY, INFINITY, MATHFUN_INTERVAL_IDENTITY, MATHFUN_INTERVAL_IDENTITY)
+MATHFUN_INTERVAL_INCREASING(trunc,     trunc,     -INFINITY, INFINITY, MATHFUN_INTERVAL_IDENTITY, MATHFUN_INTERVAL_IDENTITY)
+
+MATHFUN_INTERVAL_DECREASING(acos, acos, -1.0,      1.0)
+MATHFUN_INTERVAL_DECREASING(erfc, erfc, -INFINITY, INFINITY)
+
+static mathfun_interval mathfun_interval_sign(const mathfun_interval args[]) {
+	const mathfun_interval a = args[0];
+	if (MATHFUN_IS_EMPTY(a)) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){ a.lo < 0.0 ? -1.0 : a.lo > 0.0 ? 1.0 : 0.0, a.hi > 0.0 ? 1.0 : a.hi < 0.0 ? -1.0 : 0.0 };
+}
+
+static mathfun_interval mathfun_interval_abs(const mathfun_interval args[]) {
+	if (MATHFUN_IS_EMPTY(args[0])) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){ mathfun_interval_mig(args[0]), mathfun_interval_mag(args[0]) };
+}
+
+static mathfun_interval mathfun_interval_cosh(const mathfun_interval args[]) {
+	if (MATHFUN_IS_EMPTY(args[0])) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){
+		mathfun_libm_down(cosh(mathfun_interval_mig(args[0]))),
+		mathfun_libm_up(cosh(mathfun_interval_mag(args[0])))
+	};
+}
+
+// Range of cos(x + shift * pi). The extrema of cos are at the multiples of pi,
+// maxima at the even ones. The multiples within a are found with a little slack,
+// an extremum that isn't really there only makes the result wider.
+static mathfun_interval mathfun_interval_cos_shifted(mathfun_interval a, double (*func)(double), double shift) {
+	if (MATHFUN_IS_EMPTY(a)) return MATHFUN_INTERVAL_EMPTY;
+	if (!(a.hi - a.lo < 2.0 * M_PI) || fmax(-a.lo, a.hi) > 0x1p50) return (mathfun_interval){ -1.0, 1.0 };
+
+	const double y1 = func(a.lo);
+	const double y2 = func(a.hi);
+	double lo = fmax(mathfun_libm_down(fmin(y1, y2)), -1.0);
+	double hi = fmin(mathfun_libm_up(fmax(y1, y2)), 1.0);
+
+	const double u_lo = a.lo / M_PI + shift;
+	const double u_hi = a.hi / M_PI + shift;
+	const double first = ceil(u_lo - (fabs(u_lo) + 1.0) * 8 * DBL_EPSILON);
+	const double last  = floor(u_hi + (fabs(u_hi) + 1.0) * 8 * DBL_EPSILON);
+
+	for (double k = first; k <= last; ++ k) {
+		if (fmod(k, 2.0) == 0.0) {
+			hi = 1.0;
+		}
+		else {
+			lo = -1.0;
+		}
+	}
+
+	return (mathfun_interval){ lo, hi };
+}
+
+static mathfun_interval mathfun_interval_cos(const mathfun_interval args[]) {
+	return mathfun_interval_cos_shifted(args[0], cos, 0.0);
+}
+
+// sin(x) = cos(x - pi/2)
+static mathfun_interval mathfun_interval_sin(const mathfun_interval args[]) {
+	return mathfun_interval_cos_shifted(args[0], sin, -0.5);
+}
+
+// tan is increasing between its poles at pi/2 + k * pi
+static mathfun_interval mathfun_interval_tan(const mathfun_interval args[]) {
+	const mathfun_interval a = args[0];
+	if (MATHFUN_IS_EMPTY(a)) return MATHFUN_INTERVAL_EMPTY;
+	if (!(a.hi - a.lo < M_PI) || fmax(-a.lo, a.hi) > 0x1p50) return MATHFUN_INTERVAL_ENTIRE;
+
+	const double u_lo = a.lo / M_PI - 0.5;
+	const double u_hi = a.hi / M_PI - 0.5;
+	if (ceil(u_lo - (fabs(u_lo) + 1.0) * 8 * DBL_EPSILON) <= floor(u_hi + (fabs(u_hi) + 1.0) * 8 * DBL_EPSILON)) {
+		return MATHFUN_INTERVAL_ENTIRE;
+	}
+
+	return (mathfun_interval){ mathfun_libm_down(tan(a.lo)), mathfun_libm_up(tan(a.hi)) };
+}
+
+static mathfun_interval mathfun_interval_max(const mathfun_interval args[]) {
+	if (MATHFUN_IS_EMPTY(args[0]) || MATHFUN_IS_EMPTY(args[1])) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){ fmax(args[0].lo, args[1].lo), fmax(args[0].hi, args[1].hi) };
+}
+
+static mathfun_interval mathfun_interval_min(const mathfun_interval args[]) {
+	if (MATHFUN_IS_EMPTY(args[0]) || MATHFUN_IS_EMPTY(args[1])) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){ fmin(args[0].lo, args[1].lo), fmin(args[0].hi, args[1].hi) };
+}
+
+static mathfun_interval mathfun_interval_fdim(const mathfun_interval args[]) {
+	const mathfun_interval d = mathfun_interval_sub(args[0], args[1]);
+	if (MATHFUN_IS_EMPTY(d)) return d;
+	return (mathfun_interval){ fmax(d.lo, 0.0), fmax(d.hi, 0.0) };
+}
+
+static mathfun_interval mathfun_interval_hypot(const mathfun_interval args[]) {
+	if (MATHFUN_IS_EMPTY(args[0]) || MATHFUN_IS_EMPTY(args[1])) return MATHFUN_INTERVAL_EMPTY;
+	return (mathfun_interval){
+		mathfun_libm_down(hypot(mathfun_interval_mig(args[0]), mathfun_interval_mig(args[1]))),
+		mathfun_libm_up(hypot(mathfun_interval_mag(args[0]), mathfun_interval_mag(args[1])))
+	};
+}
+
+static mathfun_interval mathfun_interval_copysign(const mathfun_interval args[]) {
+	if (MATHFUN_IS_EMPTY(args[0]) || MATHFUN_IS_EMPTY(args[1])) return MATHFUN_INTERVAL_EMPTY;
+	const double mig = mathfun_interval_mig(args[0]);
+	const double mag = mathfun_interval_mag(args[0]);
+	// y == 0 may be -0
+	if (args[1].lo > 0.0) return (mathfun_interval){ mig, mag };
+	if (args[1].hi < 0.0) return (mathfun_interval){ -mag, -mig };
+	return (mathfun_interval){ -mag, mag };
+}
+
+static mathfun_interval mathfun_interval_fma(const mathfun_interval args[]) {
+	return mathfun_interval_add(mathfun_interval_mul(args[0], args[1]), args[2]);
+}
+
+bool mathfun_context_define_default_intervals(mathfun_context *ctx, mathfun_error_p *error) {
+	static const struct {
+		const char *name;
+		mathfun_binding_interval interval;
+	} intervals[] = {
+		{ "abs",       mathfun_interval_abs },
+		{ "acos",      mathfun_interval_acos },
+		{ "acosh",     mathfun_interval_acosh },
+		{ "asin",      mathfun_interval_asin },
+		{ "asinh",     mathfun_interval_asinh },
+		{ "atan",      mathfun_interval_atan },
+		{ "atanh",     mathfun_interval_atanh },
+		{ "cbrt",      mathfun_interval_cbrt },
+		{ "ceil",      mathfun_interval_ceil },
+		{ "copysign",  mathfun_interval_copysign },
+		{ "cos",       mathfun_interval_cos },
+		{ "cosh",      mathfun_interval_cosh },
+		{ "erf",       mathfun_interval_erf },
+		{ "erfc",      mathfun_interval_erfc },
+		{ "exp",       mathfun_interval_exp },
+		{ "exp2",      mathfun_interval_exp2 },
+		{ "expm1",     mathfun_interval_expm1 },
+		{ "fdim",      mathfun_interval_fdim },
+		{ "floor",     mathfun_interval_floor },
+		{ "fma",       mathfun_interval_fma },
+		{ "hypot",     mathfun_interval_hypot },
+		{ "log",       mathfun_interval_log },
+		{ "log10",     mathfun_interval_log10 },
+		{ "log1p",     mathfun_interval_log1p },
+		{ "log2",      mathfun_interval_log2 },
+		{ "max",       mathfun_interval_max },
+		{ "min",       mathfun_interval_min },
+		{ "nearbyint", mathfun_interval_nearbyint },
+		{ "round",     mathfun_interval_round },
+		{ "sign",      mathfun_interval_sign },
+		{ "sin",       mathfun_interval_sin },
+		{ "sinh",      mathfun_interval_sinh },
+		{ "sqrt",      mathfun_interval_sqrt },
+		{ "tan",       mathfun_interval_tan },
+		{ "tanh",      mathfun_interval_tanh },
+		{ "trunc",     mathfun_interval_trunc },
+		{ NULL, NULL }
+	};
+
+	for (size_t i = 0; intervals[i].name; ++ i) {
+		if (!mathfun_context_define_interval(ctx, intervals[i].name, intervals[i].interval, error)) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,804 @@
+#include <string.h>
+#include <math.h>
+
+#include "mathfun_intern.h"
+
+// Translates the byte code to x86-64 machine code (System V calling convention).
+//
+// The generated function takes the execution frame in rdi, keeps it in rbx and
+// returns the result in xmm0, so it can be called just like mathfun_exec(). The
+// first MATHFUN_JIT_XMM_REGS frame registers live in xmm registers, the rest in
+// their frame slots. Booleans are stored as words whose lowest byte is 0 or 1.
+//
+// All xmm registers are caller saved, so around calls the temporary registers
+// are written back to the frame (argument registers are never written) and
+// everything is reloaded afterwards. xmm14 holds the sign mask for NEG, so it is
+// reloaded after calls too, and xmm15 is used as scratch.
+//
+// Immediate operands of the ...K instructions are put into a constant pool after
+// the code and are used as RIP relative memory operands.
+
+#if defined(__x86_64__) && !defined(_WIN64) && (defined(__unix__) || defined(__APPLE__))
+#	define MATHFUN_HAVE_JIT
+#	include <sys/mman.h>
+#	ifndef MAP_ANONYMOUS
+#		define MAP_ANONYMOUS MAP_ANON
+#	endif
+#endif
+
+#ifdef MATHFUN_HAVE_JIT
+
+#define MATHFUN_JIT_XMM_REGS 14
+#define MATHFUN_JIT_SIGN  14
+#define MATHFUN_JIT_TMP   15
+
+#define MATHFUN_JIT_RAX 0
+#define MATHFUN_JIT_RCX 1
+#define MATHFUN_JIT_RBX 3
+#define MATHFUN_JIT_RDI 7
+
+// opcodes used with mathfun_jit_op. two byte opcodes are prefixed with 0x0F.
+#define MATHFUN_JIT_MOVSD_LOAD  0x0F10
+#define MATHFUN_JIT_MOVSD_STORE 0x0F11
+#define MATHFUN_JIT_MOVAPD      0x0F28
+#define MATHFUN_JIT_UCOMISD     0x0F2E
+#define MATHFUN_JIT_COMISD      0x0F2F
+#define MATHFUN_JIT_XORPD       0x0F57
+#define MATHFUN_JIT_ADDSD       0x0F58
+#define MATHFUN_JIT_MULSD       0x0F59
+#define MATHFUN_JIT_SUBSD       0x0F5C
+#define MATHFUN_JIT_DIVSD       0x0F5E
+#define MATHFUN_JIT_MOVQ_TO_XMM 0x0F6E
+#define MATHFUN_JIT_MOVQ_TO_GPR 0x0F7E
+#define MATHFUN_JIT_MOV_STORE   0x0089
+#define MATHFUN_JIT_MOV_LOAD    0x008B
+#define MATHFUN_JIT_LEA         0x008D
+
+// setcc opcodes
+#define MATHFUN_JIT_SETB  0x92
+#define MATHFUN_JIT_SETAE 0x93
+#define MATHFUN_JIT_SETE  0x94
+#define MATHFUN_JIT_SETNE 0x95
+#define MATHFUN_JIT_SETBE 0x96
+#define MATHFUN_JIT_SETA  0x97
+#define MATHFUN_JIT_SETP  0x9A
+#define MATHFUN_JIT_SETNP 0x9B
+
+typedef struct mathfun_jit_fixup {
+	size_t       pos;    // position of the rel32 operand
+	size_t       target; // byte code address of the jump target
+} mathfun_jit_fixup;
+
+typedef struct mathfun_jit_const {
+	size_t   pos;    // position of the rel32 operand
+	uint64_t value;
+} mathfun_jit_const;
+
+typedef struct mathfun_jitgen {
+	unsigned char *buf;
+	size_t size;
+	size_t used;
+	size_t argc;
+	size_t retc;
+	size_t xmmregs; // number of frame registers living in xmm registers
+	mathfun_jit_fixup *fixups;
+	size_t fixups_used;
+	mathfun_jit_const *consts;
+	size_t consts_used;
+	bool oom;
+} mathfun_jitgen;
+
+static void mathfun_jit_byte(mathfun_jitgen *jit, unsigned char byte) {
+	if (jit->oom) return;
+
+	if (jit->used == jit->size) {
+		const size_t size = jit->size * 2;
+		unsigned char *buf = realloc(jit->buf, size);
+
+		if (!buf) {
+			jit->oom = true;
+			return;
+		}
+		jit->buf  = buf;
+		jit->size = size;
+	}
+
+	jit->buf[jit->used ++] = byte;
+}
+
+static void mathfun_jit_int32(mathfun_jitgen *jit, uint32_t value) {
+	for (size_t i = 0; i < 4; ++ i) {
+		mathfun_jit_byte(jit, value >> (8 * i));
+	}
+}
+
+static void mathfun_jit_int64(mathfun_jitgen *jit, uint64_t value) {
+	for (size_t i = 0; i < 8; ++ i) {
+		mathfun_jit_byte(jit, value >> (8 * i));
+	}
+}
+
+// [prefix] [REX] opcode ModRM [disp32]
+// If slot is true rm is a frame register and addresses its frame slot ([rbx + 8 * rm]),
+// otherwise rm is a machine register.
+static void mathfun_jit_modrm(mathfun_jitgen *jit, unsigned char prefix, bool rexw, unsigned int opcode,
+	unsigned int reg, bool slot, mathfun_code rm) {
+	if (prefix) mathfun_jit_byte(jit, prefix);
+
+	const unsigned char rex = 0x40 | (rexw ? 0x08 : 0) | ((reg & 8) >> 1) | (slot ? 0 : (rm & 8) >> 3);
+	if (rex != 0x40) mathfun_jit_byte(jit, rex);
+
+	if (opcode > 0xFF) mathfun_jit_byte(jit, opcode >> 8);
+	mathfun_jit_byte(jit, opcode);
+
+	if (slot) {
+		mathfun_jit_byte(jit, 0x80 | ((reg & 7) << 3) | MATHFUN_JIT_RBX);
+		mathfun_jit_int32(jit, rm * sizeof(mathfun_value));
+	}
+	else {
+		mathfun_jit_byte(jit, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+}
+
+// [prefix] [REX] opcode ModRM disp32, rm is the constant value in the constant pool
+static void mathfun_jit_modrm_const(mathfun_jitgen *jit, unsigned char prefix, unsigned int opcode,
+	unsigned int reg, mathfun_value value) {
+	if (prefix) mathfun_jit_byte(jit, prefix);
+	if (reg & 8) mathfun_jit_byte(jit, 0x44);
+
+	if (opcode > 0xFF) mathfun_jit_byte(jit, opcode >> 8);
+	mathfun_jit_byte(jit, opcode);
+	mathfun_jit_byte(jit, 0x05 | ((reg & 7) << 3));
+
+	if (jit->oom) return;
+
+	jit->consts[jit->consts_used].pos = jit->used;
+	memcpy(&jit->consts[jit->consts_used].value, &value, sizeof(uint64_t));
+	++ jit->consts_used;
+
+	mathfun_jit_int32(jit, 0);
+}
+
+static inline bool mathfun_jit_in_xmm(const mathfun_jitgen *jit, mathfun_code reg) {
+	return reg < jit->xmmregs;
+}
+
+// operation on a frame register, wherever it lives
+static void mathfun_jit_op(mathfun_jitgen *jit, unsigned char prefix, unsigned int opcode,
+	unsigned int reg, mathfun_code frame_reg) {
+	mathfun_jit_modrm(jit, prefix, false, opcode, reg, !mathfun_jit_in_xmm(jit, frame_reg), frame_reg);
+}
+
+static void mathfun_jit_load_xmm(mathfun_jitgen *jit, unsigned int xmm, mathfun_code reg) {
+	if (mathfun_jit_in_xmm(jit, reg)) {
+		if (reg != xmm) mathfun_jit_modrm(jit, 0x66, false, MATHFUN_JIT_MOVAPD, xmm, false, reg);
+	}
+	else {
+		mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, xmm, true, reg);
+	}
+}
+
+static void mathfun_jit_store_xmm(mathfun_jitgen *jit, mathfun_code reg, unsigned int xmm) {
+	if (mathfun_jit_in_xmm(jit, reg)) {
+		if (reg != xmm) mathfun_jit_modrm(jit, 0x66, false, MATHFUN_JIT_MOVAPD, reg, false, xmm);
+	}
+	else {
+		mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_STORE, xmm, true, reg);
+	}
+}
+
+static void mathfun_jit_load_gpr(mathfun_jitgen *jit, unsigned int gpr, mathfun_code reg) {
+	if (mathfun_jit_in_xmm(jit, reg)) {
+		mathfun_jit_modrm(jit, 0x66, true, MATHFUN_JIT_MOVQ_TO_GPR, reg, false, gpr);
+	}
+	else {
+		mathfun_jit_modrm(jit, 0, true, MATHFUN_JIT_MOV_LOAD, gpr, true, reg);
+	}
+}
+
+static void mathfun_jit_store_gpr(mathfun_jitgen *jit, mathfun_code reg, unsigned int gpr) {
+	if (mathfun_jit_in_xmm(jit, reg)) {
+		mathfun_jit_modrm(jit, 0x66, true, MATHFUN_JIT_MOVQ_TO_XMM, reg, false, gpr);
+	}
+	else {
+		mathfun_jit_modrm(jit, 0, true, MATHFUN_JIT_MOV_STORE, gpr, true, reg);
+	}
+}
+
+// mov rax, imm64
+static void mathfun_jit_mov_rax(mathfun_jitgen *jit, uint64_t value) {
+	mathfun_jit_byte(jit, 0x48);
+	mathfun_jit_byte(jit, 0xB8);
+	mathfun_jit_int64(jit, value);
+}
+
+// movzx eax, al
+static void mathfun_jit_movzx_eax(mathfun_jitgen *jit) {
+	mathfun_jit_byte(jit, 0x0F);
+	mathfun_jit_byte(jit, 0xB6);
+	mathfun_jit_byte(jit, 0xC0);
+}
+
+static void mathfun_jit_setcc(mathfun_jitgen *jit, unsigned char cc, unsigned int gpr) {
+	mathfun_jit_byte(jit, 0x0F);
+	mathfun_jit_byte(jit, cc);
+	mathfun_jit_byte(jit, 0xC0 | gpr);
+}
+
+static void mathfun_jit_jump(mathfun_jitgen *jit, size_t target) {
+	if (jit->oom) return;
+
+	jit->fixups[jit->fixups_used].pos    = jit->used;
+	jit->fixups[jit->fixups_used].target = target;
+	++ jit->fixups_used;
+
+	mathfun_jit_int32(jit, 0);
+}
+
+// write temporary registers back to their frame slots
+static void mathfun_jit_spill(mathfun_jitgen *jit) {
+	for (mathfun_code reg = jit->argc; reg < jit->xmmregs; ++ reg) {
+		mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_STORE, reg, true, reg);
+	}
+}
+
+// sign mask for NEG, clobbers rax
+static void mathfun_jit_load_sign(mathfun_jitgen *jit) {
+	mathfun_jit_mov_rax(jit, UINT64_C(0x8000000000000000));
+	mathfun_jit_modrm(jit, 0x66, true, MATHFUN_JIT_MOVQ_TO_XMM, MATHFUN_JIT_SIGN, false, MATHFUN_JIT_RAX);
+}
+
+// after a call, so the results have to be stored already (rax is clobbered)
+static void mathfun_jit_reload(mathfun_jitgen *jit) {
+	for (mathfun_code reg = 0; reg < jit->xmmregs; ++ reg) {
+		mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, reg, true, reg);
+	}
+	mathfun_jit_load_sign(jit);
+}
+
+// call rax
+static void mathfun_jit_call_rax(mathfun_jitgen *jit) {
+	mathfun_jit_byte(jit, 0xFF);
+	mathfun_jit_byte(jit, 0xD0);
+}
+
+// c = a op b
+static void mathfun_jit_arith(mathfun_jitgen *jit, unsigned int opcode,
+	mathfun_code a, mathfun_code b, mathfun_code c) {
+	if (mathfun_jit_in_xmm(jit, c) && c != b) {
+		mathfun_jit_load_xmm(jit, c, a);
+		mathfun_jit_op(jit, 0xF2, opcode, c, b);
+	}
+	else {
+		mathfun_jit_load_xmm(jit, MATHFUN_JIT_TMP, a);
+		mathfun_jit_op(jit, 0xF2, opcode, MATHFUN_JIT_TMP, b);
+		mathfun_jit_store_xmm(jit, c, MATHFUN_JIT_TMP);
+	}
+}
+
+// c = a op k, or c = k op a if reverse is true
+static void mathfun_jit_arith_const(mathfun_jitgen *jit, unsigned int opcode, bool reverse,
+	mathfun_value k, mathfun_code a, mathfun_code c) {
+	if (!reverse) {
+		const unsigned int xmm = mathfun_jit_in_xmm(jit, c) ? c : MATHFUN_JIT_TMP;
+		mathfun_jit_load_xmm(jit, xmm, a);
+		mathfun_jit_modrm_const(jit, 0xF2, opcode, xmm, k);
+		mathfun_jit_store_xmm(jit, c, xmm);
+	}
+	else {
+		const unsigned int xmm = mathfun_jit_in_xmm(jit, c) && c != a ? c : MATHFUN_JIT_TMP;
+		mathfun_jit_modrm_const(jit, 0xF2, MATHFUN_JIT_MOVSD_LOAD, xmm, k);
+		mathfun_jit_op(jit, 0xF2, opcode, xmm, a);
+		mathfun_jit_store_xmm(jit, c, xmm);
+	}
+}
+
+// double function(double, double)
+static void mathfun_jit_libcall(mathfun_jitgen *jit, double (*funct)(double, double), const mathfun_code *code) {
+	mathfun_jit_spill(jit);
+	mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, 0, true, code[1]);
+	mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, 1, true, code[2]);
+	mathfun_jit_mov_rax(jit, (uintptr_t)funct);
+	mathfun_jit_call_rax(jit);
+	mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_STORE, 0, true, code[3]);
+	mathfun_jit_reload(jit);
+}
+
+// setcc condition for the comparison instr. a < b is tested as b > a, so that
+// NaN compares unequal to everything.
+static unsigned char mathfun_jit_compare_cc(mathfun_code instr) {
+	switch (instr) {
+		case EQ: return MATHFUN_JIT_SETE;
+		case NE: return MATHFUN_JIT_SETNE;
+		case GT: return MATHFUN_JIT_SETA;
+		case GE: return MATHFUN_JIT_SETAE;
+		case LT: return MATHFUN_JIT_SETA;
+		case LE: return MATHFUN_JIT_SETAE;
+		default: return 0;
+	}
+}
+
+// <, >, <= and >= use comisd, which like C raises the invalid exception for NaN
+static unsigned int mathfun_jit_compare_op(mathfun_code instr) {
+	return instr == EQ || instr == NE ? MATHFUN_JIT_UCOMISD : MATHFUN_JIT_COMISD;
+}
+
+// t = result of the preceding (u)comisd
+static void mathfun_jit_compare_store(mathfun_jitgen *jit, mathfun_code instr, unsigned char cc, mathfun_code t) {
+	mathfun_jit_setcc(jit, cc, MATHFUN_JIT_RAX);
+
+	if (instr == EQ) {
+		// and al, cl
+		mathfun_jit_setcc(jit, MATHFUN_JIT_SETNP, MATHFUN_JIT_RCX);
+		mathfun_jit_byte(jit, 0x20);
+		mathfun_jit_byte(jit, 0xC8);
+	}
+	else if (instr == NE) {
+		// or al, cl
+		mathfun_jit_setcc(jit, MATHFUN_JIT_SETP, MATHFUN_JIT_RCX);
+		mathfun_jit_byte(jit, 0x08);
+		mathfun_jit_byte(jit, 0xC8);
+	}
+
+	mathfun_jit_movzx_eax(jit);
+	mathfun_jit_store_gpr(jit, t, MATHFUN_JIT_RAX);
+}
+
+// t = a op b using (u)comisd and setcc
+static void mathfun_jit_compare(mathfun_jitgen *jit, mathfun_code instr,
+	mathfun_code a, mathfun_code b, mathfun_code t) {
+	const unsigned char cc = mathfun_jit_compare_cc(instr);
+	if (!cc) return;
+
+	if (instr == LT || instr == LE) {
+		// a < b is b > a
+		const mathfun_code tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	unsigned int xmm = a;
+	if (!mathfun_jit_in_xmm(jit, a)) {
+		xmm = MATHFUN_JIT_TMP;
+		mathfun_jit_load_xmm(jit, xmm, a);
+	}
+
+	mathfun_jit_op(jit, 0x66, mathfun_jit_compare_op(instr), xmm, b);
+	mathfun_jit_compare_store(jit, instr, cc, t);
+}
+
+// t = a op k
+static void mathfun_jit_compare_const(mathfun_jitgen *jit, mathfun_code instr,
+	mathfun_code a, mathfun_value k, mathfun_code t) {
+	const unsigned char cc = mathfun_jit_compare_cc(instr);
+	if (!cc) return;
+
+	if (instr == LT || instr == LE) {
+		// a < k is k > a
+		mathfun_jit_modrm_const(jit, 0xF2, MATHFUN_JIT_MOVSD_LOAD, MATHFUN_JIT_TMP, k);
+		mathfun_jit_op(jit, 0x66, mathfun_jit_compare_op(instr), MATHFUN_JIT_TMP, a);
+	}
+	else {
+		unsigned int xmm = a;
+		if (!mathfun_jit_in_xmm(jit, a)) {
+			xmm = MATHFUN_JIT_TMP;
+			mathfun_jit_load_xmm(jit, xmm, a);
+		}
+		mathfun_jit_modrm_const(jit, 0x66, mathfun_jit_compare_op(instr), xmm, k);
+	}
+
+	mathfun_jit_compare_store(jit, instr, cc, t);
+}
+
+// test al, al; jnz/jz rel32
+static void mathfun_jit_branch(mathfun_jitgen *jit, mathfun_code cond, bool jmpif, size_t target) {
+	mathfun_jit_load_gpr(jit, MATHFUN_JIT_RAX, cond);
+	mathfun_jit_byte(jit, 0x84);
+	mathfun_jit_byte(jit, 0xC0);
+	mathfun_jit_byte(jit, 0x0F);
+	mathfun_jit_byte(jit, jmpif ? 0x85 : 0x84);
+	mathfun_jit_jump(jit, target);
+}
+
+static bool mathfun_jit_translate(mathfun_jitgen *jit, const mathfun *fun, size_t native[]) {
+	const mathfun_code *start = fun->code;
+	const mathfun_code *code  = start;
+	const mathfun_value *consts = fun->consts;
+
+	// push rbx; mov rbx, rdi
+	mathfun_jit_byte(jit, 0x53);
+	mathfun_jit_modrm(jit, 0, true, MATHFUN_JIT_MOV_STORE, MATHFUN_JIT_RDI, false, MATHFUN_JIT_RBX);
+
+	for (mathfun_code reg = 0; reg < jit->argc && reg < jit->xmmregs; ++ reg) {
+		mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, reg, true, reg);
+	}
+
+	mathfun_jit_load_sign(jit);
+
+	while (*code != END) {
+		native[code - start] = jit->used;
+
+		switch (*code) {
+			case NOP:
+				++ code;
+				break;
+
+			case RET:
+				// the other results are read from the frame
+				for (size_t reg = jit->argc + 1; reg < jit->argc + jit->retc; ++ reg) {
+					if (mathfun_jit_in_xmm(jit, reg)) {
+						mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_STORE, reg, true, reg);
+					}
+				}
+				// movsd xmm0, reg; pop rbx; ret
+				mathfun_jit_load_xmm(jit, 0, code[1]);
+				mathfun_jit_byte(jit, 0x5B);
+				mathfun_jit_byte(jit, 0xC3);
+				code += 2;
+				break;
+
+			case MOV:
+				if (mathfun_jit_in_xmm(jit, code[2])) {
+					mathfun_jit_load_xmm(jit, code[2], code[1]);
+				}
+				else if (mathfun_jit_in_xmm(jit, code[1])) {
+					mathfun_jit_store_xmm(jit, code[2], code[1]);
+				}
+				else {
+					mathfun_jit_load_gpr(jit, MATHFUN_JIT_RAX, code[1]);
+					mathfun_jit_store_gpr(jit, code[2], MATHFUN_JIT_RAX);
+				}
+				code += 3;
+				break;
+
+			case VAL:
+			{
+				uint64_t value;
+				memcpy(&value, consts + code[1], sizeof(value));
+				mathfun_jit_mov_rax(jit, value);
+				mathfun_jit_store_gpr(jit, code[2], MATHFUN_JIT_RAX);
+				code += 3;
+				break;
+			}
+			case CALL:
+			{
+				mathfun_binding_funct funct = fun->functs[code[1]];
+				const mathfun_code firstarg = code[3];
+				const mathfun_code ret      = code[4];
+
+				// the return value is a union containing a double, so it's passed in rax
+				mathfun_jit_spill(jit);
+				mathfun_jit_modrm(jit, 0, true, MATHFUN_JIT_LEA, MATHFUN_JIT_RDI, true, firstarg);
+				mathfun_jit_mov_rax(jit, (uintptr_t)funct);
+				mathfun_jit_call_rax(jit);
+				mathfun_jit_modrm(jit, 0, true, MATHFUN_JIT_MOV_STORE, MATHFUN_JIT_RAX, true, ret);
+				mathfun_jit_reload(jit);
+				code += 5;
+				break;
+			}
+			case NEG:
+				if (mathfun_jit_in_xmm(jit, code[2])) {
+					mathfun_jit_load_xmm(jit, code[2], code[1]);
+					mathfun_jit_modrm(jit, 0x66, false, MATHFUN_JIT_XORPD, code[2], false, MATHFUN_JIT_SIGN);
+				}
+				else {
+					mathfun_jit_load_xmm(jit, MATHFUN_JIT_TMP, code[1]);
+					mathfun_jit_modrm(jit, 0x66, false, MATHFUN_JIT_XORPD, MATHFUN_JIT_TMP, false, MATHFUN_JIT_SIGN);
+					mathfun_jit_store_xmm(jit, code[2], MATHFUN_JIT_TMP);
+				}
+				code += 3;
+				break;
+
+			case ADD: mathfun_jit_arith(jit, MATHFUN_JIT_ADDSD, code[1], code[2], code[3]); code += 4; break;
+			case SUB: mathfun_jit_arith(jit, MATHFUN_JIT_SUBSD, code[1], code[2], code[3]); code += 4; break;
+			case MUL: mathfun_jit_arith(jit, MATHFUN_JIT_MULSD, code[1], code[2], code[3]); code += 4; break;
+			case DIV: mathfun_jit_arith(jit, MATHFUN_JIT_DIVSD, code[1], code[2], code[3]); code += 4; break;
+			case MOD: mathfun_jit_libcall(jit, mathfun_mod, code); code += 4; break;
+			case POW: mathfun_jit_libcall(jit, pow, code); code += 4; break;
+
+			case POWK:
+				mathfun_jit_spill(jit);
+				mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, 0, true, code[2]);
+				mathfun_jit_modrm_const(jit, 0xF2, MATHFUN_JIT_MOVSD_LOAD, 1, consts[code[1]]);
+				mathfun_jit_mov_rax(jit, (uintptr_t)mathfun_pow_k);
+				mathfun_jit_call_rax(jit);
+				mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_STORE, 0, true, code[3]);
+				mathfun_jit_reload(jit);
+				code += 4;
+				break;
+
+			case FMA:
+				// fma() is exact where the CPU has no FMA instructions
+				mathfun_jit_spill(jit);
+				mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, 0, true, code[1]);
+				mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, 1, true, code[2]);
+				mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_LOAD, 2, true, code[3]);
+				mathfun_jit_mov_rax(jit, (uintptr_t)(double (*)(double, double, double))fma);
+				mathfun_jit_call_rax(jit);
+				mathfun_jit_modrm(jit, 0xF2, false, MATHFUN_JIT_MOVSD_STORE, 0, true, code[4]);
+				mathfun_jit_reload(jit);
+				code += 5;
+				break;
+
+			case NOT:
+				// movzx eax, al; xor eax, 1
+				mathfun_jit_load_gpr(jit, MATHFUN_JIT_RAX, code[1]);
+				mathfun_jit_movzx_eax(jit);
+				mathfun_jit_byte(jit, 0x83);
+				mathfun_jit_byte(jit, 0xF0);
+				mathfun_jit_byte(jit, 0x01);
+				mathfun_jit_store_gpr(jit, code[2], MATHFUN_JIT_RAX);
+				code += 3;
+				break;
+
+			case EQ:
+			case NE:
+			case LT:
+			case GT:
+			case LE:
+			case GE:
+				mathfun_jit_compare(jit, *code, code[1], code[2], code[3]);
+				code += 4;
+				break;
+
+			case BEQ:
+			case BNE:
+				// xor eax, ecx; movzx eax, al [; xor eax, 1]
+				mathfun_jit_load_gpr(jit, MATHFUN_JIT_RAX, code[1]);
+				mathfun_jit_load_gpr(jit, MATHFUN_JIT_RCX, code[2]);
+				mathfun_jit_byte(jit, 0x31);
+				mathfun_jit_byte(jit, 0xC8);
+				mathfun_jit_movzx_eax(jit);
+				if (*code == BEQ) {
+					mathfun_jit_byte(jit, 0x83);
+					mathfun_jit_byte(jit, 0xF0);
+					mathfun_jit_byte(jit, 0x01);
+				}
+				mathfun_jit_store_gpr(jit, code[3], MATHFUN_JIT_RAX);
+				code += 4;
+				break;
+
+			case JMP:
+				mathfun_jit_byte(jit, 0xE9);
+				mathfun_jit_jump(jit, mathfun_code_adr(code + 1));
+				code += 1 + MATHFUN_ADR_CODES;
+				break;
+
+			case JMPT:
+			case JMPF:
+				mathfun_jit_branch(jit, code[1], *code == JMPT, mathfun_code_adr(code + 2));
+				code += 2 + MATHFUN_ADR_CODES;
+				break;
+
+			case SETT:
+			case SETF:
+				// mov eax, 1 / xor eax, eax
+				if (*code == SETT) {
+					mathfun_jit_byte(jit, 0xB8);
+					mathfun_jit_int32(jit, 1);
+				}
+				else {
+					mathfun_jit_byte(jit, 0x31);
+					mathfun_jit_byte(jit, 0xC0);
+				}
+				mathfun_jit_store_gpr(jit, code[1], MATHFUN_JIT_RAX);
+				code += 2;
+				break;
+
+			case MULADD:
+			case MULSUB:
+				mathfun_jit_arith(jit, MATHFUN_JIT_MULSD, code[1], code[2], code[3]);
+				mathfun_jit_arith(jit, *code == MULADD ? MATHFUN_JIT_ADDSD : MATHFUN_JIT_SUBSD,
+					code[3], code[4], code[5]);
+				code += 6;
+				break;
+
+			case VADD:
+			case VSUB:
+			case VMUL:
+			case VDIV:
+			{
+				static const unsigned int opcodes[] = {
+					MATHFUN_JIT_ADDSD, MATHFUN_JIT_SUBSD, MATHFUN_JIT_MULSD, MATHFUN_JIT_DIVSD
+				};
+				uint64_t value;
+				memcpy(&value, consts + code[1], sizeof(value));
+				mathfun_jit_mov_rax(jit, value);
+				mathfun_jit_store_gpr(jit, code[2], MATHFUN_JIT_RAX);
+				mathfun_jit_arith(jit, opcodes[*code - VADD], code[3], code[4], code[5]);
+				code += 6;
+				break;
+			}
+			case EQJ:
+			case NEJ:
+			case LTJ:
+			case GTJ:
+			case LEJ:
+			case GEJ:
+				mathfun_jit_compare(jit, EQ + (*code - EQJ), code[1], code[2], code[3]);
+				mathfun_jit_branch(jit, code[3], code[4], mathfun_code_adr(code + 5));
+				code += 5 + MATHFUN_ADR_CODES;
+				break;
+
+			case ADDK:
+			case SUBK:
+			case RSUBK:
+			case MULK:
+			case DIVK:
+			case RDIVK:
+			{
+				static const unsigned int opcodes[] = {
+					MATHFUN_JIT_ADDSD, MATHFUN_JIT_SUBSD, MATHFUN_JIT_SUBSD,
+					MATHFUN_JIT_MULSD, MATHFUN_JIT_DIVSD, MATHFUN_JIT_DIVSD
+				};
+				mathfun_jit_arith_const(jit, opcodes[*code - ADDK], *code == RSUBK || *code == RDIVK,
+					consts[code[1]], code[2], code[3]);
+				code += 4;
+				break;
+			}
+			case EQK:
+			case NEK:
+			case LTK:
+			case GTK:
+			case LEK:
+			case GEK:
+			{
+				mathfun_jit_compare_const(jit, EQ + (*code - EQK), code[2], consts[code[1]], code[3]);
+				code += 4;
+				break;
+			}
+			case INK:
+			case INXK:
+			{
+				// a >= lo is false for NaN, so the upper bound can be tested as !(a > hi) or !(a >= hi)
+				unsigned int xmm = code[3];
+				if (!mathfun_jit_in_xmm(jit, code[3])) {
+					xmm = MATHFUN_JIT_TMP;
+					mathfun_jit_load_xmm(jit, xmm, code[3]);
+				}
+				mathfun_jit_modrm_const(jit, 0x66, MATHFUN_JIT_COMISD, xmm, consts[code[1]]);
+				mathfun_jit_setcc(jit, MATHFUN_JIT_SETAE, MATHFUN_JIT_RAX);
+				mathfun_jit_modrm_const(jit, 0x66, MATHFUN_JIT_COMISD, xmm, consts[code[2]]);
+				mathfun_jit_setcc(jit, *code == INK ? MATHFUN_JIT_SETBE : MATHFUN_JIT_SETB, MATHFUN_JIT_RCX);
+				// and al, cl
+				mathfun_jit_byte(jit, 0x20);
+				mathfun_jit_byte(jit, 0xC8);
+				mathfun_jit_movzx_eax(jit);
+				mathfun_jit_store_gpr(jit, code[4], MATHFUN_JIT_RAX);
+				code += 5;
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+
+	// constant pool (int3 padding), relative to the end of the rel32 operand
+	while (!jit->oom && jit->used % sizeof(uint64_t) != 0) {
+		mathfun_jit_byte(jit, 0xCC);
+	}
+	for (size_t i = 0; i < jit->consts_used && !jit->oom; ++ i) {
+		const mathfun_jit_const *value = jit->consts + i;
+		const uint32_t rel = (uint32_t)(jit->used - (value->pos + 4));
+		for (size_t j = 0; j < 4; ++ j) {
+			jit->buf[value->pos + j] = rel >> (8 * j);
+		}
+		mathfun_jit_int64(jit, value->value);
+	}
+
+	// resolve jumps (relative to the end of the rel32 operand)
+	if (!jit->oom) {
+		for (size_t i = 0; i < jit->fixups_used; ++ i) {
+			const mathfun_jit_fixup *fixup = jit->fixups + i;
+			const uint32_t rel = (uint32_t)(native[fixup->target] - (fixup->pos + 4));
+			for (size_t j = 0; j < 4; ++ j) {
+				jit->buf[fixup->pos + j] = rel >> (8 * j);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool mathfun_jit(mathfun *fun, mathfun_error_p *error) {
+	if (fun->native || !fun->code) return true;
+
+	// slot displacements are 32 bit
+	if (fun->framesize > INT32_MAX / sizeof(mathfun_value)) return true;
+
+	size_t code_size = 0;
+	const mathfun_code *code = fun->code;
+	while (code[code_size] != END) {
+		code_size += mathfun_code_size(code + code_size);
+	}
+
+	mathfun_jitgen jit;
+	memset(&jit, 0, sizeof(jit));
+
+	jit.argc    = fun->argc;
+	jit.retc    = fun->retc;
+	jit.xmmregs = fun->framesize < MATHFUN_JIT_XMM_REGS ? fun->framesize : MATHFUN_JIT_XMM_REGS;
+	jit.size    = 256;
+	jit.buf     = malloc(jit.size);
+	// every jump needs at least two code words
+	jit.fixups  = malloc((code_size / 2 + 1) * sizeof(mathfun_jit_fixup));
+	// every immediate operand needs at least two code words
+	jit.consts  = malloc((code_size / 2 + 1) * sizeof(mathfun_jit_const));
+	size_t *native = malloc((code_size + 1) * sizeof(size_t));
+
+	if (!jit.buf || !jit.fixups || !jit.consts || !native) {
+		free(jit.buf);
+		free(jit.fixups);
+		free(jit.consts);
+		free(native);
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	const bool ok = mathfun_jit_translate(&jit, fun, native);
+	free(jit.fixups);
+	free(jit.consts);
+	free(native);
+
+	if (jit.oom) {
+		free(jit.buf);
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	if (!ok) {
+		// unknown instruction, keep using the interpreter
+		free(jit.buf);
+		return true;
+	}
+
+	// write the code, then make the pages executable but no longer writable
+	void *mem = mmap(NULL, jit.used, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED) {
+		free(jit.buf);
+		return true;
+	}
+
+	memcpy(mem, jit.buf, jit.used);
+	free(jit.buf);
+
+	if (mprotect(mem, jit.used, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, jit.used);
+		return true;
+	}
+
+	memcpy(&fun->native, &mem, sizeof(mem));
+	fun->native_size = jit.used;
+
+	return true;
+}
+
+void mathfun_jit_cleanup(mathfun *fun) {
+	if (fun->native) {
+		void *mem;
+		memcpy(&mem, &fun->native, sizeof(mem));
+		munmap(mem, fun->native_size);
+		fun->native = NULL;
+		fun->native_size = 0;
+	}
+}
+
+#else
+
+bool mathfun_jit(mathfun *fun, mathfun_error_p *error) {
+	(void)fun;
+	(void)error;
+	return true;
+}
+
+void mathfun_jit_cleanup(mathfun *fun) {
+	fun->native = NULL;
+	fun->native_size = 0;
+}
+
+#endif
+
+bool mathfun_is_native(const mathfun *fun) {
+	return fun->native != NULL;
+}
@@ -305,12 +305,79 @@ bool mathfun_context_define_funct(mathfun_context *ctx, const char *name, mathfu
 	decl->name = name;
 	decl->decl.funct.funct = funct;
 	decl->decl.funct.sig   = sig;
+	decl->decl.funct.deriv = NULL;
+	decl->decl.funct.partials = NULL;
+	decl->decl.funct.interval = NULL;
+	decl->decl.funct.float_funct = NULL;
 
 	++ ctx->decl_used;
 
 	return true;
 }
 
+bool mathfun_context_define_deriv(mathfun_context *ctx, const char *name, mathfun_binding_deriv deriv,
+	mathfun_error_p *error) {
+	size_t index = 0;
+	if (!mathfun_context_find(ctx, name, strlen(name), &index) || ctx->decls[index].type != MATHFUN_DECL_FUNCT) {
+		mathfun_raise_name_error(error, MATHFUN_NO_SUCH_NAME, name);
+		return false;
+	}
+
+	ctx->decls[index].decl.funct.deriv = deriv;
+
+	return true;
+}
+
+bool mathfun_context_define_partials(mathfun_context *ctx, const char *name, const mathfun_partials *partials,
+	mathfun_error_p *error) {
+	size_t index = 0;
+	if (!mathfun_context_find(ctx, name, strlen(name), &index) || ctx->decls[index].type != MATHFUN_DECL_FUNCT) {
+		mathfun_raise_name_error(error, MATHFUN_NO_SUCH_NAME, name);
+		return false;
+	}
+
+	if (partials) {
+		const size_t argc = ctx->decls[index].decl.funct.sig->argc;
+		for (size_t i = 0; i < argc; ++ i) {
+			if (!partials->partials[i]) continue;
+
+			mathfun_expr *expr = mathfun_context_parse(ctx, partials->params, argc, partials->partials[i], NULL, error);
+			if (!expr) return false;
+			mathfun_expr_free(expr);
+		}
+	}
+
+	ctx->decls[index].decl.funct.partials = partials;
+
+	return true;
+}
+
+bool mathfun_context_define_interval(mathfun_context *ctx, const char *name, mathfun_binding_interval interval,
+	mathfun_error_p *error) {
+	size_t index = 0;
+	if (!mathfun_context_find(ctx, name, strlen(name), &index) || ctx->decls[index].type != MATHFUN_DECL_FUNCT) {
+		mathfun_raise_name_error(error, MATHFUN_NO_SUCH_NAME, name);
+		return false;
+	}
+
+	ctx->decls[index].decl.funct.interval = interval;
+
+	return true;
+}
+
+bool mathfun_context_define_float(mathfun_context *ctx, const char *name, mathfun_binding_float float_funct,
+	mathfun_error_p *error) {
+	size_t index = 0;
+	if (!mathfun_context_find(ctx, name, strlen(name), &index) || ctx->decls[index].type != MATHFUN_DECL_FUNCT) {
+		mathfun_raise_name_error(error, MATHFUN_NO_SUCH_NAME, name);
+		return false;
+	}
+
+	ctx->decls[index].decl.funct.float_funct = float_funct;
+
+	return true;
+}
+
 bool mathfun_context_undefine(mathfun_context *ctx, const char *name, mathfun_error_p *error) {
 	size_t index = 0;
 	if (!mathfun_context_find(ctx, name, strlen(name), &index)) {
@@ -325,10 +392,122 @@ bool mathfun_context_undefine(mathfun_context *ctx, const char *name, mathfun_er
 }
 
 void mathfun_cleanup(mathfun *fun) {
+	mathfun_jit_cleanup(fun);
 	free(fun->code);
-	fun->code = NULL;
+	free(fun->consts);
+	free(fun->functs);
+	free(fun->derivs);
+	free(fun->intervals);
+	free(fun->float_consts);
+	free(fun->float_functs);
+	free(fun->sigs);
+	free(fun->source);
+	free(fun->srcmap);
+	fun->code      = NULL;
+	fun->consts    = NULL;
+	fun->functs    = NULL;
+	fun->derivs    = NULL;
+	fun->intervals = NULL;
+	fun->float_consts = NULL;
+	fun->float_functs = NULL;
+	fun->sigs         = NULL;
+	fun->source       = NULL;
+	fun->srcmap       = NULL;
+	fun->precision = MATHFUN_PRECISION_DOUBLE;
 	fun->argc = 0;
+	fun->retc = 0;
 	fun->framesize = 0;
+	fun->tapesize = 0;
+	fun->entry = 0;
+	fun->hoisted = 0;
+}
+
+#ifdef MATHFUN_THREAD_LOCAL
+// Frame for functions that don't fit on the stack. It's busy while a function
+// is executed, so a bound C function that calls a mathfun function again gets
+// a frame of its own.
+static MATHFUN_THREAD_LOCAL mathfun_value *mathfun_frame_cache = NULL;
+static MATHFUN_THREAD_LOCAL size_t mathfun_frame_cache_size = 0;
+static MATHFUN_THREAD_LOCAL bool mathfun_frame_cache_busy = false;
+
+// Default context of mathfun_arun(). Building it sorts all the default
+// declarations, which costs more than parsing and evaluating a typical
+// expression, so it's done once per thread.
+static MATHFUN_THREAD_LOCAL mathfun_context mathfun_default_ctx = MATHFUN_CONTEXT_INIT;
+#endif
+
+// Returns a frame for fun: stack if it fits, else the thread's cached frame or
+// a newly allocated one. Release it with mathfun_frame_release().
+static mathfun_value *mathfun_frame_acquire_size(size_t size, mathfun_value stack[], mathfun_error_p *error) {
+	if (size <= MATHFUN_STACK_FRAME_SIZE) {
+		return stack;
+	}
+
+#ifdef MATHFUN_THREAD_LOCAL
+	if (!mathfun_frame_cache_busy) {
+		if (mathfun_frame_cache_size < size) {
+			mathfun_value *regs = realloc(mathfun_frame_cache, size * sizeof(mathfun_value));
+
+			if (!regs) {
+				mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+				return NULL;
+			}
+
+			mathfun_frame_cache = regs;
+			mathfun_frame_cache_size = size;
+		}
+		mathfun_frame_cache_busy = true;
+		return mathfun_frame_cache;
+	}
+#endif
+
+	mathfun_value *regs = malloc(size * sizeof(mathfun_value));
+
+	if (!regs) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+	}
+
+	return regs;
+}
+
+static inline mathfun_value *mathfun_frame_acquire(const mathfun *fun, mathfun_value stack[], mathfun_error_p *error) {
+	return mathfun_frame_acquire_size(fun->framesize, stack, error);
+}
+
+static void mathfun_frame_release(mathfun_value regs[], mathfun_value stack[]) {
+	if (regs == stack) return;
+
+#ifdef MATHFUN_THREAD_LOCAL
+	if (regs == mathfun_frame_cache) {
+		mathfun_frame_cache_busy = false;
+		return;
+	}
+#endif
+
+	free(regs);
+}
+
+void mathfun_thread_cleanup(void) {
+#ifdef MATHFUN_THREAD_LOCAL
+	if (!mathfun_frame_cache_busy) {
+		free(mathfun_frame_cache);
+		mathfun_frame_cache = NULL;
+		mathfun_frame_cache_size = 0;
+	}
+	mathfun_context_cleanup(&mathfun_default_ctx);
+#endif
+}
+
+// executes fun on an initialized frame and turns errno into an error
+static double mathfun_frame_exec(const mathfun *fun, mathfun_value regs[], mathfun_error_p *error) {
+	errno = 0;
+	double value = mathfun_exec(fun, regs);
+
+	if (errno != 0) {
+		mathfun_raise_c_error(error);
+	}
+
+	return value;
 }
 
 double mathfun_call(const mathfun *fun, mathfun_error_p *error, ...) {
@@ -343,10 +522,53 @@ double mathfun_call(const mathfun *fun, mathfun_error_p *error, ...) {
 }
 
 double mathfun_acall(const mathfun *fun, const double args[], mathfun_error_p *error) {
-	mathfun_value *regs = calloc(fun->framesize, sizeof(mathfun_value));
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = mathfun_frame_acquire(fun, stack, error);
+
+	if (!regs) return NAN;
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		regs[i].number = args[i];
+	}
+
+	double value = mathfun_frame_exec(fun, regs, error);
+	mathfun_frame_release(regs, stack);
+
+	return value;
+}
+
+bool mathfun_acall_multi(const mathfun *fun, const double args[], double out[], mathfun_error_p *error) {
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = mathfun_frame_acquire(fun, stack, error);
+
+	if (!regs) return false;
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		regs[i].number = args[i];
+	}
+
+	errno = 0;
+	out[0] = mathfun_exec(fun, regs);
+	for (size_t i = 1; i < fun->retc; ++ i) {
+		out[i] = regs[fun->argc + i].number;
+	}
+	mathfun_frame_release(regs, stack);
+
+	if (errno != 0) {
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	return true;
+}
+
+double mathfun_acall_status(const mathfun *fun, const double args[], int flags, int *status,
+	mathfun_error_p *error) {
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = mathfun_frame_acquire(fun, stack, error);
 
 	if (!regs) {
-		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		if (status) *status = MATHFUN_STATUS_OK;
 		return NAN;
 	}
 
@@ -354,9 +576,36 @@ double mathfun_acall(const mathfun *fun, const double args[], mathfun_error_p *e
 		regs[i].number = args[i];
 	}
 
-	errno = 0;
+	mathfun_fenv env;
+	mathfun_fenv_enter(&env, flags);
 	double value = mathfun_exec(fun, regs);
-	free(regs);
+	const int raised = mathfun_fenv_leave(&env);
+
+	mathfun_frame_release(regs, stack);
+	if (status) *status = raised;
+
+	return value;
+}
+
+double mathfun_acall_gradient(const mathfun *fun, const double args[], double grad[], mathfun_error_p *error) {
+	if (fun->tapesize == 0) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return NAN;
+	}
+
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = mathfun_frame_acquire_size(2 * fun->framesize + fun->tapesize, stack, error);
+
+	if (!regs) return NAN;
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		regs[i].number = args[i];
+	}
+
+	errno = 0;
+	double value = mathfun_exec_gradient(fun, regs, grad);
+	mathfun_frame_release(regs, stack);
 
 	if (errno != 0) {
 		mathfun_raise_c_error(error);
@@ -366,20 +615,130 @@ double mathfun_acall(const mathfun *fun, const double args[], mathfun_error_p *e
 }
 
 double mathfun_vcall(const mathfun *fun, va_list ap, mathfun_error_p *error) {
-	mathfun_value *regs = calloc(fun->framesize, sizeof(mathfun_value));
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = mathfun_frame_acquire(fun, stack, error);
 
-	if (!regs) {
+	if (!regs) return NAN;
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		regs[i].number = va_arg(ap, double);
+	}
+
+	double value = mathfun_frame_exec(fun, regs, error);
+	mathfun_frame_release(regs, stack);
+
+	return value;
+}
+
+static double mathfun_ncall(const mathfun *fun, const double args[], size_t argc, mathfun_error_p *error) {
+	if (fun->argc != argc) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return NAN;
+	}
+
+	return mathfun_acall(fun, args, error);
+}
+
+double mathfun_call1(const mathfun *fun, double x, mathfun_error_p *error) {
+	const double args[] = { x };
+	return mathfun_ncall(fun, args, 1, error);
+}
+
+double mathfun_call2(const mathfun *fun, double x, double y, mathfun_error_p *error) {
+	const double args[] = { x, y };
+	return mathfun_ncall(fun, args, 2, error);
+}
+
+double mathfun_call3(const mathfun *fun, double x, double y, double z, mathfun_error_p *error) {
+	const double args[] = { x, y, z };
+	return mathfun_ncall(fun, args, 3, error);
+}
+
+double mathfun_call4(const mathfun *fun, double x, double y, double z, double w, mathfun_error_p *error) {
+	const double args[] = { x, y, z, w };
+	return mathfun_ncall(fun, args, 4, error);
+}
+
+static bool mathfun_frame_ensure(mathfun_frame *frame, size_t size, mathfun_error_p *error) {
+	if (frame->size < size) {
+		mathfun_value *regs = realloc(frame->regs, size * sizeof(mathfun_value));
+
+		if (!regs) {
+			mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		frame->regs = regs;
+		frame->size = size;
+	}
+	return true;
+}
+
+bool mathfun_frame_init(mathfun_frame *frame, const mathfun *fun, mathfun_error_p *error) {
+	frame->size = 0;
+	frame->regs = NULL;
+	return mathfun_frame_ensure(frame, fun->framesize, error);
+}
+
+void mathfun_frame_cleanup(mathfun_frame *frame) {
+	free(frame->regs);
+	frame->regs = NULL;
+	frame->size = 0;
+}
+
+// number of code words including END
+static size_t mathfun_code_words(const mathfun *fun) {
+	const mathfun_code *code = fun->code;
+	size_t size = 0;
+	while (code[size] != END) {
+		size += mathfun_code_size(code + size);
+	}
+	return size + 1;
+}
+
+bool mathfun_profile_init(mathfun_profile *profile, const mathfun *fun, mathfun_error_p *error) {
+	profile->size   = mathfun_code_words(fun);
+	profile->counts = calloc(profile->size, sizeof(uint64_t));
+	profile->ticks  = calloc(profile->size, sizeof(uint64_t));
+
+	if (!profile->counts || !profile->ticks) {
 		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		mathfun_profile_cleanup(profile);
+		return false;
+	}
+
+	return true;
+}
+
+void mathfun_profile_cleanup(mathfun_profile *profile) {
+	free(profile->counts);
+	free(profile->ticks);
+	profile->size   = 0;
+	profile->counts = NULL;
+	profile->ticks  = NULL;
+}
+
+double mathfun_profile_call(const mathfun *fun, mathfun_profile *profile, const double args[],
+	mathfun_error_p *error) {
+	if (profile->size != mathfun_code_words(fun)) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
 		return NAN;
 	}
 
+	mathfun_value stack[MATHFUN_STACK_FRAME_SIZE];
+	mathfun_value *regs = mathfun_frame_acquire(fun, stack, error);
+
+	if (!regs) return NAN;
+
 	for (size_t i = 0; i < fun->argc; ++ i) {
-		regs[i].number = va_arg(ap, double);
+		regs[i].number = args[i];
 	}
 
 	errno = 0;
-	double value = mathfun_exec(fun, regs);
-	free(regs);
+	double value = mathfun_exec_profile(fun, regs, profile);
+	mathfun_frame_release(regs, stack);
 
 	if (errno != 0) {
 		mathfun_raise_c_error(error);
@@ -388,6 +747,17 @@ double mathfun_vcall(const mathfun *fun, va_list ap, mathfun_error_p *error) {
 	return value;
 }
 
+double mathfun_frame_call(mathfun_frame *frame, const mathfun *fun, const double args[],
+	mathfun_error_p *error) {
+	if (!mathfun_frame_ensure(frame, fun->framesize, error)) return NAN;
+
+	for (size_t i = 0; i < fun->argc; ++ i) {
+		frame->regs[i].number = args[i];
+	}
+
+	return mathfun_frame_exec(fun, frame->regs, error);
+}
+
 double mathfun_run(const char *code, mathfun_error_p *error, ...) {
 	va_list ap;
 
@@ -401,10 +771,12 @@ double mathfun_run(const char *code, mathfun_error_p *error, ...) {
 
 	va_end(ap);
 
-	const char **argnames = NULL;
-	double *args = NULL;
+	const char *argnames_stack[MATHFUN_STACK_ARGS_SIZE];
+	double args_stack[MATHFUN_STACK_ARGS_SIZE];
+	const char **argnames = argnames_stack;
+	double *args = args_stack;
 
-	if (argc > 0) {
+	if (argc > MATHFUN_STACK_ARGS_SIZE) {
 		argnames = calloc(argc, sizeof(char*));
 
 		if (!argnames) {
@@ -432,67 +804,326 @@ double mathfun_run(const char *code, mathfun_error_p *error, ...) {
 
 	double value = mathfun_arun(argnames, argc, code, args, error);
 
-	free(args);
-	free(argnames);
+	if (args != args_stack) {
+		free(args);
+		free(argnames);
+	}
 
 	return value;
 }
 
+// Returns the context with the default declarations. Without thread local
+// storage ctx is initialized and has to be cleaned up by the caller.
+static const mathfun_context *mathfun_default_context(mathfun_context *ctx, mathfun_error_p *error) {
+#ifdef MATHFUN_THREAD_LOCAL
+	(void)ctx;
+	ctx = &mathfun_default_ctx;
+	if (ctx->decls) return ctx;
+#endif
+
+	if (!mathfun_context_init(ctx, true, error)) {
+		mathfun_context_cleanup(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static void mathfun_default_context_release(mathfun_context *ctx) {
+#ifdef MATHFUN_THREAD_LOCAL
+	(void)ctx;
+#else
+	mathfun_context_cleanup(ctx);
+#endif
+}
+
 double mathfun_arun(const char *argnames[], size_t argc, const char *code, const double args[],
 	mathfun_error_p *error) {
-	mathfun_context ctx;
+	mathfun_context local_ctx = MATHFUN_CONTEXT_INIT;
+	mathfun_arena_word buffer[MATHFUN_ARENA_STACK_SIZE];
+	mathfun_arena arena;
 
-	if (!mathfun_validate_argnames(argnames, argc, error)) return NAN;
+	const mathfun_context *ctx = mathfun_default_context(&local_ctx, error);
 
-	if (!mathfun_context_init(&ctx, true, error)) return NAN;
+	if (!ctx) return NAN;
 
-	mathfun_expr *expr = mathfun_context_parse(&ctx, argnames, argc, code, error);
+	// the expression only lives until it is executed, so all its nodes
+	// are allocated in an arena that is released at once
+	mathfun_arena_init(&arena, buffer, MATHFUN_ARENA_STACK_SIZE);
+	mathfun_expr *expr = mathfun_context_parse(ctx, argnames, argc, code, &arena, error);
+	double value = NAN;
 
-	if (!expr) {
-		mathfun_context_cleanup(&ctx);
-		return NAN;
+	if (expr) {
+		// it's only executed once, so any optimizations and byte code
+		// compilations would only add overhead
+		errno = 0;
+		value = mathfun_expr_exec(expr, args).number;
+
+		if (errno != 0) {
+			mathfun_raise_c_error(error);
+			value = NAN;
+		}
 	}
 
-	// it's only executed once, so any optimizations and byte code
-	// compilations would only add overhead
-	errno = 0;
-	double value = mathfun_expr_exec(expr, args).number;
+	mathfun_arena_cleanup(&arena);
+	mathfun_default_context_release(&local_ctx);
 
-	if (errno != 0) {
-		mathfun_raise_c_error(error);
-		mathfun_expr_free(expr);
-		mathfun_context_cleanup(&ctx);
-		return NAN;
+	return value;
+}
+
+// Keeps the code of the expressions for the source map (see mathfun_dump_profile()).
+// They are stored one after another, each terminated by a NUL.
+static bool mathfun_source_init(mathfun *fun, const char *codes[], size_t codec, mathfun_error_p *error) {
+	size_t size = 0;
+	for (size_t i = 0; i < codec; ++ i) {
+		size += strlen(codes[i]) + 1;
 	}
 
-	mathfun_expr_free(expr);
-	mathfun_context_cleanup(&ctx);
+	fun->source = malloc(size);
 
-	return value;
+	if (!fun->source) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	char *ptr = fun->source;
+	for (size_t i = 0; i < codec; ++ i) {
+		const size_t length = strlen(codes[i]) + 1;
+		memcpy(ptr, codes[i], length);
+		ptr += length;
+	}
+
+	return true;
 }
 
 bool mathfun_context_compile(const mathfun_context *ctx,
 	const char *argnames[], size_t argc, const char *code,
 	mathfun *fun, mathfun_error_p *error) {
+	return mathfun_context_compile_opt(ctx, argnames, argc, code, MATHFUN_OPT_DEFAULT, fun, error);
+}
+
+// uniform may be NULL (no uniform arguments), bind may be NULL (no bound arguments)
+static bool mathfun_context_compile_expr(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, enum mathfun_opt_level level,
+	const bool uniform[], const mathfun_bind *bind, mathfun *fun, mathfun_error_p *error) {
 	if (!mathfun_validate_argnames(argnames, argc, error)) return false;
 
-	mathfun_expr *expr = mathfun_context_parse(ctx, argnames, argc, code, error);
+	mathfun_arena_word buffer[MATHFUN_ARENA_STACK_SIZE];
+	mathfun_arena arena;
+
+	mathfun_arena_init(&arena, buffer, MATHFUN_ARENA_STACK_SIZE);
+	mathfun_expr *expr = mathfun_context_parse(ctx, argnames, argc, code, &arena, error);
 
 	memset(fun, 0, sizeof(struct mathfun));
-	if (!expr) return false;
 
-	mathfun_expr *opt = mathfun_expr_optimize(expr, error);
+	if (expr && bind) {
+		mathfun_expr_bind(expr, bind);
+		argc = bind->argc;
+	}
 
-	if (!opt) {
-		// expr is freed by mathfun_expr_optimize on error
+	// the tree lives in the arena, so the nodes mathfun_expr_optimize
+	// discards and the optimized tree are all released by the cleanup
+	mathfun_expr *opt = expr ? mathfun_expr_optimize(expr, error) : NULL;
+	const bool fast_math = level == MATHFUN_OPT_FAST_MATH;
+	bool ok = false;
+
+	if (opt && fast_math) {
+		opt = mathfun_expr_reassociate(opt, &arena, error);
+	}
+
+	if (opt) {
+		fun->argc = argc;
+		ok = mathfun_source_init(fun, &code, 1, error) &&
+			mathfun_expr_codegen(opt, fun, fast_math, uniform, error) &&
+			mathfun_code_regalloc(fun, error) && mathfun_code_fuse(fun, error);
+
+		if (!ok) mathfun_cleanup(fun);
+	}
+
+	mathfun_arena_cleanup(&arena);
+
+	return ok;
+}
+
+bool mathfun_context_compile_opt(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, enum mathfun_opt_level level,
+	mathfun *fun, mathfun_error_p *error) {
+	if (level != MATHFUN_OPT_DEFAULT && level != MATHFUN_OPT_FAST_MATH) {
+		memset(fun, 0, sizeof(struct mathfun));
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	return mathfun_context_compile_expr(ctx, argnames, argc, code, level, NULL, NULL, fun, error);
+}
+
+bool mathfun_context_compile_uniform(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, const bool uniform[],
+	mathfun *fun, mathfun_error_p *error) {
+	return mathfun_context_compile_expr(ctx, argnames, argc, code, MATHFUN_OPT_DEFAULT, uniform, NULL, fun, error);
+}
+
+bool mathfun_context_specialize(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code,
+	const size_t bound[], const double values[], size_t count,
+	mathfun *fun, mathfun_error_p *error) {
+	memset(fun, 0, sizeof(struct mathfun));
+
+	if (!mathfun_validate_argnames(argnames, argc, error)) return false;
+
+	size_t *argmap = calloc(argc, sizeof(size_t));
+	double *argvalues = malloc(argc * sizeof(double));
+
+	if (argc > 0 && (!argmap || !argvalues)) {
+		free(argmap);
+		free(argvalues);
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
 		return false;
 	}
 
+	bool ok = true;
+	for (size_t i = 0; i < count && ok; ++ i) {
+		const size_t arg = bound[i];
+		// unknown or repeated argument
+		ok = arg < argc && argmap[arg] != MATHFUN_ARG_BOUND;
+		if (ok) {
+			argmap[arg] = MATHFUN_ARG_BOUND;
+			argvalues[arg] = values[i];
+		}
+	}
+
+	if (ok) {
+		mathfun_bind bind = { argmap, argvalues, 0 };
+		for (size_t i = 0; i < argc; ++ i) {
+			if (argmap[i] != MATHFUN_ARG_BOUND) {
+				argmap[i] = bind.argc ++;
+			}
+		}
+
+		ok = mathfun_context_compile_expr(ctx, argnames, argc, code, MATHFUN_OPT_DEFAULT, NULL, &bind, fun, error);
+	}
+	else {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+	}
+
+	free(argmap);
+	free(argvalues);
+
+	return ok;
+}
+
+bool mathfun_context_compile_multi(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *codes[], size_t codec,
+	mathfun *fun, mathfun_error_p *error) {
+	memset(fun, 0, sizeof(struct mathfun));
+
+	if (!mathfun_validate_argnames(argnames, argc, error)) return false;
+
+	if (codec == 0) {
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	mathfun_expr **exprs = calloc(codec, sizeof(mathfun_expr*));
+
+	if (!exprs) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	mathfun_arena_word buffer[MATHFUN_ARENA_STACK_SIZE];
+	mathfun_arena arena;
+
+	mathfun_arena_init(&arena, buffer, MATHFUN_ARENA_STACK_SIZE);
+
+	bool ok = true;
+	for (size_t i = 0; i < codec && ok; ++ i) {
+		mathfun_expr *expr = mathfun_context_parse(ctx, argnames, argc, codes[i], &arena, error);
+		ok = expr && (exprs[i] = mathfun_expr_optimize(expr, error)) != NULL;
+	}
+
+	if (ok) {
+		fun->argc = argc;
+		ok = mathfun_source_init(fun, codes, codec, error) &&
+			mathfun_expr_codegen_multi(exprs, codec, fun, error) &&
+			mathfun_code_regalloc(fun, error) && mathfun_code_fuse(fun, error);
+
+		if (!ok) mathfun_cleanup(fun);
+	}
+
+	mathfun_arena_cleanup(&arena);
+	free(exprs);
+
+	return ok;
+}
+
+bool mathfun_context_compile_gradient(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code,
+	mathfun *fun, mathfun_error_p *error) {
+	if (!mathfun_context_compile(ctx, argnames, argc, code, fun, error)) return false;
+
+	fun->tapesize = mathfun_gradient_tapesize(fun);
+	return true;
+}
+
+bool mathfun_context_compile_precision(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, enum mathfun_precision precision,
+	mathfun *fun, mathfun_error_p *error) {
+	if (precision != MATHFUN_PRECISION_DOUBLE && precision != MATHFUN_PRECISION_FLOAT) {
+		memset(fun, 0, sizeof(struct mathfun));
+		errno = EINVAL;
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	if (!mathfun_context_compile(ctx, argnames, argc, code, fun, error)) return false;
+
+	if (precision == MATHFUN_PRECISION_FLOAT && !mathfun_float_pools(ctx, fun, error)) {
+		mathfun_cleanup(fun);
+		return false;
+	}
+
+	return true;
+}
+
+bool mathfun_context_derive(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, const char *argname,
+	mathfun *fun, mathfun_error_p *error) {
+	memset(fun, 0, sizeof(struct mathfun));
+
+	if (!mathfun_validate_argnames(argnames, argc, error)) return false;
+
+	size_t arg = 0;
+	while (arg < argc && strcmp(argnames[arg], argname) != 0) {
+		++ arg;
+	}
+
+	if (arg == argc) {
+		mathfun_raise_name_error(error, MATHFUN_NO_SUCH_NAME, argname);
+		return false;
+	}
+
+	mathfun_expr *expr = mathfun_context_parse(ctx, argnames, argc, code, NULL, error);
+	if (!expr) return false;
+
+	// expr is freed by mathfun_expr_optimize on error
+	mathfun_expr *opt = mathfun_expr_optimize(expr, error);
+	if (!opt) return false;
+
+	mathfun_expr *deriv = mathfun_expr_derive(ctx, opt, arg, error);
+	mathfun_expr_free(opt);
+	if (!deriv) return false;
+
+	opt = mathfun_expr_optimize(deriv, error);
+	if (!opt) return false;
+
 	fun->argc = argc;
-	bool ok = mathfun_expr_codegen(opt, fun, error);
+	bool ok = mathfun_expr_codegen(opt, fun, false, NULL, error) &&
+		mathfun_code_regalloc(fun, error) && mathfun_code_fuse(fun, error);
 
-	// mathfun_expr_optimize reuses expr and frees discarded things,
-	// so only opt has to be freed:
 	mathfun_expr_free(opt);
 
 	return ok;
@@ -510,6 +1141,90 @@ bool mathfun_compile(mathfun *fun, const char *argnames[], size_t argc, const ch
 	return ok;
 }
 
+bool mathfun_compile_multi(mathfun *fun, const char *argnames[], size_t argc,
+	const char *codes[], size_t codec, mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_compile_multi(&ctx, argnames, argc, codes, codec, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
+bool mathfun_compile_gradient(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_compile_gradient(&ctx, argnames, argc, code, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
+bool mathfun_compile_precision(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	enum mathfun_precision precision, mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_compile_precision(&ctx, argnames, argc, code, precision, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
+bool mathfun_compile_opt(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	enum mathfun_opt_level level, mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_compile_opt(&ctx, argnames, argc, code, level, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
+bool mathfun_compile_uniform(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	const bool uniform[], mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_compile_uniform(&ctx, argnames, argc, code, uniform, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
+bool mathfun_specialize(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	const size_t bound[], const double values[], size_t count, mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_specialize(&ctx, argnames, argc, code, bound, values, count, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
+bool mathfun_derive(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	const char *argname, mathfun_error_p *error) {
+	mathfun_context ctx;
+	memset(fun, 0, sizeof(struct mathfun));
+	if (!mathfun_context_init(&ctx, true, error)) return false;
+
+	bool ok = mathfun_context_derive(&ctx, argnames, argc, code, argname, fun, error);
+	mathfun_context_cleanup(&ctx);
+
+	return ok;
+}
+
 mathfun_expr *mathfun_expr_alloc(enum mathfun_expr_type type, mathfun_error_p *error) {
 	mathfun_expr *expr = calloc(1, sizeof(mathfun_expr));
 
@@ -524,7 +1239,8 @@ mathfun_expr *mathfun_expr_alloc(enum mathfun_expr_type type, mathfun_error_p *e
 }
 
 void mathfun_expr_free(mathfun_expr *expr) {
-	if (!expr) return;
+	// arena trees are released as a whole by mathfun_arena_cleanup()
+	if (!expr || expr->arena) return;
 
 	switch (expr->type) {
 		case EX_CONST:
@@ -585,6 +1301,71 @@ void mathfun_expr_free(mathfun_expr *expr) {
 	free(expr);
 }
 
+mathfun_expr *mathfun_expr_copy(const mathfun_expr *expr, mathfun_error_p *error) {
+	mathfun_expr *copy = mathfun_expr_alloc(expr->type, error);
+
+	if (!copy) return NULL;
+
+	copy->begin = expr->begin;
+	copy->end   = expr->end;
+
+	switch (expr->type) {
+		case EX_CONST:
+		case EX_ARG:
+			copy->ex = expr->ex;
+			return copy;
+
+		case EX_CALL:
+		{
+			const size_t argc = expr->ex.funct.sig->argc;
+			copy->ex.funct = expr->ex.funct;
+			copy->ex.funct.args = NULL;
+
+			if (argc > 0) {
+				copy->ex.funct.args = calloc(argc, sizeof(mathfun_expr*));
+
+				if (!copy->ex.funct.args) {
+					mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+					mathfun_expr_free(copy);
+					return NULL;
+				}
+			}
+
+			for (size_t i = 0; i < argc; ++ i) {
+				if (!(copy->ex.funct.args[i] = mathfun_expr_copy(expr->ex.funct.args[i], error))) {
+					mathfun_expr_free(copy);
+					return NULL;
+				}
+			}
+			return copy;
+		}
+		case EX_NEG:
+		case EX_NOT:
+			if (!(copy->ex.unary.expr = mathfun_expr_copy(expr->ex.unary.expr, error))) {
+				mathfun_expr_free(copy);
+				return NULL;
+			}
+			return copy;
+
+		case EX_IIF:
+			if (!(copy->ex.iif.cond      = mathfun_expr_copy(expr->ex.iif.cond,      error)) ||
+				!(copy->ex.iif.then_expr = mathfun_expr_copy(expr->ex.iif.then_expr, error)) ||
+				!(copy->ex.iif.else_expr = mathfun_expr_copy(expr->ex.iif.else_expr, error))) {
+				mathfun_expr_free(copy);
+				return NULL;
+			}
+			return copy;
+
+		default:
+			if (!(copy->ex.binary.left  = mathfun_expr_copy(expr->ex.binary.left,  error)) ||
+				!(copy->ex.binary.right = mathfun_expr_copy(expr->ex.binary.right, error))) {
+				mathfun_expr_free(copy);
+				return NULL;
+			}
+			return copy;
+	}
+}
+
 mathfun_type mathfun_expr_type(const mathfun_expr *expr) {
 	switch (expr->type) {
 		case EX_CONST:
@@ -643,6 +1424,7 @@ const char *mathfun_type_name(mathfun_type type) {
 double mathfun_mod(double x, double y) {
 	if (y == 0.0) {
 		errno = EDOM;
+		feraiseexcept(FE_INVALID);
 		return NAN;
 	}
 	double mod = fmod(x, y);
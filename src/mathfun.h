@@ -86,6 +86,72 @@ typedef struct mathfun_sig {
  */
 typedef mathfun_value (*mathfun_binding_funct)(const mathfun_value args[]);
 
+/** Derivative rule of a function registered with a #mathfun_context.
+ *
+ * Writes the partial derivative of the function with respect to args[i] to grad[i]
+ * (0 for boolean arguments).
+ *
+ * @see mathfun_context_define_deriv(), mathfun_acall_dual()
+ */
+typedef void (*mathfun_binding_deriv)(const mathfun_value args[], double grad[]);
+
+/** Closed interval [lo, hi] of numbers.
+ *
+ * Booleans are tri-state in interval evaluation: [0, 0] is false, [1, 1] is true and [0, 1]
+ * means the value may be either. An empty interval (the function is undefined everywhere on
+ * its arguments) is [NaN, NaN].
+ *
+ * @see mathfun_acall_interval()
+ */
+typedef struct mathfun_interval {
+	double lo; ///< lower bound
+	double hi; ///< upper bound
+} mathfun_interval;
+
+/** Interval version of a function registered with a #mathfun_context.
+ *
+ * Returns an interval that contains the result of the function for all arguments within args.
+ * The result may be wider than the exact range, but it must not be narrower, so round outward.
+ *
+ * @see mathfun_context_define_interval(), mathfun_acall_interval()
+ */
+typedef mathfun_interval (*mathfun_binding_interval)(const mathfun_interval args[]);
+
+/** Single precision value type.
+ *
+ * Registers of float programs (see mathfun_exec_batch_float()) hold this instead of #mathfun_value.
+ */
+typedef union mathfun_value_float {
+	float number;  ///< numeric value
+	bool boolean;  ///< boolean value
+} mathfun_value_float;
+
+/** Single precision version of a function registered with a #mathfun_context.
+ *
+ * @see mathfun_context_define_float(), mathfun_exec_batch_float()
+ */
+typedef mathfun_value_float (*mathfun_binding_float)(const mathfun_value_float args[]);
+
+/** Symbolic derivative of a function registered with a #mathfun_context.
+ *
+ * partials[i] is the partial derivative of the function with respect to its i-th argument,
+ * written as function expression over the arguments named in params. NULL stands for 0
+ * (e.g. for boolean or integer arguments).
+ *
+@code
+static const mathfun_partials hypot_partials = {
+    (const char*[]){ "x", "y" },
+    (const char*[]){ "x / hypot(x, y)", "y / hypot(x, y)" }
+};
+@endcode
+ *
+ * @see mathfun_context_define_partials(), mathfun_context_derive()
+ */
+typedef struct mathfun_partials {
+	const char **params;   ///< argument names used in partials
+	const char **partials; ///< partial derivative for each argument or NULL
+} mathfun_partials;
+
 /** Error code as returned by mathfun_error_type(mathfun_error_p error)
  */
 enum mathfun_error_type {
@@ -112,7 +178,52 @@ enum mathfun_error_type {
 	MATHFUN_PARSER_EXPECTED_DOTS,               ///< expected '..' or '...' but got something else
 	MATHFUN_PARSER_TYPE_ERROR,                  ///< expression with wrong type for this position
 	MATHFUN_PARSER_UNEXPECTED_END_OF_INPUT,     ///< unexpected end of input
-	MATHFUN_PARSER_TRAILING_GARBAGE             ///< garbage at the end of input
+	MATHFUN_PARSER_TRAILING_GARBAGE,            ///< garbage at the end of input
+	MATHFUN_NO_DERIVATIVE,          ///< a function without symbolic derivative was differentiated
+	MATHFUN_INVALID_CODE,           ///< byte code failed verification
+	MATHFUN_EXCEEDS_MAX_CODE_SIZE   ///< code or constant/function pool of compiled function exceeds maximum
+};
+
+/** Status flags reported by mathfun_acall_status() and mathfun_exec_batch_status().
+ *
+ * The flags are a bit set of the IEEE 754 exceptions raised while executing.
+ */
+enum mathfun_status {
+	MATHFUN_STATUS_OK        = 0, ///< no floating point exception was raised
+	MATHFUN_STATUS_INVALID   = 1, ///< invalid operation, like x % 0, sqrt(-1) or comparing with NaN
+	MATHFUN_STATUS_DIVBYZERO = 2, ///< division of a finite number by zero
+	MATHFUN_STATUS_OVERFLOW  = 4, ///< result too large to be represented
+	MATHFUN_STATUS_UNDERFLOW = 8  ///< result too small to be represented as a normal number
+};
+
+/** Execution flags for mathfun_acall_status() and mathfun_exec_batch_status().
+ */
+enum mathfun_exec_flags {
+	MATHFUN_EXEC_DEFAULT = 0, ///< use the floating point environment of the caller
+	MATHFUN_EXEC_FTZ     = 1  ///< flush denormal results and operands to zero (FTZ/DAZ) where supported
+};
+
+/** Flags for mathfun_pool_create().
+ */
+enum mathfun_pool_flags {
+	MATHFUN_POOL_DEFAULT = 0, ///< let the operating system schedule the worker threads
+	MATHFUN_POOL_PIN     = 1  ///< pin each worker thread to its own CPU where supported (Linux)
+};
+
+/** Precision of a compiled function expression.
+ * @see mathfun_context_compile_precision()
+ */
+enum mathfun_precision {
+	MATHFUN_PRECISION_DOUBLE = 0, ///< double precision only
+	MATHFUN_PRECISION_FLOAT  = 1  ///< also single precision (see mathfun_exec_batch_float())
+};
+
+/** Optimization level of a compiled function expression.
+ * @see mathfun_context_compile_opt()
+ */
+enum mathfun_opt_level {
+	MATHFUN_OPT_DEFAULT   = 0, ///< every operation is rounded as written (see mathfun_context_compile_opt())
+	MATHFUN_OPT_FAST_MATH = 1  ///< also reassociation and contraction (results may differ in rounding)
 };
 
 /** Declaration type enum.
@@ -129,8 +240,12 @@ struct mathfun_decl {
 	union {
 		double value; ///< numeric value
 		struct {
-			mathfun_binding_funct funct;  ///< function pointer
-			const mathfun_sig *sig;       ///< function signature
+			mathfun_binding_funct funct;      ///< function pointer
+			const mathfun_sig *sig;           ///< function signature
+			mathfun_binding_deriv deriv;      ///< derivative rule or NULL
+			const mathfun_partials *partials; ///< symbolic derivative or NULL
+			mathfun_binding_interval interval; ///< interval version or NULL
+			mathfun_binding_float float_funct; ///< single precision version or NULL
 		} funct;      ///< function info
 	} decl; ///< declaration info
 };
@@ -150,6 +265,21 @@ typedef struct mathfun_context mathfun_context;
  */
 typedef struct mathfun mathfun;
 
+/** Reusable execution frame.
+ * @see mathfun_frame_init()
+ */
+typedef struct mathfun_frame mathfun_frame;
+
+/** Execution profile of a compiled function expression.
+ * @see mathfun_profile_init()
+ */
+typedef struct mathfun_profile mathfun_profile;
+
+/** Thread pool for mathfun_exec_parallel().
+ * @see mathfun_pool_create()
+ */
+typedef struct mathfun_pool mathfun_pool;
+
 /** Error handle.
  *
  * A pointer to this type (so a pointer to a pointer) is used as argument type of
@@ -183,11 +313,46 @@ struct mathfun_context {
 
 struct mathfun {
 	size_t argc;
+	size_t retc;
 	size_t framesize;
+	size_t tapesize;
+	size_t entry;
+	size_t hoisted;
 	void  *code;
+	mathfun_value *consts;
+	mathfun_binding_funct *functs;
+	mathfun_binding_deriv *derivs;
+	mathfun_binding_interval *intervals;
+	enum mathfun_precision precision;
+	mathfun_value_float *float_consts;
+	mathfun_binding_float *float_functs;
+	const mathfun_sig **sigs;
+	double (*native)(mathfun_value frame[]);
+	size_t native_size;
+	char  *source;
+	void  *srcmap;
+};
+
+#define MATHFUN_INIT { .argc = 0, .retc = 0, .framesize = 0, .tapesize = 0, .entry = 0, .hoisted = 0, \
+	.code = NULL, .consts = NULL, .functs = NULL, .derivs = NULL, .intervals = NULL, \
+	.precision = MATHFUN_PRECISION_DOUBLE, \
+	.float_consts = NULL, .float_functs = NULL, .sigs = NULL, .native = NULL, .native_size = 0, \
+	.source = NULL, .srcmap = NULL }
+
+struct mathfun_frame {
+	size_t size;
+	mathfun_value *regs;
+};
+
+#define MATHFUN_FRAME_INIT { .size = 0, .regs = NULL }
+
+struct mathfun_profile {
+	size_t    size;   ///< number of code words of the profiled function
+	uint64_t *counts; ///< executions of the instruction at each code address
+	uint64_t *ticks;  ///< ticks spent in the instruction at each code address
 };
 
-#define MATHFUN_INIT { .argc = 0, .framesize = 0, .code = NULL }
+#define MATHFUN_PROFILE_INIT { .size = 0, .counts = NULL, .ticks = NULL }
 
 /** Initialize a mathfun_context.
  *
@@ -336,6 +501,70 @@ MATHFUN_EXPORT bool mathfun_context_define_const(mathfun_context *ctx, const cha
 MATHFUN_EXPORT bool mathfun_context_define_funct(mathfun_context *ctx, const char *name, mathfun_binding_funct funct,
 	const mathfun_sig *sig, mathfun_error_p *error);
 
+/** Define the derivative rule of a function.
+ *
+ * The rule is used by mathfun_acall_dual(). Only functions compiled after this call use it.
+ * All default functions with a derivative that can be computed with the C math library have
+ * a rule.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param name The name of the function.
+ * @param deriv The derivative rule or NULL to remove it.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_NO_SUCH_NAME (also if name is a constant)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_define_deriv(mathfun_context *ctx, const char *name, mathfun_binding_deriv deriv,
+	mathfun_error_p *error);
+
+/** Define the symbolic derivative of a function.
+ *
+ * The partial derivatives are used by mathfun_context_derive(). They are parsed in ctx, so they
+ * can call any function of ctx, including the function itself. All default functions with a
+ * derivative that can be written with the default functions have one.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param name The name of the function.
+ * @param partials The symbolic derivative or NULL to remove it. partials and the strings it refers
+ *        to have to have a lifetime of at least as long as ctx.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_NO_SUCH_NAME (also if name is
+ *        a constant), #MATHFUN_OUT_OF_MEMORY, #MATHFUN_ILLEGAL_NAME, #MATHFUN_DUPLICATE_ARGUMENT,
+ *        MATHFUN_PARSER_* (the partial derivatives are checked)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_define_partials(mathfun_context *ctx, const char *name,
+	const mathfun_partials *partials, mathfun_error_p *error);
+
+/** Define the interval version of a function.
+ *
+ * The interval version is used by mathfun_acall_interval(). Only functions compiled after this
+ * call use it. Functions without one yield the whole real line (or maybe if they return a boolean).
+ * Most of the default functions have one.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param name The name of the function.
+ * @param interval The interval version or NULL to remove it.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_NO_SUCH_NAME (also if name is a constant)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_define_interval(mathfun_context *ctx, const char *name,
+	mathfun_binding_interval interval, mathfun_error_p *error);
+
+/** Define the single precision version of a function.
+ *
+ * The single precision version is used by mathfun_exec_batch_float(). Only functions compiled
+ * after this call use it. Functions without one are called with their arguments converted to
+ * double and the result rounded to float. All default functions except the Bessel functions
+ * have one (e.g. sinf() for sin).
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param name The name of the function.
+ * @param float_funct The single precision version or NULL to remove it.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_NO_SUCH_NAME (also if name is a constant)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_define_float(mathfun_context *ctx, const char *name,
+	mathfun_binding_float float_funct, mathfun_error_p *error);
+
 /** Find the name of a given function.
  * @param ctx A pointer to a #mathfun_context
  * @param funct Function pointer to the function that shall be found.
@@ -375,6 +604,185 @@ MATHFUN_EXPORT bool mathfun_context_compile(const mathfun_context *ctx,
 	const char *argnames[], size_t argc, const char *code,
 	mathfun *fun, mathfun_error_p *error);
 
+/** Compile several function expressions over the same arguments to one byte code object.
+ *
+ * The result is a function with codec results. Subexpressions that occur in more than one
+ * place (in the same or in different expressions) are only computed once, as long as they
+ * are computed unconditionally (i.e. not only in one branch of ?:, && or ||).
+ *
+ * Use mathfun_acall_multi() or mathfun_exec_batch_multi() to get all results. mathfun_exec()
+ * and the other call functions return the first one, the i-th result is left in frame
+ * register mathfun::argc + i.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expressions
+ * @param argc Number of arguments
+ * @param codes Array of function expressions
+ * @param codec Number of function expressions (at least 1)
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_ILLEGAL_NAME, #MATHFUN_DUPLICATE_ARGUMENT,
+ *        #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR, #MATHFUN_TOO_MANY_ARGUMENTS, #MATHFUN_EXCEEDS_MAX_FRAME_SIZE,
+ *        #MATHFUN_C_ERROR (errno is EINVAL if codec is 0), MATHFUN_PARSER_*
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_compile_multi(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *codes[], size_t codec,
+	mathfun *fun, mathfun_error_p *error);
+
+/** Compile a function expression for mathfun_acall_gradient().
+ *
+ * Like mathfun_context_compile(), but also sizes the tape of the reverse mode differentiation
+ * (see mathfun::tapesize). The result can be used like any other compiled function expression.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_compile_gradient(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code,
+	mathfun *fun, mathfun_error_p *error);
+
+/** Compile a function expression with a given precision.
+ *
+ * With #MATHFUN_PRECISION_DOUBLE this is the same as mathfun_context_compile(). With
+ * #MATHFUN_PRECISION_FLOAT the byte code also gets a single precision constant pool and the
+ * single precision versions of the called functions (see mathfun_context_define_float()), so it
+ * can be executed with mathfun_exec_batch_float(). Constant subexpressions are still folded in
+ * double precision, only their results are rounded to float. The result can be used like any
+ * other compiled function expression, the double precision functions execute it in double
+ * precision.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param precision A #mathfun_precision
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile(), and
+ *        #MATHFUN_C_ERROR (errno is EINVAL if precision is unknown)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_compile_precision(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, enum mathfun_precision precision,
+	mathfun *fun, mathfun_error_p *error);
+
+/** Compile a function expression with a given optimization level.
+ *
+ * With #MATHFUN_OPT_DEFAULT this is the same as mathfun_context_compile(): constants are folded,
+ * common subexpressions are computed once and operations without effect are removed, but every
+ * remaining operation is rounded as written. The only differences to evaluating the expression
+ * as written are that x + 0 is -0 rather than 0 for x = -0 and that math errors of operands whose
+ * value doesn't matter (like log(x) in log(x) < 0 && false) aren't raised.
+ *
+ * #MATHFUN_OPT_FAST_MATH treats + and * as associative: chains of sums and products are flattened,
+ * their constants are gathered (so (x + 1) + 2 is x + 3 and 2 * x * 3 is x * 6, x / 4 * 2 is
+ * x * 0.5) and long chains are rebuilt as balanced trees, whose terms don't depend on each other.
+ * a * b + c is computed with one rounding (fused multiply-add). Powers with a constant exponent
+ * don't call pow(): x ** 0.5 is sqrt(x), x ** -1 is 1 / x and integer exponents up to 8 are
+ * computed by multiplying. Results may differ from the default level in rounding and intermediate
+ * results may overflow where they didn't before, so only use it where this is acceptable.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param level A #mathfun_opt_level
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile(), and
+ *        #MATHFUN_C_ERROR (errno is EINVAL if level is unknown)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_compile_opt(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, enum mathfun_opt_level level,
+	mathfun *fun, mathfun_error_p *error);
+
+/** Compile a function expression with some arguments that are the same for many rows.
+ *
+ * Arguments marked in uniform are expected to have the same value in every row of a batch
+ * (like the channel of a sample generator or the parameters of a request). The
+ * subexpressions that only depend on uniform arguments and constants, and are computed in
+ * every call, are hoisted into a prologue: mathfun_exec_batch() and the other batch and
+ * parallel execution functions compute them once per call and the rows only read their
+ * results. For sin(channel * pi / 4) * sin(r * 440) with uniform channel only
+ * sin(r * 440) and the product are computed per row. Subexpressions in branches of ?:, &&
+ * and || aren't hoisted.
+ *
+ * The result can be used like any other compiled function expression. The other execution
+ * functions simply run the prologue with every call. If a uniform argument column has
+ * different values the hoisted subexpressions get the values of its first row (per call,
+ * per chunk of mathfun_exec_parallel()).
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param uniform Array of argc flags, true for arguments that are uniform
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_compile_uniform(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, const bool uniform[],
+	mathfun *fun, mathfun_error_p *error);
+
+/** Compile a function expression with some arguments bound to fixed values.
+ *
+ * The arguments listed in bound are replaced by the given constants before the expression
+ * is optimized, so everything that only depends on them is folded and ?: with a bound
+ * condition is reduced to the taken branch. The result is a function of the remaining
+ * arguments (in their original order). This pays off for arguments that change much less
+ * often than the function is called, like model parameters: with a = 2 and b = 3 bound
+ * a > 0 ? sqrt(a) * x + b : x is compiled like 1.4142135623730951 * x + 3.
+ *
+ * Compiled functions don't keep the expression tree, so a function is specialized from its
+ * code. Errors that folding the bound values raises (like log(a) with a = -1) are reported
+ * by this function.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param bound Array of count indices into argnames of the arguments to bind
+ * @param values Array of count values of the bound arguments
+ * @param count Number of bound arguments
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile(), and
+ *        #MATHFUN_C_ERROR (errno is EINVAL if an index in bound is out of range or repeated)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_specialize(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code,
+	const size_t bound[], const double values[], size_t count,
+	mathfun *fun, mathfun_error_p *error);
+
+/** Compile the derivative of a function expression.
+ *
+ * The expression is differentiated symbolically with respect to the argument argname. The
+ * derivative is optimized and compiled like any other function expression, so it's a function
+ * of the same arguments that is as cheap as a hand written one. Bound functions are
+ * differentiated using their symbolic derivatives (see mathfun_context_define_partials()).
+ * Comparisons and the conditions of ?: are constant, so the derivative of
+ * x < 0 ? -x : x is x < 0 ? -1 : 1.
+ *
+ * @param ctx A pointer to a #mathfun_context
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param argname The argument to differentiate for
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile(), and
+ *        #MATHFUN_NO_SUCH_NAME (argname is no argument), #MATHFUN_NO_DERIVATIVE (a function without
+ *        symbolic derivative depends on argname)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_context_derive(const mathfun_context *ctx,
+	const char *argnames[], size_t argc, const char *code, const char *argname,
+	mathfun *fun, mathfun_error_p *error);
+
 /** Frees allocated resources.
  *
  * @param fun A pointer to a #mathfun object
@@ -395,7 +803,117 @@ MATHFUN_EXPORT void mathfun_cleanup(mathfun *fun);
 MATHFUN_EXPORT bool mathfun_compile(mathfun *fun, const char *argnames[], size_t argc, const char *code,
 	mathfun_error_p *error);
 
+/** Compile several function expressions using default function/constant definitions.
+ *
+ * @see mathfun_context_compile_multi()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expressions
+ * @param argc Number of arguments
+ * @param codes Array of function expressions
+ * @param codec Number of function expressions (at least 1)
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile_multi()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_compile_multi(mathfun *fun, const char *argnames[], size_t argc,
+	const char *codes[], size_t codec, mathfun_error_p *error);
+
+/** Compile a function expression for mathfun_acall_gradient() using default function/constant definitions.
+ *
+ * @see mathfun_context_compile_gradient()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_compile_gradient(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	mathfun_error_p *error);
+
+/** Compile a function expression with a given precision using default function/constant definitions.
+ *
+ * @see mathfun_context_compile_precision()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param precision A #mathfun_precision
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile_precision()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_compile_precision(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	enum mathfun_precision precision, mathfun_error_p *error);
+
+/** Compile a function expression with a given optimization level using default function/constant definitions.
+ *
+ * @see mathfun_context_compile_opt()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param level A #mathfun_opt_level
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile_opt()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_compile_opt(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	enum mathfun_opt_level level, mathfun_error_p *error);
+
+/** Compile a function expression with uniform arguments using default function/constant definitions.
+ *
+ * @see mathfun_context_compile_uniform()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param uniform Array of argc flags, true for arguments that are uniform
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_compile_uniform()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_compile_uniform(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	const bool uniform[], mathfun_error_p *error);
+
+/** Compile a function expression with bound arguments using default function/constant definitions.
+ *
+ * @see mathfun_context_specialize()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param bound Array of count indices into argnames of the arguments to bind
+ * @param values Array of count values of the bound arguments
+ * @param count Number of bound arguments
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_specialize()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_specialize(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	const size_t bound[], const double values[], size_t count, mathfun_error_p *error);
+
+/** Compile the derivative of a function expression using default function/constant definitions.
+ *
+ * @see mathfun_context_derive()
+ *
+ * @param fun Target byte code object (will be initialized in any case)
+ * @param argnames Array of argument names of the function expression
+ * @param argc Number of arguments
+ * @param code The function expression
+ * @param argname The argument to differentiate for
+ * @param error A pointer to an error handle. Possible errors: see mathfun_context_derive()
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_derive(mathfun *fun, const char *argnames[], size_t argc, const char *code,
+	const char *argname, mathfun_error_p *error);
+
 /** Execute a compiled function expression.
+ *
+ * mathfun_call(), mathfun_acall(), mathfun_vcall() and mathfun_call1() to mathfun_call4() don't
+ * allocate memory for small functions (up to 64 registers, see mathfun::framesize). Bigger
+ * functions use a frame that is cached per thread, see mathfun_thread_cleanup().
  *
  * @param fun Byte code object to execute
  * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
@@ -404,6 +922,34 @@ MATHFUN_EXPORT bool mathfun_compile(mathfun *fun, const char *argnames[], size_t
  */
 MATHFUN_EXPORT double mathfun_call(const mathfun *fun, mathfun_error_p *error, ...);
 
+/** Execute a compiled function expression with exactly one argument.
+ *
+ * Like mathfun_call(), but without variable arguments.
+ *
+ * @param fun Byte code object to execute
+ * @param x The argument
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (errno is EINVAL if fun doesn't take exactly one argument)
+ * @return The result of the evaluation.
+ */
+MATHFUN_EXPORT double mathfun_call1(const mathfun *fun, double x, mathfun_error_p *error);
+
+/** Execute a compiled function expression with exactly two arguments.
+ * @see mathfun_call1()
+ */
+MATHFUN_EXPORT double mathfun_call2(const mathfun *fun, double x, double y, mathfun_error_p *error);
+
+/** Execute a compiled function expression with exactly three arguments.
+ * @see mathfun_call1()
+ */
+MATHFUN_EXPORT double mathfun_call3(const mathfun *fun, double x, double y, double z, mathfun_error_p *error);
+
+/** Execute a compiled function expression with exactly four arguments.
+ * @see mathfun_call1()
+ */
+MATHFUN_EXPORT double mathfun_call4(const mathfun *fun, double x, double y, double z, double w,
+	mathfun_error_p *error);
+
 /** Execute a compiled function expression.
  *
  * @param fun Byte code object to execute
@@ -414,6 +960,107 @@ MATHFUN_EXPORT double mathfun_call(const mathfun *fun, mathfun_error_p *error, .
  */
 MATHFUN_EXPORT double mathfun_acall(const mathfun *fun, const double args[], mathfun_error_p *error);
 
+/** Execute a compiled function expression and get all of its results.
+ *
+ * @see mathfun_context_compile_multi()
+ *
+ * @param fun Byte code object to execute
+ * @param args Array of argument values
+ * @param out Array of mathfun::retc elements that receives the results
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_acall_multi(const mathfun *fun, const double args[], double out[],
+	mathfun_error_p *error);
+
+/** Execute a compiled function expression, reporting math errors as status word.
+ *
+ * Like mathfun_acall(), but errno is neither cleared nor checked. Math errors are returned
+ * as status word instead of errors.
+ * @see mathfun_exec_batch_status()
+ *
+ * @param fun Byte code object to execute
+ * @param args Array of argument values
+ * @param flags Bit set of #mathfun_exec_flags
+ * @param status Receives the bit set of raised #mathfun_status flags. Can be NULL.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY
+ * @return The result of the evaluation.
+ */
+MATHFUN_EXPORT double mathfun_acall_status(const mathfun *fun, const double args[], int flags, int *status,
+	mathfun_error_p *error);
+
+/** Execute a compiled function expression and its directional derivative.
+ *
+ * Forward mode automatic differentiation: the byte code is executed with dual numbers, so one
+ * pass yields f(args) and the derivative of f in direction dirs, i.e. the sum of
+ * df/dargs[i] * dirs[i]. Pass the i-th unit vector as dirs to get df/dargs[i].
+ *
+ * Bound functions are differentiated using their derivative rules (see
+ * mathfun_context_define_deriv()). The derivative is NaN if a function without a rule depends on
+ * the direction. Functions that are constant almost everywhere (like floor) and comparisons
+ * have a zero derivative, so the derivative of x < 0 ? -x : x is the one of the taken branch.
+ *
+ * The byte code is always interpreted, even after mathfun_jit().
+ *
+ * @param fun Byte code object to execute
+ * @param args Array of argument values
+ * @param dirs Array of fun->argc direction components
+ * @param deriv Receives the directional derivative
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return The result of the evaluation.
+ */
+MATHFUN_EXPORT double mathfun_acall_dual(const mathfun *fun, const double args[], const double dirs[], double *deriv,
+	mathfun_error_p *error);
+
+/** Execute a compiled function expression and its gradient.
+ *
+ * Reverse mode automatic differentiation: one forward pass records the executed instructions
+ * on a tape, one backward pass over the tape yields all partial derivatives. So unlike
+ * mathfun_acall_dual() the cost doesn't grow with the number of arguments. The derivatives
+ * follow the same rules as the ones of mathfun_acall_dual(). Only the evaluation of the
+ * function raises math errors, partial derivatives that can't be computed are NaN.
+ *
+ * The tape is part of the execution frame, which has 2 * mathfun::framesize + mathfun::tapesize
+ * elements. Like for mathfun_acall() small frames are on the stack and bigger ones are cached
+ * per thread, so no memory is allocated per call.
+ *
+ * @param fun Byte code object compiled with mathfun_compile_gradient() or
+ *        mathfun_context_compile_gradient()
+ * @param args Array of argument values
+ * @param grad Array of fun->argc elements that receives the partial derivatives
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (errno is EINVAL if fun wasn't compiled for gradients, other errors depend on
+ *        the functions called by the expression)
+ * @return The result of the evaluation.
+ */
+MATHFUN_EXPORT double mathfun_acall_gradient(const mathfun *fun, const double args[], double grad[],
+	mathfun_error_p *error);
+
+/** Execute a compiled function expression with interval arithmetic.
+ *
+ * Computes an interval that contains the result of the function for all arguments within
+ * args, so e.g. a root finder or plotter can discard a box if it doesn't contain 0. Bounds are
+ * rounded outward. The interval may be wider than the exact range of the function, but for
+ * small boxes it gets close. Values outside of the domain of an operation are ignored
+ * (sqrt([-1, 4]) is [0, 2]), and the result is empty if the function is undefined everywhere.
+ *
+ * Comparisons are tri-state. If a condition may be either true or false, both branches are
+ * evaluated and the result is the hull of theirs. Bound functions use their interval versions
+ * (see mathfun_context_define_interval()). Math errors aren't raised.
+ *
+ * The byte code is always interpreted, even after mathfun_jit(). Of multiple results only the
+ * first one is computed.
+ *
+ * @param fun Byte code object to execute
+ * @param args Array of argument intervals
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_C_ERROR
+ * @return The interval of the result or [NaN, NaN] if an error occured.
+ */
+MATHFUN_EXPORT mathfun_interval mathfun_acall_interval(const mathfun *fun, const mathfun_interval args[],
+	mathfun_error_p *error);
+
 /** Execute a compiled function expression.
  *
  * @param fun Byte code object to execute
@@ -424,6 +1071,45 @@ MATHFUN_EXPORT double mathfun_acall(const mathfun *fun, const double args[], mat
  */
 MATHFUN_EXPORT double mathfun_vcall(const mathfun *fun, va_list ap, mathfun_error_p *error);
 
+/** Free the frame and the default context cached for the calling thread.
+ *
+ * The call functions keep a frame per thread for functions with more than 64 registers and
+ * mathfun_run() and mathfun_arun() keep the context with the default declarations.
+ * Call this before a thread exits to release them. They're allocated again when needed.
+ */
+MATHFUN_EXPORT void mathfun_thread_cleanup(void);
+
+/** Initialize an execution frame for a compiled function expression.
+ *
+ * The frame can be used for any number of mathfun_frame_call() calls, also with other
+ * function expressions. It grows if a function needs more registers than it has.
+ *
+ * @param frame A pointer to a #mathfun_frame
+ * @param fun The compiled function expression the frame is sized for
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_frame_init(mathfun_frame *frame, const mathfun *fun, mathfun_error_p *error);
+
+/** Frees allocated resources.
+ * @param frame A pointer to a #mathfun_frame
+ */
+MATHFUN_EXPORT void mathfun_frame_cleanup(mathfun_frame *frame);
+
+/** Execute a compiled function expression using a reusable frame.
+ *
+ * Doesn't allocate memory unless the frame is too small for fun.
+ *
+ * @param frame The execution frame
+ * @param fun Byte code object to execute
+ * @param args Array of argument values
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return The result of the evaluation.
+ */
+MATHFUN_EXPORT double mathfun_frame_call(mathfun_frame *frame, const mathfun *fun, const double args[],
+	mathfun_error_p *error);
+
 /** Execute a compiled function expression.
  *
  * This is a low-level function used by mathfun_call(), mathfun_acall() and mathfun_vcall(). Use it if you need
@@ -435,6 +1121,11 @@ MATHFUN_EXPORT double mathfun_vcall(const mathfun *fun, va_list ap, mathfun_erro
  *
  * Sets errno when a math error occurs.
  *
+ * The byte code isn't checked while it runs. Functions produced by the compile functions are valid,
+ * but a #mathfun assembled in any other way (e.g. loaded from a file) has to pass mathfun_verify()
+ * first. Executing invalid byte code is undefined behaviour. (Only the switch dispatch of the
+ * interpreter rejects unknown opcodes with EINVAL, unless the library is built with MATHFUN_ASSUME_VERIFIED.)
+ *
  * @param fun The compiled function expression
  * @param frame The functions execution frame
  * @return The result of the execution
@@ -442,6 +1133,246 @@ MATHFUN_EXPORT double mathfun_vcall(const mathfun *fun, va_list ap, mathfun_erro
 MATHFUN_EXPORT double mathfun_exec(const mathfun *fun, mathfun_value frame[])
 	__attribute__((__noinline__,__noclone__));
 
+/** Verify byte code that wasn't produced by the compile functions.
+ *
+ * Checks that every instruction is known and complete, that all register operands are less than
+ * fun->framesize and all constant/function pool indices are less than the given pool sizes, that
+ * jumps only go forward and land on instructions and that the code ends with a RET or JMP followed
+ * by END. The interpreters rely on all of this without checking it, so do this once after loading
+ * byte code from an untrusted source (e.g. a file or shared memory) before executing it.
+ *
+ * Function pointers in fun->functs can't be checked beyond being non-NULL.
+ *
+ * @param fun The function expression to verify
+ * @param codesize Number of 16 bit words in fun->code, including the terminating END
+ * @param constc Number of entries in fun->consts
+ * @param functc Number of entries in fun->functs
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY,
+ *        #MATHFUN_INVALID_CODE (use mathfun_error_log() to get the address of the offending instruction)
+ * @return true if the byte code is valid, false otherwise.
+ */
+MATHFUN_EXPORT bool mathfun_verify(const mathfun *fun, size_t codesize, size_t constc, size_t functc,
+	mathfun_error_p *error);
+
+/** Translate a compiled function expression to native machine code.
+ *
+ * After this mathfun_exec() (and therefore mathfun_call(), mathfun_acall() and mathfun_vcall())
+ * runs the generated machine code instead of interpreting the byte code. mathfun_exec_batch()
+ * keeps using the vectorized interpreter.
+ *
+ * Native code is currently only generated on x86-64 (System V ABI). On other platforms, or if
+ * executable memory can't be mapped, the function silently keeps using the interpreter.
+ * Use mathfun_is_native() to find out which is the case.
+ *
+ * The machine code is freed by mathfun_cleanup().
+ *
+ * @param fun The compiled function expression
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY
+ * @return true on success (including falling back to the interpreter), false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_jit(mathfun *fun, mathfun_error_p *error);
+
+/** Returns true if the function expression is executed as native machine code.
+ *
+ * @param fun The compiled function expression
+ * @return true if mathfun_jit() generated machine code for fun
+ */
+MATHFUN_EXPORT bool mathfun_is_native(const mathfun *fun);
+
+/** Execute a compiled function expression for many argument rows at once.
+ *
+ * The arguments are passed as columns: args[i] points to the n values of the i-th argument.
+ * Rows are processed in blocks so that each instruction is dispatched once per block instead
+ * of once per row, which is a lot faster than calling mathfun_exec() in a loop.
+ *
+ * out is written even if an error occurs.
+ *
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Output array of n elements
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_batch(const mathfun *fun, const double *args[], size_t n, double out[],
+	mathfun_error_p *error);
+
+/** Execute a compiled function expression for many argument rows at once, reporting math errors as status word.
+ *
+ * Like mathfun_exec_batch(), but errno is neither cleared nor checked and math errors are not
+ * reported as errors. Instead the floating point exceptions raised by all rows are collected in
+ * a status word (see #mathfun_status). The floating point environment of the caller, including
+ * the flags reported in the status word, is restored afterwards (the inexact flag may be set).
+ *
+ * The status mode costs nothing per call as long as the caller has none of the reported flags
+ * set. Enabling FTZ/DAZ has to change the environment twice, which is cheap per batch but
+ * noticeable for single calls.
+ *
+ * With #MATHFUN_EXEC_FTZ denormal numbers are flushed to zero while executing, which avoids the
+ * large slowdown denormal arithmetic has on most CPUs (e.g. in decaying signals). This is only
+ * supported on x86-64 and AArch64 and ignored elsewhere.
+ *
+ * Bound functions that report errors only through errno don't show up in the status word.
+ *
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Output array of n elements
+ * @param flags Bit set of #mathfun_exec_flags
+ * @param status Receives the bit set of raised #mathfun_status flags. Can be NULL.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_batch_status(const mathfun *fun, const double *args[], size_t n, double out[],
+	int flags, int *status, mathfun_error_p *error);
+
+/** Execute a compiled function expression with several results for many argument rows at once.
+ *
+ * Like mathfun_exec_batch(), but writes every result of fun into its own column.
+ * @see mathfun_context_compile_multi()
+ *
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Array of fun->retc pointers to output columns of n elements each
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_batch_multi(const mathfun *fun, const double *args[], size_t n, double *out[],
+	mathfun_error_p *error);
+
+/** Execute a compiled function expression with several results for many argument rows at once,
+ * reporting math errors as status word.
+ *
+ * @see mathfun_exec_batch_multi(), mathfun_exec_batch_status()
+ *
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Array of fun->retc pointers to output columns of n elements each
+ * @param flags Bit set of #mathfun_exec_flags
+ * @param status Receives the bit set of raised #mathfun_status flags. Can be NULL.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_batch_multi_status(const mathfun *fun, const double *args[], size_t n,
+	double *out[], int flags, int *status, mathfun_error_p *error);
+
+/** Execute a compiled function expression in single precision for many argument rows at once.
+ *
+ * Like mathfun_exec_batch(), but the arguments, the results and all registers are floats, so a
+ * vector instruction processes twice as many rows and the columns take half the memory. fun has
+ * to be compiled with #MATHFUN_PRECISION_FLOAT (see mathfun_context_compile_precision()).
+ *
+ * <strong>Error bound:</strong> Every arithmetic instruction is correctly rounded to float
+ * (relative error at most 2^-24) and the single precision functions of the C library are
+ * accurate to about 1 ulp (2^-23). So compared to mathfun_exec_batch() with the same arguments,
+ * an expression that evaluates k operations and functions has a relative error of at most about
+ * k * 2^-23 (i.e. 6 * 10^-8 per operation) as long as no operation amplifies errors. Subtracting
+ * nearly equal numbers and steep functions (like exp() of large or tan() near pi/2 arguments)
+ * amplify the error of their operands by their condition number, just like in double precision.
+ * Intermediate results beyond +-3.4 * 10^38 overflow to +-inf and below 1.2 * 10^-38 lose
+ * precision. Comparisons of nearly equal numbers may take the other branch of ?:, so
+ * discontinuous expressions may differ arbitrarily close to their discontinuities.
+ *
+ * out is written even if an error occurs.
+ *
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Output array of n elements
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (errno is EINVAL if fun wasn't compiled with #MATHFUN_PRECISION_FLOAT, else
+ *        depending on the functions called by the expression)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_batch_float(const mathfun *fun, const float *args[], size_t n, float out[],
+	mathfun_error_p *error);
+
+/** Create a thread pool for mathfun_exec_parallel().
+ *
+ * The calling thread of mathfun_exec_parallel() takes part in the evaluation, so a pool of
+ * nthreads threads starts nthreads - 1 worker threads. They sleep while no batch is executed.
+ *
+ * With #MATHFUN_POOL_PIN the worker threads are pinned to the CPUs the process may run on,
+ * one after another. The calling thread is not pinned. This is ignored where unsupported.
+ *
+ * Platforms without POSIX threads get a pool that evaluates everything on the calling thread.
+ *
+ * @param nthreads Number of threads evaluating rows (including the calling thread).
+ *        0 means one per online CPU.
+ * @param flags Bit set of #mathfun_pool_flags
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY,
+ *        #MATHFUN_C_ERROR (if a thread can't be created)
+ * @return The new pool or NULL if an error occured. Free it with mathfun_pool_destroy().
+ */
+MATHFUN_EXPORT mathfun_pool *mathfun_pool_create(size_t nthreads, int flags, mathfun_error_p *error);
+
+/** Stop the worker threads and free the pool.
+ *
+ * @param pool The pool to destroy. Can be NULL.
+ */
+MATHFUN_EXPORT void mathfun_pool_destroy(mathfun_pool *pool);
+
+/** Number of threads evaluating rows of a batch, including the calling thread.
+ *
+ * @param pool The thread pool
+ * @return The number of threads
+ */
+MATHFUN_EXPORT size_t mathfun_pool_size(const mathfun_pool *pool);
+
+/** Execute a compiled function expression for many argument rows at once using a thread pool.
+ *
+ * Like mathfun_exec_batch(), but the rows are split into chunks of a few blocks that are
+ * evaluated by the threads of pool. Threads that run out of chunks steal them from the others.
+ * A compiled function is never written while executing, so the same function can be
+ * executed on any number of threads. Each thread uses its own frame, which the pool keeps
+ * between calls.
+ *
+ * Small batches are evaluated on the calling thread only. Concurrent calls with the same
+ * pool are serialized.
+ *
+ * out is written even if an error occurs.
+ *
+ * @param pool The thread pool
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Output array of n elements
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_parallel(mathfun_pool *pool, const mathfun *fun, const double *args[], size_t n,
+	double out[], mathfun_error_p *error);
+
+/** Execute a compiled function expression with several results for many argument rows at once
+ * using a thread pool.
+ *
+ * @see mathfun_exec_parallel(), mathfun_exec_batch_multi()
+ *
+ * @param pool The thread pool
+ * @param fun The compiled function expression
+ * @param args Array of fun->argc pointers to argument columns of n elements each
+ * @param n Number of rows
+ * @param out Array of fun->retc pointers to output columns of n elements each
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (depending on the functions called by the expression)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_exec_parallel_multi(mathfun_pool *pool, const mathfun *fun, const double *args[],
+	size_t n, double *out[], mathfun_error_p *error);
+
+/** Name of the vector instruction set used by mathfun_exec_batch().
+ *
+ * The instruction set is selected when the library is loaded.
+ *
+ * @return "generic", "sse2", "avx2" or "avx512"
+ */
+MATHFUN_EXPORT const char *mathfun_batch_isa();
+
 /** Dump text representation of byte code.
  * 
  * @param fun The compiled function expression
@@ -453,6 +1384,61 @@ MATHFUN_EXPORT double mathfun_exec(const mathfun *fun, mathfun_value frame[])
 MATHFUN_EXPORT bool mathfun_dump(const mathfun *fun, FILE *stream, const mathfun_context *ctx,
 	mathfun_error_p *error);
 
+/** Initialize an execution profile for a compiled function expression.
+ *
+ * All counters start at zero. The profile can only be used with fun.
+ *
+ * @param profile A pointer to a #mathfun_profile
+ * @param fun The compiled function expression to profile
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_profile_init(mathfun_profile *profile, const mathfun *fun, mathfun_error_p *error);
+
+/** Frees allocated resources.
+ * @param profile A pointer to a #mathfun_profile
+ */
+MATHFUN_EXPORT void mathfun_profile_cleanup(mathfun_profile *profile);
+
+/** Execute a compiled function expression and record where the time is spent.
+ *
+ * Same as mathfun_acall(), but always runs the byte code interpreter (even if fun was compiled to
+ * native code) and adds the number of executions and the elapsed ticks of every instruction to
+ * profile. Ticks are time stamp counter cycles on x86, generic timer ticks on AArch64 and
+ * nanoseconds elsewhere. The time of an instruction includes the functions it calls and part of
+ * the overhead of the measurement, which is in the order of a few dozen cycles per instruction,
+ * so cheap instructions appear more expensive than they are. Compare instructions relative to
+ * each other.
+ *
+ * @param fun Byte code object to execute
+ * @param profile A profile initialized for fun
+ * @param args Array of argument values
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_OUT_OF_MEMORY, #MATHFUN_MATH_ERROR,
+ *        #MATHFUN_C_ERROR (EINVAL if profile wasn't initialized for fun, others depending on the functions
+ *        called by the expression)
+ * @return The result of the evaluation
+ */
+MATHFUN_EXPORT double mathfun_profile_call(const mathfun *fun, mathfun_profile *profile, const double args[],
+	mathfun_error_p *error);
+
+/** Dump text representation of byte code annotated with an execution profile.
+ *
+ * Prints the same instructions as mathfun_dump(), each preceded by its execution count, ticks and
+ * share of the total ticks and followed by the part of the function expression it was generated
+ * for. Functions produced by mathfun_context_derive() have no source map, so the expression text
+ * is missing for them.
+ *
+ * @param fun The compiled function expression
+ * @param profile A profile of fun, see mathfun_profile_call()
+ * @param stream The output FILE
+ * @param ctx A pointer to a #mathfun_context. Can be NULL.
+ * @param error A pointer to an error handle. Possible errors: #MATHFUN_IO_ERROR, #MATHFUN_C_ERROR (EINVAL if
+ *        profile wasn't initialized for fun)
+ * @return true on success, false if an error occured.
+ */
+MATHFUN_EXPORT bool mathfun_dump_profile(const mathfun *fun, const mathfun_profile *profile, FILE *stream,
+	const mathfun_context *ctx, mathfun_error_p *error);
+
 /** Parse and run a function expression.
  * 
  * This doesn't optimize or compile the expression but instead directly runs on the abstract syntax tree.
@@ -473,6 +1459,10 @@ MATHFUN_EXPORT double mathfun_run(const char *code, mathfun_error_p *error, ...)
  * This doesn't optimize or compile the expression but instead directly runs on the abstract syntax tree.
  * Use this for one-time executions.
  *
+ * The syntax tree is allocated in an arena on the stack (larger ones spill into a few heap chunks) and
+ * released at once. The context with the default declarations is built once per thread and kept until
+ * mathfun_thread_cleanup() is called.
+ *
  * @param argnames Array of argument names.
  * @param argc Number of arguments.
  * @param code The function expression.
@@ -9,18 +9,58 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdarg.h>
+#include <string.h>
+#include <fenv.h>
+#include <math.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// assumtions:
-// sizeof(x) == 2 ** n and sizeof(x) == __alignof__(x)
-// for x in {mathfun_value, mathfun_binding_funct}
+// Byte code is a sequence of 16 bit words. Registers and constant/function pool
+// indices are one word, jump targets are 32 bit and span two words.
+#define MATHFUN_REGS_MAX  UINT16_MAX
+#define MATHFUN_POOL_MAX  UINT16_MAX
+#define MATHFUN_CODE_MAX  UINT32_MAX
+#define MATHFUN_ADR_CODES (sizeof(uint32_t) / sizeof(mathfun_code))
+
+// number of rows mathfun_exec_batch() processes per instruction dispatch
+#define MATHFUN_BATCH_SIZE 64
+
+// functions with up to this many registers are called with a frame on the stack
+#define MATHFUN_STACK_FRAME_SIZE 64
+
+// calls with up to this many arguments are evaluated by mathfun_expr_exec()
+// and folded by mathfun_expr_optimize() with an argument buffer on the stack
+#define MATHFUN_STACK_ARGS_SIZE 8
+
+// integer powers up to this exponent are computed by multiplication, see mathfun_pow_k()
+#define MATHFUN_POW_UNROLL_MAX 8
+
+// size in words of the arena buffer that mathfun_arun() and the compile
+// functions keep on the stack (enough for the nodes of most expressions)
+#define MATHFUN_ARENA_STACK_SIZE 512
+
+// Boolean lanes of batch registers are whole 64 bit words. Only their .boolean
+// byte is significant, so masking a lane with MATHFUN_BOOL_BYTE yields either 0
+// or MATHFUN_TRUE_WORD. The vector kernels always write one of those two words.
+// (assumes sizeof(mathfun_value) == sizeof(uint64_t) and true is stored as 1)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#	define MATHFUN_TRUE_WORD UINT64_C(0x0100000000000000)
+#	define MATHFUN_BOOL_BYTE UINT64_C(0xFF00000000000000)
+#else
+#	define MATHFUN_TRUE_WORD UINT64_C(0x0000000000000001)
+#	define MATHFUN_BOOL_BYTE UINT64_C(0x00000000000000FF)
+#endif
 
-#define MATHFUN_REGS_MAX UINTPTR_MAX
-#define MATHFUN_FUNCT_CODES (1 + ((sizeof(mathfun_binding_funct) - 1) / sizeof(mathfun_code)))
-#define MATHFUN_VALUE_CODES (1 + ((sizeof(mathfun_value) - 1) / sizeof(mathfun_code)))
+// the same for the 32 bit lanes of single precision batch registers
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#	define MATHFUN_FLOAT_TRUE_WORD UINT32_C(0x01000000)
+#	define MATHFUN_FLOAT_BOOL_BYTE UINT32_C(0xFF000000)
+#else
+#	define MATHFUN_FLOAT_TRUE_WORD UINT32_C(0x00000001)
+#	define MATHFUN_FLOAT_BOOL_BYTE UINT32_C(0x000000FF)
+#endif
 
 #ifndef M_TAU
 #	define M_TAU (2*M_PI)
@@ -30,6 +70,14 @@ extern "C" {
 #	define __attribute__(X)
 #endif
 
+#if defined(__GNUC__)
+#	define MATHFUN_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#	define MATHFUN_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#	define MATHFUN_THREAD_LOCAL _Thread_local
+#endif
+
 #if (defined(_WIN16) || defined(_WIN32) || defined(_WIN64)) && !defined(__CYGWIN__)
 #	if defined(_WIN64)
 #		define PRIzu PRIu64
@@ -46,11 +94,15 @@ extern "C" {
 #	define PRIzx "zx"
 #endif
 
-typedef uintptr_t mathfun_code;
+typedef uint16_t mathfun_code;
 typedef struct mathfun_expr mathfun_expr;
 typedef struct mathfun_error mathfun_error;
 typedef struct mathfun_parser mathfun_parser;
 typedef struct mathfun_codegen mathfun_codegen;
+typedef struct mathfun_cse mathfun_cse;
+typedef struct mathfun_arena mathfun_arena;
+typedef struct mathfun_arena_chunk mathfun_arena_chunk;
+typedef struct mathfun_bind mathfun_bind;
 
 enum mathfun_expr_type {
 	EX_CONST,
@@ -86,18 +138,34 @@ enum mathfun_expr_type {
 	EX_IIF
 };
 
+// Arguments that mathfun_context_specialize() replaces by constants. The
+// remaining arguments are renumbered in their original order.
+#define MATHFUN_ARG_BOUND SIZE_MAX
+
+struct mathfun_bind {
+	const size_t *argmap; // new index of each argument, or MATHFUN_ARG_BOUND
+	const double *values; // values of the bound arguments (by old index)
+	size_t argc;          // number of remaining arguments
+};
+
 struct mathfun_expr {
 	enum mathfun_expr_type type;
+	bool arena; // node (and its args array) belongs to a mathfun_arena
+	size_t begin; // offsets of the node's text in the parsed code
+	size_t end;   // (both 0 for nodes that don't come from the parser)
 	union {
 		struct {
 			mathfun_type type;
 			mathfun_value value;
 		} value;
 
-		mathfun_code arg;
+		size_t arg;
 
 		struct {
 			mathfun_binding_funct funct;
+			mathfun_binding_deriv deriv;
+			const mathfun_partials *partials;
+			mathfun_binding_interval interval;
 			const mathfun_sig *sig;
 			mathfun_expr **args;
 		} funct;
@@ -121,12 +189,13 @@ struct mathfun_expr {
 
 enum mathfun_bytecode {
 	             // arguments      description
-	NOP  =  0,   //                do nothing. used to align VAL and CALL
+	NOP  =  0,   //                do nothing
 	RET  =  1,   // reg            return
 	MOV  =  2,   // reg, reg       copy value
-	VAL  =  3,   // val, reg       load an immediate value
-	CALL =  4,   // ptr, reg, reg  call a function. parameters:
-	             //                 * C function pointer
+	VAL  =  3,   // val, reg       load a value from the constant pool
+	CALL =  4,   // fun, n, reg, reg  call a function. parameters:
+	             //                 * index into the function pool
+	             //                 * number of arguments
 	             //                 * register of first argument
 	             //                 * register for the return value
 
@@ -156,9 +225,138 @@ enum mathfun_bytecode {
 	SETT = 24,   // reg            set reg to true
 	SETF = 25,   // reg            set reg to false
 
-	END  = 26    //                pseudo instruction. marks end of code.
+	// Superinstructions produced by mathfun_code_fuse(). They do exactly what
+	// the fused instructions would do, including writing the intermediate
+	// register, just with one dispatch instead of two.
+	MULADD = 26, // reg, reg, reg, reg, reg  a, b, t, c, d: t = a * b; d = t + c
+	MULSUB = 27, // reg, reg, reg, reg, reg  a, b, t, c, d: t = a * b; d = t - c
+
+	VADD = 28,   // val, reg, reg, reg, reg  k, t, a, b, d: t = k; d = a + b
+	VSUB = 29,   // val, reg, reg, reg, reg  k, t, a, b, d: t = k; d = a - b
+	VMUL = 30,   // val, reg, reg, reg, reg  k, t, a, b, d: t = k; d = a * b
+	VDIV = 31,   // val, reg, reg, reg, reg  k, t, a, b, d: t = k; d = a / b
+
+	EQJ  = 32,   // reg, reg, reg, bool, adr  a, b, t, f, adr: t = a == b; jump to adr if t == f
+	NEJ  = 33,   // reg, reg, reg, bool, adr  like EQJ, but compare using !=
+	LTJ  = 34,   // reg, reg, reg, bool, adr  like EQJ, but compare using <
+	GTJ  = 35,   // reg, reg, reg, bool, adr  like EQJ, but compare using >
+	LEJ  = 36,   // reg, reg, reg, bool, adr  like EQJ, but compare using <=
+	GEJ  = 37,   // reg, reg, reg, bool, adr  like EQJ, but compare using >=
+
+	// Instructions with immediate operands, so constants don't need a VAL and a register.
+	ADDK  = 38,  // val, reg, reg  k, a, d: d = a + k
+	SUBK  = 39,  // val, reg, reg  k, a, d: d = a - k
+	RSUBK = 40,  // val, reg, reg  k, a, d: d = k - a
+	MULK  = 41,  // val, reg, reg  k, a, d: d = a * k
+	DIVK  = 42,  // val, reg, reg  k, a, d: d = a / k
+	RDIVK = 43,  // val, reg, reg  k, a, d: d = k / a
+
+	EQK  = 44,   // val, reg, reg  k, a, d: d = a == k
+	NEK  = 45,   // val, reg, reg  k, a, d: d = a != k
+	LTK  = 46,   // val, reg, reg  k, a, d: d = a <  k
+	GTK  = 47,   // val, reg, reg  k, a, d: d = a >  k
+	LEK  = 48,   // val, reg, reg  k, a, d: d = a <= k
+	GEK  = 49,   // val, reg, reg  k, a, d: d = a >= k
+
+	INK  = 50,   // val, val, reg, reg  lo, hi, a, d: d = a >= lo && a <= hi
+	INXK = 51,   // val, val, reg, reg  lo, hi, a, d: d = a >= lo && a <  hi
+
+	POWK = 52,   // val, reg, reg  k, a, d: d = a ** k, see mathfun_pow_k()
+
+	FMA  = 53,   // reg, reg, reg, reg  a, b, c, d: d = a * b + c, rounded once (MATHFUN_OPT_FAST_MATH)
+
+	END  = 54,   //                pseudo instruction. marks end of code.
+
+	// The numbers above are fixed, so code dumps and stored byte code keep
+	// their meaning. New instructions are appended here, after END.
+
+	MATHFUN_BYTECODE_COUNT // not an instruction, one past the highest opcode
 };
 
+// Operand kinds of an instruction, one character per operand:
+//   r ... register
+//   n ... number (argument count or boolean flag)
+//   a ... code address (MATHFUN_ADR_CODES words, unaligned)
+//   v ... index into the constant pool
+//   f ... index into the function pool
+typedef struct mathfun_bytecode_info {
+	const char *name;
+	const char *operands;
+} mathfun_bytecode_info;
+
+// Source map entry: the text of the expression an instruction was generated
+// for, as offsets into mathfun::source. mathfun::srcmap has one entry per code
+// word, only those of the first word of each instruction are used.
+typedef struct mathfun_srcspan {
+	uint32_t begin;
+	uint32_t end;
+} mathfun_srcspan;
+
+// Kernels used by the batch interpreter. mask is NULL if all rows are active,
+// otherwise only rows with an all ones mask word are written.
+typedef void (*mathfun_batch_binary)(const mathfun_value a[], const mathfun_value b[], mathfun_value c[],
+	const uint64_t mask[], size_t count);
+typedef void (*mathfun_batch_unary)(const mathfun_value a[], mathfun_value b[],
+	const uint64_t mask[], size_t count);
+typedef void (*mathfun_batch_const)(const mathfun_value a[], mathfun_value k, mathfun_value c[],
+	const uint64_t mask[], size_t count);
+
+typedef struct mathfun_batch_kernels {
+	const char *isa;
+	mathfun_batch_binary add, sub, mul, div;
+	mathfun_batch_binary eq, ne, lt, gt, le, ge;
+	mathfun_batch_binary beq, bne;
+	mathfun_batch_unary  neg, not;
+	mathfun_batch_const  addk, subk, rsubk, mulk, divk, rdivk;
+	mathfun_batch_const  eqk, nek, ltk, gtk, lek, gek;
+} mathfun_batch_kernels;
+
+// the same for single precision registers, see float.c
+typedef void (*mathfun_batch_float_binary)(const mathfun_value_float a[], const mathfun_value_float b[],
+	mathfun_value_float c[], const uint32_t mask[], size_t count);
+typedef void (*mathfun_batch_float_unary)(const mathfun_value_float a[], mathfun_value_float b[],
+	const uint32_t mask[], size_t count);
+typedef void (*mathfun_batch_float_const)(const mathfun_value_float a[], mathfun_value_float k,
+	mathfun_value_float c[], const uint32_t mask[], size_t count);
+
+typedef struct mathfun_batch_float_kernels {
+	const char *isa;
+	mathfun_batch_float_binary add, sub, mul, div;
+	mathfun_batch_float_binary eq, ne, lt, gt, le, ge;
+	mathfun_batch_float_binary beq, bne;
+	mathfun_batch_float_unary  neg, not;
+	mathfun_batch_float_const  addk, subk, rsubk, mulk, divk, rdivk;
+	mathfun_batch_float_const  eqk, nek, ltk, gtk, lek, gek;
+} mathfun_batch_float_kernels;
+
+// Registers of the batch interpreter: argument registers point into the
+// argument columns, the others into values (MATHFUN_BATCH_SIZE rows each).
+// Grows as needed, so it can be reused for different functions.
+typedef struct mathfun_batch_frame {
+	size_t framesize;
+	size_t size;
+	mathfun_value **regs;
+	mathfun_value  *values;
+	mathfun_value  *argbuf;
+} mathfun_batch_frame;
+
+#define MATHFUN_BATCH_FRAME_INIT { .framesize = 0, .size = 0, .regs = NULL, .values = NULL, .argbuf = NULL }
+
+// Floating point environment of the caller, saved by mathfun_fenv_enter().
+// On x86-64 the SSE control/status register is accessed directly, which is a
+// lot cheaper than the <fenv.h> functions that also handle the x87 unit.
+#if defined(__x86_64__) || defined(_M_X64)
+#	define MATHFUN_FENV_MXCSR
+#endif
+
+typedef struct mathfun_fenv {
+#ifdef MATHFUN_FENV_MXCSR
+	unsigned int csr;
+#else
+	fenv_t env;
+#endif
+} mathfun_fenv;
+
 struct mathfun_error {
 	enum mathfun_error_type type;
 	int         errnum;
@@ -177,6 +375,10 @@ struct mathfun_error {
 			mathfun_type got;
 			mathfun_type expected;
 		} type;
+
+		struct {
+			size_t address;
+		} code;
 	} err;
 };
 
@@ -186,32 +388,219 @@ struct mathfun_parser {
 	size_t       argc;
 	const char  *code;
 	const char  *ptr;
+	mathfun_arena *arena;
 	mathfun_error_p *error;
 };
 
+// Bump allocator for the nodes of short lived expression trees. Allocations
+// are never freed one by one, mathfun_arena_cleanup() releases all of them.
+// The first allocations come from a caller supplied buffer (usually on the
+// stack), further ones from chunks on the heap.
+typedef union mathfun_arena_word {
+	double number;
+	void  *pointer;
+	size_t size;
+} mathfun_arena_word;
+
+struct mathfun_arena_chunk {
+	mathfun_arena_chunk *prev;
+	mathfun_arena_word   words[];
+};
+
+struct mathfun_arena {
+	mathfun_arena_word  *ptr;
+	mathfun_arena_word  *end;
+	mathfun_arena_chunk *chunks;
+	size_t               chunk_size; // in words
+};
+
+// Common subexpressions of the expressions of a function (see cse.c).
+// Every class of structurally equal subexpressions that occurs more than once
+// gets a register of its own, which holds the value once it's computed.
+// Hoisted classes only depend on uniform arguments and are computed by the
+// prologue, their registers come first.
+typedef struct mathfun_cse_class {
+	mathfun_code reg;
+	bool computed;
+	bool hoisted;
+} mathfun_cse_class;
+
+typedef struct mathfun_cse_node {
+	const mathfun_expr *expr;
+	const mathfun_expr *parent;
+	size_t hash;
+	size_t cls;
+	bool   uncond;
+	bool   uniform;
+	bool   hoist;  // uniform, unconditional and the parent isn't uniform
+} mathfun_cse_node;
+
+struct mathfun_cse {
+	mathfun_cse_node  *nodes;
+	size_t             nodes_used;
+	size_t             nodes_size;
+	mathfun_cse_class *classes;
+	size_t             classes_used;
+	size_t             hoisted;
+	const bool        *uniform; // uniform arguments, NULL if none
+};
+
 struct mathfun_codegen {
 	size_t argc;
 	size_t maxstack;
 	size_t currstack;
+	size_t conditional; // > 0 while generating code that isn't always executed
+	bool fast_math;     // a * b + c may be computed by FMA, x ** k by mathfun_pow_k()
+	mathfun_cse *cse;
 	size_t code_size;
 	size_t code_used;
 	mathfun_code *code;
+	size_t consts_size;
+	size_t consts_used;
+	mathfun_value *consts;
+	size_t functs_size;
+	size_t functs_used;
+	mathfun_binding_funct *functs;
+	mathfun_binding_deriv *derivs;
+	mathfun_binding_interval *intervals;
+	mathfun_srcspan *srcmap;  // parallel to code, NULL if there is no source
+	mathfun_srcspan  span;    // span of the expression currently generated
+	size_t           srcbase; // offset of the current expression in mathfun::source
 	mathfun_error_p *error;
 };
 
+// Jump targets aren't aligned to 4 bytes, so they are accessed via memcpy
+// (which compiles to a plain load/store on the usual targets).
+static inline size_t mathfun_code_adr(const mathfun_code *code) {
+	uint32_t adr;
+	memcpy(&adr, code, sizeof(adr));
+	return adr;
+}
+
+static inline void mathfun_code_set_adr(mathfun_code *code, size_t adr) {
+	const uint32_t value = (uint32_t)adr;
+	memcpy(code, &value, sizeof(value));
+}
+
+// pow(x, k) for the constant exponent of POWK. For k = 0.5 sqrt() is used and
+// small integer powers are computed by squaring and multiplying. pow() isn't
+// correctly rounded, so even x * x differs from pow(x, 2) in the last bit for a
+// few inputs, and the chains of larger k are off by up to one rounding per
+// multiplication. That's why POWK is only generated with fast math. Whenever
+// the result isn't a normal number pow() is called after all, so special values
+// and errno (overflow, underflow, poles) are the same as with pow().
+static inline double mathfun_pow_k(double x, double k) {
+	double value;
+
+	if (k == 0.5) {
+		// sqrt() of negative numbers sets errno even where pow() doesn't (-inf)
+		if (!(x > 0.0)) return pow(x, k);
+		value = sqrt(x);
+	}
+	else if (k == -1.0) {
+		value = 1.0 / x;
+	}
+	else if (k >= 2.0 && k <= MATHFUN_POW_UNROLL_MAX && k == (unsigned int)k) {
+		const unsigned int n = (unsigned int)k;
+		unsigned int bit = 1;
+		while ((n >> bit) > 1) ++ bit;
+
+		value = x;
+		while (bit -- > 0) {
+			value *= value;
+			if ((n >> bit) & 1) value *= x;
+		}
+	}
+	else {
+		return pow(x, k);
+	}
+
+	return isnormal(value) ? value : pow(x, k);
+}
+
+MATHFUN_LOCAL extern const mathfun_bytecode_info mathfun_bytecode_infos[];
+
+// selected at load time, see simd.c
+MATHFUN_LOCAL extern const mathfun_batch_kernels *mathfun_batch_simd;
+
+// the portable kernels, used when spurious exceptions of inactive rows must be avoided
+MATHFUN_LOCAL extern const mathfun_batch_kernels mathfun_batch_generic;
+
+MATHFUN_LOCAL extern const mathfun_batch_float_kernels *mathfun_batch_float_simd;
+MATHFUN_LOCAL extern const mathfun_batch_float_kernels mathfun_batch_float_generic;
+
+// Executes fun with dual numbers, dregs are the tangents of regs. See dual.c.
+MATHFUN_LOCAL double mathfun_exec_dual(const mathfun *fun, mathfun_value regs[], double dregs[], double *deriv);
+
+MATHFUN_LOCAL size_t mathfun_gradient_tapesize(const mathfun *fun);
+MATHFUN_LOCAL double mathfun_exec_gradient(const mathfun *fun, mathfun_value frame[], double grad[]);
+
+// Executes fun with intervals, see interval.c. Returns false and sets errno on
+// an out of memory error or an unknown instruction.
+MATHFUN_LOCAL bool mathfun_exec_interval(const mathfun *fun, mathfun_interval frame[], mathfun_interval *ret);
+
+// interval versions of functions that have none (by return type)
+MATHFUN_LOCAL mathfun_interval mathfun_interval_any_number(const mathfun_interval args[]);
+MATHFUN_LOCAL mathfun_interval mathfun_interval_any_boolean(const mathfun_interval args[]);
+
+MATHFUN_LOCAL bool mathfun_context_define_default_intervals(mathfun_context *ctx, mathfun_error_p *error);
+
+// Adds the single precision constant and function pools to fun, see float.c.
+MATHFUN_LOCAL bool mathfun_float_pools(const mathfun_context *ctx, mathfun *fun, mathfun_error_p *error);
+
+MATHFUN_LOCAL bool mathfun_context_define_default_floats(mathfun_context *ctx, mathfun_error_p *error);
+
+MATHFUN_LOCAL bool mathfun_batch_frame_reserve(mathfun_batch_frame *frame, const mathfun *fun, mathfun_error_p *error);
+MATHFUN_LOCAL void mathfun_batch_frame_cleanup(mathfun_batch_frame *frame);
+
+// Executes rows [offset, offset + n) using a frame reserved for fun. Returns
+// false on an unknown instruction (errno is left alone for math errors).
+MATHFUN_LOCAL bool mathfun_exec_rows(const mathfun *fun, const mathfun_batch_kernels *masked, mathfun_batch_frame *frame,
+	const double *args[], size_t offset, size_t n, double *out[], size_t outc);
+
+MATHFUN_LOCAL void mathfun_fenv_enter(mathfun_fenv *saved, int flags);
+MATHFUN_LOCAL int  mathfun_fenv_leave(const mathfun_fenv *saved);
+
 MATHFUN_LOCAL bool mathfun_context_ensure(mathfun_context *ctx, size_t n, mathfun_error_p *error);
 
 MATHFUN_LOCAL const mathfun_decl *mathfun_context_getn(const mathfun_context *ctx, const char *name, size_t n);
 
 MATHFUN_LOCAL mathfun_expr *mathfun_context_parse(const mathfun_context *ctx,
-	const char *argnames[], size_t argc, const char *code, mathfun_error_p *error);
+	const char *argnames[], size_t argc, const char *code, mathfun_arena *arena, mathfun_error_p *error);
+
+MATHFUN_LOCAL void  mathfun_arena_init(mathfun_arena *arena, mathfun_arena_word buffer[], size_t size);
+MATHFUN_LOCAL void *mathfun_arena_alloc(mathfun_arena *arena, size_t size, mathfun_error_p *error);
+MATHFUN_LOCAL void  mathfun_arena_cleanup(mathfun_arena *arena);
 
-MATHFUN_LOCAL bool mathfun_expr_codegen(mathfun_expr *expr, mathfun *mathfun, mathfun_error_p *error);
+MATHFUN_LOCAL bool mathfun_expr_codegen(mathfun_expr *expr, mathfun *mathfun, bool fast_math, const bool uniform[],
+	mathfun_error_p *error);
+MATHFUN_LOCAL bool mathfun_expr_codegen_multi(mathfun_expr *exprs[], size_t count, mathfun *mathfun,
+	mathfun_error_p *error);
+
+MATHFUN_LOCAL bool mathfun_cse_init(mathfun_cse *cse, mathfun_expr *exprs[], size_t count, mathfun_code firstreg,
+	const bool uniform[], mathfun_error_p *error);
+MATHFUN_LOCAL void mathfun_cse_cleanup(mathfun_cse *cse);
+MATHFUN_LOCAL mathfun_cse_class *mathfun_cse_lookup(const mathfun_cse *cse, const mathfun_expr *expr);
+MATHFUN_LOCAL bool mathfun_expr_equal(const mathfun_expr *a, const mathfun_expr *b);
 
 MATHFUN_LOCAL bool mathfun_codegen_expr(mathfun_codegen *codegen, mathfun_expr *expr, mathfun_code *ret);
 
+MATHFUN_LOCAL size_t mathfun_code_size(const mathfun_code *code);
+
+MATHFUN_LOCAL bool mathfun_code_regalloc(mathfun *fun, mathfun_error_p *error);
+MATHFUN_LOCAL bool mathfun_code_fuse(mathfun *fun, mathfun_error_p *error);
+
+MATHFUN_LOCAL double mathfun_exec_count(const mathfun *fun, mathfun_value regs[], size_t *count);
+MATHFUN_LOCAL double mathfun_exec_profile(const mathfun *fun, mathfun_value regs[], mathfun_profile *profile);
+
 MATHFUN_LOCAL bool mathfun_codegen_val(mathfun_codegen *codegen, mathfun_value value, mathfun_code target);
-MATHFUN_LOCAL bool mathfun_codegen_call(mathfun_codegen *codegen, mathfun_binding_funct funct, mathfun_code firstarg, mathfun_code target);
+MATHFUN_LOCAL bool mathfun_codegen_insk(mathfun_codegen *codegen, enum mathfun_bytecode code, mathfun_value value,
+	mathfun_code arg1, mathfun_code arg2);
+MATHFUN_LOCAL bool mathfun_codegen_insk2(mathfun_codegen *codegen, enum mathfun_bytecode code, mathfun_value value1,
+	mathfun_value value2, mathfun_code arg1, mathfun_code arg2);
+MATHFUN_LOCAL bool mathfun_codegen_call(mathfun_codegen *codegen, mathfun_binding_funct funct,
+	mathfun_binding_deriv deriv, mathfun_binding_interval interval, mathfun_code argc, mathfun_code firstarg,
+	mathfun_code target);
 
 MATHFUN_LOCAL bool mathfun_codegen_ins0(mathfun_codegen *codegen, enum mathfun_bytecode code);
 MATHFUN_LOCAL bool mathfun_codegen_ins1(mathfun_codegen *codegen, enum mathfun_bytecode code, mathfun_code arg1);
@@ -224,11 +613,20 @@ MATHFUN_LOCAL bool mathfun_codegen_binary(mathfun_codegen *codegen, mathfun_expr
 MATHFUN_LOCAL bool mathfun_codegen_unary(mathfun_codegen *codegen, mathfun_expr *expr,
 	enum mathfun_bytecode code, mathfun_code *ret);
 
+MATHFUN_LOCAL void mathfun_jit_cleanup(mathfun *fun);
+
 MATHFUN_LOCAL mathfun_expr *mathfun_expr_alloc(enum mathfun_expr_type type, mathfun_error_p *error);
 
 MATHFUN_LOCAL void mathfun_expr_free(mathfun_expr *expr);
 
+MATHFUN_LOCAL mathfun_expr *mathfun_expr_copy(const mathfun_expr *expr, mathfun_error_p *error);
+
+MATHFUN_LOCAL mathfun_expr *mathfun_expr_derive(const mathfun_context *ctx, const mathfun_expr *expr, size_t arg,
+	mathfun_error_p *error);
+
+MATHFUN_LOCAL void mathfun_expr_bind(mathfun_expr *expr, const mathfun_bind *bind);
 MATHFUN_LOCAL mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error);
+MATHFUN_LOCAL mathfun_expr *mathfun_expr_reassociate(mathfun_expr *expr, mathfun_arena *arena, mathfun_error_p *error);
 
 MATHFUN_LOCAL mathfun_type mathfun_expr_type(const mathfun_expr *expr);
 
@@ -241,6 +639,7 @@ MATHFUN_LOCAL void mathfun_raise_error(mathfun_error_p *error, enum mathfun_erro
 MATHFUN_LOCAL void mathfun_raise_name_error(mathfun_error_p *error, enum mathfun_error_type type, const char *name);
 MATHFUN_LOCAL void mathfun_raise_math_error(mathfun_error_p *error, int errnum);
 MATHFUN_LOCAL void mathfun_raise_c_error(mathfun_error_p *error);
+MATHFUN_LOCAL void mathfun_raise_code_error(mathfun_error_p *error, size_t address);
 
 MATHFUN_LOCAL void mathfun_raise_parser_error(const mathfun_parser *parser,
 	enum mathfun_error_type type, const char *errpos);
@@ -17,6 +17,40 @@ static bool mathfun_lt(double a, double b) { return a <  b; }
 static bool mathfun_ge(double a, double b) { return a >= b; }
 static bool mathfun_le(double a, double b) { return a <= b; }
 
+// Calls a bound function with constant arguments. Not every libm function sets
+// errno on a math error (see NOTES in man math_error), so domain and pole errors
+// and overflows are also detected through the floating point exception flags.
+// Ordered comparisons of NaN (like in max() and min()) raise FE_INVALID too, so
+// it's only a domain error if a NaN result didn't come from a NaN argument. The
+// flags of the caller are preserved. Returns false and sets errno on error.
+static bool mathfun_fold_call(const mathfun_sig *sig, mathfun_binding_funct funct,
+	const mathfun_value args[], mathfun_value *value) {
+	fexcept_t flags;
+	fegetexceptflag(&flags, FE_ALL_EXCEPT);
+	feclearexcept(FE_ALL_EXCEPT);
+	errno = 0;
+
+	*value = funct(args);
+
+	if (errno == 0) {
+		if (fetestexcept(FE_INVALID) && sig->rettype == MATHFUN_NUMBER && isnan(value->number)) {
+			errno = EDOM;
+			for (size_t i = 0; i < sig->argc; ++ i) {
+				if (sig->argtypes[i] == MATHFUN_NUMBER && isnan(args[i].number)) {
+					errno = 0;
+					break;
+				}
+			}
+		}
+		else if (fetestexcept(FE_DIVBYZERO | FE_OVERFLOW)) {
+			errno = ERANGE;
+		}
+	}
+	fesetexceptflag(&flags, FE_ALL_EXCEPT);
+
+	return errno == 0;
+}
+
 static mathfun_expr *mathfun_expr_optimize_binary(mathfun_expr *expr,
 	mathfun_binary_op op, bool has_neutral, double neutral, bool commutative,
 	mathfun_error_p *error) {
@@ -68,6 +102,25 @@ static mathfun_expr *mathfun_expr_optimize_binary(mathfun_expr *expr,
 	return expr;
 }
 
+// Dividing by a power of two is multiplying by its reciprocal, if that is
+// representable too: both round the exact quotient once. Constant exponents are
+// handled by POWK with fast math, see mathfun_pow_k().
+static mathfun_expr *mathfun_expr_optimize_division(mathfun_expr *expr) {
+	if (!expr || expr->type != EX_DIV || expr->ex.binary.right->type != EX_CONST) {
+		return expr;
+	}
+
+	mathfun_value *divisor = &expr->ex.binary.right->ex.value.value;
+	const double inv = 1.0 / divisor->number;
+	int exp = 0;
+	if (fabs(frexp(divisor->number, &exp)) == 0.5 && fabs(frexp(inv, &exp)) == 0.5) {
+		expr->type = EX_MUL;
+		divisor->number = inv;
+	}
+
+	return expr;
+}
+
 static mathfun_expr *mathfun_expr_optimize_comparison(mathfun_expr *expr,
 	mathfun_cmp cmp, mathfun_error_p *error) {
 
@@ -220,6 +273,83 @@ static mathfun_expr *mathfun_expr_optimize_not(mathfun_expr *expr, mathfun_error
 	}
 }
 
+// Comparisons of arguments and constants never raise math errors, so a
+// condition built only from them can be dropped without changing anything.
+static bool mathfun_expr_cant_raise(const mathfun_expr *expr) {
+	switch (expr->type) {
+		case EX_CONST:
+		case EX_ARG:
+			return true;
+
+		case EX_NOT:
+			return mathfun_expr_cant_raise(expr->ex.unary.expr);
+
+		case EX_EQ:
+		case EX_NE:
+		case EX_LT:
+		case EX_GT:
+		case EX_LE:
+		case EX_GE:
+		case EX_IN:
+		case EX_RNG_INCL:
+		case EX_RNG_EXCL:
+		case EX_BEQ:
+		case EX_BNE:
+		case EX_AND:
+		case EX_OR:
+			return mathfun_expr_cant_raise(expr->ex.binary.left) &&
+			       mathfun_expr_cant_raise(expr->ex.binary.right);
+
+		default:
+			return false;
+	}
+}
+
+void mathfun_expr_bind(mathfun_expr *expr, const mathfun_bind *bind) {
+	switch (expr->type) {
+		case EX_CONST:
+			break;
+
+		case EX_ARG:
+		{
+			const size_t arg = expr->ex.arg;
+			if (bind->argmap[arg] == MATHFUN_ARG_BOUND) {
+				expr->type = EX_CONST;
+				expr->ex.value.type = MATHFUN_NUMBER;
+				expr->ex.value.value.number = bind->values[arg];
+			}
+			else {
+				expr->ex.arg = bind->argmap[arg];
+			}
+			break;
+		}
+		case EX_CALL:
+		{
+			const size_t argc = expr->ex.funct.sig->argc;
+			for (size_t i = 0; i < argc; ++ i) {
+				mathfun_expr_bind(expr->ex.funct.args[i], bind);
+			}
+			break;
+		}
+		case EX_NEG:
+		case EX_NOT:
+			mathfun_expr_bind(expr->ex.unary.expr, bind);
+			break;
+
+		case EX_IIF:
+			mathfun_expr_bind(expr->ex.iif.cond,      bind);
+			mathfun_expr_bind(expr->ex.iif.then_expr, bind);
+			mathfun_expr_bind(expr->ex.iif.else_expr, bind);
+			break;
+
+		default:
+			// all other expressions are binary
+			mathfun_expr_bind(expr->ex.binary.left,  bind);
+			mathfun_expr_bind(expr->ex.binary.right, bind);
+			break;
+	}
+}
+
 mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error) {
 	switch (expr->type) {
 		case EX_CONST:
@@ -242,26 +372,32 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 				}
 			}
 			if (allconst) {
-				mathfun_value *args = calloc(argc, sizeof(mathfun_value));
-				if (!args) return NULL;
+				mathfun_value stack[MATHFUN_STACK_ARGS_SIZE];
+				mathfun_value *args = stack;
+				if (argc > MATHFUN_STACK_ARGS_SIZE) {
+					args = malloc(argc * sizeof(mathfun_value));
+					if (!args) {
+						mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+						mathfun_expr_free(expr);
+						return NULL;
+					}
+				}
 				for (size_t i = 0; i < argc; ++ i) {
 					mathfun_expr *arg = expr->ex.funct.args[i];
 					args[i] = arg->ex.value.value;
 					mathfun_expr_free(arg);
 				}
-				free(expr->ex.funct.args);
+				if (!expr->arena) free(expr->ex.funct.args);
 
-				// math errors are communicated via errno
-				// XXX: buggy. see NOTES in man math_error
-				errno = 0;
-				mathfun_value value = expr->ex.funct.funct(args);
+				mathfun_value value;
+				const bool ok = mathfun_fold_call(expr->ex.funct.sig, expr->ex.funct.funct, args, &value);
 
-				free(args);
+				if (args != stack) free(args);
 				expr->type = EX_CONST;
 				expr->ex.value.type = expr->ex.funct.sig->rettype;
 				expr->ex.value.value = value;
 
-				if (errno != 0) {
+				if (!ok) {
 					mathfun_raise_c_error(error);
 					mathfun_expr_free(expr);
 					return NULL;
@@ -294,7 +430,8 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 		case EX_ADD: return mathfun_expr_optimize_binary(expr, mathfun_add, true,    0, true,  error);
 		case EX_SUB: return mathfun_expr_optimize_binary(expr, mathfun_sub, true,    0, false, error);
 		case EX_MUL: return mathfun_expr_optimize_binary(expr, mathfun_mul, true,    1, true,  error);
-		case EX_DIV: return mathfun_expr_optimize_binary(expr, mathfun_div, true,    1, false, error);
+		case EX_DIV: return mathfun_expr_optimize_division(
+			mathfun_expr_optimize_binary(expr, mathfun_div, true,    1, false, error));
 		case EX_MOD: return mathfun_expr_optimize_binary(expr, mathfun_mod, false, NAN, false, error);
 		case EX_POW: return mathfun_expr_optimize_binary(expr, pow,         true,    1, false, error);
 
@@ -328,10 +465,10 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 				if (lower->type == EX_CONST && upper->type == EX_CONST) {
 					bool res = range->type == EX_RNG_INCL ?
 						value->ex.value.value.number >= lower->ex.value.value.number &&
-						value->ex.value.value.number <= lower->ex.value.value.number :
+						value->ex.value.value.number <= upper->ex.value.value.number :
 
 						value->ex.value.value.number >= lower->ex.value.value.number &&
-						value->ex.value.value.number <  lower->ex.value.value.number;
+						value->ex.value.value.number <  upper->ex.value.value.number;
 
 					expr->ex.binary.left = NULL;
 					mathfun_expr_free(expr);
@@ -412,6 +549,15 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 				return NULL;
 			}
 
+			if (expr->ex.binary.left->type == EX_CONST && !expr->ex.binary.left->ex.value.value.boolean) {
+				// false && ... never evaluates the right operand, so it isn't folded
+				// either and can't raise math errors
+				mathfun_expr *child = expr->ex.binary.left;
+				expr->ex.binary.left = NULL;
+				mathfun_expr_free(expr);
+				return child;
+			}
+
 			expr->ex.binary.right = mathfun_expr_optimize(expr->ex.binary.right, error);
 			if (!expr->ex.binary.right) {
 				mathfun_expr_free(expr);
@@ -467,6 +613,14 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 				return NULL;
 			}
 
+			if (expr->ex.binary.left->type == EX_CONST && expr->ex.binary.left->ex.value.value.boolean) {
+				// same short circuit as for &&
+				mathfun_expr *child = expr->ex.binary.left;
+				expr->ex.binary.left = NULL;
+				mathfun_expr_free(expr);
+				return child;
+			}
+
 			expr->ex.binary.right = mathfun_expr_optimize(expr->ex.binary.right, error);
 			if (!expr->ex.binary.right) {
 				mathfun_expr_free(expr);
@@ -522,6 +676,22 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 				return NULL;
 			}
 
+			if (expr->ex.iif.cond->type == EX_CONST) {
+				// only the taken branch is optimized, so errors that only the other
+				// branch would raise don't fail the compilation
+				mathfun_expr *child;
+				if (expr->ex.iif.cond->ex.value.value.boolean) {
+					child = expr->ex.iif.then_expr;
+					expr->ex.iif.then_expr = NULL;
+				}
+				else {
+					child = expr->ex.iif.else_expr;
+					expr->ex.iif.else_expr = NULL;
+				}
+				mathfun_expr_free(expr);
+				return mathfun_expr_optimize(child, error);
+			}
+
 			expr->ex.iif.then_expr = mathfun_expr_optimize(expr->ex.iif.then_expr, error);
 			if (!expr->ex.iif.then_expr) {
 				mathfun_expr_free(expr);
@@ -534,16 +704,11 @@ mathfun_expr *mathfun_expr_optimize(mathfun_expr *expr, mathfun_error_p *error)
 				return NULL;
 			}
 
-			if (expr->ex.iif.cond->type == EX_CONST) {
-				mathfun_expr *child;
-				if (expr->ex.iif.cond->ex.value.value.boolean) {
-					child = expr->ex.iif.then_expr;
-					expr->ex.iif.then_expr = NULL;
-				}
-				else {
-					child = expr->ex.iif.else_expr;
-					expr->ex.iif.else_expr = NULL;
-				}
+			if (mathfun_expr_equal(expr->ex.iif.then_expr, expr->ex.iif.else_expr) &&
+				mathfun_expr_cant_raise(expr->ex.iif.cond)) {
+				// the condition doesn't matter, so it isn't evaluated at all
+				mathfun_expr *child = expr->ex.iif.then_expr;
+				expr->ex.iif.then_expr = NULL;
 				mathfun_expr_free(expr);
 				return child;
 			}
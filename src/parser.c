@@ -48,8 +48,32 @@ static mathfun_expr *mathfun_parse_atom(mathfun_parser *parser);
 static mathfun_expr *mathfun_parse_number(mathfun_parser *parser);
 static size_t        mathfun_parse_identifier(mathfun_parser *parser);
 
+// Nodes are allocated in the parser's arena if it has one, else on the heap.
+static mathfun_expr *mathfun_parser_alloc(mathfun_parser *parser, enum mathfun_expr_type type) {
+	if (!parser->arena) return mathfun_expr_alloc(type, parser->error);
+
+	mathfun_expr *expr = mathfun_arena_alloc(parser->arena, sizeof(mathfun_expr), parser->error);
+
+	if (expr) {
+		expr->type  = type;
+		expr->arena = true;
+	}
+
+	return expr;
+}
+
+// The node's text starts at offset begin and ends at the current position
+// (without trailing whitespace). Used for the source map of compiled functions.
+static void mathfun_parser_span(const mathfun_parser *parser, mathfun_expr *expr, size_t begin) {
+	const char *end = parser->ptr;
+	while (end > parser->code + begin && isspace(end[-1])) -- end;
+	expr->begin = begin;
+	expr->end   = end - parser->code;
+}
+
 mathfun_expr *mathfun_parse_test(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_or_test(parser);
 
 	if (!expr) return NULL;
@@ -104,7 +128,7 @@ mathfun_expr *mathfun_parse_test(mathfun_parser *parser) {
 			return NULL;
 		}
 
-		expr = mathfun_expr_alloc(EX_IIF, parser->error);
+		expr = mathfun_parser_alloc(parser, EX_IIF);
 
 		if (!expr) {
 			mathfun_expr_free(then_expr);
@@ -116,6 +140,7 @@ mathfun_expr *mathfun_parse_test(mathfun_parser *parser) {
 		expr->ex.iif.cond = cond;
 		expr->ex.iif.then_expr = then_expr;
 		expr->ex.iif.else_expr = else_expr;
+		mathfun_parser_span(parser, expr, begin);
 	}
 
 	return expr;
@@ -123,6 +148,7 @@ mathfun_expr *mathfun_parse_test(mathfun_parser *parser) {
 
 mathfun_expr *mathfun_parse_or_test(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_and_test(parser);
 
 	if (!expr) return NULL;
@@ -151,7 +177,7 @@ mathfun_expr *mathfun_parse_or_test(mathfun_parser *parser) {
 				mathfun_expr_free(right);
 				return NULL;
 			}
-			expr = mathfun_expr_alloc(EX_OR, parser->error);
+			expr = mathfun_parser_alloc(parser, EX_OR);
 			if (!expr) {
 				mathfun_expr_free(left);
 				mathfun_expr_free(right);
@@ -159,6 +185,7 @@ mathfun_expr *mathfun_parse_or_test(mathfun_parser *parser) {
 			}
 			expr->ex.binary.left  = left;
 			expr->ex.binary.right = right;
+			mathfun_parser_span(parser, expr, begin);
 
 		} while (parser->ptr[0] == '|' && parser->ptr[1] == '|');
 	}
@@ -168,6 +195,7 @@ mathfun_expr *mathfun_parse_or_test(mathfun_parser *parser) {
 
 mathfun_expr *mathfun_parse_and_test(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_not_test(parser);
 
 	if (!expr) return NULL;
@@ -196,7 +224,7 @@ mathfun_expr *mathfun_parse_and_test(mathfun_parser *parser) {
 				mathfun_expr_free(right);
 				return NULL;
 			}
-			expr = mathfun_expr_alloc(EX_AND, parser->error);
+			expr = mathfun_parser_alloc(parser, EX_AND);
 			if (!expr) {
 				mathfun_expr_free(left);
 				mathfun_expr_free(right);
@@ -204,6 +232,7 @@ mathfun_expr *mathfun_parse_and_test(mathfun_parser *parser) {
 			}
 			expr->ex.binary.left  = left;
 			expr->ex.binary.right = right;
+			mathfun_parser_span(parser, expr, begin);
 		} while (parser->ptr[0] == '&' && parser->ptr[1] == '&');
 	}
 
@@ -216,15 +245,17 @@ mathfun_expr *mathfun_parse_not_test(mathfun_parser *parser) {
 	mathfun_expr **exprptr = &expr;
 
 	while (*parser->ptr == '!') {
+		const size_t begin = parser->ptr - parser->code;
 		++ parser->ptr;
 		skipws(parser);
 		errptr = parser->ptr;
 
-		mathfun_expr *not_expr = mathfun_expr_alloc(EX_NOT, parser->error);
+		mathfun_expr *not_expr = mathfun_parser_alloc(parser, EX_NOT);
 		if (!not_expr) {
 			mathfun_expr_free(expr);
 			return NULL;
 		}
+		not_expr->begin = begin;
 
 		*exprptr = not_expr;
 		exprptr = &not_expr->ex.unary.expr;
@@ -253,11 +284,16 @@ mathfun_expr *mathfun_parse_not_test(mathfun_parser *parser) {
 
 	*exprptr = comparison_expr;
 
+	for (mathfun_expr *not_expr = expr; not_expr != comparison_expr; not_expr = not_expr->ex.unary.expr) {
+		mathfun_parser_span(parser, not_expr, not_expr->begin);
+	}
+
 	return expr;
 }
 
 mathfun_expr *mathfun_parse_range(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *left = mathfun_parse_arith_expr(parser);
 
 	if (!left) return NULL;
@@ -299,7 +335,7 @@ mathfun_expr *mathfun_parse_range(mathfun_parser *parser) {
 			return NULL;
 		}
 
-		mathfun_expr *expr = mathfun_expr_alloc(type, parser->error);
+		mathfun_expr *expr = mathfun_parser_alloc(parser, type);
 
 		if (!expr) {
 			mathfun_expr_free(left);
@@ -309,6 +345,7 @@ mathfun_expr *mathfun_parse_range(mathfun_parser *parser) {
 
 		expr->ex.binary.left  = left;
 		expr->ex.binary.right = right;
+		mathfun_parser_span(parser, expr, begin);
 
 		return expr;
 	}
@@ -320,6 +357,7 @@ mathfun_expr *mathfun_parse_range(mathfun_parser *parser) {
 
 mathfun_expr *mathfun_parse_comparison(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_arith_expr(parser);
 
 	if (!expr) return NULL;
@@ -418,7 +456,7 @@ mathfun_expr *mathfun_parse_comparison(mathfun_parser *parser) {
 				return NULL;
 			}
 		}
-		expr = mathfun_expr_alloc(type, parser->error);
+		expr = mathfun_parser_alloc(parser, type);
 		if (!expr) {
 			mathfun_expr_free(left);
 			mathfun_expr_free(right);
@@ -426,6 +464,7 @@ mathfun_expr *mathfun_parse_comparison(mathfun_parser *parser) {
 		}
 		expr->ex.binary.left  = left;
 		expr->ex.binary.right = right;
+		mathfun_parser_span(parser, expr, begin);
 	}
 
 	return expr;
@@ -433,6 +472,7 @@ mathfun_expr *mathfun_parse_comparison(mathfun_parser *parser) {
 
 mathfun_expr *mathfun_parse_arith_expr(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_term(parser);
 
 	if (!expr) return NULL;
@@ -462,7 +502,7 @@ mathfun_expr *mathfun_parse_arith_expr(mathfun_parser *parser) {
 				mathfun_expr_free(right);
 				return NULL;
 			}
-			expr = mathfun_expr_alloc(ch == '+' ? EX_ADD : EX_SUB, parser->error);
+			expr = mathfun_parser_alloc(parser, ch == '+' ? EX_ADD : EX_SUB);
 			if (!expr) {
 				mathfun_expr_free(left);
 				mathfun_expr_free(right);
@@ -470,6 +510,7 @@ mathfun_expr *mathfun_parse_arith_expr(mathfun_parser *parser) {
 			}
 			expr->ex.binary.left  = left;
 			expr->ex.binary.right = right;
+			mathfun_parser_span(parser, expr, begin);
 
 			ch = *parser->ptr;
 		} while (ch == '+' || ch == '-');
@@ -480,6 +521,7 @@ mathfun_expr *mathfun_parse_arith_expr(mathfun_parser *parser) {
 
 mathfun_expr *mathfun_parse_term(mathfun_parser *parser) {
 	const char *errptr = parser->ptr;
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_factor(parser);
 
 	if (!expr) return NULL;
@@ -509,7 +551,7 @@ mathfun_expr *mathfun_parse_term(mathfun_parser *parser) {
 				mathfun_expr_free(right);
 				return NULL;
 			}
-			expr = mathfun_expr_alloc(ch == '*' ? EX_MUL : ch == '/' ? EX_DIV : EX_MOD, parser->error);
+			expr = mathfun_parser_alloc(parser, ch == '*' ? EX_MUL : ch == '/' ? EX_DIV : EX_MOD);
 			if (!expr) {
 				mathfun_expr_free(left);
 				mathfun_expr_free(right);
@@ -517,6 +559,7 @@ mathfun_expr *mathfun_parse_term(mathfun_parser *parser) {
 			}
 			expr->ex.binary.left  = left;
 			expr->ex.binary.right = right;
+			mathfun_parser_span(parser, expr, begin);
 
 			ch = *parser->ptr;
 		} while (ch == '*' || ch == '/' || ch == '%');
@@ -528,6 +571,7 @@ mathfun_expr *mathfun_parse_term(mathfun_parser *parser) {
 mathfun_expr *mathfun_parse_factor(mathfun_parser *parser) {
 	const char ch = *parser->ptr;
 	if (ch == '+' || ch == '-') {
+		const size_t begin = parser->ptr - parser->code;
 		++ parser->ptr;
 		skipws(parser);
 		const char *errptr = parser->ptr;
@@ -542,7 +586,7 @@ mathfun_expr *mathfun_parse_factor(mathfun_parser *parser) {
 
 		if (ch == '-') {
 			mathfun_expr *child = expr;
-			expr = mathfun_expr_alloc(EX_NEG, parser->error);
+			expr = mathfun_parser_alloc(parser, EX_NEG);
 
 			if (!expr) {
 				mathfun_expr_free(child);
@@ -550,6 +594,7 @@ mathfun_expr *mathfun_parse_factor(mathfun_parser *parser) {
 			}
 
 			expr->ex.unary.expr = child;
+			mathfun_parser_span(parser, expr, begin);
 		}
 		return expr;
 	}
@@ -559,10 +604,14 @@ mathfun_expr *mathfun_parse_factor(mathfun_parser *parser) {
 }
 
 mathfun_expr *mathfun_parse_power(mathfun_parser *parser) {
+	const size_t begin = parser->ptr - parser->code;
 	mathfun_expr *expr = mathfun_parse_atom(parser);
 
 	if (!expr) return NULL;
 
+	// parenthesized expressions already have a span, the other atoms get theirs here
+	if (expr->end == 0) mathfun_parser_span(parser, expr, begin);
+
 	if (parser->ptr[0] == '*' && parser->ptr[1] == '*') {
 		parser->ptr += 2;
 		skipws(parser);
@@ -583,7 +632,7 @@ mathfun_expr *mathfun_parse_power(mathfun_parser *parser) {
 			return NULL;
 		}
 
-		expr = mathfun_expr_alloc(EX_POW, parser->error);
+		expr = mathfun_parser_alloc(parser, EX_POW);
 		if (!expr) {
 			mathfun_expr_free(left);
 			mathfun_expr_free(right);
@@ -592,6 +641,7 @@ mathfun_expr *mathfun_parse_power(mathfun_parser *parser) {
 
 		expr->ex.binary.left  = left;
 		expr->ex.binary.right = right;
+		mathfun_parser_span(parser, expr, begin);
 	}
 
 	return expr;
@@ -624,28 +674,28 @@ mathfun_expr *mathfun_parse_atom(mathfun_parser *parser) {
 		if (idlen == 0) return NULL;
 
 		if (idlen == 3 && strncasecmp(idstart, "nan", idlen) == 0) {
-			mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, parser->error);
+			mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CONST);
 			if (!expr) return NULL;
 			expr->ex.value.type = MATHFUN_NUMBER;
 			expr->ex.value.value.number = NAN;
 			return expr;
 		}
 		else if (idlen == 3 && strncasecmp(idstart, "inf", idlen) == 0) {
-			mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, parser->error);
+			mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CONST);
 			if (!expr) return NULL;
 			expr->ex.value.type = MATHFUN_NUMBER;
 			expr->ex.value.value.number = INFINITY;
 			return expr;
 		}
 		else if (idlen == 4 && strncasecmp(idstart, "true", idlen) == 0) {
-			mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, parser->error);
+			mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CONST);
 			if (!expr) return NULL;
 			expr->ex.value.type = MATHFUN_BOOLEAN;
 			expr->ex.value.value.boolean = true;
 			return expr;
 		}
 		else if (idlen == 5 && strncasecmp(idstart, "false", idlen) == 0) {
-			mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, parser->error);
+			mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CONST);
 			if (!expr) return NULL;
 			expr->ex.value.type = MATHFUN_BOOLEAN;
 			expr->ex.value.value.boolean = false;
@@ -662,7 +712,7 @@ mathfun_expr *mathfun_parse_atom(mathfun_parser *parser) {
 
 		if (*parser->ptr != '(') {
 			if (argind < parser->argc) {
-				mathfun_expr *expr = mathfun_expr_alloc(EX_ARG, parser->error);
+				mathfun_expr *expr = mathfun_parser_alloc(parser, EX_ARG);
 				if (!expr) return NULL;
 				expr->ex.arg = argind;
 				return expr;
@@ -680,7 +730,7 @@ mathfun_expr *mathfun_parse_atom(mathfun_parser *parser) {
 				return NULL;
 			}
 
-			mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, parser->error);
+			mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CONST);
 			if (!expr) return NULL;
 
 			expr->ex.value.type = MATHFUN_NUMBER;
@@ -704,17 +754,23 @@ mathfun_expr *mathfun_parse_atom(mathfun_parser *parser) {
 				return NULL;
 			}
 
-			mathfun_expr *expr = mathfun_expr_alloc(EX_CALL, parser->error);
+			mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CALL);
 
 			if (!expr) {
 				return NULL;
 			}
 
-			expr->ex.funct.funct = decl->decl.funct.funct;
-			expr->ex.funct.sig   = decl->decl.funct.sig;
+			expr->ex.funct.funct    = decl->decl.funct.funct;
+			expr->ex.funct.deriv    = decl->decl.funct.deriv;
+			expr->ex.funct.partials = decl->decl.funct.partials;
+			expr->ex.funct.interval = decl->decl.funct.interval;
+			expr->ex.funct.sig      = decl->decl.funct.sig;
 
 			if (expr->ex.funct.sig->argc > 0) {
-				expr->ex.funct.args = calloc(expr->ex.funct.sig->argc, sizeof(mathfun_expr*));
+				const size_t funct_argc = expr->ex.funct.sig->argc;
+				expr->ex.funct.args = parser->arena ?
+					mathfun_arena_alloc(parser->arena, funct_argc * sizeof(mathfun_expr*), parser->error) :
+					calloc(funct_argc, sizeof(mathfun_expr*));
 
 				if (!expr->ex.funct.args) {
 					mathfun_expr_free(expr);
@@ -796,7 +852,7 @@ mathfun_expr *mathfun_parse_number(mathfun_parser *parser) {
 
 	skipws(parser);
 
-	mathfun_expr *expr = mathfun_expr_alloc(EX_CONST, parser->error);
+	mathfun_expr *expr = mathfun_parser_alloc(parser, EX_CONST);
 	if (!expr) return NULL;
 
 	expr->ex.value.type = MATHFUN_NUMBER;
@@ -834,10 +890,10 @@ size_t mathfun_parse_identifier(mathfun_parser *parser) {
 }
 
 mathfun_expr *mathfun_context_parse(const mathfun_context *ctx,
-	const char *argnames[], size_t argc, const char *code, mathfun_error_p *error) {
+	const char *argnames[], size_t argc, const char *code, mathfun_arena *arena, mathfun_error_p *error) {
 	if (!mathfun_validate_argnames(argnames, argc, error)) return NULL;
 
-	mathfun_parser parser = { ctx, argnames, argc, code, code, error };
+	mathfun_parser parser = { ctx, argnames, argc, code, code, arena, error };
 
 	skipws(&parser);
 	mathfun_expr *expr = mathfun_parse_test(&parser);
@@ -0,0 +1,409 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+// for pthread_attr_setaffinity_np()
+#	define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+
+#include "mathfun_intern.h"
+
+// Thread pool of mathfun_exec_parallel(). The rows are split into chunks of
+// MATHFUN_POOL_CHUNK_SIZE rows (small enough that the argument and output
+// columns of a chunk stay in the cache of the core evaluating it). Every worker
+// starts with an equal, contiguous range of chunks and takes chunks from the
+// front of it. A worker that runs out of chunks steals the back half of the
+// range of another worker, so uneven costs (e.g. branches that are only taken
+// for some rows) are balanced without a shared queue. The calling thread is
+// worker 0, so a pool of n threads spawns n - 1.
+
+#if defined(MATHFUN_PTHREADS) && defined(__GNUC__)
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#	include <sched.h>
+#	define MATHFUN_POOL_AFFINITY
+#endif
+
+#define MATHFUN_POOL_CHUNK_SIZE (16 * MATHFUN_BATCH_SIZE)
+#define MATHFUN_CACHE_LINE 64
+
+// chunk range [lo, hi) packed into one word, so it can be changed with a single CAS
+#define MATHFUN_RANGE(LO, HI) (((uint64_t)(HI) << 32) | (uint32_t)(LO))
+#define MATHFUN_RANGE_LO(RANGE) ((uint32_t)(RANGE))
+#define MATHFUN_RANGE_HI(RANGE) ((uint32_t)((RANGE) >> 32))
+
+typedef struct mathfun_pool_worker {
+	uint64_t range;
+	struct mathfun_pool *pool;
+	size_t index;
+	pthread_t thread;
+	mathfun_batch_frame frame;
+} __attribute__((aligned(MATHFUN_CACHE_LINE))) mathfun_pool_worker;
+
+struct mathfun_pool {
+	// serializes mathfun_exec_parallel() calls
+	pthread_mutex_t exec;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t  start;
+	pthread_cond_t  done;
+	size_t generation;
+	size_t pending;
+	bool   quit;
+
+	size_t nthreads;
+	mathfun_pool_worker *workers;
+
+	// the current job
+	const mathfun *fun;
+	const double **args;
+	double **out;
+	size_t outc;
+	size_t n;
+	size_t chunk_size;
+	int errnum;
+};
+
+static void mathfun_pool_fail(mathfun_pool *pool, int errnum) {
+	int expected = 0;
+	__atomic_compare_exchange_n(&pool->errnum, &expected, errnum, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static bool mathfun_pool_take(mathfun_pool_worker *worker, size_t *chunk) {
+	uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+
+	for (;;) {
+		const uint32_t lo = MATHFUN_RANGE_LO(range);
+		const uint32_t hi = MATHFUN_RANGE_HI(range);
+
+		if (lo >= hi) return false;
+
+		if (__atomic_compare_exchange_n(&worker->range, &range, MATHFUN_RANGE(lo + 1, hi), true,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*chunk = lo;
+			return true;
+		}
+	}
+}
+
+// Moves the back half of the chunks of victim to thief, whose range is empty.
+// Chunks in transit belong to nobody for a moment, which at worst makes another
+// idle worker give up early.
+static bool mathfun_pool_steal(mathfun_pool_worker *thief, mathfun_pool_worker *victim) {
+	uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+
+	for (;;) {
+		const uint32_t lo = MATHFUN_RANGE_LO(range);
+		const uint32_t hi = MATHFUN_RANGE_HI(range);
+
+		if (lo >= hi) return false;
+
+		const uint32_t mid = lo + (hi - lo) / 2;
+		if (__atomic_compare_exchange_n(&victim->range, &range, MATHFUN_RANGE(lo, mid), true,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&thief->range, MATHFUN_RANGE(mid, hi), __ATOMIC_RELEASE);
+			return true;
+		}
+	}
+}
+
+static void mathfun_pool_run(mathfun_pool *pool, mathfun_pool_worker *worker) {
+	if (!mathfun_batch_frame_reserve(&worker->frame, pool->fun, NULL)) {
+		// the chunks of this worker are stolen by the others
+		mathfun_pool_fail(pool, ENOMEM);
+		return;
+	}
+
+	for (;;) {
+		size_t chunk;
+
+		if (mathfun_pool_take(worker, &chunk)) {
+			const size_t offset = chunk * pool->chunk_size;
+			const size_t count  = pool->n - offset < pool->chunk_size ? pool->n - offset : pool->chunk_size;
+
+			errno = 0;
+			if (!mathfun_exec_rows(pool->fun, mathfun_batch_simd, &worker->frame,
+					pool->args, offset, count, pool->out, pool->outc)) {
+				mathfun_pool_fail(pool, EINVAL);
+			}
+			else if (errno != 0) {
+				mathfun_pool_fail(pool, errno);
+			}
+			continue;
+		}
+
+		bool stolen = false;
+		for (size_t i = 1; i < pool->nthreads && !stolen; ++ i) {
+			stolen = mathfun_pool_steal(worker, &pool->workers[(worker->index + i) % pool->nthreads]);
+		}
+
+		if (!stolen) break;
+	}
+}
+
+static void *mathfun_pool_main(void *ptr) {
+	mathfun_pool_worker *worker = (mathfun_pool_worker*)ptr;
+	mathfun_pool *pool = worker->pool;
+	size_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation) {
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		}
+
+		if (pool->quit) break;
+
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		mathfun_pool_run(pool, worker);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (-- pool->pending == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+// stops and joins the threads of workers 1 .. count - 1
+static void mathfun_pool_join(mathfun_pool *pool, size_t count) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (size_t i = 1; i < count; ++ i) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+}
+
+static void mathfun_pool_free(mathfun_pool *pool) {
+	for (size_t i = 0; i < pool->nthreads; ++ i) {
+		mathfun_batch_frame_cleanup(&pool->workers[i].frame);
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_mutex_destroy(&pool->exec);
+
+	free(pool->workers);
+	free(pool);
+}
+
+// Starts worker thread index. With MATHFUN_POOL_PIN it's pinned to the
+// index-th CPU the process may run on (wrapping around).
+static int mathfun_pool_spawn(mathfun_pool *pool, size_t index, int flags) {
+	pthread_attr_t attr;
+	int errnum = pthread_attr_init(&attr);
+
+	if (errnum != 0) return errnum;
+
+#ifdef MATHFUN_POOL_AFFINITY
+	cpu_set_t allowed;
+	if ((flags & MATHFUN_POOL_PIN) && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		const int count = CPU_COUNT(&allowed);
+		int nth = (int)(index % (size_t)count);
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++ cpu) {
+			if (CPU_ISSET(cpu, &allowed) && nth -- == 0) {
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+				break;
+			}
+		}
+	}
+#else
+	(void)flags;
+#endif
+
+	errnum = pthread_create(&pool->workers[index].thread, &attr, mathfun_pool_main, &pool->workers[index]);
+	pthread_attr_destroy(&attr);
+
+	return errnum;
+}
+
+mathfun_pool *mathfun_pool_create(size_t nthreads, int flags, mathfun_error_p *error) {
+	if (nthreads == 0) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = cpus > 0 ? (size_t)cpus : 1;
+	}
+
+	mathfun_pool *pool = calloc(1, sizeof(mathfun_pool));
+
+	if (!pool) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	void *workers = NULL;
+	if (posix_memalign(&workers, MATHFUN_CACHE_LINE, nthreads * sizeof(mathfun_pool_worker)) != 0) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		free(pool);
+		return NULL;
+	}
+	memset(workers, 0, nthreads * sizeof(mathfun_pool_worker));
+
+	pool->workers  = (mathfun_pool_worker*)workers;
+	pool->nthreads = nthreads;
+
+	pthread_mutex_init(&pool->exec, NULL);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (size_t i = 0; i < nthreads; ++ i) {
+		pool->workers[i].pool  = pool;
+		pool->workers[i].index = i;
+	}
+
+	for (size_t i = 1; i < nthreads; ++ i) {
+		const int errnum = mathfun_pool_spawn(pool, i, flags);
+
+		if (errnum != 0) {
+			mathfun_pool_join(pool, i);
+			mathfun_pool_free(pool);
+			errno = errnum;
+			mathfun_raise_c_error(error);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+void mathfun_pool_destroy(mathfun_pool *pool) {
+	if (!pool) return;
+
+	mathfun_pool_join(pool, pool->nthreads);
+	mathfun_pool_free(pool);
+}
+
+size_t mathfun_pool_size(const mathfun_pool *pool) {
+	return pool->nthreads;
+}
+
+static bool mathfun_pool_exec(mathfun_pool *pool, const mathfun *fun, const double *args[], size_t n,
+	double *out[], size_t outc, mathfun_error_p *error) {
+	pthread_mutex_lock(&pool->exec);
+
+	size_t chunk_size = MATHFUN_POOL_CHUNK_SIZE;
+	while (n / chunk_size >= UINT32_MAX) {
+		chunk_size *= 2;
+	}
+	const size_t chunks = (n + chunk_size - 1) / chunk_size;
+
+	pool->fun        = fun;
+	pool->args       = args;
+	pool->out        = out;
+	pool->outc       = outc;
+	pool->n          = n;
+	pool->chunk_size = chunk_size;
+	pool->errnum     = 0;
+
+	if (chunks <= 1 || pool->nthreads == 1) {
+		// not worth waking up the other threads
+		pool->workers[0].range = MATHFUN_RANGE(0, chunks);
+		for (size_t i = 1; i < pool->nthreads; ++ i) {
+			pool->workers[i].range = 0;
+		}
+		mathfun_pool_run(pool, &pool->workers[0]);
+	}
+	else {
+		for (size_t i = 0; i < pool->nthreads; ++ i) {
+			pool->workers[i].range = MATHFUN_RANGE(
+				chunks * i / pool->nthreads, chunks * (i + 1) / pool->nthreads);
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		++ pool->generation;
+		pool->pending = pool->nthreads - 1;
+		pthread_cond_broadcast(&pool->start);
+		pthread_mutex_unlock(&pool->mutex);
+
+		mathfun_pool_run(pool, &pool->workers[0]);
+
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->pending > 0) {
+			pthread_cond_wait(&pool->done, &pool->mutex);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	const int errnum = pool->errnum;
+	pthread_mutex_unlock(&pool->exec);
+
+	if (errnum == ENOMEM) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+	else if (errnum != 0) {
+		errno = errnum;
+		mathfun_raise_c_error(error);
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+// Without threads the pool evaluates everything on the calling thread.
+
+struct mathfun_pool {
+	size_t nthreads;
+};
+
+mathfun_pool *mathfun_pool_create(size_t nthreads, int flags, mathfun_error_p *error) {
+	(void)nthreads;
+	(void)flags;
+
+	mathfun_pool *pool = calloc(1, sizeof(mathfun_pool));
+
+	if (!pool) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	pool->nthreads = 1;
+
+	return pool;
+}
+
+void mathfun_pool_destroy(mathfun_pool *pool) {
+	free(pool);
+}
+
+size_t mathfun_pool_size(const mathfun_pool *pool) {
+	return pool->nthreads;
+}
+
+static bool mathfun_pool_exec(mathfun_pool *pool, const mathfun *fun, const double *args[], size_t n,
+	double *out[], size_t outc, mathfun_error_p *error) {
+	(void)pool;
+
+	if (outc == 1) {
+		return mathfun_exec_batch(fun, args, n, out[0], error);
+	}
+
+	return mathfun_exec_batch_multi(fun, args, n, out, error);
+}
+
+#endif
+
+bool mathfun_exec_parallel(mathfun_pool *pool, const mathfun *fun, const double *args[], size_t n,
+	double out[], mathfun_error_p *error) {
+	return mathfun_pool_exec(pool, fun, args, n, &out, 1, error);
+}
+
+bool mathfun_exec_parallel_multi(mathfun_pool *pool, const mathfun *fun, const double *args[], size_t n,
+	double *out[], mathfun_error_p *error) {
+	return mathfun_pool_exec(pool, fun, args, n, out, fun->retc, error);
+}
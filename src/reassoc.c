@@ -0,0 +1,344 @@
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Reassociation of sums and products for MATHFUN_OPT_FAST_MATH.
+//
+// Chains of +, - and unary - (and chains of * and divisions by constants) are
+// flattened into lists of terms (factors). Their constants are gathered into
+// one, and the chain is rebuilt as a balanced tree, so that the terms don't
+// depend on each other:
+//
+//   (x + 1) + 2    ->  x + 3
+//   2 * x * 3      ->  x * 6
+//   a + b + c + d  ->  (a + b) + (c + d)
+//   x - 2 * y      ->  x + y * -2
+//
+// This changes the rounding and which intermediate results overflow, so it is
+// only done on request. Terms that aren't sums (factors that aren't products)
+// are reassociated recursively. New nodes are allocated in the arena of the
+// tree and get the source span of the chain they replace.
+
+typedef struct mathfun_terms {
+	mathfun_expr **exprs;
+	size_t used;
+	size_t size;
+} mathfun_terms;
+
+typedef struct mathfun_chain {
+	mathfun_terms terms[2]; // added (multiplied) and subtracted terms
+	double constant;
+	const mathfun_expr *root;
+	mathfun_arena *arena;
+	mathfun_error_p *error;
+} mathfun_chain;
+
+static bool mathfun_terms_push(mathfun_chain *chain, mathfun_expr *expr, bool negative) {
+	mathfun_terms *terms = &chain->terms[negative];
+
+	if (terms->used == terms->size) {
+		const size_t size = terms->size ? terms->size * 2 : 8;
+		mathfun_expr **exprs = realloc(terms->exprs, size * sizeof(mathfun_expr*));
+
+		if (!exprs) {
+			mathfun_raise_error(chain->error, MATHFUN_OUT_OF_MEMORY);
+			return false;
+		}
+
+		terms->exprs = exprs;
+		terms->size  = size;
+	}
+
+	terms->exprs[terms->used ++] = expr;
+	return true;
+}
+
+static void mathfun_chain_cleanup(mathfun_chain *chain) {
+	free(chain->terms[0].exprs);
+	free(chain->terms[1].exprs);
+}
+
+static mathfun_expr *mathfun_chain_node(mathfun_chain *chain, enum mathfun_expr_type type) {
+	mathfun_expr *expr = mathfun_arena_alloc(chain->arena, sizeof(mathfun_expr), chain->error);
+
+	if (expr) {
+		expr->type  = type;
+		expr->arena = true;
+		expr->begin = chain->root->begin;
+		expr->end   = chain->root->end;
+	}
+
+	return expr;
+}
+
+static mathfun_expr *mathfun_chain_binary(mathfun_chain *chain, enum mathfun_expr_type type,
+	mathfun_expr *left, mathfun_expr *right) {
+	if (!left || !right) return NULL;
+
+	mathfun_expr *expr = mathfun_chain_node(chain, type);
+
+	if (expr) {
+		expr->ex.binary.left  = left;
+		expr->ex.binary.right = right;
+	}
+
+	return expr;
+}
+
+static mathfun_expr *mathfun_chain_neg(mathfun_chain *chain, mathfun_expr *operand) {
+	if (!operand) return NULL;
+
+	mathfun_expr *expr = mathfun_chain_node(chain, EX_NEG);
+
+	if (expr) {
+		expr->ex.unary.expr = operand;
+	}
+
+	return expr;
+}
+
+static mathfun_expr *mathfun_chain_const(mathfun_chain *chain, double value) {
+	mathfun_expr *expr = mathfun_chain_node(chain, EX_CONST);
+
+	if (expr) {
+		expr->ex.value.type = MATHFUN_NUMBER;
+		expr->ex.value.value.number = value;
+	}
+
+	return expr;
+}
+
+// balanced tree of count > 0 terms
+static mathfun_expr *mathfun_chain_balance(mathfun_chain *chain, enum mathfun_expr_type type,
+	mathfun_expr *exprs[], size_t count) {
+	if (count == 1) return exprs[0];
+
+	const size_t half = count / 2;
+	mathfun_expr *left  = mathfun_chain_balance(chain, type, exprs, half);
+	mathfun_expr *right = left ? mathfun_chain_balance(chain, type, exprs + half, count - half) : NULL;
+
+	return mathfun_chain_binary(chain, type, left, right);
+}
+
+static inline bool mathfun_reassoc_is_number(const mathfun_expr *expr) {
+	return expr->type == EX_CONST && expr->ex.value.type == MATHFUN_NUMBER;
+}
+
+static bool mathfun_flatten_sum(mathfun_chain *chain, mathfun_expr *expr, bool negative) {
+	switch (expr->type) {
+		case EX_ADD:
+			return mathfun_flatten_sum(chain, expr->ex.binary.left,  negative) &&
+			       mathfun_flatten_sum(chain, expr->ex.binary.right, negative);
+
+		case EX_SUB:
+			return mathfun_flatten_sum(chain, expr->ex.binary.left,  negative) &&
+			       mathfun_flatten_sum(chain, expr->ex.binary.right, !negative);
+
+		case EX_NEG:
+			return mathfun_flatten_sum(chain, expr->ex.unary.expr, !negative);
+
+		default:
+		{
+			mathfun_expr *term = mathfun_expr_reassociate(expr, chain->arena, chain->error);
+			if (!term) return false;
+
+			// a product might have become -(...) or a constant
+			if (term->type == EX_NEG) {
+				term = term->ex.unary.expr;
+				negative = !negative;
+			}
+
+			if (mathfun_reassoc_is_number(term)) {
+				const double value = term->ex.value.value.number;
+				chain->constant += negative ? -value : value;
+				return true;
+			}
+
+			// - x * k is x * -k
+			if (negative && term->type == EX_MUL && mathfun_reassoc_is_number(term->ex.binary.right)) {
+				term->ex.binary.right->ex.value.value.number = -term->ex.binary.right->ex.value.value.number;
+				negative = false;
+			}
+
+			return mathfun_terms_push(chain, term, negative);
+		}
+	}
+}
+
+static bool mathfun_flatten_product(mathfun_chain *chain, mathfun_expr *expr) {
+	switch (expr->type) {
+		case EX_MUL:
+			return mathfun_flatten_product(chain, expr->ex.binary.left) &&
+			       mathfun_flatten_product(chain, expr->ex.binary.right);
+
+		case EX_DIV:
+			if (mathfun_reassoc_is_number(expr->ex.binary.right)) {
+				if (!mathfun_flatten_product(chain, expr->ex.binary.left)) return false;
+				chain->constant /= expr->ex.binary.right->ex.value.value.number;
+				return true;
+			}
+			break;
+
+		case EX_NEG:
+			if (!mathfun_flatten_product(chain, expr->ex.unary.expr)) return false;
+			chain->constant = -chain->constant;
+			return true;
+
+		default:
+			break;
+	}
+
+	mathfun_expr *factor = mathfun_expr_reassociate(expr, chain->arena, chain->error);
+	if (!factor) return false;
+
+	// a sum might have become -(...) or a constant
+	if (factor->type == EX_NEG) {
+		factor = factor->ex.unary.expr;
+		chain->constant = -chain->constant;
+	}
+
+	if (mathfun_reassoc_is_number(factor)) {
+		chain->constant *= factor->ex.value.value.number;
+		return true;
+	}
+
+	return mathfun_terms_push(chain, factor, false);
+}
+
+static mathfun_expr *mathfun_reassoc_sum(mathfun_expr *expr, mathfun_arena *arena, mathfun_error_p *error) {
+	mathfun_chain chain;
+	memset(&chain, 0, sizeof(chain));
+	chain.constant = 0.0;
+	chain.root  = expr;
+	chain.arena = arena;
+	chain.error = error;
+
+	mathfun_expr *result = NULL;
+	if (mathfun_flatten_sum(&chain, expr, false)) {
+		const mathfun_terms *added = &chain.terms[0];
+		const mathfun_terms *subtracted = &chain.terms[1];
+		mathfun_expr *pos = added->used      ? mathfun_chain_balance(&chain, EX_ADD, added->exprs, added->used) : NULL;
+		mathfun_expr *neg = subtracted->used ? mathfun_chain_balance(&chain, EX_ADD, subtracted->exprs, subtracted->used) : NULL;
+		double constant = chain.constant;
+
+		if ((added->used && !pos) || (subtracted->used && !neg)) {
+			// out of memory
+		}
+		else if (pos && neg) {
+			result = mathfun_chain_binary(&chain, EX_SUB, pos, neg);
+		}
+		else if (pos) {
+			result = pos;
+		}
+		else if (neg && constant != 0.0) {
+			result = mathfun_chain_binary(&chain, EX_SUB, mathfun_chain_const(&chain, constant), neg);
+			constant = 0.0;
+		}
+		else if (neg) {
+			result = mathfun_chain_neg(&chain, neg);
+		}
+		else {
+			result = mathfun_chain_const(&chain, constant);
+			constant = 0.0;
+		}
+
+		if (result && constant != 0.0) {
+			result = mathfun_chain_binary(&chain, EX_ADD, result, mathfun_chain_const(&chain, constant));
+		}
+	}
+
+	mathfun_chain_cleanup(&chain);
+	return result;
+}
+
+static mathfun_expr *mathfun_reassoc_product(mathfun_expr *expr, mathfun_arena *arena, mathfun_error_p *error) {
+	mathfun_chain chain;
+	memset(&chain, 0, sizeof(chain));
+	chain.constant = 1.0;
+	chain.root  = expr;
+	chain.arena = arena;
+	chain.error = error;
+
+	mathfun_expr *result = NULL;
+	if (mathfun_flatten_product(&chain, expr)) {
+		const mathfun_terms *factors = &chain.terms[0];
+
+		if (factors->used == 0) {
+			result = mathfun_chain_const(&chain, chain.constant);
+		}
+		else {
+			result = mathfun_chain_balance(&chain, EX_MUL, factors->exprs, factors->used);
+
+			if (chain.constant == -1.0) {
+				result = mathfun_chain_neg(&chain, result);
+			}
+			else if (chain.constant != 1.0) {
+				result = mathfun_chain_binary(&chain, EX_MUL, result, mathfun_chain_const(&chain, chain.constant));
+			}
+		}
+	}
+
+	mathfun_chain_cleanup(&chain);
+	return result;
+}
+
+mathfun_expr *mathfun_expr_reassociate(mathfun_expr *expr, mathfun_arena *arena, mathfun_error_p *error) {
+	switch (expr->type) {
+		case EX_CONST:
+		case EX_ARG:
+			return expr;
+
+		case EX_NEG:
+		case EX_ADD:
+		case EX_SUB:
+			return mathfun_reassoc_sum(expr, arena, error);
+
+		case EX_MUL:
+			return mathfun_reassoc_product(expr, arena, error);
+
+		case EX_DIV:
+			if (mathfun_reassoc_is_number(expr->ex.binary.right)) {
+				return mathfun_reassoc_product(expr, arena, error);
+			}
+			break;
+
+		case EX_CALL:
+		{
+			const size_t argc = expr->ex.funct.sig->argc;
+			for (size_t i = 0; i < argc; ++ i) {
+				mathfun_expr *arg = mathfun_expr_reassociate(expr->ex.funct.args[i], arena, error);
+				if (!arg) return NULL;
+				expr->ex.funct.args[i] = arg;
+			}
+			return expr;
+		}
+		case EX_NOT:
+		{
+			mathfun_expr *operand = mathfun_expr_reassociate(expr->ex.unary.expr, arena, error);
+			if (!operand) return NULL;
+			expr->ex.unary.expr = operand;
+			return expr;
+		}
+		case EX_IIF:
+		{
+			mathfun_expr *cond      = mathfun_expr_reassociate(expr->ex.iif.cond, arena, error);
+			mathfun_expr *then_expr = cond      ? mathfun_expr_reassociate(expr->ex.iif.then_expr, arena, error) : NULL;
+			mathfun_expr *else_expr = then_expr ? mathfun_expr_reassociate(expr->ex.iif.else_expr, arena, error) : NULL;
+			if (!else_expr) return NULL;
+			expr->ex.iif.cond      = cond;
+			expr->ex.iif.then_expr = then_expr;
+			expr->ex.iif.else_expr = else_expr;
+			return expr;
+		}
+		default:
+			break;
+	}
+
+	// all other expressions are binary
+	mathfun_expr *left  = mathfun_expr_reassociate(expr->ex.binary.left, arena, error);
+	mathfun_expr *right = left ? mathfun_expr_reassociate(expr->ex.binary.right, arena, error) : NULL;
+	if (!right) return NULL;
+	expr->ex.binary.left  = left;
+	expr->ex.binary.right = right;
+	return expr;
+}
@@ -0,0 +1,591 @@
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Register allocation for the output of the code generator.
+//
+// The code generator hands out registers like a stack and every common
+// subexpression keeps its register for the whole function, so the frame grows
+// with the depth of the expression and the number of shared subexpressions.
+// This pass computes which registers are live before every instruction and
+// splits every register into webs: the definitions and uses that are connected
+// by the control flow. The webs are then assigned to registers again with a
+// linear scan over the code, reusing registers of dead webs.
+//
+// Byte code only jumps forward, so the code order is a topological order of the
+// control flow graph and a single backward pass yields exact liveness.
+//
+// Constraints:
+//   * argument registers are never written and are left alone (batch execution
+//     points them at the caller's columns), as are the result registers of
+//     functions with multiple results and the registers of hoisted values, which
+//     the prologue computes once for all rows of a batch
+//   * the arguments of a CALL have to be consecutive registers. Webs passed to
+//     the same CALL (or nested CALLs sharing registers) form a group that is
+//     allocated as one block. Groups that include an argument register are
+//     pinned, by not touching any register up to the end of that group.
+//
+// A web is treated as live from its first to its last instruction, including
+// holes in between, so in rare cases the linear scan could need more registers
+// than the code generator. The code is kept as it is then.
+
+#define MATHFUN_REGALLOC_NONE SIZE_MAX
+
+// Positions are two per instruction: reads happen at 2*i, writes at 2*i+1. So the
+// target of an instruction can reuse the register of an operand that dies there.
+#define MATHFUN_REGALLOC_USE(I) (2 * (I))
+#define MATHFUN_REGALLOC_DEF(I) (2 * (I) + 1)
+
+typedef struct mathfun_regalloc_web {
+	size_t parent;   // union-find of runs of the same web
+	size_t group;    // union-find of webs passed to the same CALL
+	size_t next;     // next web of the same group
+	size_t start;
+	size_t end;
+	size_t hint;     // web copied by the defining MOV
+	mathfun_code reg;
+	mathfun_code assigned;
+} mathfun_regalloc_web;
+
+typedef struct mathfun_regalloc_edge {
+	size_t next;
+	size_t run;
+	mathfun_code reg;
+} mathfun_regalloc_edge;
+
+// a web or a group of webs that is allocated at once
+typedef struct mathfun_regalloc_unit {
+	size_t start;
+	size_t web;
+} mathfun_regalloc_unit;
+
+typedef struct mathfun_regalloc {
+	mathfun_code *code;
+	size_t  count;     // number of instructions
+	size_t *addrs;     // code address of every instruction
+	size_t *index;     // instruction of every code address
+	size_t  framesize;
+	size_t  fixed;     // registers below are never touched
+	size_t  words;     // uint64_t words per register set
+	uint64_t *live;    // registers live before every instruction (count + 1 sets)
+	size_t *current;   // run of every register at the current instruction
+	size_t *opwebs;    // run of every register operand
+	size_t *edges;     // first jump edge into every instruction
+	mathfun_regalloc_edge *edge_list;
+	size_t  edges_used;
+	size_t  edges_size;
+	size_t *links;     // pairs of runs passed to the same CALL
+	size_t  links_used;
+	size_t  links_size;
+	mathfun_regalloc_web *webs;
+	size_t  webs_used;
+	size_t  webs_size;
+	mathfun_regalloc_unit *units; // webs and groups ordered by start
+	size_t *busy;      // position + 1 up to which a register is taken
+	size_t *lanes;     // end of every register of a group
+} mathfun_regalloc;
+
+// Offsets of the register operands of a code generator instruction: the ones
+// read in uses, the one written in def (0 if none). The arguments of CALL aren't
+// included. Returns false for superinstructions, which only exist after fusing.
+static bool mathfun_regalloc_operands(const mathfun_code *ins, size_t uses[], size_t *usec, size_t *def) {
+	size_t offsets[4];
+	size_t count = 0;
+	size_t offset = 1;
+
+	if (*ins >= MULADD && *ins <= GEJ) return false;
+
+	for (const char *kind = mathfun_bytecode_infos[*ins].operands; *kind; ++ kind) {
+		if (*kind == 'r') offsets[count ++] = offset;
+		offset += *kind == 'a' ? MATHFUN_ADR_CODES : 1;
+	}
+
+	*usec = 0;
+	*def  = 0;
+
+	switch (*ins) {
+		case RET:
+		case JMPT:
+		case JMPF:
+			uses[(*usec) ++] = offsets[0];
+			return true;
+
+		case CALL:
+			// first argument, target
+			if (ins[2] == 1) uses[(*usec) ++] = offsets[0];
+			*def = offsets[1];
+			return true;
+
+		default:
+			if (count > 0) {
+				for (size_t i = 0; i + 1 < count; ++ i) {
+					uses[(*usec) ++] = offsets[i];
+				}
+				*def = offsets[count - 1];
+			}
+			return true;
+	}
+}
+
+static inline bool mathfun_regset_has(const uint64_t *set, size_t reg) {
+	return (set[reg / 64] >> (reg % 64)) & 1;
+}
+
+static inline void mathfun_regset_add(uint64_t *set, size_t reg) {
+	set[reg / 64] |= UINT64_C(1) << (reg % 64);
+}
+
+static inline void mathfun_regset_remove(uint64_t *set, size_t reg) {
+	set[reg / 64] &= ~(UINT64_C(1) << (reg % 64));
+}
+
+static inline uint64_t *mathfun_regalloc_live(const mathfun_regalloc *ra, size_t i) {
+	return ra->live + i * ra->words;
+}
+
+static inline bool mathfun_regalloc_falls_through(const mathfun_code *ins) {
+	return *ins != RET && *ins != JMP;
+}
+
+static size_t mathfun_regalloc_target(const mathfun_regalloc *ra, const mathfun_code *ins) {
+	switch (*ins) {
+		case JMP:  return ra->index[mathfun_code_adr(ins + 1)];
+		case JMPT:
+		case JMPF: return ra->index[mathfun_code_adr(ins + 2)];
+		default:   return MATHFUN_REGALLOC_NONE;
+	}
+}
+
+// Raises ra->fixed until no CALL has arguments on both sides of it.
+static void mathfun_regalloc_pin(mathfun_regalloc *ra) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (const mathfun_code *ins = ra->code; *ins != END; ins += mathfun_code_size(ins)) {
+			if (*ins == CALL && ins[2] > 1 && ins[3] < ra->fixed && (size_t)ins[3] + ins[2] > ra->fixed) {
+				ra->fixed = (size_t)ins[3] + ins[2];
+				changed = true;
+			}
+		}
+	}
+}
+
+static bool mathfun_regalloc_liveness(mathfun_regalloc *ra) {
+	for (size_t i = ra->count; i > 0;) {
+		-- i;
+		const mathfun_code *ins = ra->code + ra->addrs[i];
+		uint64_t *live = mathfun_regalloc_live(ra, i);
+		size_t uses[3], usec, def;
+
+		if (!mathfun_regalloc_operands(ins, uses, &usec, &def) || (def && ins[def] >= ra->framesize) ||
+			(*ins == CALL && (size_t)ins[3] + ins[2] > ra->framesize)) return false;
+
+		if (mathfun_regalloc_falls_through(ins)) {
+			memcpy(live, mathfun_regalloc_live(ra, i + 1), ra->words * sizeof(uint64_t));
+		}
+
+		const size_t target = mathfun_regalloc_target(ra, ins);
+		if (target != MATHFUN_REGALLOC_NONE) {
+			const uint64_t *other = mathfun_regalloc_live(ra, target);
+			for (size_t w = 0; w < ra->words; ++ w) {
+				live[w] |= other[w];
+			}
+		}
+
+		if (def) mathfun_regset_remove(live, ins[def]);
+
+		for (size_t k = 0; k < usec; ++ k) {
+			if (ins[uses[k]] >= ra->framesize) return false;
+			mathfun_regset_add(live, ins[uses[k]]);
+		}
+
+		if (*ins == CALL && ins[2] > 1) {
+			for (size_t k = 0; k < ins[2]; ++ k) {
+				mathfun_regset_add(live, (size_t)ins[3] + k);
+			}
+		}
+	}
+
+	return true;
+}
+
+// Returns array grown to hold at least used + 1 elements, or NULL if out of memory.
+static void *mathfun_regalloc_grow(void *array, size_t *size, size_t used, size_t elemsize) {
+	if (used < *size) return array;
+
+	const size_t newsize = *size ? *size * 2 : 64;
+	void *ptr = realloc(array, newsize * elemsize);
+	if (ptr) *size = newsize;
+
+	return ptr;
+}
+
+static bool mathfun_regalloc_new_run(mathfun_regalloc *ra, mathfun_code reg, size_t start, size_t *run) {
+	mathfun_regalloc_web *webs = mathfun_regalloc_grow(ra->webs, &ra->webs_size, ra->webs_used,
+		sizeof(mathfun_regalloc_web));
+	if (!webs) return false;
+	ra->webs = webs;
+
+	*run = ra->webs_used ++;
+	mathfun_regalloc_web *web = ra->webs + *run;
+	web->parent   = *run;
+	web->group    = *run;
+	web->next     = MATHFUN_REGALLOC_NONE;
+	web->start    = start;
+	web->end      = start;
+	web->hint     = MATHFUN_REGALLOC_NONE;
+	web->reg      = reg;
+	web->assigned = reg;
+
+	return true;
+}
+
+static bool mathfun_regalloc_add_edge(mathfun_regalloc *ra, size_t target, mathfun_code reg, size_t run) {
+	mathfun_regalloc_edge *edges = mathfun_regalloc_grow(ra->edge_list, &ra->edges_size, ra->edges_used,
+		sizeof(mathfun_regalloc_edge));
+	if (!edges) return false;
+	ra->edge_list = edges;
+
+	mathfun_regalloc_edge *edge = ra->edge_list + ra->edges_used;
+	edge->next = ra->edges[target];
+	edge->run  = run;
+	edge->reg  = reg;
+	ra->edges[target] = ra->edges_used ++;
+
+	return true;
+}
+
+static bool mathfun_regalloc_add_link(mathfun_regalloc *ra, size_t a, size_t b) {
+	size_t *links = mathfun_regalloc_grow(ra->links, &ra->links_size, ra->links_used + 1, sizeof(size_t));
+	if (!links) return false;
+	ra->links = links;
+
+	ra->links[ra->links_used ++] = a;
+	ra->links[ra->links_used ++] = b;
+
+	return true;
+}
+
+static size_t mathfun_regalloc_find(mathfun_regalloc_web *webs, size_t web) {
+	while (webs[web].parent != web) {
+		webs[web].parent = webs[webs[web].parent].parent;
+		web = webs[web].parent;
+	}
+	return web;
+}
+
+static size_t mathfun_regalloc_find_group(mathfun_regalloc_web *webs, size_t web) {
+	while (webs[web].group != web) {
+		webs[web].group = webs[webs[web].group].group;
+		web = webs[web].group;
+	}
+	return web;
+}
+
+// Splits the registers into runs of consecutive instructions where they are live
+// and joins the runs connected by jumps into webs.
+static bool mathfun_regalloc_webs(mathfun_regalloc *ra) {
+	for (size_t reg = 0; reg < ra->framesize; ++ reg) {
+		ra->current[reg] = MATHFUN_REGALLOC_NONE;
+	}
+
+	bool falls_through = false;
+	for (size_t i = 0; i < ra->count; ++ i) {
+		const size_t adr = ra->addrs[i];
+		const mathfun_code *ins = ra->code + adr;
+		const uint64_t *live = mathfun_regalloc_live(ra, i);
+		size_t uses[3], usec, def;
+
+		mathfun_regalloc_operands(ins, uses, &usec, &def);
+
+		for (size_t reg = ra->fixed; reg < ra->framesize; ++ reg) {
+			const bool is_live = mathfun_regset_has(live, reg);
+			const bool is_def  = def && ins[def] == reg;
+
+			if (!is_live && !is_def) {
+				ra->current[reg] = MATHFUN_REGALLOC_NONE;
+				continue;
+			}
+
+			if (!is_live || !falls_through || ra->current[reg] == MATHFUN_REGALLOC_NONE) {
+				size_t run;
+				if (!mathfun_regalloc_new_run(ra, (mathfun_code)reg,
+					is_live ? MATHFUN_REGALLOC_USE(i) : MATHFUN_REGALLOC_DEF(i), &run)) return false;
+				ra->current[reg] = run;
+			}
+
+			ra->webs[ra->current[reg]].end = is_def ? MATHFUN_REGALLOC_DEF(i) : MATHFUN_REGALLOC_USE(i);
+		}
+
+		// values that come in through jumps belong to the same web as at the jump
+		for (size_t edge = ra->edges[i]; edge != MATHFUN_REGALLOC_NONE; edge = ra->edge_list[edge].next) {
+			const size_t a = mathfun_regalloc_find(ra->webs, ra->edge_list[edge].run);
+			const size_t b = mathfun_regalloc_find(ra->webs, ra->current[ra->edge_list[edge].reg]);
+			if (a < b) ra->webs[b].parent = a;
+			else       ra->webs[a].parent = b;
+		}
+
+		for (size_t k = 0; k < usec; ++ k) {
+			if (ins[uses[k]] >= ra->fixed) {
+				ra->opwebs[adr + uses[k]] = ra->current[ins[uses[k]]];
+			}
+		}
+
+		if (def && ins[def] >= ra->fixed) {
+			const size_t run = ra->current[ins[def]];
+			ra->opwebs[adr + def] = run;
+
+			if (*ins == MOV && ins[1] >= ra->fixed && ra->webs[run].start == MATHFUN_REGALLOC_DEF(i)) {
+				ra->webs[run].hint = ra->current[ins[1]];
+			}
+		}
+
+		if (*ins == CALL && ins[2] > 1 && ins[3] >= ra->fixed) {
+			ra->opwebs[adr + 3] = ra->current[ins[3]];
+			for (size_t k = 1; k < ins[2]; ++ k) {
+				if (!mathfun_regalloc_add_link(ra, ra->current[ins[3]], ra->current[(size_t)ins[3] + k])) {
+					return false;
+				}
+			}
+		}
+
+		const size_t target = mathfun_regalloc_target(ra, ins);
+		if (target != MATHFUN_REGALLOC_NONE && target < ra->count) {
+			const uint64_t *target_live = mathfun_regalloc_live(ra, target);
+			for (size_t reg = ra->fixed; reg < ra->framesize; ++ reg) {
+				if (mathfun_regset_has(target_live, reg) &&
+					!mathfun_regalloc_add_edge(ra, target, (mathfun_code)reg, ra->current[reg])) return false;
+			}
+		}
+
+		falls_through = mathfun_regalloc_falls_through(ins);
+	}
+
+	// the extent of a web covers all its runs
+	for (size_t run = 0; run < ra->webs_used; ++ run) {
+		mathfun_regalloc_web *web = ra->webs + mathfun_regalloc_find(ra->webs, run);
+		if (ra->webs[run].start < web->start) web->start = ra->webs[run].start;
+		if (ra->webs[run].end   > web->end)   web->end   = ra->webs[run].end;
+		if (web->hint == MATHFUN_REGALLOC_NONE) web->hint = ra->webs[run].hint;
+	}
+
+	// webs passed to the same CALL form a group
+	for (size_t k = 0; k < ra->links_used; k += 2) {
+		const size_t a = mathfun_regalloc_find_group(ra->webs, mathfun_regalloc_find(ra->webs, ra->links[k]));
+		const size_t b = mathfun_regalloc_find_group(ra->webs, mathfun_regalloc_find(ra->webs, ra->links[k + 1]));
+		if (a < b) ra->webs[b].group = a;
+		else       ra->webs[a].group = b;
+	}
+
+	return true;
+}
+
+static int mathfun_regalloc_cmp_unit(const void *a, const void *b) {
+	const mathfun_regalloc_unit *unit1 = a;
+	const mathfun_regalloc_unit *unit2 = b;
+
+	if (unit1->start != unit2->start) return unit1->start < unit2->start ? -1 : 1;
+	return unit1->web < unit2->web ? -1 : unit1->web > unit2->web;
+}
+
+static inline bool mathfun_regalloc_free(const mathfun_regalloc *ra, size_t reg, size_t start) {
+	return ra->busy[reg] <= start;
+}
+
+// Assigns registers to all webs. Returns the new frame size, or the old one if the
+// linear scan would need more registers than the code generator did.
+static size_t mathfun_regalloc_scan(mathfun_regalloc *ra) {
+	mathfun_regalloc_web *webs = ra->webs;
+	size_t unitc = 0;
+
+	for (size_t run = 0; run < ra->webs_used; ++ run) {
+		if (webs[run].parent != run) continue;
+
+		const size_t group = mathfun_regalloc_find_group(webs, run);
+		if (group == run) {
+			ra->units[unitc ++] = (mathfun_regalloc_unit){ webs[run].start, run };
+		}
+		else {
+			webs[run].next = webs[group].next;
+			webs[group].next = run;
+		}
+	}
+
+	for (size_t k = 0; k < unitc; ++ k) {
+		for (size_t web = webs[ra->units[k].web].next; web != MATHFUN_REGALLOC_NONE; web = webs[web].next) {
+			if (webs[web].start < ra->units[k].start) ra->units[k].start = webs[web].start;
+		}
+	}
+
+	qsort(ra->units, unitc, sizeof(mathfun_regalloc_unit), mathfun_regalloc_cmp_unit);
+
+	size_t framesize = ra->fixed;
+	for (size_t k = 0; k < unitc; ++ k) {
+		const size_t start = ra->units[k].start;
+		mathfun_regalloc_web *first = webs + ra->units[k].web;
+		size_t reg = ra->framesize;
+
+		if (first->next == MATHFUN_REGALLOC_NONE) {
+			// prefer the register of the copied web, so the MOV goes away
+			if (first->hint != MATHFUN_REGALLOC_NONE) {
+				const size_t hint = webs[mathfun_regalloc_find(webs, first->hint)].assigned;
+				if (hint >= ra->fixed && mathfun_regalloc_free(ra, hint, start)) reg = hint;
+			}
+
+			for (size_t r = ra->fixed; r < ra->framesize && reg == ra->framesize; ++ r) {
+				if (mathfun_regalloc_free(ra, r, start)) reg = r;
+			}
+
+			if (reg == ra->framesize) return ra->framesize;
+
+			first->assigned = (mathfun_code)reg;
+			ra->busy[reg] = first->end + 1;
+		}
+		else {
+			size_t minreg = first->reg, maxreg = first->reg;
+			for (size_t web = first->next; web != MATHFUN_REGALLOC_NONE; web = webs[web].next) {
+				if (webs[web].reg < minreg) minreg = webs[web].reg;
+				if (webs[web].reg > maxreg) maxreg = webs[web].reg;
+			}
+
+			const size_t lanec = maxreg - minreg + 1;
+			memset(ra->lanes, 0, lanec * sizeof(size_t));
+			for (size_t web = ra->units[k].web; web != MATHFUN_REGALLOC_NONE; web = webs[web].next) {
+				size_t *lane = ra->lanes + (webs[web].reg - minreg);
+				if (webs[web].end + 1 > *lane) *lane = webs[web].end + 1;
+			}
+
+			for (size_t base = ra->fixed; base + lanec <= ra->framesize && reg == ra->framesize; ++ base) {
+				size_t lane = 0;
+				while (lane < lanec && mathfun_regalloc_free(ra, base + lane, start)) ++ lane;
+				if (lane == lanec) reg = base;
+			}
+
+			if (reg == ra->framesize) return ra->framesize;
+
+			for (size_t web = ra->units[k].web; web != MATHFUN_REGALLOC_NONE; web = webs[web].next) {
+				webs[web].assigned = (mathfun_code)(reg + webs[web].reg - minreg);
+			}
+
+			for (size_t lane = 0; lane < lanec; ++ lane) {
+				if (ra->lanes[lane] > 0) ra->busy[reg + lane] = ra->lanes[lane];
+			}
+
+			reg += lanec - 1;
+		}
+
+		if (reg + 1 > framesize) framesize = reg + 1;
+	}
+
+	return framesize;
+}
+
+static void mathfun_regalloc_rewrite(mathfun_regalloc *ra) {
+	for (size_t i = 0; i < ra->count; ++ i) {
+		const size_t adr = ra->addrs[i];
+		mathfun_code *ins = ra->code + adr;
+		const size_t size = mathfun_code_size(ins);
+
+		for (size_t offset = 1; offset < size; ++ offset) {
+			if (ra->opwebs[adr + offset] != MATHFUN_REGALLOC_NONE) {
+				ins[offset] = ra->webs[mathfun_regalloc_find(ra->webs, ra->opwebs[adr + offset])].assigned;
+			}
+		}
+
+		if (*ins == CALL && ins[2] == 0) {
+			ins[3] = 0;
+		}
+		else if (*ins == MOV && ins[1] == ins[2]) {
+			for (size_t offset = 0; offset < size; ++ offset) {
+				ins[offset] = NOP;
+			}
+		}
+	}
+}
+
+static void mathfun_regalloc_cleanup(mathfun_regalloc *ra) {
+	free(ra->addrs);
+	free(ra->index);
+	free(ra->live);
+	free(ra->current);
+	free(ra->opwebs);
+	free(ra->edges);
+	free(ra->edge_list);
+	free(ra->links);
+	free(ra->webs);
+	free(ra->units);
+	free(ra->busy);
+	free(ra->lanes);
+}
+
+bool mathfun_code_regalloc(mathfun *fun, mathfun_error_p *error) {
+	mathfun_regalloc ra;
+	memset(&ra, 0, sizeof(mathfun_regalloc));
+
+	ra.code      = fun->code;
+	ra.framesize = fun->framesize;
+	ra.fixed     = fun->argc + (fun->retc > 1 || fun->hoisted > 0 ? fun->retc + fun->hoisted : 0);
+
+	size_t size = 0;
+	while (ra.code[size] != END) {
+		size += mathfun_code_size(ra.code + size);
+		++ ra.count;
+	}
+
+	mathfun_regalloc_pin(&ra);
+	if (ra.fixed >= ra.framesize) return true;
+
+	ra.words   = (ra.framesize + 63) / 64;
+	ra.addrs   = calloc(ra.count, sizeof(size_t));
+	ra.index   = calloc(size + 1, sizeof(size_t));
+	ra.live    = calloc((ra.count + 1) * ra.words, sizeof(uint64_t));
+	ra.current = calloc(ra.framesize, sizeof(size_t));
+	ra.opwebs  = malloc(size * sizeof(size_t));
+	ra.edges   = malloc(ra.count * sizeof(size_t));
+	ra.busy    = calloc(ra.framesize, sizeof(size_t));
+	ra.lanes   = calloc(ra.framesize, sizeof(size_t));
+
+	if (!ra.addrs || !ra.index || !ra.live || !ra.current || (size && !ra.opwebs) ||
+		(ra.count && !ra.edges) || !ra.busy || !ra.lanes) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		mathfun_regalloc_cleanup(&ra);
+		return false;
+	}
+
+	for (size_t i = 0, adr = 0; i < ra.count; ++ i) {
+		ra.addrs[i] = adr;
+		ra.index[adr] = i;
+		ra.edges[i] = MATHFUN_REGALLOC_NONE;
+		adr += mathfun_code_size(ra.code + adr);
+	}
+	ra.index[size] = ra.count;
+
+	for (size_t adr = 0; adr < size; ++ adr) {
+		ra.opwebs[adr] = MATHFUN_REGALLOC_NONE;
+	}
+
+	if (!mathfun_regalloc_liveness(&ra)) {
+		mathfun_raise_error(error, MATHFUN_INTERNAL_ERROR);
+		mathfun_regalloc_cleanup(&ra);
+		return false;
+	}
+
+	if (!mathfun_regalloc_webs(&ra) ||
+		!(ra.units = malloc((ra.webs_used ? ra.webs_used : 1) * sizeof(mathfun_regalloc_unit)))) {
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		mathfun_regalloc_cleanup(&ra);
+		return false;
+	}
+
+	size_t framesize = mathfun_regalloc_scan(&ra);
+	if (framesize < fun->argc + fun->retc) framesize = fun->argc + fun->retc;
+
+	if (framesize < ra.framesize) {
+		mathfun_regalloc_rewrite(&ra);
+		fun->framesize = framesize;
+	}
+
+	mathfun_regalloc_cleanup(&ra);
+
+	return true;
+}
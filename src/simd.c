@@ -0,0 +1,587 @@
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Vector kernels for the batch interpreter. The widest instruction set the CPU
+// supports is selected when the library is loaded, so one binary runs on every
+// x86 CPU. Define MATHFUN_SIMD_FORCE (see the MATHFUN_SIMD cmake option) to cap
+// the selection at a given level for testing:
+//
+//   0 ... generic C
+//   1 ... SSE2
+//   2 ... AVX2
+//   3 ... AVX-512F
+//
+// Comparisons store canonical boolean words (see MATHFUN_TRUE_WORD), which turns
+// them into lane masks that can be used to blend the results of diverged rows.
+// Like C's relational operators <, >, <= and >= raise the invalid exception for
+// NaN operands while == and != don't, so every instruction set reports the same
+// flags to mathfun_exec_batch_status().
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define MATHFUN_X86_SIMD
+#	include <immintrin.h>
+#endif
+
+#define MATHFUN_SIMD_GENERIC 0
+#define MATHFUN_SIMD_SSE2    1
+#define MATHFUN_SIMD_AVX2    2
+#define MATHFUN_SIMD_AVX512  3
+
+#ifndef MATHFUN_SIMD_FORCE
+#	define MATHFUN_SIMD_FORCE MATHFUN_SIMD_AVX512
+#endif
+
+static inline void mathfun_set_word(mathfun_value *value, uint64_t word) {
+	memcpy(value, &word, sizeof(word));
+}
+
+static inline uint64_t mathfun_get_word(const mathfun_value *value) {
+	uint64_t word;
+	memcpy(&word, value, sizeof(word));
+	return word;
+}
+
+static inline void mathfun_float_set_word(mathfun_value_float *value, uint32_t word) {
+	memcpy(value, &word, sizeof(word));
+}
+
+static inline uint32_t mathfun_float_get_word(const mathfun_value_float *value) {
+	uint32_t word;
+	memcpy(&word, value, sizeof(word));
+	return word;
+}
+
+// The kernels are generated for double (prefix generic) and for single
+// precision registers (prefix float_generic), which differ in these types.
+#define MATHFUN_generic_VALUE    mathfun_value
+#define MATHFUN_generic_MASK     uint64_t
+#define MATHFUN_generic_KERNELS  mathfun_batch_kernels
+#define MATHFUN_generic_TRUE     MATHFUN_TRUE_WORD
+#define MATHFUN_generic_BOOL     MATHFUN_BOOL_BYTE
+#define MATHFUN_generic_SET_WORD mathfun_set_word
+#define MATHFUN_generic_GET_WORD mathfun_get_word
+
+#define MATHFUN_float_generic_VALUE    mathfun_value_float
+#define MATHFUN_float_generic_MASK     uint32_t
+#define MATHFUN_float_generic_KERNELS  mathfun_batch_float_kernels
+#define MATHFUN_float_generic_TRUE     MATHFUN_FLOAT_TRUE_WORD
+#define MATHFUN_float_generic_BOOL     MATHFUN_FLOAT_BOOL_BYTE
+#define MATHFUN_float_generic_SET_WORD mathfun_float_set_word
+#define MATHFUN_float_generic_GET_WORD mathfun_float_get_word
+
+#define MATHFUN_GENERIC_BINARY(P, NAME, STMT) \
+	static void mathfun_##P##_##NAME(const MATHFUN_##P##_VALUE a[], const MATHFUN_##P##_VALUE b[], \
+		MATHFUN_##P##_VALUE c[], const MATHFUN_##P##_MASK mask[], size_t count) { \
+		if (mask) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				if (mask[i]) { STMT; } \
+			} \
+		} \
+		else { \
+			for (size_t i = 0; i < count; ++ i) { \
+				STMT; \
+			} \
+		} \
+	}
+
+#define MATHFUN_GENERIC_UNARY(P, NAME, STMT) \
+	static void mathfun_##P##_##NAME(const MATHFUN_##P##_VALUE a[], MATHFUN_##P##_VALUE b[], \
+		const MATHFUN_##P##_MASK mask[], size_t count) { \
+		if (mask) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				if (mask[i]) { STMT; } \
+			} \
+		} \
+		else { \
+			for (size_t i = 0; i < count; ++ i) { \
+				STMT; \
+			} \
+		} \
+	}
+
+// second operand is the constant k
+#define MATHFUN_GENERIC_CONST(P, NAME, STMT) \
+	static void mathfun_##P##_##NAME(const MATHFUN_##P##_VALUE a[], MATHFUN_##P##_VALUE k, \
+		MATHFUN_##P##_VALUE c[], const MATHFUN_##P##_MASK mask[], size_t count) { \
+		if (mask) { \
+			for (size_t i = 0; i < count; ++ i) { \
+				if (mask[i]) { STMT; } \
+			} \
+		} \
+		else { \
+			for (size_t i = 0; i < count; ++ i) { \
+				STMT; \
+			} \
+		} \
+	}
+
+#define MATHFUN_GENERIC_CMP(P, NAME, OP) \
+	MATHFUN_GENERIC_BINARY(P, NAME, MATHFUN_##P##_SET_WORD(c + i, \
+		a[i].number OP b[i].number ? MATHFUN_##P##_TRUE : 0))
+
+#define MATHFUN_GENERIC_CMPK(P, NAME, OP) \
+	MATHFUN_GENERIC_CONST(P, NAME, MATHFUN_##P##_SET_WORD(c + i, \
+		a[i].number OP k.number ? MATHFUN_##P##_TRUE : 0))
+
+#define MATHFUN_GENERIC_KERNELS(P, NAME) \
+	MATHFUN_GENERIC_BINARY(P, add, c[i].number = a[i].number + b[i].number) \
+	MATHFUN_GENERIC_BINARY(P, sub, c[i].number = a[i].number - b[i].number) \
+	MATHFUN_GENERIC_BINARY(P, mul, c[i].number = a[i].number * b[i].number) \
+	MATHFUN_GENERIC_BINARY(P, div, c[i].number = a[i].number / b[i].number) \
+	\
+	MATHFUN_GENERIC_CMP(P, eq, ==) \
+	MATHFUN_GENERIC_CMP(P, ne, !=) \
+	MATHFUN_GENERIC_CMP(P, lt, <) \
+	MATHFUN_GENERIC_CMP(P, gt, >) \
+	MATHFUN_GENERIC_CMP(P, le, <=) \
+	MATHFUN_GENERIC_CMP(P, ge, >=) \
+	\
+	MATHFUN_GENERIC_BINARY(P, beq, MATHFUN_##P##_SET_WORD(c + i, \
+		((MATHFUN_##P##_GET_WORD(a + i) ^ MATHFUN_##P##_GET_WORD(b + i)) & MATHFUN_##P##_BOOL) ^ \
+		MATHFUN_##P##_TRUE)) \
+	MATHFUN_GENERIC_BINARY(P, bne, MATHFUN_##P##_SET_WORD(c + i, \
+		(MATHFUN_##P##_GET_WORD(a + i) ^ MATHFUN_##P##_GET_WORD(b + i)) & MATHFUN_##P##_BOOL)) \
+	\
+	MATHFUN_GENERIC_CONST(P, addk,  c[i].number = a[i].number + k.number) \
+	MATHFUN_GENERIC_CONST(P, subk,  c[i].number = a[i].number - k.number) \
+	MATHFUN_GENERIC_CONST(P, rsubk, c[i].number = k.number - a[i].number) \
+	MATHFUN_GENERIC_CONST(P, mulk,  c[i].number = a[i].number * k.number) \
+	MATHFUN_GENERIC_CONST(P, divk,  c[i].number = a[i].number / k.number) \
+	MATHFUN_GENERIC_CONST(P, rdivk, c[i].number = k.number / a[i].number) \
+	\
+	MATHFUN_GENERIC_CMPK(P, eqk, ==) \
+	MATHFUN_GENERIC_CMPK(P, nek, !=) \
+	MATHFUN_GENERIC_CMPK(P, ltk, <) \
+	MATHFUN_GENERIC_CMPK(P, gtk, >) \
+	MATHFUN_GENERIC_CMPK(P, lek, <=) \
+	MATHFUN_GENERIC_CMPK(P, gek, >=) \
+	\
+	MATHFUN_GENERIC_UNARY(P, neg, b[i].number = -a[i].number) \
+	MATHFUN_GENERIC_UNARY(P, not, MATHFUN_##P##_SET_WORD(b + i, \
+		(MATHFUN_##P##_GET_WORD(a + i) & MATHFUN_##P##_BOOL) ^ MATHFUN_##P##_TRUE)) \
+	\
+	const MATHFUN_##P##_KERNELS mathfun_batch_##P = { \
+		NAME, \
+		mathfun_##P##_add, mathfun_##P##_sub, mathfun_##P##_mul, mathfun_##P##_div, \
+		mathfun_##P##_eq,  mathfun_##P##_ne,  mathfun_##P##_lt,  mathfun_##P##_gt, \
+		mathfun_##P##_le,  mathfun_##P##_ge, \
+		mathfun_##P##_beq, mathfun_##P##_bne, \
+		mathfun_##P##_neg, mathfun_##P##_not, \
+		mathfun_##P##_addk, mathfun_##P##_subk, mathfun_##P##_rsubk, \
+		mathfun_##P##_mulk, mathfun_##P##_divk, mathfun_##P##_rdivk, \
+		mathfun_##P##_eqk,  mathfun_##P##_nek,  mathfun_##P##_ltk, \
+		mathfun_##P##_gtk,  mathfun_##P##_lek,  mathfun_##P##_gek \
+	};
+
+MATHFUN_GENERIC_KERNELS(generic, "generic")
+MATHFUN_GENERIC_KERNELS(float_generic, "generic")
+
+const mathfun_batch_kernels *mathfun_batch_simd = &mathfun_batch_generic;
+const mathfun_batch_float_kernels *mathfun_batch_float_simd = &mathfun_batch_float_generic;
+
+#ifdef MATHFUN_X86_SIMD
+
+// Every instruction set defines LOAD, STORE, STORE_MASKED, SET1, ZEROUPPER,
+// WIDTH and the operations, then the kernels are generated from these
+// templates. The rows that don't fill a whole vector are handled by the generic
+// kernels. VALUE, MASK, KERNELS and GENERIC select double or single precision
+// registers, the single precision variant of an instruction set is named
+// ISA_float.
+//
+// The generic kernels and the interpreter the kernels return to are SSE code,
+// so the AVX kernels clear the upper halves of the vector registers before the
+// generic tail. Otherwise the first SSE instruction after a kernel pays for a
+// state transition, which costs more than computing a whole block.
+
+#define MATHFUN_SIMD_BINARY(ISA, NAME, OP) \
+	MATHFUN_TARGET_##ISA static void mathfun_##ISA##_##NAME(const MATHFUN_##ISA##_VALUE a[], const MATHFUN_##ISA##_VALUE b[], \
+		MATHFUN_##ISA##_VALUE c[], const MATHFUN_##ISA##_MASK mask[], size_t count) { \
+		size_t i = 0; \
+		if (mask) { \
+			for (; i + MATHFUN_##ISA##_WIDTH <= count; i += MATHFUN_##ISA##_WIDTH) { \
+				MATHFUN_##ISA##_STORE_MASKED(c + i, mask + i, \
+					OP(MATHFUN_##ISA##_LOAD(a + i), MATHFUN_##ISA##_LOAD(b + i))); \
+			} \
+		} \
+		else { \
+			for (; i + MATHFUN_##ISA##_WIDTH <= count; i += MATHFUN_##ISA##_WIDTH) { \
+				MATHFUN_##ISA##_STORE(c + i, \
+					OP(MATHFUN_##ISA##_LOAD(a + i), MATHFUN_##ISA##_LOAD(b + i))); \
+			} \
+		} \
+		MATHFUN_##ISA##_ZEROUPPER(); \
+		MATHFUN_##ISA##_GENERIC(NAME)(a + i, b + i, c + i, mask ? mask + i : NULL, count - i); \
+	}
+
+#define MATHFUN_SIMD_UNARY(ISA, NAME, OP) \
+	MATHFUN_TARGET_##ISA static void mathfun_##ISA##_##NAME(const MATHFUN_##ISA##_VALUE a[], MATHFUN_##ISA##_VALUE b[], \
+		const MATHFUN_##ISA##_MASK mask[], size_t count) { \
+		size_t i = 0; \
+		if (mask) { \
+			for (; i + MATHFUN_##ISA##_WIDTH <= count; i += MATHFUN_##ISA##_WIDTH) { \
+				MATHFUN_##ISA##_STORE_MASKED(b + i, mask + i, OP(MATHFUN_##ISA##_LOAD(a + i))); \
+			} \
+		} \
+		else { \
+			for (; i + MATHFUN_##ISA##_WIDTH <= count; i += MATHFUN_##ISA##_WIDTH) { \
+				MATHFUN_##ISA##_STORE(b + i, OP(MATHFUN_##ISA##_LOAD(a + i))); \
+			} \
+		} \
+		MATHFUN_##ISA##_ZEROUPPER(); \
+		MATHFUN_##ISA##_GENERIC(NAME)(a + i, b + i, mask ? mask + i : NULL, count - i); \
+	}
+
+// X and Y are A (the register operand) or K (the constant)
+#define MATHFUN_SIMD_ARG_A(ISA) MATHFUN_##ISA##_LOAD(a + i)
+#define MATHFUN_SIMD_ARG_K(ISA) MATHFUN_##ISA##_SET1(k.number)
+
+#define MATHFUN_SIMD_CONST(ISA, NAME, OP, X, Y) \
+	MATHFUN_TARGET_##ISA static void mathfun_##ISA##_##NAME(const MATHFUN_##ISA##_VALUE a[], MATHFUN_##ISA##_VALUE k, \
+		MATHFUN_##ISA##_VALUE c[], const MATHFUN_##ISA##_MASK mask[], size_t count) { \
+		size_t i = 0; \
+		if (mask) { \
+			for (; i + MATHFUN_##ISA##_WIDTH <= count; i += MATHFUN_##ISA##_WIDTH) { \
+				MATHFUN_##ISA##_STORE_MASKED(c + i, mask + i, \
+					OP(MATHFUN_SIMD_ARG_##X(ISA), MATHFUN_SIMD_ARG_##Y(ISA))); \
+			} \
+		} \
+		else { \
+			for (; i + MATHFUN_##ISA##_WIDTH <= count; i += MATHFUN_##ISA##_WIDTH) { \
+				MATHFUN_##ISA##_STORE(c + i, \
+					OP(MATHFUN_SIMD_ARG_##X(ISA), MATHFUN_SIMD_ARG_##Y(ISA))); \
+			} \
+		} \
+		MATHFUN_##ISA##_ZEROUPPER(); \
+		MATHFUN_##ISA##_GENERIC(NAME)(a + i, k, c + i, mask ? mask + i : NULL, count - i); \
+	}
+
+#define MATHFUN_SIMD_KERNELS(ISA, NAME) \
+	MATHFUN_SIMD_BINARY(ISA, add, MATHFUN_##ISA##_ADD) \
+	MATHFUN_SIMD_BINARY(ISA, sub, MATHFUN_##ISA##_SUB) \
+	MATHFUN_SIMD_BINARY(ISA, mul, MATHFUN_##ISA##_MUL) \
+	MATHFUN_SIMD_BINARY(ISA, div, MATHFUN_##ISA##_DIV) \
+	MATHFUN_SIMD_BINARY(ISA, eq,  MATHFUN_##ISA##_EQ) \
+	MATHFUN_SIMD_BINARY(ISA, ne,  MATHFUN_##ISA##_NE) \
+	MATHFUN_SIMD_BINARY(ISA, lt,  MATHFUN_##ISA##_LT) \
+	MATHFUN_SIMD_BINARY(ISA, gt,  MATHFUN_##ISA##_GT) \
+	MATHFUN_SIMD_BINARY(ISA, le,  MATHFUN_##ISA##_LE) \
+	MATHFUN_SIMD_BINARY(ISA, ge,  MATHFUN_##ISA##_GE) \
+	MATHFUN_SIMD_BINARY(ISA, beq, MATHFUN_##ISA##_BEQ) \
+	MATHFUN_SIMD_BINARY(ISA, bne, MATHFUN_##ISA##_BNE) \
+	MATHFUN_SIMD_UNARY(ISA,  neg, MATHFUN_##ISA##_NEG) \
+	MATHFUN_SIMD_UNARY(ISA,  not, MATHFUN_##ISA##_NOT) \
+	MATHFUN_SIMD_CONST(ISA, addk,  MATHFUN_##ISA##_ADD, A, K) \
+	MATHFUN_SIMD_CONST(ISA, subk,  MATHFUN_##ISA##_SUB, A, K) \
+	MATHFUN_SIMD_CONST(ISA, rsubk, MATHFUN_##ISA##_SUB, K, A) \
+	MATHFUN_SIMD_CONST(ISA, mulk,  MATHFUN_##ISA##_MUL, A, K) \
+	MATHFUN_SIMD_CONST(ISA, divk,  MATHFUN_##ISA##_DIV, A, K) \
+	MATHFUN_SIMD_CONST(ISA, rdivk, MATHFUN_##ISA##_DIV, K, A) \
+	MATHFUN_SIMD_CONST(ISA, eqk,   MATHFUN_##ISA##_EQ,  A, K) \
+	MATHFUN_SIMD_CONST(ISA, nek,   MATHFUN_##ISA##_NE,  A, K) \
+	MATHFUN_SIMD_CONST(ISA, ltk,   MATHFUN_##ISA##_LT,  A, K) \
+	MATHFUN_SIMD_CONST(ISA, gtk,   MATHFUN_##ISA##_GT,  A, K) \
+	MATHFUN_SIMD_CONST(ISA, lek,   MATHFUN_##ISA##_LE,  A, K) \
+	MATHFUN_SIMD_CONST(ISA, gek,   MATHFUN_##ISA##_GE,  A, K) \
+	\
+	static const MATHFUN_##ISA##_KERNELS mathfun_batch_##ISA = { \
+		NAME, \
+		mathfun_##ISA##_add, mathfun_##ISA##_sub, mathfun_##ISA##_mul, mathfun_##ISA##_div, \
+		mathfun_##ISA##_eq,  mathfun_##ISA##_ne,  mathfun_##ISA##_lt,  mathfun_##ISA##_gt, \
+		mathfun_##ISA##_le,  mathfun_##ISA##_ge, \
+		mathfun_##ISA##_beq, mathfun_##ISA##_bne, \
+		mathfun_##ISA##_neg, mathfun_##ISA##_not, \
+		mathfun_##ISA##_addk, mathfun_##ISA##_subk, mathfun_##ISA##_rsubk, \
+		mathfun_##ISA##_mulk, mathfun_##ISA##_divk, mathfun_##ISA##_rdivk, \
+		mathfun_##ISA##_eqk,  mathfun_##ISA##_nek,  mathfun_##ISA##_ltk, \
+		mathfun_##ISA##_gtk,  mathfun_##ISA##_lek,  mathfun_##ISA##_gek \
+	};
+
+#if MATHFUN_SIMD_FORCE >= MATHFUN_SIMD_SSE2
+// ---- SSE2 ----
+#define MATHFUN_TARGET_sse2 __attribute__((target("sse2")))
+#define MATHFUN_sse2_VALUE   mathfun_value
+#define MATHFUN_sse2_MASK    uint64_t
+#define MATHFUN_sse2_KERNELS mathfun_batch_kernels
+#define MATHFUN_sse2_GENERIC(NAME) mathfun_generic_##NAME
+#define MATHFUN_sse2_WIDTH 2
+#define MATHFUN_sse2_LOAD(P)     _mm_loadu_pd((const double*)(P))
+#define MATHFUN_sse2_STORE(P, V) _mm_storeu_pd((double*)(P), (V))
+#define MATHFUN_sse2_SET1(X)     _mm_set1_pd(X)
+#define MATHFUN_sse2_ZEROUPPER() (void)0
+#define MATHFUN_sse2_STORE_MASKED(P, M, V) \
+	{ \
+		const __m128d mask_ = _mm_loadu_pd((const double*)(M)); \
+		MATHFUN_sse2_STORE(P, _mm_or_pd(_mm_and_pd(mask_, (V)), _mm_andnot_pd(mask_, MATHFUN_sse2_LOAD(P)))); \
+	}
+#define MATHFUN_sse2_WORD(W) _mm_castsi128_pd(_mm_set1_epi64x((long long)(W)))
+#define MATHFUN_sse2_BOOL(A) _mm_and_pd((A), MATHFUN_sse2_WORD(MATHFUN_BOOL_BYTE))
+#define MATHFUN_sse2_TRUE(A) _mm_and_pd((A), MATHFUN_sse2_WORD(MATHFUN_TRUE_WORD))
+
+#define MATHFUN_sse2_ADD(A, B) _mm_add_pd(A, B)
+#define MATHFUN_sse2_SUB(A, B) _mm_sub_pd(A, B)
+#define MATHFUN_sse2_MUL(A, B) _mm_mul_pd(A, B)
+#define MATHFUN_sse2_DIV(A, B) _mm_div_pd(A, B)
+#define MATHFUN_sse2_EQ(A, B)  MATHFUN_sse2_TRUE(_mm_cmpeq_pd(A, B))
+#define MATHFUN_sse2_NE(A, B)  MATHFUN_sse2_TRUE(_mm_cmpneq_pd(A, B))
+#define MATHFUN_sse2_LT(A, B)  MATHFUN_sse2_TRUE(_mm_cmplt_pd(A, B))
+#define MATHFUN_sse2_GT(A, B)  MATHFUN_sse2_TRUE(_mm_cmpgt_pd(A, B))
+#define MATHFUN_sse2_LE(A, B)  MATHFUN_sse2_TRUE(_mm_cmple_pd(A, B))
+#define MATHFUN_sse2_GE(A, B)  MATHFUN_sse2_TRUE(_mm_cmpge_pd(A, B))
+#define MATHFUN_sse2_BNE(A, B) MATHFUN_sse2_BOOL(_mm_xor_pd(A, B))
+#define MATHFUN_sse2_BEQ(A, B) _mm_xor_pd(MATHFUN_sse2_BNE(A, B), MATHFUN_sse2_WORD(MATHFUN_TRUE_WORD))
+#define MATHFUN_sse2_NEG(A)    _mm_xor_pd(A, _mm_set1_pd(-0.0))
+#define MATHFUN_sse2_NOT(A)    _mm_xor_pd(MATHFUN_sse2_BOOL(A), MATHFUN_sse2_WORD(MATHFUN_TRUE_WORD))
+
+MATHFUN_SIMD_KERNELS(sse2, "sse2")
+
+// ---- SSE2, single precision ----
+#define MATHFUN_TARGET_sse2_float __attribute__((target("sse2")))
+#define MATHFUN_sse2_float_VALUE   mathfun_value_float
+#define MATHFUN_sse2_float_MASK    uint32_t
+#define MATHFUN_sse2_float_KERNELS mathfun_batch_float_kernels
+#define MATHFUN_sse2_float_GENERIC(NAME) mathfun_float_generic_##NAME
+#define MATHFUN_sse2_float_WIDTH 4
+#define MATHFUN_sse2_float_LOAD(P)     _mm_loadu_ps((const float*)(P))
+#define MATHFUN_sse2_float_STORE(P, V) _mm_storeu_ps((float*)(P), (V))
+#define MATHFUN_sse2_float_SET1(X)     _mm_set1_ps(X)
+#define MATHFUN_sse2_float_ZEROUPPER() (void)0
+#define MATHFUN_sse2_float_STORE_MASKED(P, M, V) \
+	{ \
+		const __m128 mask_ = _mm_loadu_ps((const float*)(M)); \
+		MATHFUN_sse2_float_STORE(P, _mm_or_ps(_mm_and_ps(mask_, (V)), \
+			_mm_andnot_ps(mask_, MATHFUN_sse2_float_LOAD(P)))); \
+	}
+#define MATHFUN_sse2_float_WORD(W) _mm_castsi128_ps(_mm_set1_epi32((int)(W)))
+#define MATHFUN_sse2_float_BOOL(A) _mm_and_ps((A), MATHFUN_sse2_float_WORD(MATHFUN_FLOAT_BOOL_BYTE))
+#define MATHFUN_sse2_float_TRUE(A) _mm_and_ps((A), MATHFUN_sse2_float_WORD(MATHFUN_FLOAT_TRUE_WORD))
+
+#define MATHFUN_sse2_float_ADD(A, B) _mm_add_ps(A, B)
+#define MATHFUN_sse2_float_SUB(A, B) _mm_sub_ps(A, B)
+#define MATHFUN_sse2_float_MUL(A, B) _mm_mul_ps(A, B)
+#define MATHFUN_sse2_float_DIV(A, B) _mm_div_ps(A, B)
+#define MATHFUN_sse2_float_EQ(A, B)  MATHFUN_sse2_float_TRUE(_mm_cmpeq_ps(A, B))
+#define MATHFUN_sse2_float_NE(A, B)  MATHFUN_sse2_float_TRUE(_mm_cmpneq_ps(A, B))
+#define MATHFUN_sse2_float_LT(A, B)  MATHFUN_sse2_float_TRUE(_mm_cmplt_ps(A, B))
+#define MATHFUN_sse2_float_GT(A, B)  MATHFUN_sse2_float_TRUE(_mm_cmpgt_ps(A, B))
+#define MATHFUN_sse2_float_LE(A, B)  MATHFUN_sse2_float_TRUE(_mm_cmple_ps(A, B))
+#define MATHFUN_sse2_float_GE(A, B)  MATHFUN_sse2_float_TRUE(_mm_cmpge_ps(A, B))
+#define MATHFUN_sse2_float_BNE(A, B) MATHFUN_sse2_float_BOOL(_mm_xor_ps(A, B))
+#define MATHFUN_sse2_float_BEQ(A, B) \
+	_mm_xor_ps(MATHFUN_sse2_float_BNE(A, B), MATHFUN_sse2_float_WORD(MATHFUN_FLOAT_TRUE_WORD))
+#define MATHFUN_sse2_float_NEG(A)    _mm_xor_ps(A, _mm_set1_ps(-0.0f))
+#define MATHFUN_sse2_float_NOT(A) \
+	_mm_xor_ps(MATHFUN_sse2_float_BOOL(A), MATHFUN_sse2_float_WORD(MATHFUN_FLOAT_TRUE_WORD))
+
+MATHFUN_SIMD_KERNELS(sse2_float, "sse2")
+#endif
+
+#if MATHFUN_SIMD_FORCE >= MATHFUN_SIMD_AVX2
+// ---- AVX2 ----
+#define MATHFUN_TARGET_avx2 __attribute__((target("avx2")))
+#define MATHFUN_avx2_VALUE   mathfun_value
+#define MATHFUN_avx2_MASK    uint64_t
+#define MATHFUN_avx2_KERNELS mathfun_batch_kernels
+#define MATHFUN_avx2_GENERIC(NAME) mathfun_generic_##NAME
+#define MATHFUN_avx2_WIDTH 4
+#define MATHFUN_avx2_LOAD(P)     _mm256_loadu_pd((const double*)(P))
+#define MATHFUN_avx2_STORE(P, V) _mm256_storeu_pd((double*)(P), (V))
+#define MATHFUN_avx2_SET1(X)     _mm256_set1_pd(X)
+#define MATHFUN_avx2_ZEROUPPER() _mm256_zeroupper()
+#define MATHFUN_avx2_STORE_MASKED(P, M, V) \
+	_mm256_maskstore_pd((double*)(P), _mm256_loadu_si256((const __m256i*)(M)), (V))
+#define MATHFUN_avx2_WORD(W) _mm256_castsi256_pd(_mm256_set1_epi64x((long long)(W)))
+#define MATHFUN_avx2_BOOL(A) _mm256_and_pd((A), MATHFUN_avx2_WORD(MATHFUN_BOOL_BYTE))
+#define MATHFUN_avx2_TRUE(A) _mm256_and_pd((A), MATHFUN_avx2_WORD(MATHFUN_TRUE_WORD))
+
+#define MATHFUN_avx2_ADD(A, B) _mm256_add_pd(A, B)
+#define MATHFUN_avx2_SUB(A, B) _mm256_sub_pd(A, B)
+#define MATHFUN_avx2_MUL(A, B) _mm256_mul_pd(A, B)
+#define MATHFUN_avx2_DIV(A, B) _mm256_div_pd(A, B)
+#define MATHFUN_avx2_EQ(A, B)  MATHFUN_avx2_TRUE(_mm256_cmp_pd(A, B, _CMP_EQ_OQ))
+#define MATHFUN_avx2_NE(A, B)  MATHFUN_avx2_TRUE(_mm256_cmp_pd(A, B, _CMP_NEQ_UQ))
+#define MATHFUN_avx2_LT(A, B)  MATHFUN_avx2_TRUE(_mm256_cmp_pd(A, B, _CMP_LT_OS))
+#define MATHFUN_avx2_GT(A, B)  MATHFUN_avx2_TRUE(_mm256_cmp_pd(A, B, _CMP_GT_OS))
+#define MATHFUN_avx2_LE(A, B)  MATHFUN_avx2_TRUE(_mm256_cmp_pd(A, B, _CMP_LE_OS))
+#define MATHFUN_avx2_GE(A, B)  MATHFUN_avx2_TRUE(_mm256_cmp_pd(A, B, _CMP_GE_OS))
+#define MATHFUN_avx2_BNE(A, B) MATHFUN_avx2_BOOL(_mm256_xor_pd(A, B))
+#define MATHFUN_avx2_BEQ(A, B) _mm256_xor_pd(MATHFUN_avx2_BNE(A, B), MATHFUN_avx2_WORD(MATHFUN_TRUE_WORD))
+#define MATHFUN_avx2_NEG(A)    _mm256_xor_pd(A, _mm256_set1_pd(-0.0))
+#define MATHFUN_avx2_NOT(A)    _mm256_xor_pd(MATHFUN_avx2_BOOL(A), MATHFUN_avx2_WORD(MATHFUN_TRUE_WORD))
+
+MATHFUN_SIMD_KERNELS(avx2, "avx2")
+
+// ---- AVX2, single precision ----
+#define MATHFUN_TARGET_avx2_float __attribute__((target("avx2")))
+#define MATHFUN_avx2_float_VALUE   mathfun_value_float
+#define MATHFUN_avx2_float_MASK    uint32_t
+#define MATHFUN_avx2_float_KERNELS mathfun_batch_float_kernels
+#define MATHFUN_avx2_float_GENERIC(NAME) mathfun_float_generic_##NAME
+#define MATHFUN_avx2_float_WIDTH 8
+#define MATHFUN_avx2_float_LOAD(P)     _mm256_loadu_ps((const float*)(P))
+#define MATHFUN_avx2_float_STORE(P, V) _mm256_storeu_ps((float*)(P), (V))
+#define MATHFUN_avx2_float_SET1(X)     _mm256_set1_ps(X)
+#define MATHFUN_avx2_float_ZEROUPPER() _mm256_zeroupper()
+#define MATHFUN_avx2_float_STORE_MASKED(P, M, V) \
+	_mm256_maskstore_ps((float*)(P), _mm256_loadu_si256((const __m256i*)(M)), (V))
+#define MATHFUN_avx2_float_WORD(W) _mm256_castsi256_ps(_mm256_set1_epi32((int)(W)))
+#define MATHFUN_avx2_float_BOOL(A) _mm256_and_ps((A), MATHFUN_avx2_float_WORD(MATHFUN_FLOAT_BOOL_BYTE))
+#define MATHFUN_avx2_float_TRUE(A) _mm256_and_ps((A), MATHFUN_avx2_float_WORD(MATHFUN_FLOAT_TRUE_WORD))
+
+#define MATHFUN_avx2_float_ADD(A, B) _mm256_add_ps(A, B)
+#define MATHFUN_avx2_float_SUB(A, B) _mm256_sub_ps(A, B)
+#define MATHFUN_avx2_float_MUL(A, B) _mm256_mul_ps(A, B)
+#define MATHFUN_avx2_float_DIV(A, B) _mm256_div_ps(A, B)
+#define MATHFUN_avx2_float_EQ(A, B)  MATHFUN_avx2_float_TRUE(_mm256_cmp_ps(A, B, _CMP_EQ_OQ))
+#define MATHFUN_avx2_float_NE(A, B)  MATHFUN_avx2_float_TRUE(_mm256_cmp_ps(A, B, _CMP_NEQ_UQ))
+#define MATHFUN_avx2_float_LT(A, B)  MATHFUN_avx2_float_TRUE(_mm256_cmp_ps(A, B, _CMP_LT_OS))
+#define MATHFUN_avx2_float_GT(A, B)  MATHFUN_avx2_float_TRUE(_mm256_cmp_ps(A, B, _CMP_GT_OS))
+#define MATHFUN_avx2_float_LE(A, B)  MATHFUN_avx2_float_TRUE(_mm256_cmp_ps(A, B, _CMP_LE_OS))
+#define MATHFUN_avx2_float_GE(A, B)  MATHFUN_avx2_float_TRUE(_mm256_cmp_ps(A, B, _CMP_GE_OS))
+#define MATHFUN_avx2_float_BNE(A, B) MATHFUN_avx2_float_BOOL(_mm256_xor_ps(A, B))
+#define MATHFUN_avx2_float_BEQ(A, B) \
+	_mm256_xor_ps(MATHFUN_avx2_float_BNE(A, B), MATHFUN_avx2_float_WORD(MATHFUN_FLOAT_TRUE_WORD))
+#define MATHFUN_avx2_float_NEG(A)    _mm256_xor_ps(A, _mm256_set1_ps(-0.0f))
+#define MATHFUN_avx2_float_NOT(A) \
+	_mm256_xor_ps(MATHFUN_avx2_float_BOOL(A), MATHFUN_avx2_float_WORD(MATHFUN_FLOAT_TRUE_WORD))
+
+MATHFUN_SIMD_KERNELS(avx2_float, "avx2")
+#endif
+
+#if MATHFUN_SIMD_FORCE >= MATHFUN_SIMD_AVX512
+// ---- AVX-512F ----
+// AVX-512F has no floating point and/xor (that's AVX-512DQ), so bit operations
+// are done on integer vectors. Comparisons yield mask registers which select
+// between 0 and the canonical true word.
+#define MATHFUN_TARGET_avx512 __attribute__((target("avx512f")))
+#define MATHFUN_avx512_VALUE   mathfun_value
+#define MATHFUN_avx512_MASK    uint64_t
+#define MATHFUN_avx512_KERNELS mathfun_batch_kernels
+#define MATHFUN_avx512_GENERIC(NAME) mathfun_generic_##NAME
+#define MATHFUN_avx512_WIDTH 8
+#define MATHFUN_avx512_LOAD(P)     _mm512_loadu_pd((const double*)(P))
+#define MATHFUN_avx512_STORE(P, V) _mm512_storeu_pd((double*)(P), (V))
+#define MATHFUN_avx512_SET1(X)     _mm512_set1_pd(X)
+#define MATHFUN_avx512_ZEROUPPER() _mm256_zeroupper()
+#define MATHFUN_avx512_STORE_MASKED(P, M, V) \
+	{ \
+		const __m512i mask_ = _mm512_loadu_si512((const void*)(M)); \
+		_mm512_mask_storeu_pd((double*)(P), _mm512_test_epi64_mask(mask_, mask_), (V)); \
+	}
+#define MATHFUN_avx512_WORD(W)    _mm512_set1_epi64((long long)(W))
+#define MATHFUN_avx512_BITS(OP, A, B) \
+	_mm512_castsi512_pd(OP(_mm512_castpd_si512(A), _mm512_castpd_si512(B)))
+#define MATHFUN_avx512_CMP(A, B, P) \
+	_mm512_castsi512_pd(_mm512_maskz_mov_epi64(_mm512_cmp_pd_mask(A, B, P), \
+		MATHFUN_avx512_WORD(MATHFUN_TRUE_WORD)))
+#define MATHFUN_avx512_BOOL(A) \
+	MATHFUN_avx512_BITS(_mm512_and_epi64, A, _mm512_castsi512_pd(MATHFUN_avx512_WORD(MATHFUN_BOOL_BYTE)))
+
+#define MATHFUN_avx512_ADD(A, B) _mm512_add_pd(A, B)
+#define MATHFUN_avx512_SUB(A, B) _mm512_sub_pd(A, B)
+#define MATHFUN_avx512_MUL(A, B) _mm512_mul_pd(A, B)
+#define MATHFUN_avx512_DIV(A, B) _mm512_div_pd(A, B)
+#define MATHFUN_avx512_EQ(A, B)  MATHFUN_avx512_CMP(A, B, _CMP_EQ_OQ)
+#define MATHFUN_avx512_NE(A, B)  MATHFUN_avx512_CMP(A, B, _CMP_NEQ_UQ)
+#define MATHFUN_avx512_LT(A, B)  MATHFUN_avx512_CMP(A, B, _CMP_LT_OS)
+#define MATHFUN_avx512_GT(A, B)  MATHFUN_avx512_CMP(A, B, _CMP_GT_OS)
+#define MATHFUN_avx512_LE(A, B)  MATHFUN_avx512_CMP(A, B, _CMP_LE_OS)
+#define MATHFUN_avx512_GE(A, B)  MATHFUN_avx512_CMP(A, B, _CMP_GE_OS)
+#define MATHFUN_avx512_BNE(A, B) MATHFUN_avx512_BOOL(MATHFUN_avx512_BITS(_mm512_xor_epi64, A, B))
+#define MATHFUN_avx512_BEQ(A, B) \
+	MATHFUN_avx512_BITS(_mm512_xor_epi64, MATHFUN_avx512_BNE(A, B), \
+		_mm512_castsi512_pd(MATHFUN_avx512_WORD(MATHFUN_TRUE_WORD)))
+#define MATHFUN_avx512_NEG(A) \
+	MATHFUN_avx512_BITS(_mm512_xor_epi64, A, _mm512_set1_pd(-0.0))
+#define MATHFUN_avx512_NOT(A) \
+	MATHFUN_avx512_BITS(_mm512_xor_epi64, MATHFUN_avx512_BOOL(A), \
+		_mm512_castsi512_pd(MATHFUN_avx512_WORD(MATHFUN_TRUE_WORD)))
+
+MATHFUN_SIMD_KERNELS(avx512, "avx512")
+
+// ---- AVX-512F, single precision ----
+#define MATHFUN_TARGET_avx512_float __attribute__((target("avx512f")))
+#define MATHFUN_avx512_float_VALUE   mathfun_value_float
+#define MATHFUN_avx512_float_MASK    uint32_t
+#define MATHFUN_avx512_float_KERNELS mathfun_batch_float_kernels
+#define MATHFUN_avx512_float_GENERIC(NAME) mathfun_float_generic_##NAME
+#define MATHFUN_avx512_float_WIDTH 16
+#define MATHFUN_avx512_float_LOAD(P)     _mm512_loadu_ps((const float*)(P))
+#define MATHFUN_avx512_float_STORE(P, V) _mm512_storeu_ps((float*)(P), (V))
+#define MATHFUN_avx512_float_SET1(X)     _mm512_set1_ps(X)
+#define MATHFUN_avx512_float_ZEROUPPER() _mm256_zeroupper()
+#define MATHFUN_avx512_float_STORE_MASKED(P, M, V) \
+	{ \
+		const __m512i mask_ = _mm512_loadu_si512((const void*)(M)); \
+		_mm512_mask_storeu_ps((float*)(P), _mm512_test_epi32_mask(mask_, mask_), (V)); \
+	}
+#define MATHFUN_avx512_float_WORD(W)    _mm512_set1_epi32((int)(W))
+#define MATHFUN_avx512_float_BITS(OP, A, B) \
+	_mm512_castsi512_ps(OP(_mm512_castps_si512(A), _mm512_castps_si512(B)))
+#define MATHFUN_avx512_float_CMP(A, B, P) \
+	_mm512_castsi512_ps(_mm512_maskz_mov_epi32(_mm512_cmp_ps_mask(A, B, P), \
+		MATHFUN_avx512_float_WORD(MATHFUN_FLOAT_TRUE_WORD)))
+#define MATHFUN_avx512_float_BOOL(A) \
+	MATHFUN_avx512_float_BITS(_mm512_and_epi32, A, \
+		_mm512_castsi512_ps(MATHFUN_avx512_float_WORD(MATHFUN_FLOAT_BOOL_BYTE)))
+
+#define MATHFUN_avx512_float_ADD(A, B) _mm512_add_ps(A, B)
+#define MATHFUN_avx512_float_SUB(A, B) _mm512_sub_ps(A, B)
+#define MATHFUN_avx512_float_MUL(A, B) _mm512_mul_ps(A, B)
+#define MATHFUN_avx512_float_DIV(A, B) _mm512_div_ps(A, B)
+#define MATHFUN_avx512_float_EQ(A, B)  MATHFUN_avx512_float_CMP(A, B, _CMP_EQ_OQ)
+#define MATHFUN_avx512_float_NE(A, B)  MATHFUN_avx512_float_CMP(A, B, _CMP_NEQ_UQ)
+#define MATHFUN_avx512_float_LT(A, B)  MATHFUN_avx512_float_CMP(A, B, _CMP_LT_OS)
+#define MATHFUN_avx512_float_GT(A, B)  MATHFUN_avx512_float_CMP(A, B, _CMP_GT_OS)
+#define MATHFUN_avx512_float_LE(A, B)  MATHFUN_avx512_float_CMP(A, B, _CMP_LE_OS)
+#define MATHFUN_avx512_float_GE(A, B)  MATHFUN_avx512_float_CMP(A, B, _CMP_GE_OS)
+#define MATHFUN_avx512_float_BNE(A, B) \
+	MATHFUN_avx512_float_BOOL(MATHFUN_avx512_float_BITS(_mm512_xor_epi32, A, B))
+#define MATHFUN_avx512_float_BEQ(A, B) \
+	MATHFUN_avx512_float_BITS(_mm512_xor_epi32, MATHFUN_avx512_float_BNE(A, B), \
+		_mm512_castsi512_ps(MATHFUN_avx512_float_WORD(MATHFUN_FLOAT_TRUE_WORD)))
+#define MATHFUN_avx512_float_NEG(A) \
+	MATHFUN_avx512_float_BITS(_mm512_xor_epi32, A, _mm512_set1_ps(-0.0f))
+#define MATHFUN_avx512_float_NOT(A) \
+	MATHFUN_avx512_float_BITS(_mm512_xor_epi32, MATHFUN_avx512_float_BOOL(A), \
+		_mm512_castsi512_ps(MATHFUN_avx512_float_WORD(MATHFUN_FLOAT_TRUE_WORD)))
+
+MATHFUN_SIMD_KERNELS(avx512_float, "avx512")
+#endif
+
+#endif
+
+#if defined(MATHFUN_X86_SIMD) && MATHFUN_SIMD_FORCE > MATHFUN_SIMD_GENERIC
+__attribute__((constructor))
+static void mathfun_batch_simd_init() {
+	__builtin_cpu_init();
+
+#if MATHFUN_SIMD_FORCE >= MATHFUN_SIMD_AVX512
+	if (__builtin_cpu_supports("avx512f")) {
+		mathfun_batch_simd = &mathfun_batch_avx512;
+		mathfun_batch_float_simd = &mathfun_batch_avx512_float;
+		return;
+	}
+#endif
+
+#if MATHFUN_SIMD_FORCE >= MATHFUN_SIMD_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		mathfun_batch_simd = &mathfun_batch_avx2;
+		mathfun_batch_float_simd = &mathfun_batch_avx2_float;
+		return;
+	}
+#endif
+
+#if MATHFUN_SIMD_FORCE >= MATHFUN_SIMD_SSE2
+	if (__builtin_cpu_supports("sse2")) {
+		mathfun_batch_simd = &mathfun_batch_sse2;
+		mathfun_batch_float_simd = &mathfun_batch_sse2_float;
+		return;
+	}
+#endif
+}
+#endif
+
+const char *mathfun_batch_isa() {
+	return mathfun_batch_simd->isa;
+}
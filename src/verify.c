@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "mathfun_intern.h"
+
+// Verification of byte code that wasn't produced by the code generator (e.g. loaded from
+// a file or shared memory). The interpreters don't check anything at runtime, so every
+// property they rely on is checked here once:
+//
+//   * every opcode is known and every instruction lies completely within the code
+//   * register operands are < framesize, pool indices are < the pool sizes
+//   * the arguments of CALL are within the frame
+//   * jumps only go forward and land on the start of an instruction (not on END)
+//   * the code ends with END and control can't fall through into it, i.e. the last
+//     instruction is RET or JMP
+//   * the entry is the start of an instruction, and the prologue before it doesn't
+//     return or jump past it (batch execution runs it on its own)
+
+static bool mathfun_verify_operands(const mathfun *fun, const mathfun_code *code, size_t ptr,
+	size_t codesize, size_t constc, size_t functc, bool targets[]) {
+	const mathfun_code *ins = code + ptr;
+	size_t offset = 1;
+
+	for (const char *kind = mathfun_bytecode_infos[*ins].operands; *kind; ++ kind) {
+		const mathfun_code operand = ins[offset];
+
+		switch (*kind) {
+			case 'r':
+				if (operand >= fun->framesize) return false;
+				break;
+
+			case 'v':
+				if (operand >= constc) return false;
+				break;
+
+			case 'f':
+				if (operand >= functc || !fun->functs[operand]) return false;
+				break;
+
+			case 'n':
+				// argument count of CALL, boolean flag otherwise
+				if (*ins != CALL && operand > 1) return false;
+				break;
+
+			case 'a':
+			{
+				const size_t adr = mathfun_code_adr(ins + offset);
+				if (adr <= ptr || adr >= codesize - 1 || (ptr < fun->entry && adr > fun->entry)) return false;
+				targets[adr] = true;
+				break;
+			}
+		}
+
+		offset += *kind == 'a' ? MATHFUN_ADR_CODES : 1;
+	}
+
+	if (*ins == CALL && (size_t)ins[3] + ins[2] > fun->framesize) {
+		return false;
+	}
+
+	return true;
+}
+
+// Returns the address of the first invalid instruction or codesize if the code is valid.
+static size_t mathfun_verify_code(const mathfun *fun, size_t codesize, size_t constc, size_t functc,
+	bool starts[], bool targets[]) {
+	const mathfun_code *code = fun->code;
+	size_t ptr  = 0;
+	size_t last = 0;
+
+	if (code[codesize - 1] != END) return codesize - 1;
+
+	while (ptr < codesize - 1) {
+		if (code[ptr] == END || code[ptr] >= MATHFUN_BYTECODE_COUNT ||
+			ptr + mathfun_code_size(code + ptr) > codesize - 1 ||
+			!mathfun_verify_operands(fun, code, ptr, codesize, constc, functc, targets)) {
+			return ptr;
+		}
+
+		if (ptr < fun->entry && code[ptr] == RET) return ptr;
+
+		starts[ptr] = true;
+		last = ptr;
+		ptr += mathfun_code_size(code + ptr);
+	}
+
+	// control must not fall through into END
+	if (ptr == 0 || (code[last] != RET && code[last] != JMP)) return last;
+
+	if (fun->entry > 0 && !starts[fun->entry]) return fun->entry;
+
+	for (size_t adr = 0; adr < codesize; ++ adr) {
+		if (targets[adr] && !starts[adr]) return adr;
+	}
+
+	return codesize;
+}
+
+bool mathfun_verify(const mathfun *fun, size_t codesize, size_t constc, size_t functc,
+	mathfun_error_p *error) {
+	if (!fun->code || codesize == 0 || codesize > MATHFUN_CODE_MAX || (constc > 0 && !fun->consts) ||
+		(functc > 0 && !fun->functs) || fun->retc == 0 || fun->framesize > MATHFUN_REGS_MAX ||
+		fun->argc + fun->retc + fun->hoisted > fun->framesize || fun->entry >= codesize) {
+		mathfun_raise_code_error(error, 0);
+		return false;
+	}
+
+	bool *starts  = calloc(codesize, sizeof(bool));
+	bool *targets = calloc(codesize, sizeof(bool));
+
+	if (!starts || !targets) {
+		free(starts);
+		free(targets);
+		mathfun_raise_error(error, MATHFUN_OUT_OF_MEMORY);
+		return false;
+	}
+
+	const size_t adr = mathfun_verify_code(fun, codesize, constc, functc, starts, targets);
+
+	free(starts);
+	free(targets);
+
+	if (adr != codesize) {
+		mathfun_raise_code_error(error, adr);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mathfun_intern.h"
+
+// Compares the byte code interpreter before and after instruction fusion:
+// instructions executed per evaluation, ns per evaluation, program size in bytes
+// (byte code plus constant and function pools) and frame size.
+//
+//     bench_exec [expression...]
+//
+// Expressions may use the arguments x, y and z.
+
+#define BENCH_ROWS 1024
+#define BENCH_REPEAT 2000
+
+static const char *bench_default_exprs[] = {
+	"x*y + z*x - (y - z)*(x + 0.5) / 3 + x*x*y",
+	"x > y ? x*y - z : (z < 0.5 ? x/z : y + z)",
+	"x > 0 && y > 0 ? sin(x) * y + 2 : x < -5 || y in -1...1 ? y : -x ** 2",
+	"x*x*0.25 + y*y*0.5 + z*z*0.75 - 2*x*y + 3*y*z - 4",
+	NULL
+};
+
+static double bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool bench_compile_unfused(const mathfun_context *ctx, const char *argnames[], size_t argc,
+	const char *code, mathfun *fun, mathfun_error_p *error) {
+	memset(fun, 0, sizeof(struct mathfun));
+	mathfun_expr *expr = mathfun_context_parse(ctx, argnames, argc, code, error);
+	if (!expr) return false;
+
+	mathfun_expr *opt = mathfun_expr_optimize(expr, error);
+	if (!opt) return false;
+
+	fun->argc = argc;
+	bool ok = mathfun_expr_codegen(opt, fun, error);
+	mathfun_expr_free(opt);
+
+	return ok;
+}
+
+static size_t bench_program_size(const mathfun *fun) {
+	const mathfun_code *code = fun->code;
+	size_t size = 0;
+	size_t consts = 0;
+	size_t functs = 0;
+	while (code[size] != END) {
+		const char *kind = mathfun_bytecode_infos[code[size]].operands;
+		for (size_t offset = 1; *kind; ++ kind, ++ offset) {
+			if (*kind == 'v' && code[size + offset] >= consts) consts = code[size + offset] + 1;
+			if (*kind == 'f' && code[size + offset] >= functs) functs = code[size + offset] + 1;
+			if (*kind == 'a') offset += MATHFUN_ADR_CODES - 1;
+		}
+		size += mathfun_code_size(code + size);
+	}
+	return (size + 1) * sizeof(mathfun_code) +
+		consts * sizeof(mathfun_value) + functs * sizeof(mathfun_binding_funct);
+}
+
+static void bench_run(const char *name, const mathfun *fun, double rows[][3]) {
+	mathfun_value *frame = calloc(fun->framesize, sizeof(mathfun_value));
+	size_t count = 0;
+	double sum = 0;
+
+	for (size_t i = 0; i < BENCH_ROWS; ++ i) {
+		for (size_t j = 0; j < 3; ++ j) frame[j].number = rows[i][j];
+		sum += mathfun_exec_count(fun, frame, &count);
+	}
+
+	const double start = bench_now();
+	for (size_t k = 0; k < BENCH_REPEAT; ++ k) {
+		for (size_t i = 0; i < BENCH_ROWS; ++ i) {
+			for (size_t j = 0; j < 3; ++ j) frame[j].number = rows[i][j];
+			sum += mathfun_exec(fun, frame);
+		}
+	}
+	const double elapsed = bench_now() - start;
+
+	printf("  %-8s %6.2f instr/eval  %6.2f ns/eval  %4"PRIzu" bytes  %2"PRIzu" regs  (checksum %g)\n", name,
+		(double)count / BENCH_ROWS, elapsed / (BENCH_ROWS * BENCH_REPEAT) * 1e9,
+		bench_program_size(fun), fun->framesize, sum);
+
+	free(frame);
+}
+
+int main(int argc, const char *argv[]) {
+	const char *argnames[] = { "x", "y", "z" };
+	const char **exprs = argc > 1 ? argv + 1 : bench_default_exprs;
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+	static double rows[BENCH_ROWS][3];
+
+	srand(0);
+	for (size_t i = 0; i < BENCH_ROWS; ++ i) {
+		for (size_t j = 0; j < 3; ++ j) {
+			rows[i][j] = 4.0 * rand() / RAND_MAX - 2.0;
+		}
+	}
+
+	if (!mathfun_context_init(&ctx, true, &error)) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return 1;
+	}
+
+	for (; *exprs; ++ exprs) {
+		mathfun unfused, fused;
+
+		if (!bench_compile_unfused(&ctx, argnames, 3, *exprs, &unfused, &error) ||
+			!mathfun_context_compile(&ctx, argnames, 3, *exprs, &fused, &error)) {
+			mathfun_error_log_and_cleanup(&error, stderr);
+			mathfun_context_cleanup(&ctx);
+			return 1;
+		}
+
+		printf("%s\n", *exprs);
+		bench_run("unfused", &unfused, rows);
+		bench_run("fused", &fused, rows);
+
+		mathfun_cleanup(&unfused);
+		mathfun_cleanup(&fused);
+	}
+
+	mathfun_context_cleanup(&ctx);
+
+	return 0;
+}
@@ -2,6 +2,10 @@
 #include <CUnit/TestRun.h>
 #include <mathfun.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <fenv.h>
 
 #define STRINGIFY(arg)  STRINGIFY1(arg)
 #define STRINGIFY1(arg) STRINGIFY2(arg)
@@ -70,6 +74,17 @@
 		CU_ASSERT(issame(cexpr, mathfun_acall(&fun, args, &error))); \
 		CU_ASSERT(error == NULL); \
 		if (error) mathfun_error_log_and_cleanup(&error, stderr); \
+		const double *columns[PP_NARG(__VA_ARGS__)]; \
+		for (size_t i = 0; i < PP_NARG(__VA_ARGS__); ++ i) columns[i] = args + i; \
+		double batch_value = 0; \
+		CU_ASSERT(mathfun_exec_batch(&fun, columns, 1, &batch_value, &error)); \
+		CU_ASSERT(issame(cexpr, batch_value)); \
+		CU_ASSERT(error == NULL); \
+		if (error) mathfun_error_log_and_cleanup(&error, stderr); \
+		CU_ASSERT(mathfun_jit(&fun, &error)); \
+		CU_ASSERT(issame(cexpr, mathfun_acall(&fun, args, &error))); \
+		CU_ASSERT(error == NULL); \
+		if (error) mathfun_error_log_and_cleanup(&error, stderr); \
 		mathfun_cleanup(&fun); \
 	}\
 }
@@ -80,6 +95,15 @@ static bool issame(double x, double y) {
 	return isnan(x) ? isnan(y) : x == y;
 }
 
+static size_t test_code_size(const mathfun *fun) {
+	mathfun_profile profile = MATHFUN_PROFILE_INIT;
+	mathfun_error_p error = NULL;
+	CU_ASSERT(mathfun_profile_init(&profile, fun, &error));
+	const size_t size = profile.size;
+	mathfun_profile_cleanup(&profile);
+	return size;
+}
+
 static bool test_compile_success(const char *argnames[], size_t argc, const char *code) {
 	mathfun fun;
 	mathfun_error_p error = NULL;
@@ -226,6 +250,53 @@ static void test_math_error_in_const_folding() {
 	ASSERT_COMPILE_ERROR_NOARGS(MATHFUN_MATH_ERROR, "5 % 0");
 }
 
+static void test_nan_in_const_folding() {
+	const char *argnames[] = { "x" };
+	const char *codes[] = { "max(nan, 1)", "min(1, nan)", "max(0/0, 1)", "max(nan, 1) + x" };
+	const char *runtime[] = { "max(x, 1)", "min(1, x)", "max(x, 1)", "max(x, 1) + 2" };
+	mathfun_error_p error = NULL;
+
+	// NaN arguments aren't a math error, just like when they're passed at runtime
+	for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++ i) {
+		mathfun folded, fun;
+		CU_ASSERT_FATAL(mathfun_compile(&folded, argnames, 1, codes[i], &error));
+		CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 1, runtime[i], &error));
+		const double expected = mathfun_call(&fun, &error, NAN);
+		CU_ASSERT(issame(mathfun_call(&folded, &error, 2.0), expected));
+		CU_ASSERT(error == NULL);
+		mathfun_cleanup(&fun);
+		mathfun_cleanup(&folded);
+	}
+
+	ASSERT_COMPILE_ERROR_NOARGS(MATHFUN_MATH_ERROR, "sqrt(-1)");
+}
+
+static void test_const_range_folding() {
+	const char *argnames[] = { "x", "y" };
+	mathfun_error_p error = NULL;
+	mathfun fun;
+
+	// constant values are compared against both limits of the range
+	CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 2, "3 in 2..8 ? x : y", &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 1.0, 2.0), 1.0);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 2, "8 in 2...8 || 9 in 2..8 ? x : y", &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 1.0, 2.0), 2.0);
+	mathfun_cleanup(&fun);
+
+	// only the upper limit is constant
+	CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 2, "3 in x..8 ? 1 : 0", &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 2.0, 0.0), 1.0);
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 4.0, 0.0), 0.0);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 2, "9 in x..8 ? 1 : 0", &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 2.0, 0.0), 0.0);
+	mathfun_cleanup(&fun);
+	CU_ASSERT(error == NULL);
+}
+
 static void test_mod() {
 	errno = 0;
 	CU_ASSERT(issame(mathfun_mod(5.0, 0.0), NAN));
@@ -277,6 +348,1529 @@ static void test_exec_all() {
 		x, y, z);
 }
 
+// one-shot runs: arena spilling into heap chunks, many arguments and error paths
+static void test_exec_run() {
+	const size_t terms = 500;
+	char *code = malloc(terms * 7 + 2);
+	CU_ASSERT_FATAL(code != NULL);
+
+	char *ptr = code;
+	for (size_t i = 0; i < terms; ++ i) {
+		ptr += sprintf(ptr, "sin(x)+");
+	}
+	strcpy(ptr, "0");
+
+	mathfun_error_p error = NULL;
+	const double x = 0.5;
+	double expected = sin(x);
+	for (size_t i = 1; i < terms; ++ i) {
+		expected += sin(x);
+	}
+	expected += 0;
+	CU_ASSERT(issame(mathfun_run(code, &error, "x", x, NULL), expected));
+	free(code);
+
+	CU_ASSERT(issame(mathfun_run("a+b+c+d+e+f+g+h+i+j", &error,
+		"a", 1.0, "b", 2.0, "c", 3.0, "d", 4.0, "e", 5.0,
+		"f", 6.0, "g", 7.0, "h", 8.0, "i", 9.0, "j", 10.0, NULL), 55.0));
+	CU_ASSERT(error == NULL);
+
+	CU_ASSERT(issame(mathfun_run("sin(x", &error, "x", x, NULL), NAN));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_PARSER_UNEXPECTED_END_OF_INPUT);
+	mathfun_error_cleanup(&error);
+
+	CU_ASSERT(issame(mathfun_run("x + log(x - 1)", &error, "x", x, NULL), NAN));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+
+	// the default context is built again after it was released
+	mathfun_thread_cleanup();
+	CU_ASSERT(issame(mathfun_run("hypot(x, 2 * x)", &error, "x", x, NULL), hypot(x, 2 * x)));
+	CU_ASSERT(error == NULL);
+}
+
+#define TEST_BATCH_ROWS 1000
+
+static void test_exec_batch() {
+	const char *argnames[] = { "x", "y" };
+	mathfun fun;
+	mathfun_error_p error = NULL;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2,
+		"x > 0 && y > 0 ? sin(x) * y + 2 : x < -5 || y in -1...1 ? y : -x ** 2", &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	double xs[TEST_BATCH_ROWS], ys[TEST_BATCH_ROWS], out[TEST_BATCH_ROWS];
+	for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+		xs[i] = i < 300 ? 1.0 : (double)(i % 17) - 8.0;
+		ys[i] = (double)(i % 7) - 3.0;
+	}
+
+	const double *columns[] = { xs, ys };
+	CU_ASSERT(mathfun_exec_batch(&fun, columns, TEST_BATCH_ROWS, out, &error));
+	CU_ASSERT(error == NULL);
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+		CU_ASSERT(issame(mathfun_call(&fun, &error, xs[i], ys[i]), out[i]));
+	}
+
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_batch_vector() {
+	const char *argnames[] = { "x", "y" };
+	mathfun fun;
+	mathfun_error_p error = NULL;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2,
+		"(x <= y) == (y != 0) ? x / y - -y : !((x >= 1) != (y < 2)) || x == y ? x * y : x - y", &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	double xs[TEST_BATCH_ROWS], ys[TEST_BATCH_ROWS], out[TEST_BATCH_ROWS];
+	for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+		xs[i] = i % 31 == 0 ? NAN : (double)(i % 5) - 2.0;
+		ys[i] = (double)(i % 3) - 1.0;
+	}
+
+	// odd row counts leave rows that don't fill a whole vector
+	const double *columns[] = { xs, ys };
+	CU_ASSERT(mathfun_exec_batch(&fun, columns, TEST_BATCH_ROWS - 3, out, &error));
+	CU_ASSERT(error == NULL);
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	for (size_t i = 0; i < TEST_BATCH_ROWS - 3; ++ i) {
+		CU_ASSERT(issame(mathfun_call(&fun, &error, xs[i], ys[i]), out[i]));
+	}
+
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_batch_math_error() {
+	const char *argnames[] = { "x", "y" };
+	mathfun fun;
+	mathfun_error_p error = NULL;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "x % y", &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	const double xs[] = { 1, 2, 3 };
+	const double ys[] = { 2, 0, 2 };
+	const double *columns[] = { xs, ys };
+	double out[3];
+	CU_ASSERT(!mathfun_exec_batch(&fun, columns, 3, out, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+	CU_ASSERT(issame(out[0], 1.0));
+	CU_ASSERT(issame(out[1], NAN));
+	CU_ASSERT(issame(out[2], 1.0));
+
+	mathfun_cleanup(&fun);
+}
+
+// superinstructions next to join points, compared against the tree interpreter
+static void test_exec_fused() {
+	const char *exprs[] = {
+		"(x > 0 ? y : x*y) + 1",
+		"x*y + (y < 1 ? 2 : x*x - y)",
+		"y > 0 ? x*y - 2 : x*x + y",
+		"x < y || y*x > 2 ? 3/x : 2 - y",
+		"(x < y) == (x*y - 1 >= 0) ? x : -y",
+		NULL
+	};
+	const char *argnames[] = { "x", "y" };
+	mathfun_error_p error = NULL;
+
+	for (const char **expr = exprs; *expr; ++ expr) {
+		mathfun fun;
+		CU_ASSERT(mathfun_compile(&fun, argnames, 2, *expr, &error));
+		if (error) {
+			mathfun_error_log_and_cleanup(&error, stderr);
+			continue;
+		}
+
+		for (double x = -2; x <= 2; x += 0.5) {
+			for (double y = -2; y <= 2; y += 0.5) {
+				const double expected = mathfun_run(*expr, &error, "x", x, "y", y, NULL);
+				CU_ASSERT(issame(expected, mathfun_call(&fun, &error, x, y)));
+			}
+		}
+
+		mathfun_cleanup(&fun);
+	}
+}
+
+// every immediate form, on all execution paths, compared against the tree interpreter
+static void test_exec_immediate() {
+	const char *exprs[] = {
+		"x + 0.5 - (2 - y) * (x * 3) / 4 + 1 / y",
+		"x == 1 || x != 2 && (y < 0.5 || 0.5 < x) ? y - 1.5 : -1",
+		"(x > -1 == (y >= 0) ? 2 <= y : x <= -0.5 || 1 >= x) ? x : y",
+		"(x in -1..1 ? y in -0.5...0.5 : x in 0...y) ? x : y",
+		NULL
+	};
+	const char *argnames[] = { "x", "y" };
+	mathfun_error_p error = NULL;
+
+	for (const char **expr = exprs; *expr; ++ expr) {
+		mathfun fun;
+		CU_ASSERT(mathfun_compile(&fun, argnames, 2, *expr, &error));
+		if (error) {
+			mathfun_error_log_and_cleanup(&error, stderr);
+			continue;
+		}
+
+		double xs[TEST_BATCH_ROWS], ys[TEST_BATCH_ROWS], out[TEST_BATCH_ROWS];
+		for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+			xs[i] = i % 29 == 0 ? NAN : (double)(i % 9) * 0.5 - 2.0;
+			ys[i] = (double)(i % 5) * 0.5 - 1.0;
+		}
+
+		const double *columns[] = { xs, ys };
+		CU_ASSERT(mathfun_exec_batch(&fun, columns, TEST_BATCH_ROWS, out, &error));
+		CU_ASSERT(error == NULL);
+		if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+		mathfun jit;
+		CU_ASSERT(mathfun_compile(&jit, argnames, 2, *expr, &error));
+		CU_ASSERT(mathfun_jit(&jit, &error));
+
+		for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+			const double expected = mathfun_run(*expr, &error, "x", xs[i], "y", ys[i], NULL);
+			CU_ASSERT(issame(expected, mathfun_call(&fun, &error, xs[i], ys[i])));
+			CU_ASSERT(issame(expected, mathfun_call(&jit, &error, xs[i], ys[i])));
+			CU_ASSERT(issame(expected, out[i]));
+		}
+
+		mathfun_cleanup(&jit);
+		mathfun_cleanup(&fun);
+	}
+
+	// constants don't need a register
+	mathfun fun;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "x*y + 0.5", &error));
+	CU_ASSERT_EQUAL(fun.framesize, 3);
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_short_batch() {
+	const char *argnames[] = { "x", "y" };
+	mathfun_error_p error = NULL;
+	mathfun fun, single;
+	const char *expr = "(x * 3 - 0.5) * y + 2 * x < 1 ? 4 - x : y - 0.25";
+	CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 2, expr, &error));
+	CU_ASSERT_FATAL(mathfun_compile_precision(&single, argnames, 2, expr, MATHFUN_PRECISION_FLOAT, &error));
+
+	double xs[40], ys[40], out[40];
+	float fxs[40], fys[40], fout[40];
+	for (size_t i = 0; i < 40; ++ i) {
+		fxs[i] = (float)(xs[i] = (double)(i % 7) * 0.25 - 1.0);
+		fys[i] = (float)(ys[i] = (double)(i % 3) + 0.5);
+	}
+
+	// every row count up to more than two of the widest vectors, so each
+	// kernel runs with every length of the tail the generic kernels compute
+	const double *columns[] = { xs, ys };
+	const float *fcolumns[] = { fxs, fys };
+	for (size_t count = 0; count <= 40; ++ count) {
+		CU_ASSERT(mathfun_exec_batch(&fun, columns, count, out, &error));
+		CU_ASSERT(mathfun_exec_batch_float(&single, fcolumns, count, fout, &error));
+		for (size_t i = 0; i < count; ++ i) {
+			CU_ASSERT(issame(out[i], mathfun_call(&fun, &error, xs[i], ys[i])));
+			CU_ASSERT(fout[i] == (float)mathfun_call(&single, &error, (double)fxs[i], (double)fys[i]));
+		}
+	}
+	CU_ASSERT(error == NULL);
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	mathfun_cleanup(&single);
+	mathfun_cleanup(&fun);
+}
+
+// (x*first.5 + y*0.25) + ... + (x*(first + count - 1).5 + y*0.25) as a balanced
+// tree, so neither the parser nor the code generator recurse deeply
+static char *test_balanced_sum(char *ptr, size_t first, size_t count) {
+	if (count == 1) {
+		return ptr + sprintf(ptr, "(x*%zu.5 + y*0.25)", first);
+	}
+	ptr += sprintf(ptr, "(");
+	ptr = test_balanced_sum(ptr, first, count / 2);
+	ptr += sprintf(ptr, " + ");
+	ptr = test_balanced_sum(ptr, first + count / 2, count - count / 2);
+	return ptr + sprintf(ptr, ")");
+}
+
+static double test_balanced_sum_value(double x, double y, size_t first, size_t count) {
+	if (count == 1) {
+		return x*(first + 0.5) + y*0.25;
+	}
+	return test_balanced_sum_value(x, y, first, count / 2) +
+	       test_balanced_sum_value(x, y, first + count / 2, count - count / 2);
+}
+
+static void test_exec_long_jump() {
+	// enough code that the jump over the then branch doesn't fit into 16 bit, every
+	// term has its own constant so they aren't common subexpressions
+	const size_t terms = 10000;
+	char *code = malloc(terms * 32 + 32);
+	CU_ASSERT_FATAL(code != NULL);
+
+	char *ptr = code + sprintf(code, "x > 0 ? ");
+	ptr = test_balanced_sum(ptr, 0, terms);
+	strcpy(ptr, " + 0.5 : y");
+
+	const char *argnames[] = { "x", "y" };
+	mathfun_error_p error = NULL;
+	mathfun fun, jit;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, code, &error));
+	CU_ASSERT(mathfun_compile(&jit, argnames, 2, code, &error));
+	CU_ASSERT(mathfun_jit(&jit, &error));
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+	CU_ASSERT(test_code_size(&fun) > UINT16_MAX);
+
+	// constants are deduplicated, in order of first use
+	CU_ASSERT_EQUAL(fun.consts[0].number, 0.0);
+	CU_ASSERT_EQUAL(fun.consts[1].number, 0.5);
+	CU_ASSERT_EQUAL(fun.consts[2].number, 0.25);
+	CU_ASSERT_EQUAL(fun.consts[3].number, 1.5);
+
+	for (double x = -1; x <= 1; x += 0.5) {
+		const double y = 3 - x;
+		const double expected = x > 0 ? test_balanced_sum_value(x, y, 0, terms) + 0.5 : y;
+		CU_ASSERT(issame(expected, mathfun_call(&fun, &error, x, y)));
+		CU_ASSERT(issame(expected, mathfun_call(&jit, &error, x, y)));
+	}
+
+	mathfun_cleanup(&jit);
+	mathfun_cleanup(&fun);
+	free(code);
+}
+
+// "(x+1)*((x+2)*(...))" needs more registers than fit into a stack frame
+static char *test_big_expr(const char *extra) {
+	const size_t depth = 80;
+	char *code = malloc(depth * 16 + strlen(extra) + 1);
+	if (!code) return NULL;
+
+	char *ptr = code;
+	for (size_t i = 1; i < depth; ++ i) {
+		ptr += sprintf(ptr, "(x+%u)*(", (unsigned int)i);
+	}
+	ptr += sprintf(ptr, "x");
+	for (size_t i = 1; i < depth; ++ i) {
+		*ptr ++ = ')';
+	}
+	strcpy(ptr, extra);
+	return code;
+}
+
+static mathfun test_big_fun;
+
+static mathfun_value test_call_big(const mathfun_value args[]) {
+	return (mathfun_value){ .number = mathfun_call1(&test_big_fun, args[0].number, NULL) };
+}
+
+static void test_call_frames() {
+	const char *argnames[] = { "x", "y", "z", "w" };
+	mathfun_error_p error = NULL;
+	const char *codes[] = { "x*3", "x - y*2", "x - y*2 + z*3", "x - y*2 + z*3 - w*4" };
+	mathfun funs[4];
+
+	for (size_t i = 0; i < 4; ++ i) {
+		CU_ASSERT(mathfun_compile(&funs[i], argnames, i + 1, codes[i], &error));
+	}
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	CU_ASSERT_EQUAL(mathfun_call1(&funs[0], 2, &error), 6);
+	CU_ASSERT_EQUAL(mathfun_call2(&funs[1], 2, 3, &error), -4);
+	CU_ASSERT_EQUAL(mathfun_call3(&funs[2], 2, 3, 4, &error), 8);
+	CU_ASSERT_EQUAL(mathfun_call4(&funs[3], 2, 3, 4, 5, &error), -12);
+	CU_ASSERT(error == NULL);
+
+	// wrong number of arguments
+	CU_ASSERT(isnan(mathfun_call2(&funs[0], 2, 3, &error)));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+
+	// one frame for several functions
+	mathfun_frame frame = MATHFUN_FRAME_INIT;
+	const double args[] = { 2, 3, 4, 5 };
+	CU_ASSERT(mathfun_frame_init(&frame, &funs[0], &error));
+	CU_ASSERT_EQUAL(mathfun_frame_call(&frame, &funs[0], args, &error), 6);
+	CU_ASSERT_EQUAL(mathfun_frame_call(&frame, &funs[3], args, &error), -12);
+	CU_ASSERT(frame.size >= funs[3].framesize);
+	CU_ASSERT(error == NULL);
+
+	// big frames, also when the cached frame is already in use by the calling function
+	char *big = test_big_expr("");
+	char *outer = test_big_expr(" + big(x)");
+	CU_ASSERT(big != NULL && outer != NULL);
+
+	mathfun_context ctx;
+	const mathfun_sig sig = {1, (mathfun_type[]){MATHFUN_NUMBER}, MATHFUN_NUMBER};
+	CU_ASSERT(mathfun_context_init(&ctx, false, &error));
+	CU_ASSERT(mathfun_context_define_funct(&ctx, "big", test_call_big, &sig, &error));
+
+	mathfun outer_fun;
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 1, big, &test_big_fun, &error));
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 1, outer, &outer_fun, &error));
+	CU_ASSERT(test_big_fun.framesize > 64);
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	for (double x = -1; x <= 1; x += 0.25) {
+		const double expected = mathfun_run(big, &error, "x", x, NULL);
+		CU_ASSERT(issame(expected, mathfun_call1(&test_big_fun, x, &error)));
+		CU_ASSERT(issame(expected, mathfun_acall(&test_big_fun, &x, &error)));
+		CU_ASSERT(issame(expected, mathfun_frame_call(&frame, &test_big_fun, &x, &error)));
+		CU_ASSERT(issame(expected + expected, mathfun_call1(&outer_fun, x, &error)));
+	}
+	CU_ASSERT(error == NULL);
+	mathfun_thread_cleanup();
+
+	mathfun_cleanup(&outer_fun);
+	mathfun_cleanup(&test_big_fun);
+	mathfun_context_cleanup(&ctx);
+	mathfun_frame_cleanup(&frame);
+	for (size_t i = 0; i < 4; ++ i) {
+		mathfun_cleanup(&funs[i]);
+	}
+	free(outer);
+	free(big);
+}
+
+static void test_exec_status() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = { "x % y", "x / y", "y != 0 ? x / y : 0", "x < y ? 1 : 2", "x == y ? 1 : 2", "x * 0.5" };
+	mathfun_error_p error = NULL;
+	double xs[64], ys[64], out[64];
+	const double *args[] = { xs, ys };
+	int status = -1;
+
+	for (size_t i = 0; i < 64; ++ i) {
+		xs[i] = i + 1;
+		ys[i] = i % 3 == 0 ? 0 : i;
+	}
+
+	mathfun funs[6];
+	for (size_t i = 0; i < 6; ++ i) {
+		CU_ASSERT(mathfun_compile(&funs[i], argnames, 2, codes[i], &error));
+	}
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	// the flags of the caller are preserved
+	feclearexcept(FE_ALL_EXCEPT);
+	feraiseexcept(FE_INEXACT);
+
+	CU_ASSERT(mathfun_exec_batch_status(&funs[0], args, 64, out, MATHFUN_EXEC_DEFAULT, &status, &error));
+	CU_ASSERT_EQUAL(status, MATHFUN_STATUS_INVALID);
+	CU_ASSERT(isnan(out[0]) && out[1] == 0);
+
+	CU_ASSERT(mathfun_exec_batch_status(&funs[1], args, 64, out, MATHFUN_EXEC_DEFAULT, &status, &error));
+	CU_ASSERT_EQUAL(status, MATHFUN_STATUS_DIVBYZERO);
+
+	// rows that don't take the branch don't raise exceptions
+	CU_ASSERT(mathfun_exec_batch_status(&funs[2], args, 64, out, MATHFUN_EXEC_DEFAULT, &status, &error));
+	CU_ASSERT_EQUAL(status, MATHFUN_STATUS_OK);
+	CU_ASSERT(out[0] == 0 && out[1] == 2);
+	CU_ASSERT(error == NULL);
+
+	CU_ASSERT(fetestexcept(FE_INEXACT) && !fetestexcept(FE_INVALID | FE_DIVBYZERO));
+
+	// only ordered comparisons raise invalid for NaN, also in native code
+	const double nans[] = { NAN, 1 };
+	for (size_t native = 0; native < 2; ++ native) {
+		if (native) {
+			CU_ASSERT(mathfun_jit(&funs[3], &error));
+			CU_ASSERT(mathfun_jit(&funs[4], &error));
+		}
+		CU_ASSERT_EQUAL(mathfun_acall_status(&funs[3], nans, MATHFUN_EXEC_DEFAULT, &status, &error), 2);
+		CU_ASSERT_EQUAL(status, MATHFUN_STATUS_INVALID);
+		CU_ASSERT_EQUAL(mathfun_acall_status(&funs[4], nans, MATHFUN_EXEC_DEFAULT, &status, &error), 2);
+		CU_ASSERT_EQUAL(status, MATHFUN_STATUS_OK);
+	}
+	CU_ASSERT(error == NULL);
+
+	// denormal results are flushed to zero only when asked for
+	const double tiny[] = { DBL_MIN, 0 };
+	CU_ASSERT_EQUAL(mathfun_acall_status(&funs[5], tiny, MATHFUN_EXEC_DEFAULT, &status, &error), DBL_MIN * 0.5);
+	CU_ASSERT_EQUAL(status, MATHFUN_STATUS_OK);
+#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__)
+	CU_ASSERT_EQUAL(mathfun_acall_status(&funs[5], tiny, MATHFUN_EXEC_FTZ, &status, &error), 0);
+	CU_ASSERT(status & MATHFUN_STATUS_UNDERFLOW);
+#endif
+	volatile double half = 0.5;
+	CU_ASSERT(DBL_MIN * half != 0);
+
+	for (size_t i = 0; i < 6; ++ i) {
+		mathfun_cleanup(&funs[i]);
+	}
+}
+
+static void test_exec_multi() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = { "sin(x * y) + cos(y)", "sin(x * y) * 2", "x > 0 ? log(x) : 0", "x > 1 ? log(x) : 1" };
+	mathfun_error_p error = NULL;
+	double xs[100], ys[100], outs[4][100];
+	const double *args[] = { xs, ys };
+	double *out[] = { outs[0], outs[1], outs[2], outs[3] };
+	mathfun fun;
+	mathfun funs[4];
+
+	for (size_t i = 0; i < 100; ++ i) {
+		xs[i] = i * 0.25 - 10;
+		ys[i] = i * 0.5;
+	}
+
+	CU_ASSERT(mathfun_compile_multi(&fun, argnames, 2, codes, 4, &error));
+	for (size_t i = 0; i < 4; ++ i) {
+		CU_ASSERT(mathfun_compile(&funs[i], argnames, 2, codes[i], &error));
+	}
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	CU_ASSERT_EQUAL(fun.retc, 4);
+	CU_ASSERT(fun.framesize >= 2 + 4);
+
+	// log(x) is only evaluated where the condition holds, so there is no math error
+	for (size_t native = 0; native < 2; ++ native) {
+		if (native) {
+			CU_ASSERT(mathfun_jit(&fun, &error));
+		}
+		CU_ASSERT(mathfun_exec_batch_multi(&fun, args, 100, out, &error));
+		CU_ASSERT(error == NULL);
+		for (size_t i = 0; i < 100; ++ i) {
+			const double row[] = { xs[i], ys[i] };
+			double res[4];
+			CU_ASSERT(mathfun_acall_multi(&fun, row, res, &error));
+			for (size_t j = 0; j < 4; ++ j) {
+				const double expected = mathfun_acall(&funs[j], row, &error);
+				CU_ASSERT_EQUAL(outs[j][i], expected);
+				CU_ASSERT_EQUAL(res[j], expected);
+			}
+		}
+		CU_ASSERT(error == NULL);
+	}
+
+	// the result of a multi-output function is its first expression
+	const double row[] = { 2, 3 };
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, row, &error), sin(2 * 3) + cos(3));
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT(!mathfun_compile_multi(&fun, argnames, 2, codes, 0, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+
+	for (size_t i = 0; i < 4; ++ i) {
+		mathfun_cleanup(&funs[i]);
+	}
+}
+
+static size_t test_count_calls = 0;
+
+static mathfun_value test_count(const mathfun_value args[]) {
+	++ test_count_calls;
+	return (mathfun_value){ .number = args[0].number + 1 };
+}
+
+static void test_exec_cse() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = {
+		"count(x) * count(x) + count(x)",
+		"count(x) * y + y * count(x)",
+		"x > y ? count(x) + 1 : 1 + count(x)",
+		"x > y ? count(x) : count(y)"
+	};
+	const size_t calls[] = { 1, 1, 1, 1 };
+	const mathfun_sig sig = { 1, (mathfun_type[]){ MATHFUN_NUMBER }, MATHFUN_NUMBER };
+	const double args[] = { 0.5, 1.5 };
+	const double x = args[0] + 1, y = args[1];
+	const double expected[] = { x * x + x, x * y + y * x, 1 + x, y + 1 };
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+
+	CU_ASSERT(mathfun_context_init(&ctx, true, &error));
+	CU_ASSERT(mathfun_context_define_funct(&ctx, "count", test_count, &sig, &error));
+
+	for (size_t i = 0; i < 4; ++ i) {
+		mathfun fun;
+		CU_ASSERT_FATAL(mathfun_context_compile(&ctx, argnames, 2, codes[i], &fun, &error));
+
+		test_count_calls = 0;
+		CU_ASSERT_EQUAL(mathfun_acall(&fun, args, &error), expected[i]);
+		CU_ASSERT_EQUAL(test_count_calls, calls[i]);
+		mathfun_cleanup(&fun);
+	}
+	CU_ASSERT(error == NULL);
+
+	// with the same branches the condition is only dropped if it can't raise a math error
+	mathfun fun, plain;
+	const double zero[] = { 1, 0 };
+	CU_ASSERT_FATAL(mathfun_context_compile(&ctx, argnames, 2, "x % y > 0 ? x : x", &fun, &error));
+	mathfun_acall(&fun, zero, &error);
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT_FATAL(mathfun_context_compile(&ctx, argnames, 2, "x > y || !(y in 0..x) ? x : x", &fun, &error));
+	CU_ASSERT_FATAL(mathfun_context_compile(&ctx, argnames, 2, "x", &plain, &error));
+	CU_ASSERT_EQUAL(test_code_size(&fun), test_code_size(&plain));
+	mathfun_cleanup(&plain);
+	mathfun_cleanup(&fun);
+
+	mathfun_context_cleanup(&ctx);
+}
+
+// compiled code (interpreted and native) against the unoptimized tree
+// interpreter, within ulps units in the last place (0 means the same bits)
+static void test_strength_reduced(const char *code, const double xs[], size_t n,
+	enum mathfun_opt_level level, double ulps) {
+	const char *argnames[] = { "x" };
+	const double *columns[] = { xs };
+	mathfun_error_p error = NULL;
+	mathfun fun;
+
+	CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 1, code, level, &error));
+
+	for (int native = 0; native < 2; ++ native) {
+		CU_ASSERT(!native || mathfun_jit(&fun, &error));
+
+		double out[16];
+		mathfun_exec_batch(&fun, columns, n, out, &error);
+		mathfun_error_cleanup(&error);
+
+		for (size_t i = 0; i < n; ++ i) {
+			// math errors have to be detected too, the results may differ then
+			const double expected = mathfun_arun(argnames, 1, code, xs + i, &error);
+			const bool math_error = error != NULL;
+			mathfun_error_cleanup(&error);
+			const double value = mathfun_acall(&fun, xs + i, &error);
+			CU_ASSERT_EQUAL(error != NULL, math_error);
+			mathfun_error_cleanup(&error);
+			if (math_error) continue;
+
+			if (ulps == 0.0 || !isfinite(expected)) {
+				CU_ASSERT(issame(value, expected) && (isnan(value) || signbit(value) == signbit(expected)));
+				CU_ASSERT(issame(out[i], expected));
+			}
+			else {
+				CU_ASSERT(fabs(value  - expected) <= ulps * DBL_EPSILON * fabs(expected));
+				CU_ASSERT(fabs(out[i] - expected) <= ulps * DBL_EPSILON * fabs(expected));
+			}
+		}
+	}
+
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_strength_reduction() {
+	const double xs[] = { 3.0, -2.5, 0.1, 0.0, -0.0, 1e300, 7e-310, INFINITY, -INFINITY, NAN };
+	const size_t n = sizeof(xs) / sizeof(xs[0]);
+
+	// exact: reciprocals of powers of two, powers still call pow()
+	test_strength_reduced("x / 8", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x / -0.25", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x / 3", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x / 0x1p-1070", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x ** 0.5", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x ** 2", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x ** -1", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("x ** 8", xs, n, MATHFUN_OPT_DEFAULT, 0);
+	test_strength_reduced("((exp(x) ** x) ** 8) % (pi ** 8)", xs, n, MATHFUN_OPT_DEFAULT, 0);
+
+	// with fast math sqrt(), 1 / x and multiplication chains round once per operation
+	test_strength_reduced("x ** 0.5", xs, n, MATHFUN_OPT_FAST_MATH, 2);
+	test_strength_reduced("x ** 2", xs, n, MATHFUN_OPT_FAST_MATH, 2);
+	test_strength_reduced("(x + 1) ** 2 + x", xs, n, MATHFUN_OPT_FAST_MATH, 4);
+	test_strength_reduced("x ** -1", xs, n, MATHFUN_OPT_FAST_MATH, 2);
+	test_strength_reduced("x ** 2.5", xs, n, MATHFUN_OPT_FAST_MATH, 0);
+	test_strength_reduced("x ** 3", xs, n, MATHFUN_OPT_FAST_MATH, 4);
+	test_strength_reduced("(x + 1) ** 5 - x", xs, n, MATHFUN_OPT_FAST_MATH, 8);
+	test_strength_reduced("x ** 6", xs, n, MATHFUN_OPT_FAST_MATH, 8);
+	test_strength_reduced("x ** 8", xs, n, MATHFUN_OPT_FAST_MATH, 8);
+}
+
+static void test_exec_fast_math() {
+	const char *argnames[] = { "x", "y", "z" };
+	mathfun_error_p error = NULL;
+	mathfun fun;
+
+	// constants of sums and products are gathered into one immediate operand
+	const char *codes[] = { "(x + 1) + 2", "2 * x * 3", "x / 4 * 2", "1 - (2 - x)", "-(x * -2) * 3" };
+	const double expected[] = { 1.5 + 3, 1.5 * 6, 1.5 * 0.5, 1.5 - 1, 1.5 * 6 };
+	const double args[] = { 1.5, -0.25, 3.0 };
+	for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++ i) {
+		CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 3, codes[i], MATHFUN_OPT_FAST_MATH, &error));
+		CU_ASSERT_EQUAL(test_code_size(&fun), 4 + 2 + 1); // xxxK, RET, END
+		CU_ASSERT_EQUAL(mathfun_acall(&fun, args, &error), expected[i]);
+		mathfun_cleanup(&fun);
+	}
+
+	// constant exponents are immediate operands, but only with fast math
+	CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 3, "x ** 3", MATHFUN_OPT_FAST_MATH, &error));
+	CU_ASSERT_EQUAL(test_code_size(&fun), 4 + 2 + 1); // POWK, RET, END
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, args, &error), 1.5 * 1.5 * 1.5);
+	mathfun_cleanup(&fun);
+	CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 3, "x ** 3", MATHFUN_OPT_DEFAULT, &error));
+	CU_ASSERT(test_code_size(&fun) > 4 + 2 + 1);
+	mathfun_cleanup(&fun);
+
+	// long sums are split into halves that are computed independently
+	CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 3, "x + y + z + x * y + y * z + z * x",
+		MATHFUN_OPT_FAST_MATH, &error));
+	CU_ASSERT_DOUBLE_EQUAL(mathfun_acall(&fun, args, &error), 1.5 - 0.25 + 3 - 1.5 * 0.25 - 0.25 * 3 + 3 * 1.5, 1e-12);
+	CU_ASSERT(error == NULL);
+	mathfun_cleanup(&fun);
+
+	// a * b + c is rounded once
+	const double fused[] = { 1 + 0x1p-30, 1 - 0x1p-30, -1 };
+	const double *columns[] = { fused, fused + 1, fused + 2 };
+	double out = 0;
+	CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 3, "x * y + z", MATHFUN_OPT_FAST_MATH, &error));
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, fused, &error), -0x1p-60);
+	CU_ASSERT(mathfun_exec_batch(&fun, columns, 1, &out, &error));
+	CU_ASSERT_EQUAL(out, -0x1p-60);
+
+	double deriv = 0;
+	const double dirs[] = { 1, 0, 1 };
+	mathfun_acall_dual(&fun, fused, dirs, &deriv, &error);
+	CU_ASSERT_EQUAL(deriv, fused[1] + 1);
+
+	CU_ASSERT(mathfun_jit(&fun, &error));
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, fused, &error), -0x1p-60);
+	CU_ASSERT(error == NULL);
+	mathfun_cleanup(&fun);
+
+	// the default level keeps both roundings
+	CU_ASSERT_FATAL(mathfun_compile_opt(&fun, argnames, 3, "x * y + z", MATHFUN_OPT_DEFAULT, &error));
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, fused, &error), 0);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT(!mathfun_compile_opt(&fun, argnames, 3, "x", (enum mathfun_opt_level)2, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+}
+
+static void test_exec_uniform() {
+	const char *argnames[] = { "channel", "r" };
+	const bool uniform[] = { true, false };
+	const char *code = "sin(channel * pi / 4) * sin(r * 440)";
+	enum { ROWS = 150 }; // the last block isn't full
+	double channel[ROWS], r[ROWS], out[ROWS], expected[ROWS];
+	const double *args[] = { channel, r };
+	mathfun_error_p error = NULL;
+	mathfun fun, plain;
+
+	for (size_t i = 0; i < ROWS; ++ i) {
+		channel[i] = 3;
+		r[i] = (double)i / 1000;
+	}
+
+	// sin(channel * pi / 4) is computed once by the prologue, its register survives all blocks
+	CU_ASSERT_FATAL(mathfun_compile_uniform(&fun, argnames, 2, code, uniform, &error));
+	CU_ASSERT_FATAL(mathfun_compile(&plain, argnames, 2, code, &error));
+	CU_ASSERT(fun.entry > 0);
+	CU_ASSERT_EQUAL(fun.hoisted, 1);
+
+	CU_ASSERT(mathfun_exec_batch(&fun, args, ROWS, out, &error));
+	CU_ASSERT(mathfun_exec_batch(&plain, args, ROWS, expected, &error));
+	CU_ASSERT(memcmp(out, expected, sizeof(out)) == 0);
+
+	const double row[] = { channel[ROWS - 1], r[ROWS - 1] };
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, row, &error), expected[ROWS - 1]);
+	CU_ASSERT(error == NULL);
+
+	mathfun_profile profile = MATHFUN_PROFILE_INIT;
+	CU_ASSERT(mathfun_profile_init(&profile, &fun, &error));
+	CU_ASSERT(mathfun_verify(&fun, profile.size, 3, 2, &error));
+	const size_t entry = fun.entry;
+	fun.entry = entry - 1;
+	CU_ASSERT(!mathfun_verify(&fun, profile.size, 3, 2, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+	mathfun_error_cleanup(&error);
+	fun.entry = entry;
+	mathfun_profile_cleanup(&profile);
+	mathfun_cleanup(&plain);
+	mathfun_cleanup(&fun);
+
+	// subexpressions that aren't always computed stay where they are
+	CU_ASSERT_FATAL(mathfun_compile_uniform(&fun, argnames, 2, "r > 0.1 ? sin(channel) : r", uniform, &error));
+	CU_ASSERT_EQUAL(fun.entry, 0);
+	mathfun_cleanup(&fun);
+
+	// if the uniform column isn't uniform after all, all rows use its first row
+	for (size_t i = 0; i < ROWS; ++ i) {
+		channel[i] = (double)i;
+	}
+	CU_ASSERT_FATAL(mathfun_compile_uniform(&fun, argnames, 2, "sin(channel) + r", uniform, &error));
+	CU_ASSERT(mathfun_exec_batch(&fun, args, ROWS, out, &error));
+	for (size_t i = 0; i < ROWS; ++ i) {
+		const double first[] = { channel[0], r[i] };
+		CU_ASSERT_EQUAL(out[i], mathfun_acall(&fun, first, &error));
+	}
+	CU_ASSERT(error == NULL);
+	mathfun_cleanup(&fun);
+
+	// math errors of the prologue are reported like those of the rows
+	for (size_t i = 0; i < ROWS; ++ i) {
+		channel[i] = -1;
+	}
+	CU_ASSERT_FATAL(mathfun_compile_uniform(&fun, argnames, 2, "log(channel) + r", uniform, &error));
+	CU_ASSERT(!mathfun_exec_batch(&fun, args, ROWS, out, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_specialize() {
+	const char *argnames[] = { "a", "x", "b" };
+	const char *code = "a > 0 ? sqrt(a) * x + b : x";
+	const size_t bound[] = { 0, 2 };
+	const double values[] = { 2, 3 };
+	mathfun_error_p error = NULL;
+	mathfun fun, plain;
+
+	// the condition and sqrt(a) are folded, x is the only argument left
+	CU_ASSERT_FATAL(mathfun_specialize(&fun, argnames, 3, code, bound, values, 2, &error));
+	CU_ASSERT_FATAL(mathfun_compile(&plain, argnames, 3, code, &error));
+	CU_ASSERT_EQUAL(fun.argc, 1);
+	CU_ASSERT_EQUAL(test_code_size(&fun), 4 + 4 + 2 + 1); // MULK, ADDK, RET, END
+	CU_ASSERT(test_code_size(&fun) < test_code_size(&plain));
+
+	for (int i = -4; i <= 4; ++ i) {
+		const double args[] = { 2, i * 0.75, 3 };
+		CU_ASSERT_EQUAL(mathfun_call(&fun, &error, args[1]), mathfun_acall(&plain, args, &error));
+	}
+	CU_ASSERT(error == NULL);
+	mathfun_cleanup(&plain);
+	mathfun_cleanup(&fun);
+
+	// the remaining arguments keep their order
+	const size_t middle[] = { 1 };
+	CU_ASSERT_FATAL(mathfun_specialize(&fun, argnames, 3, "a - x * b", middle, values, 1, &error));
+	CU_ASSERT_EQUAL(fun.argc, 2);
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 10.0, 4.0), 10.0 - 2 * 4.0);
+	mathfun_cleanup(&fun);
+
+	// bound values are folded at compile time
+	const double negative[] = { -1 };
+	CU_ASSERT(!mathfun_specialize(&fun, argnames, 3, "log(a) + x", bound, negative, 1, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+
+	// but not in branches that are never taken
+	CU_ASSERT_FATAL(mathfun_specialize(&fun, argnames, 3, code, bound, negative, 1, &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 5.0, 3.0), 5.0);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT_FATAL(mathfun_specialize(&fun, argnames, 3, "a > 0 ? log(a) : x", bound, negative, 1, &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 5.0, 3.0), 5.0);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT_FATAL(mathfun_specialize(&fun, argnames, 3, "a > 0 && log(a) < x || a < -2 && sqrt(a) > x ? 1 : b", bound, negative, 1, &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 5.0, 3.0), 3.0);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT_FATAL(mathfun_specialize(&fun, argnames, 3, "a < 0 || log(a) < x ? x : b", bound, negative, 1, &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 5.0, 3.0), 5.0);
+	mathfun_cleanup(&fun);
+	CU_ASSERT(error == NULL);
+
+	const size_t repeated[] = { 2, 2 };
+	CU_ASSERT(!mathfun_specialize(&fun, argnames, 3, code, repeated, values, 2, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+
+	const size_t unknown[] = { 3 };
+	CU_ASSERT(!mathfun_specialize(&fun, argnames, 3, code, unknown, values, 1, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+}
+
+static void test_exec_regalloc() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = { "sin(x) * 2 + sin(x)", "cos(y) * 3 + cos(y)" };
+	mathfun_error_p error = NULL;
+	mathfun fun;
+
+	// sin(x) is dead before cos(y) is computed, so they share a register
+	CU_ASSERT_FATAL(mathfun_compile_multi(&fun, argnames, 2, codes, 2, &error));
+	CU_ASSERT_EQUAL(fun.framesize, 2 + 2 + 2);
+
+	const double args[] = { 0.5, 1.5 };
+	double out[2];
+	CU_ASSERT(mathfun_acall_multi(&fun, args, out, &error));
+	CU_ASSERT_EQUAL(out[0], sin(0.5) * 2 + sin(0.5));
+	CU_ASSERT_EQUAL(out[1], cos(1.5) * 3 + cos(1.5));
+
+	mathfun_profile profile = MATHFUN_PROFILE_INIT;
+	CU_ASSERT(mathfun_profile_init(&profile, &fun, &error));
+	CU_ASSERT(mathfun_verify(&fun, profile.size, 2, 2, &error));
+	mathfun_profile_cleanup(&profile);
+	mathfun_cleanup(&fun);
+
+	// arguments of calls stay in consecutive registers
+	CU_ASSERT_FATAL(mathfun_compile(&fun, argnames, 2,
+		"fma(x + 1, hypot(y, atan2(x * y, 2)), min(x, y) + 3) - max(y - 1, x)", &error));
+	CU_ASSERT_EQUAL(mathfun_acall(&fun, args, &error),
+		fma(0.5 + 1, hypot(1.5, atan2(0.5 * 1.5, 2)), fmin(0.5, 1.5) + 3) - fmax(1.5 - 1, 0.5));
+	CU_ASSERT(error == NULL);
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_parallel() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = { "x > 0.5 ? sin(x * y) + exp(y * x) : x - y", "x * y" };
+	const size_t n = 100003;
+	mathfun_error_p error = NULL;
+	double *xs  = calloc(n, sizeof(double));
+	double *ys  = calloc(n, sizeof(double));
+	double *out = calloc(n, sizeof(double));
+	double *out2 = calloc(n, sizeof(double));
+	double *expected = calloc(n, sizeof(double));
+	const double *args[] = { xs, ys };
+	double *outs[] = { out, out2 };
+	mathfun fun, multi, err;
+
+	CU_ASSERT_FATAL(xs && ys && out && out2 && expected);
+
+	for (size_t i = 0; i < n; ++ i) {
+		xs[i] = (double)(i % 1000) / 1000;
+		ys[i] = (double)i / n;
+	}
+
+	mathfun_pool *pool = mathfun_pool_create(4, MATHFUN_POOL_PIN, &error);
+	CU_ASSERT_FATAL(pool != NULL);
+	CU_ASSERT_EQUAL(mathfun_pool_size(pool), 4);
+
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, codes[0], &error));
+	CU_ASSERT(mathfun_compile_multi(&multi, argnames, 2, codes, 2, &error));
+	CU_ASSERT(mathfun_compile(&err, argnames, 2, "log(y - 0.9)", &error));
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	CU_ASSERT(mathfun_exec_batch(&fun, args, n, expected, &error));
+	CU_ASSERT(mathfun_exec_parallel(pool, &fun, args, n, out, &error));
+	CU_ASSERT(memcmp(out, expected, n * sizeof(double)) == 0);
+
+	// small batches are evaluated on the calling thread
+	memset(out, 0, n * sizeof(double));
+	CU_ASSERT(mathfun_exec_parallel(pool, &fun, args, 100, out, &error));
+	CU_ASSERT(memcmp(out, expected, 100 * sizeof(double)) == 0);
+
+	memset(out, 0, n * sizeof(double));
+	CU_ASSERT(mathfun_exec_parallel_multi(pool, &multi, args, n, outs, &error));
+	CU_ASSERT(memcmp(out, expected, n * sizeof(double)) == 0);
+	CU_ASSERT(out2[n - 1] == xs[n - 1] * ys[n - 1]);
+	CU_ASSERT(error == NULL);
+
+	// math errors of any thread are reported
+	CU_ASSERT(!mathfun_exec_parallel(pool, &err, args, n, out, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+
+	mathfun_pool_destroy(pool);
+	mathfun_cleanup(&err);
+	mathfun_cleanup(&multi);
+	mathfun_cleanup(&fun);
+	free(expected);
+	free(out2);
+	free(out);
+	free(ys);
+	free(xs);
+}
+
+static mathfun_value test_square(const mathfun_value args[]) {
+	return (mathfun_value){ .number = args[0].number * args[0].number };
+}
+
+static void test_square_deriv(const mathfun_value args[], double grad[]) {
+	grad[0] = 2 * args[0].number;
+}
+
+static void test_exec_dual() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = {
+		"x * y + sin(x) / y - x**3",
+		"x < 0 ? -x : x * 2 + y % 4",
+		"hypot(x, y) + 2 / x - 3 / y + exp(x * 0.5) * max(x, y)",
+		"square(x + 1) * y"
+	};
+	const double points[][2] = { { -1.5, 2.5 }, { 0.75, 3 }, { 3, -7.25 } };
+	const mathfun_sig sig = { 1, (mathfun_type[]){ MATHFUN_NUMBER }, MATHFUN_NUMBER };
+	const double dirs[][2] = { { 1, 0 }, { 0, 1 } };
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+	mathfun funs[4];
+
+	CU_ASSERT(mathfun_context_init(&ctx, true, &error));
+	CU_ASSERT(mathfun_context_define_funct(&ctx, "square", test_square, &sig, &error));
+	for (size_t i = 0; i < 4; ++ i) {
+		CU_ASSERT(mathfun_context_compile(&ctx, argnames, 2, codes[i], &funs[i], &error));
+	}
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	// x * y + sin(x) / y - x**3
+	for (size_t p = 0; p < 3; ++ p) {
+		const double x = points[p][0], y = points[p][1];
+		double dx = 0, dy = 0;
+		CU_ASSERT_DOUBLE_EQUAL(mathfun_acall_dual(&funs[0], points[p], dirs[0], &dx, &error),
+			x * y + sin(x) / y - x*x*x, 1e-12);
+		mathfun_acall_dual(&funs[0], points[p], dirs[1], &dy, &error);
+		CU_ASSERT_DOUBLE_EQUAL(dx, y + cos(x) / y - 3*x*x, 1e-12);
+		CU_ASSERT_DOUBLE_EQUAL(dy, x - sin(x) / (y*y), 1e-12);
+	}
+
+	// the taken branch is differentiated
+	double deriv = 0;
+	mathfun_acall_dual(&funs[1], points[0], dirs[0], &deriv, &error);
+	CU_ASSERT_EQUAL(deriv, -1);
+	mathfun_acall_dual(&funs[1], points[1], dirs[0], &deriv, &error);
+	CU_ASSERT_EQUAL(deriv, 2);
+	mathfun_acall_dual(&funs[1], points[1], dirs[1], &deriv, &error);
+	CU_ASSERT_EQUAL(deriv, 1);
+
+	// compare with central differences in a diagonal direction
+	const double diag[] = { 0.6, 0.8 };
+	for (size_t p = 0; p < 3; ++ p) {
+		const double h = 1e-6;
+		const double plus[]  = { points[p][0] + h * diag[0], points[p][1] + h * diag[1] };
+		const double minus[] = { points[p][0] - h * diag[0], points[p][1] - h * diag[1] };
+		const double fd = (mathfun_acall(&funs[2], plus, &error) - mathfun_acall(&funs[2], minus, &error)) / (2 * h);
+		mathfun_acall_dual(&funs[2], points[p], diag, &deriv, &error);
+		CU_ASSERT_DOUBLE_EQUAL(deriv, fd, 1e-6 * (1 + fabs(fd)));
+	}
+	CU_ASSERT(error == NULL);
+
+	// functions without derivative rule give NaN, but only where they matter
+	mathfun_acall_dual(&funs[3], points[1], dirs[0], &deriv, &error);
+	CU_ASSERT(isnan(deriv));
+
+	CU_ASSERT(mathfun_context_define_deriv(&ctx, "square", test_square_deriv, &error));
+	CU_ASSERT(!mathfun_context_define_deriv(&ctx, "pi", test_square_deriv, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_NO_SUCH_NAME);
+	mathfun_error_cleanup(&error);
+
+	mathfun_cleanup(&funs[3]);
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 2, codes[3], &funs[3], &error));
+	mathfun_acall_dual(&funs[3], points[1], dirs[0], &deriv, &error);
+	CU_ASSERT_EQUAL(deriv, 2 * (0.75 + 1) * 3);
+	mathfun_acall_dual(&funs[3], points[1], dirs[1], &deriv, &error);
+	CU_ASSERT_EQUAL(deriv, (0.75 + 1) * (0.75 + 1));
+	CU_ASSERT(error == NULL);
+
+	for (size_t i = 0; i < 4; ++ i) {
+		mathfun_cleanup(&funs[i]);
+	}
+	mathfun_context_cleanup(&ctx);
+}
+
+static void test_exec_gradient() {
+	const char *argnames[] = { "x", "y", "z" };
+	const char *codes[] = {
+		"x * y * z + sin(x) / y - x**3 + z**y",
+		"x < 0 ? -x * z : x * 2 + y % 4 - 1 / z",
+		"hypot(x, y) + 2 / x - 3 / y + exp(x * 0.5) * max(x, y * z)",
+		"x in 0...1 ? atan2(y, x) : (y * z - 1) * (x + y) + z"
+	};
+	const double points[][3] = { { -1.5, 2.5, 0.5 }, { 0.75, 3, 1.25 }, { 3, -7.25, 2 } };
+	const double dirs[][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+	mathfun_error_p error = NULL;
+	mathfun fun;
+
+	// every partial derivative equals the one of forward mode
+	for (size_t i = 0; i < 4; ++ i) {
+		CU_ASSERT(mathfun_compile_gradient(&fun, argnames, 3, codes[i], &error));
+		CU_ASSERT(fun.tapesize > 0);
+		for (size_t p = 0; p < 3; ++ p) {
+			double grad[3] = { 0, 0, 0 };
+			const double value = mathfun_acall_gradient(&fun, points[p], grad, &error);
+			CU_ASSERT_EQUAL(value, mathfun_acall(&fun, points[p], &error));
+			for (size_t j = 0; j < 3; ++ j) {
+				double deriv = 0;
+				mathfun_acall_dual(&fun, points[p], dirs[j], &deriv, &error);
+				CU_ASSERT_DOUBLE_EQUAL(grad[j], deriv, 1e-12 * (1 + fabs(deriv)));
+			}
+		}
+		mathfun_cleanup(&fun);
+	}
+	CU_ASSERT(error == NULL);
+
+	// many arguments, each with another partial derivative
+	enum { N = 24 };
+	const char *names[N];
+	char namebuf[N][4];
+	double args[N], grad[N];
+	char code[N * 24] = "0";
+	for (size_t i = 0; i < N; ++ i) {
+		snprintf(namebuf[i], sizeof(namebuf[i]), "a%zu", i);
+		names[i] = namebuf[i];
+		args[i] = 0.25 * i - 2;
+		snprintf(code + strlen(code), sizeof(code) - strlen(code), " + %zu * a%zu * a%zu", i, i, i);
+	}
+	CU_ASSERT(mathfun_compile_gradient(&fun, names, N, code, &error));
+	mathfun_acall_gradient(&fun, args, grad, &error);
+	for (size_t i = 0; i < N; ++ i) {
+		CU_ASSERT_DOUBLE_EQUAL(grad[i], 2.0 * i * args[i], 1e-12);
+	}
+	CU_ASSERT(error == NULL);
+	mathfun_cleanup(&fun);
+
+	// other compile functions don't size the tape
+	CU_ASSERT(mathfun_compile(&fun, argnames, 3, codes[0], &error));
+	CU_ASSERT(isnan(mathfun_acall_gradient(&fun, points[0], grad, &error)));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+	mathfun_cleanup(&fun);
+}
+
+static void test_derive() {
+	const char *argnames[] = { "x", "y", "z" };
+	const char *codes[] = {
+		"x * y * z + sin(x) / y - x**3 + z**y",
+		"x < 0 ? -x * z : x * 2 + y % 4 - 1 / z",
+		"hypot(x, y) + 2 / x - 3 / y + exp(x * 0.5) * max(x, y * z)",
+		"x in 0...1 ? atan2(y, x) : log(y * y + 1) * sqrt(z) - tanh(x * z)"
+	};
+	const double points[][3] = { { -1.5, 2.5, 0.5 }, { 0.75, 3, 1.25 }, { 3, -7.25, 2 } };
+	const double dirs[][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+	const mathfun_sig sig = { 1, (mathfun_type[]){ MATHFUN_NUMBER }, MATHFUN_NUMBER };
+	const mathfun_partials partials = { (const char*[]){ "a" }, (const char*[]){ "2 * a" } };
+	const mathfun_partials bad_partials = { (const char*[]){ "a" }, (const char*[]){ "2 * b" } };
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+	mathfun fun, deriv;
+
+	CU_ASSERT(mathfun_context_init(&ctx, true, &error));
+
+	// symbolic derivatives agree with forward mode
+	for (size_t i = 0; i < 4; ++ i) {
+		CU_ASSERT(mathfun_context_compile(&ctx, argnames, 3, codes[i], &fun, &error));
+		for (size_t j = 0; j < 3; ++ j) {
+			CU_ASSERT(mathfun_context_derive(&ctx, argnames, 3, codes[i], argnames[j], &deriv, &error));
+			for (size_t p = 0; p < 3; ++ p) {
+				double expected = 0;
+				mathfun_acall_dual(&fun, points[p], dirs[j], &expected, &error);
+				CU_ASSERT_DOUBLE_EQUAL(mathfun_acall(&deriv, points[p], &error), expected,
+					1e-12 * (1 + fabs(expected)));
+			}
+			mathfun_cleanup(&deriv);
+		}
+		mathfun_cleanup(&fun);
+	}
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	// terms that don't depend on the argument vanish, even if they'd be NaN
+	CU_ASSERT(mathfun_derive(&deriv, argnames, 3, "3 * x + y * z + log(y)", "x", &error));
+	CU_ASSERT_EQUAL(mathfun_acall(&deriv, (const double[]){ 1, -1, NAN }, &error), 3);
+	mathfun_cleanup(&deriv);
+
+	// user functions need partial derivatives
+	CU_ASSERT(mathfun_context_define_funct(&ctx, "square", test_square, &sig, &error));
+	CU_ASSERT(mathfun_context_derive(&ctx, argnames, 3, "square(y) + x", "x", &deriv, &error));
+	mathfun_cleanup(&deriv);
+	CU_ASSERT(!mathfun_context_derive(&ctx, argnames, 3, "square(x + 1) * y", "x", &deriv, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_NO_DERIVATIVE);
+	mathfun_error_cleanup(&error);
+
+	CU_ASSERT(!mathfun_context_define_partials(&ctx, "square", &bad_partials, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_PARSER_UNDEFINED_REFERENCE);
+	mathfun_error_cleanup(&error);
+
+	CU_ASSERT(mathfun_context_define_partials(&ctx, "square", &partials, &error));
+	CU_ASSERT(mathfun_context_derive(&ctx, argnames, 3, "square(x + 1) * y", "x", &deriv, &error));
+	CU_ASSERT_EQUAL(mathfun_acall(&deriv, points[1], &error), 2 * (0.75 + 1) * 3);
+	mathfun_cleanup(&deriv);
+
+	CU_ASSERT(!mathfun_context_derive(&ctx, argnames, 3, "x", "w", &deriv, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_NO_SUCH_NAME);
+	mathfun_error_cleanup(&error);
+
+	mathfun_context_cleanup(&ctx);
+}
+
+static mathfun_interval test_square_interval(const mathfun_interval args[]) {
+	const double lo = args[0].lo > 0 ? args[0].lo : args[0].hi < 0 ? -args[0].hi : 0;
+	const double hi = fmax(-args[0].lo, args[0].hi);
+	return (mathfun_interval){ nextafter(lo * lo, 0), nextafter(hi * hi, INFINITY) };
+}
+
+static void test_exec_interval() {
+	const char *argnames[] = { "x", "y" };
+	const char *codes[] = {
+		"x * y - sin(x) / (y + 3) + x**3 - abs(y)**x",
+		"x < 0 ? -x * y : x * 2 + y % 4 - 1 / (y - 5)",
+		"hypot(x, y) + exp(x * 0.5) * max(x, y) - log(x * x + 1)",
+		"x in 0...1 && y > x ? cos(y) * 3 : tan(x / 4) + sqrt(y + 2) - cosh(y)"
+	};
+	const mathfun_interval boxes[][2] = {
+		{ { -1.5, -0.5 }, { 2.5, 3 } },
+		{ { -0.25, 0.75 }, { -2, -1.25 } },
+		{ { 0.5, 0.5 }, { 1, 1.75 } },
+		{ { -3, 3 }, { -1.5, 4 } }
+	};
+	const mathfun_sig sig = { 1, (mathfun_type[]){ MATHFUN_NUMBER }, MATHFUN_NUMBER };
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+	mathfun fun;
+
+	// the result contains the values at all points of the box
+	for (size_t i = 0; i < 4; ++ i) {
+		CU_ASSERT(mathfun_compile(&fun, argnames, 2, codes[i], &error));
+		for (size_t b = 0; b < 4; ++ b) {
+			const mathfun_interval range = mathfun_acall_interval(&fun, boxes[b], &error);
+			for (size_t p = 0; p <= 16; ++ p) {
+				for (size_t q = 0; q <= 16; ++ q) {
+					const double args[] = {
+						boxes[b][0].lo + (boxes[b][0].hi - boxes[b][0].lo) * p / 16,
+						boxes[b][1].lo + (boxes[b][1].hi - boxes[b][1].lo) * q / 16
+					};
+					const double value = mathfun_acall(&fun, args, NULL);
+					CU_ASSERT(isnan(value) || (range.lo <= value && value <= range.hi));
+				}
+			}
+		}
+		mathfun_cleanup(&fun);
+	}
+	CU_ASSERT(error == NULL);
+
+	// exact bounds stay exact, undefined parts are ignored
+	mathfun_interval range;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "sqrt(x) + y", &error));
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { -1, 4 }, { 1, 1.5 } }, &error);
+	CU_ASSERT_EQUAL(range.lo, 1);
+	CU_ASSERT_EQUAL(range.hi, 3.5);
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { -4, -1 }, { 1, 1.5 } }, &error);
+	CU_ASSERT(isnan(range.lo) && isnan(range.hi));
+	mathfun_cleanup(&fun);
+
+	// inexact bounds are rounded outward (1.0 / 3 and 2.0 / 3 are rounded down)
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "x / y", &error));
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { 1, 2 }, { 3, 3 } }, &error);
+	CU_ASSERT_EQUAL(range.lo, 1.0 / 3);
+	CU_ASSERT_EQUAL(range.hi, nextafter(2.0 / 3, 1));
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { 1, 2 }, { 0, 3 } }, &error);
+	CU_ASSERT_EQUAL(range.lo, 1.0 / 3);
+	CU_ASSERT_EQUAL(range.hi, INFINITY);
+	mathfun_cleanup(&fun);
+
+	// a condition that is known takes one branch, a maybe takes both
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "x < y ? 1 : x > 2 * y ? 5 : 3", &error));
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { 0, 1 }, { 2, 3 } }, &error);
+	CU_ASSERT(range.lo == 1 && range.hi == 1);
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { 0, 3 }, { 2, 3 } }, &error);
+	CU_ASSERT(range.lo == 1 && range.hi == 3);
+	range = mathfun_acall_interval(&fun, (const mathfun_interval[]){ { 0, 7 }, { 2, 3 } }, &error);
+	CU_ASSERT(range.lo == 1 && range.hi == 5);
+	mathfun_cleanup(&fun);
+	CU_ASSERT(error == NULL);
+
+	// user functions without interval version may be anything
+	const mathfun_interval box[] = { { -1, 2 }, { 0, 0 } };
+	CU_ASSERT(mathfun_context_init(&ctx, true, &error));
+	CU_ASSERT(mathfun_context_define_funct(&ctx, "square", test_square, &sig, &error));
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 2, "square(x) + 1", &fun, &error));
+	range = mathfun_acall_interval(&fun, box, &error);
+	CU_ASSERT(range.lo == -INFINITY && range.hi == INFINITY);
+	mathfun_cleanup(&fun);
+
+	CU_ASSERT(mathfun_context_define_interval(&ctx, "square", test_square_interval, &error));
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 2, "square(x) + 1", &fun, &error));
+	range = mathfun_acall_interval(&fun, box, &error);
+	CU_ASSERT(range.lo <= 1 && range.lo > 0.99 && range.hi >= 5 && range.hi < 5.01);
+	mathfun_cleanup(&fun);
+	CU_ASSERT(error == NULL);
+
+	CU_ASSERT(!mathfun_context_define_interval(&ctx, "pi", test_square_interval, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_NO_SUCH_NAME);
+	mathfun_error_cleanup(&error);
+
+	mathfun_context_cleanup(&ctx);
+}
+
+static void test_exec_batch_float() {
+	const char *argnames[] = { "x", "y" };
+	mathfun fun;
+	mathfun_error_p error = NULL;
+	// j0 has no single precision version, so it's called through the double one
+	CU_ASSERT(mathfun_compile_precision(&fun, argnames, 2,
+		"x > 0 && y > 0 ? sin(x) * y + 2 : x < -5 || y in -1...1 ? exp(y / 4) + j0(x) : -x ** 2 + 0.1",
+		MATHFUN_PRECISION_FLOAT, &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	float xs[TEST_BATCH_ROWS], ys[TEST_BATCH_ROWS], out[TEST_BATCH_ROWS];
+	for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+		xs[i] = i < 300 ? 1.0f : (float)(i % 17) * 0.75f - 6.0f;
+		ys[i] = (float)(i % 7) * 0.5f - 1.5f;
+	}
+
+	// odd row counts leave rows that don't fill a whole vector
+	const float *columns[] = { xs, ys };
+	CU_ASSERT(mathfun_exec_batch_float(&fun, columns, TEST_BATCH_ROWS - 3, out, &error));
+	CU_ASSERT(error == NULL);
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+
+	// within the documented error bound of about 2^-23 per operation
+	for (size_t i = 0; i < TEST_BATCH_ROWS - 3; ++ i) {
+		const double expected = mathfun_call(&fun, &error, (double)xs[i], (double)ys[i]);
+		CU_ASSERT(fabs(out[i] - expected) <= 8 * ldexp(fmax(fabs(expected), 1.0), -23));
+	}
+
+	// exact operations give the same results
+	mathfun_cleanup(&fun);
+	CU_ASSERT(mathfun_compile_precision(&fun, argnames, 2, "x * 4 - y < 0 ? -x : x * y + 0.5", MATHFUN_PRECISION_FLOAT, &error));
+	CU_ASSERT(mathfun_exec_batch_float(&fun, columns, TEST_BATCH_ROWS, out, &error));
+	for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+		CU_ASSERT(out[i] == mathfun_call(&fun, &error, (double)xs[i], (double)ys[i]));
+	}
+	mathfun_cleanup(&fun);
+
+	// double precision programs can't be executed in single precision
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "x + y", &error));
+	CU_ASSERT(!mathfun_exec_batch_float(&fun, columns, TEST_BATCH_ROWS, out, &error));
+	CU_ASSERT(mathfun_error_type(error) == MATHFUN_C_ERROR && mathfun_error_errno(error) == EINVAL);
+	mathfun_error_cleanup(&error);
+	mathfun_cleanup(&fun);
+}
+
+static void test_exec_profile() {
+	const char *argnames[] = { "x", "y" };
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+	mathfun fun, other;
+	CU_ASSERT(mathfun_context_init(&ctx, true, &error));
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 2, "x > 0 ? sin(x) * y : cos(y) + 1", &fun, &error));
+	CU_ASSERT(mathfun_context_compile(&ctx, argnames, 2, "x + y", &other, &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	mathfun_profile profile = MATHFUN_PROFILE_INIT;
+	CU_ASSERT(mathfun_profile_init(&profile, &fun, &error));
+
+	for (int i = 0; i < 15; ++ i) {
+		const double args[] = { i < 10 ? 1.0 : -1.0, 2.5 };
+		CU_ASSERT(issame(mathfun_profile_call(&fun, &profile, args, &error), mathfun_acall(&fun, args, &error)));
+	}
+	CU_ASSERT(error == NULL);
+	CU_ASSERT_EQUAL(profile.counts[0], 15);
+
+	FILE *stream = tmpfile();
+	CU_ASSERT_FATAL(stream != NULL);
+	CU_ASSERT(mathfun_dump_profile(&fun, &profile, stream, &ctx, &error));
+
+	char text[4096];
+	rewind(stream);
+	const size_t size = fread(text, 1, sizeof(text) - 1, stream);
+	text[size] = 0;
+	fclose(stream);
+	CU_ASSERT(strstr(text, "call sin") != NULL);
+	CU_ASSERT(strstr(text, "sin(x) * y\n") != NULL);
+	CU_ASSERT(strstr(text, "cos(y) + 1\n") != NULL);
+
+	// a profile only fits the function it was initialized for
+	const double args[] = { 1, 2 };
+	CU_ASSERT(issame(mathfun_profile_call(&other, &profile, args, &error), NAN));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	mathfun_error_cleanup(&error);
+
+	// also when dumping, the profile of a smaller function isn't read past its end
+	mathfun_profile small = MATHFUN_PROFILE_INIT;
+	CU_ASSERT(mathfun_profile_init(&small, &other, &error));
+	CU_ASSERT(!mathfun_dump_profile(&fun, &small, stderr, &ctx, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_C_ERROR);
+	CU_ASSERT_EQUAL(mathfun_error_errno(error), EINVAL);
+	mathfun_error_cleanup(&error);
+	mathfun_profile_cleanup(&small);
+
+	mathfun_profile_cleanup(&profile);
+	mathfun_cleanup(&other);
+	mathfun_cleanup(&fun);
+	mathfun_context_cleanup(&ctx);
+}
+
+static void test_exec_verify() {
+	// byte code as a loader would read it from a file (opcodes as in mathfun_intern.h,
+	// where their numbers are fixed)
+	enum { RET = 1, VAL = 3, ADD = 6, GT = 16, JMPF = 23, SETT = 24, END = 54 };
+	uint16_t code[] = {
+		/*  0 */ VAL, 0, 1,
+		/*  3 */ GT, 0, 1, 2,
+		/*  7 */ JMPF, 2, 0, 0,
+		/* 11 */ ADD, 0, 1, 2,
+		/* 15 */ RET, 2,
+		/* 17 */ RET, 1,
+		/* 19 */ END
+	};
+	const size_t codesize = sizeof(code) / sizeof(code[0]);
+	const uint32_t adr = 17;
+	memcpy(code + 9, &adr, sizeof(adr));
+
+	mathfun_value consts[] = { { .number = 2 } };
+	mathfun fun = MATHFUN_INIT;
+	fun.argc      = 1;
+	fun.retc      = 1;
+	fun.framesize = 3;
+	fun.code      = code;
+	fun.consts    = consts;
+
+	mathfun_error_p error = NULL;
+	CU_ASSERT(mathfun_verify(&fun, codesize, 1, 0, &error));
+	CU_ASSERT(error == NULL);
+
+	mathfun_value frame[3] = { { .number = 3 } };
+	CU_ASSERT_EQUAL(mathfun_exec(&fun, frame), 5);
+	frame[0].number = 1;
+	CU_ASSERT_EQUAL(mathfun_exec(&fun, frame), 2);
+
+	// constant pool index out of range
+	CU_ASSERT(!mathfun_verify(&fun, codesize, 0, 0, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+	mathfun_error_cleanup(&error);
+
+	// register out of range
+	code[14] = 3;
+	CU_ASSERT(!mathfun_verify(&fun, codesize, 1, 0, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+	mathfun_error_cleanup(&error);
+	code[14] = 2;
+
+	// jump into the middle of an instruction, backwards and onto END
+	const uint32_t bad_adrs[] = { 16, 3, 19 };
+	for (size_t i = 0; i < sizeof(bad_adrs) / sizeof(bad_adrs[0]); ++ i) {
+		memcpy(code + 9, &bad_adrs[i], sizeof(adr));
+		CU_ASSERT(!mathfun_verify(&fun, codesize, 1, 0, &error));
+		CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+		mathfun_error_cleanup(&error);
+	}
+	memcpy(code + 9, &adr, sizeof(adr));
+
+	// falling through into END
+	code[17] = SETT;
+	CU_ASSERT(!mathfun_verify(&fun, codesize, 1, 0, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+	mathfun_error_cleanup(&error);
+	code[17] = RET;
+
+	// END in the middle of the code and unknown opcodes
+	const uint16_t bad_opcodes[] = { END, UINT16_MAX };
+	for (size_t i = 0; i < sizeof(bad_opcodes) / sizeof(bad_opcodes[0]); ++ i) {
+		code[15] = bad_opcodes[i];
+		CU_ASSERT(!mathfun_verify(&fun, codesize, 1, 0, &error));
+		CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+		mathfun_error_cleanup(&error);
+	}
+	code[15] = RET;
+
+	// missing END
+	CU_ASSERT(!mathfun_verify(&fun, codesize - 1, 1, 0, &error));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_INVALID_CODE);
+	mathfun_error_cleanup(&error);
+
+	// compiled code passes (a profile has one counter per code word)
+	const char *argnames[] = { "x", "y" };
+	mathfun compiled;
+	CU_ASSERT_FATAL(mathfun_compile(&compiled, argnames, 2, "x < y ? x * y - 1 : y", &error));
+	mathfun_profile profile = MATHFUN_PROFILE_INIT;
+	CU_ASSERT(mathfun_profile_init(&profile, &compiled, &error));
+	CU_ASSERT(mathfun_verify(&compiled, profile.size, 1, 0, &error));
+	CU_ASSERT(error == NULL);
+	mathfun_profile_cleanup(&profile);
+	mathfun_cleanup(&compiled);
+}
+
+static void test_jit() {
+	const char *argnames[] = { "x", "y" };
+	mathfun fun, jit;
+	mathfun_error_p error = NULL;
+	// enough nested sub-expressions to need more registers than there are xmm registers
+	const char *code = "x > 0 && y > 0 ? sin(x) * y + 2 : x < -5 || y in -1...1 ? y % 2 : -x ** 2 + "
+		"(x+1)*((y+2)*((x+3)*((y+4)*((x+5)*((y+6)*((x+7)*((y+8)*((x == y ? 2 : 1))))))))) / "
+		"((y-1)*((x-2)*((y-3)*((x-4)*((y-5)*((x-6)*((y-7)*((x-8)*(y)))))))))";
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, code, &error));
+	CU_ASSERT(mathfun_compile(&jit, argnames, 2, code, &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	CU_ASSERT(!mathfun_is_native(&jit));
+	CU_ASSERT(mathfun_jit(&jit, &error));
+	CU_ASSERT(error == NULL);
+	if (error) mathfun_error_log_and_cleanup(&error, stderr);
+#if defined(__x86_64__) && defined(__unix__)
+	CU_ASSERT(mathfun_is_native(&jit));
+#endif
+
+	for (size_t i = 0; i < TEST_BATCH_ROWS; ++ i) {
+		const double x = i % 23 == 0 ? NAN : (double)(i % 17) - 8.0;
+		const double y = (double)(i % 7) - 3.0;
+		CU_ASSERT(issame(mathfun_call(&fun, &error, x, y), mathfun_call(&jit, &error, x, y)));
+	}
+
+	mathfun_cleanup(&jit);
+	CU_ASSERT(!mathfun_is_native(&jit));
+	mathfun_cleanup(&fun);
+}
+
+static void test_jit_math_error() {
+	const char *argnames[] = { "x", "y" };
+	mathfun fun;
+	mathfun_error_p error = NULL;
+	CU_ASSERT(mathfun_compile(&fun, argnames, 2, "x % y", &error));
+	CU_ASSERT(mathfun_jit(&fun, &error));
+	if (error) {
+		mathfun_error_log_and_cleanup(&error, stderr);
+		return;
+	}
+
+	CU_ASSERT(issame(mathfun_call(&fun, &error, 1.0, 0.0), NAN));
+	CU_ASSERT_EQUAL(mathfun_error_type(error), MATHFUN_MATH_ERROR);
+	mathfun_error_cleanup(&error);
+
+	mathfun_cleanup(&fun);
+}
+
+static mathfun_value test_clobber(const mathfun_value args[]) {
+#if defined(__x86_64__) && defined(__GNUC__)
+	// all xmm registers are caller saved, the native code keeps constants in some
+	__asm__ volatile ("xorpd %%xmm14, %%xmm14\n\txorpd %%xmm15, %%xmm15" ::: "xmm14", "xmm15");
+#endif
+	return args[0];
+}
+
+static void test_jit_call_clobbers() {
+	const char *argnames[] = { "x" };
+	const mathfun_sig sig = { 1, (mathfun_type[]){ MATHFUN_NUMBER }, MATHFUN_NUMBER };
+	mathfun_error_p error = NULL;
+	mathfun_context ctx;
+	mathfun fun;
+
+	CU_ASSERT_FATAL(mathfun_context_init(&ctx, true, &error));
+	CU_ASSERT(mathfun_context_define_funct(&ctx, "clobber", test_clobber, &sig, &error));
+	CU_ASSERT_FATAL(mathfun_context_compile(&ctx, argnames, 1, "-clobber(x) + -x", &fun, &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 3.0), -6.0);
+	CU_ASSERT(mathfun_jit(&fun, &error));
+	CU_ASSERT_EQUAL(mathfun_call(&fun, &error, 3.0), -6.0);
+	CU_ASSERT(error == NULL);
+
+	mathfun_cleanup(&fun);
+	mathfun_context_cleanup(&ctx);
+}
+
 static mathfun_value test_funct1(const mathfun_value args[]) {
 	return (mathfun_value){ .number = args[0].number + args[1].number };
 }
@@ -479,6 +2073,8 @@ CU_TestInfo compile_test_infos[] = {
 	{"type error: expected boolean", test_parser_type_error_expected_boolean},
 	{"trailing garbage", test_parser_trailing_garbage},
 	{"math error in const folding", test_math_error_in_const_folding},
+	{"NaN in const folding", test_nan_in_const_folding},
+	{"range with constant limits", test_const_range_folding},
 	{NULL, NULL}
 };
 
@@ -486,6 +2082,34 @@ CU_TestInfo exec_test_infos[] = {
 	{"mathfun_mod", test_mod},
 	{"sin(x)", test_exec_sin_x},
 	{"expression with all operators", test_exec_all},
+	{"one-shot runs", test_exec_run},
+	{"batch execution", test_exec_batch},
+	{"vectorized batch execution", test_exec_batch_vector},
+	{"math error in batch execution", test_exec_batch_math_error},
+	{"superinstructions", test_exec_fused},
+	{"immediate operands", test_exec_immediate},
+	{"short batches", test_exec_short_batch},
+	{"jump targets beyond 16 bit", test_exec_long_jump},
+	{"frames and fixed arity calls", test_call_frames},
+	{"status word execution", test_exec_status},
+	{"multi-output functions", test_exec_multi},
+	{"common subexpressions", test_exec_cse},
+	{"strength reduction", test_exec_strength_reduction},
+	{"fast math", test_exec_fast_math},
+	{"uniform arguments", test_exec_uniform},
+	{"specialize", test_exec_specialize},
+	{"register allocation", test_exec_regalloc},
+	{"parallel execution", test_exec_parallel},
+	{"forward mode differentiation", test_exec_dual},
+	{"reverse mode differentiation", test_exec_gradient},
+	{"symbolic differentiation", test_derive},
+	{"interval arithmetic", test_exec_interval},
+	{"single precision batch execution", test_exec_batch_float},
+	{"execution profile", test_exec_profile},
+	{"byte code verification", test_exec_verify},
+	{"native code", test_jit},
+	{"math error in native code", test_jit_math_error},
+	{"native code around calls", test_jit_call_clobbers},
 	{NULL, NULL}
 };
 